@@ -221,8 +221,12 @@ typedef bool (*flow_destructor_function)(flow_c * c, void * thing);
 // Assuming, here, that we never get a pointer to address 42 in memory.
 #define FLOW_OWNER_IMMORTAL ((void *)42)
 
+// Read-only modes map the file into memory when possible (see flow_io_create_for_mapped_file)
 PUB struct flow_io * flow_io_create_for_file(flow_c * c, flow_io_mode mode, const char * filename, void * owner);
 
+// Maps the whole file read-only (with a sequential read-ahead hint). Fails for empty files.
+PUB struct flow_io * flow_io_create_for_mapped_file(flow_c * c, const char * filename, void * owner);
+
 PUB struct flow_io * flow_io_create_from_file_pointer(flow_c * c, flow_io_mode mode, FILE * file_pointer,
                                                       int64_t optional_file_length, void * owner);
 
@@ -230,10 +234,25 @@ PUB struct flow_io * flow_io_create_from_memory(flow_c * c, flow_io_mode mode, u
                                                 void * owner, flow_destructor_function memory_free);
 PUB struct flow_io * flow_io_create_for_output_buffer(flow_c * c, void * owner);
 
+struct flow_io_buffer_segment {
+    uint8_t * data;
+    size_t length;
+};
+
 // Returns false if the flow_io struct is disposed or not an output buffer type (or for any other error)
+// Output that grew past its reserved size is merged into one buffer first; prefer
+// flow_io_get_output_buffer_segments when the consumer can take a list.
 PUB bool flow_io_get_output_buffer(flow_c * c, struct flow_io * io, uint8_t ** out_pointer_to_buffer,
                                    size_t * out_length);
 
+// Exposes the output as a list of buffers, in order, without copying. The list is valid until the next write.
+PUB bool flow_io_get_output_buffer_segments(flow_c * c, struct flow_io * io,
+                                            const struct flow_io_buffer_segment ** out_segments, size_t * out_count);
+
+// Ensures the next 'byte_count' bytes written to an output buffer need no further allocation. Has no effect on other
+// kinds of flow_io.
+PUB bool flow_io_output_buffer_reserve(flow_c * c, struct flow_io * io, size_t byte_count);
+
 PUB bool flow_io_write_output_buffer_to_file(flow_c * c, struct flow_io * io, const char * file_path);
 
 
@@ -240,6 +240,10 @@ struct flow_bitmap_bgra {
     uint8_t matte_color[4];
 
     flow_bitmap_compositing_mode compositing_mode;
+
+    // If true, pixels points into another bitmap's buffer (see flow_bitmap_bgra_create_view); rows may be shorter than
+    // stride, and the buffer must outlive this header.
+    bool pixels_borrowed;
 };
 
 PUB void flow_colorcontext_init(flow_c * context, struct flow_colorcontext_info * colorcontext,
@@ -277,6 +281,8 @@ PUB bool flow_bitmap_bgra_sharpen_block_edges(flow_c * c, struct flow_bitmap_bgr
 PUB struct flow_bitmap_bgra * flow_bitmap_bgra_create(flow_c * c, int sx, int sy, bool zeroed,
                                                       flow_pixel_format format);
 PUB struct flow_bitmap_bgra * flow_bitmap_bgra_create_header(flow_c * c, int sx, int sy);
+PUB struct flow_bitmap_bgra * flow_bitmap_bgra_create_view(flow_c * c, struct flow_bitmap_bgra * source, uint32_t x,
+                                                           uint32_t y, uint32_t w, uint32_t h);
 PUB void flow_bitmap_bgra_destroy(flow_c * c, struct flow_bitmap_bgra * im);
 PUB bool flow_bitmap_bgra_flip_horizontal(flow_c * c, struct flow_bitmap_bgra * b);
 PUB bool flow_bitmap_bgra_flip_vertical(flow_c * c, struct flow_bitmap_bgra * b);
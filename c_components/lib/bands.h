@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) Imazen LLC.
+ * No part of this project, including this file, may be copied, modified,
+ * propagated, or distributed except as permitted in COPYRIGHT.txt.
+ * Licensed under the GNU Affero General Public License, Version 3.0.
+ * Commercial licenses available at http://imageresizing.net/
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The part [from, from + count) of band band_index when length is split into band_count nearly equal bands, as
+// imageflow_core::bands::band_rows splits them. Every band but the last starts and ends on a multiple of align.
+static inline void flow_band_bounds(uint32_t length, uint32_t band_count, uint32_t band_index, uint32_t align,
+                                    uint32_t * from, uint32_t * count)
+{
+    uint32_t start = (uint32_t)((uint64_t)length * band_index / band_count) / align * align;
+    uint32_t end = band_index + 1 == band_count
+                       ? length
+                       : (uint32_t)((uint64_t)length * (band_index + 1) / band_count) / align * align;
+    *from = start;
+    *count = end - start;
+}
+
+#ifdef __cplusplus
+}
+#endif
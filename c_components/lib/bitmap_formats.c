@@ -94,6 +94,12 @@ uint32_t flow_pixel_format_channels(flow_pixel_format format)
     exit(70);
 }
 
+// Hands pooled pixel buffers back to the context before the header's owned allocations are freed
+static bool flow_bitmap_bgra_header_destructor(flow_c * context, void * thing)
+{
+    return flow_bitmap_pool_release_owned_by(context, thing);
+}
+
 FLOW_HINT_HOT FLOW_HINT_PURE
 
     struct flow_bitmap_bgra *
@@ -105,7 +111,8 @@ FLOW_HINT_HOT FLOW_HINT_PURE
         return NULL;
     }
     size_t byte_count = sizeof(struct flow_bitmap_bgra);
-    im = (struct flow_bitmap_bgra *)FLOW_calloc(context, 1, byte_count);
+    im = (struct flow_bitmap_bgra *)flow_context_calloc(context, 1, byte_count, flow_bitmap_bgra_header_destructor,
+                                                        context, __FILE__, __LINE__);
     if (im == NULL) {
         FLOW_error(context, flow_status_Out_of_memory);
         return NULL;
@@ -139,11 +146,7 @@ struct flow_bitmap_bgra * flow_bitmap_bgra_create(flow_c * context, int sx, int
     im->stride = unpadded_stride + padding;
 
     size_t byte_count = im->h * im->stride;
-    if (zeroed) {
-        im->pixels = (unsigned char *)FLOW_calloc_owned(context, byte_count, sizeof(unsigned char), im);
-    } else {
-        im->pixels = (unsigned char *)FLOW_malloc_owned(context, byte_count, im);
-    }
+    im->pixels = (unsigned char *)flow_bitmap_pool_acquire(context, byte_count, zeroed, im);
     if (im->pixels == NULL) {
         FLOW_destroy(context, im);
         FLOW_error(context, flow_status_Out_of_memory);
@@ -156,6 +159,35 @@ struct flow_bitmap_bgra * flow_bitmap_bgra_create(flow_c * context, int sx, int
     return im;
 }
 
+struct flow_bitmap_bgra * flow_bitmap_bgra_create_view(flow_c * context, struct flow_bitmap_bgra * source, uint32_t x,
+                                                       uint32_t y, uint32_t w, uint32_t h)
+{
+    if (source == NULL || source->pixels == NULL) {
+        FLOW_error_msg(context, flow_status_Null_argument, "Cannot create a view of a bitmap without pixels");
+        return NULL;
+    }
+    if (x >= source->w || y >= source->h || w > source->w - x || h > source->h - y) {
+        FLOW_error_msg(context, flow_status_Invalid_argument,
+                       "View %dx%d at (%d,%d) does not fit within the %dx%d source bitmap", w, h, x, y, source->w,
+                       source->h);
+        return NULL;
+    }
+    struct flow_bitmap_bgra * im = flow_bitmap_bgra_create_header(context, (int)w, (int)h);
+    if (im == NULL) {
+        FLOW_add_to_callstack(context);
+        return NULL;
+    }
+    // Rows keep the source stride; only the first w * bpp bytes of each belong to the view
+    im->fmt = source->fmt;
+    im->stride = source->stride;
+    im->pixels
+        = source->pixels + (size_t)y * source->stride + (size_t)x * flow_pixel_format_bytes_per_pixel(source->fmt);
+    im->pixels_borrowed = true;
+    memcpy(&im->matte_color, &source->matte_color, 4);
+    im->compositing_mode = source->compositing_mode;
+    return im;
+}
+
 void flow_bitmap_bgra_destroy(flow_c * context, struct flow_bitmap_bgra * im) { FLOW_destroy(context, im); }
 
 struct flow_bitmap_float * flow_bitmap_float_create_header(flow_c * context, int sx, int sy, int channels)
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Imazen LLC.
+ * No part of this project, including this file, may be copied, modified,
+ * propagated, or distributed except as permitted in COPYRIGHT.txt.
+ * Licensed under the GNU Affero General Public License, Version 3.0.
+ * Commercial licenses available at http://imageresizing.net/
+ */
+#ifdef _MSC_VER
+#pragma unmanaged
+#endif
+
+#include "imageflow_private.h"
+
+// Pixel buffers are rounded up to one of 8 size classes per power of two (at most 12.5% slack), so that
+// a canvas, its transposed copy, and the next decoded frame can all share a buffer.
+// Released buffers are owned by the context, and are freed with it if nobody claims them.
+
+// Marks a tracked allocation as a poolable pixel buffer. The buffer itself needs no cleanup.
+static bool flow_bitmap_pool_buffer_marker(flow_c * c, void * thing) { return true; }
+
+void flow_bitmap_pool_initialize(struct flow_bitmap_pool * pool)
+{
+    memset(pool, 0, sizeof(struct flow_bitmap_pool));
+    pool->max_bytes_pooled = FLOW_BITMAP_POOL_DEFAULT_MAX_BYTES;
+    pool->enabled = true;
+}
+
+void flow_bitmap_pool_begin_terminate(flow_c * c)
+{
+    // Everything is about to be freed by owner; records must not be re-parented mid-sweep.
+    c->bitmap_pool.enabled = false;
+    c->bitmap_pool.slot_count = 0;
+    c->bitmap_pool.bytes_pooled = 0;
+}
+
+void flow_bitmap_pool_end_terminate(flow_c * c)
+{
+    struct flow_heap * heap = &c->underlying_heap;
+    if (c->bitmap_pool.slots != NULL) {
+        heap->_free(c, heap, c->bitmap_pool.slots, __FILE__, __LINE__);
+        c->bitmap_pool.slots = NULL;
+    }
+}
+
+bool flow_context_set_bitmap_pool_limit(flow_c * c, size_t max_bytes_pooled)
+{
+    struct flow_bitmap_pool * pool = &c->bitmap_pool;
+    pool->max_bytes_pooled = max_bytes_pooled;
+    while (pool->slot_count > 0 && pool->bytes_pooled > pool->max_bytes_pooled) {
+        struct flow_bitmap_pool_slot oldest = pool->slots[0];
+        memmove(&pool->slots[0], &pool->slots[1], (pool->slot_count - 1) * sizeof(struct flow_bitmap_pool_slot));
+        pool->slot_count--;
+        pool->bytes_pooled -= oldest.capacity;
+        if (!FLOW_destroy(c, oldest.buffer)) {
+            FLOW_error_return(c);
+        }
+    }
+    return true;
+}
+
+size_t flow_bitmap_pool_size_class(size_t byte_count)
+{
+    if (byte_count < FLOW_BITMAP_POOL_MIN_BYTES) {
+        return byte_count;
+    }
+    size_t power = FLOW_BITMAP_POOL_MIN_BYTES;
+    while (power * 2 < byte_count && power * 2 > power) {
+        power *= 2;
+    }
+    size_t step = power / 8;
+    size_t rounded = ((byte_count + step - 1) / step) * step;
+    return rounded < byte_count ? byte_count : rounded;
+}
+
+static void flow_bitmap_pool_adopt(flow_c * c, struct flow_heap_object_record * record, void * owner)
+{
+    record->owner = owner;
+    record->destructor_called = false;
+    if (owner != NULL && owner != c) {
+        struct flow_heap_object_record * owner_record = flow_objtracking_get_record_by_ptr(c, owner);
+        if (owner_record != NULL) {
+            owner_record->is_owner = true;
+        }
+    }
+}
+
+void * flow_bitmap_pool_acquire(flow_c * c, size_t byte_count, bool zeroed, void * owner)
+{
+    struct flow_bitmap_pool * pool = &c->bitmap_pool;
+    if (!pool->enabled || pool->max_bytes_pooled == 0 || byte_count < FLOW_BITMAP_POOL_MIN_BYTES) {
+        return zeroed ? flow_context_calloc(c, byte_count, 1, NULL, owner, __FILE__, __LINE__)
+                      : flow_context_malloc(c, byte_count, NULL, owner, __FILE__, __LINE__);
+    }
+    size_t size_class = flow_bitmap_pool_size_class(byte_count);
+
+    // Best fit, allowing up to two size classes of slack
+    int64_t best = -1;
+    for (size_t i = 0; i < pool->slot_count; i++) {
+        size_t capacity = pool->slots[i].capacity;
+        if (capacity >= size_class && capacity <= size_class + size_class / 4
+            && (best < 0 || capacity < pool->slots[best].capacity)) {
+            best = (int64_t)i;
+        }
+    }
+    if (best >= 0) {
+        struct flow_bitmap_pool_slot slot = pool->slots[best];
+        struct flow_heap_object_record * record = flow_objtracking_get_record_by_ptr(c, slot.buffer);
+        if (record != NULL) {
+            pool->slots[best] = pool->slots[pool->slot_count - 1];
+            pool->slot_count--;
+            pool->bytes_pooled -= slot.capacity;
+            pool->hits++;
+            pool->bytes_reused += byte_count;
+            flow_bitmap_pool_adopt(c, record, owner);
+            if (zeroed) {
+                memset(slot.buffer, 0, byte_count);
+            }
+            return slot.buffer;
+        }
+    }
+    pool->misses++;
+    return zeroed ? flow_context_calloc(c, size_class, 1, flow_bitmap_pool_buffer_marker, owner, __FILE__, __LINE__)
+                  : flow_context_malloc(c, size_class, flow_bitmap_pool_buffer_marker, owner, __FILE__, __LINE__);
+}
+
+// Called from bitmap header destructors; re-parents the pixel buffer to the context instead of letting it be freed
+bool flow_bitmap_pool_release_owned_by(flow_c * c, void * owner)
+{
+    struct flow_bitmap_pool * pool = &c->bitmap_pool;
+    if (!pool->enabled || pool->max_bytes_pooled == 0) {
+        return true;
+    }
+    struct flow_heap_object_record * records = &c->object_tracking.allocs[0];
+    struct flow_heap_object_record * record = NULL;
+    for (size_t i = 0; i < c->object_tracking.total_slots; i++) {
+        if (records[i].ptr != NULL && records[i].owner == owner
+            && records[i].destructor == flow_bitmap_pool_buffer_marker) {
+            record = &records[i];
+            break;
+        }
+    }
+    if (record == NULL || record->bytes > pool->max_bytes_pooled) {
+        return true;
+    }
+    if (pool->slots == NULL) {
+        // Untracked on purpose: adding a tracking record here could move the record array mid-destroy
+        struct flow_heap * heap = &c->underlying_heap;
+        pool->slots = (struct flow_bitmap_pool_slot *)heap->_calloc(c, heap, FLOW_BITMAP_POOL_SLOTS,
+                                                                     sizeof(struct flow_bitmap_pool_slot), __FILE__,
+                                                                     __LINE__);
+        if (pool->slots == NULL) {
+            return true; // The buffer is simply freed with its bitmap
+        }
+    }
+    // Make room by evicting the oldest buffers. We may be inside a destroy sweep, so no tracked allocations here.
+    while (pool->slot_count > 0
+           && (pool->slot_count == FLOW_BITMAP_POOL_SLOTS
+               || pool->bytes_pooled + record->bytes > pool->max_bytes_pooled)) {
+        struct flow_bitmap_pool_slot oldest = pool->slots[0];
+        memmove(&pool->slots[0], &pool->slots[1], (pool->slot_count - 1) * sizeof(struct flow_bitmap_pool_slot));
+        pool->slot_count--;
+        pool->bytes_pooled -= oldest.capacity;
+        if (!FLOW_destroy(c, oldest.buffer)) {
+            FLOW_error_return(c);
+        }
+    }
+    pool->slots[pool->slot_count].buffer = record->ptr;
+    pool->slots[pool->slot_count].capacity = record->bytes;
+    pool->slot_count++;
+    pool->bytes_pooled += record->bytes;
+    flow_bitmap_pool_adopt(c, record, c);
+    return true;
+}
@@ -0,0 +1,223 @@
+#include "imageflow_private.h"
+#include "bands.h"
+
+// A 2D gaussian blur of a bgra/bgr bitmap, in place, split into stages whose bands can run on separate threads.
+//
+// The bitmap is converted to a premultiplied 4-channel float frame, blurred along rows, then down columns, then
+// written back. Every band of one stage must finish before any band of the next starts; bands within a stage
+// touch disjoint rows (or columns) of the frame and use their own work buffers, so they need no locking.
+// The column stage walks strips of adjacent columns top to bottom rather than transposing the frame.
+//
+// An unsharp mask runs the same stages; its output stage re-reads each row of the still untouched bitmap and pushes it
+// away from the blurred frame before writing it back.
+
+struct flow_gaussian_blur_job {
+    struct flow_bitmap_bgra * bitmap;
+    struct flow_bitmap_float * frame;
+    struct flow_colorcontext_info colorcontext;
+    float sigma;
+    // 0 for a plain blur
+    float unsharp_amount;
+    // One row per band of the original pixels, in the frame's float space; unsharp masks only
+    struct flow_bitmap_float * originals;
+    uint32_t band_count;
+    float * row_buffers;
+    size_t row_buffer_element_count;
+    float * column_buffers;
+    size_t column_buffer_element_count;
+};
+
+// Column bands start on a cache line (4 pixels) so that bands on different threads don't share one
+#define FLOW_GAUSSIAN_BLUR_COLUMN_BAND_ALIGN 4
+
+static struct flow_gaussian_blur_job * gaussian_blur_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                                float sigma, float unsharp_amount,
+                                                                flow_working_floatspace space, uint32_t band_count)
+{
+    // Below 2, the box blur approximation is too far from a gaussian
+    if (sigma < 2) {
+        FLOW_error_msg(c, flow_status_Invalid_argument, "Gaussian blur sigma must be at least 2, got %f", sigma);
+        return NULL;
+    }
+    flow_pixel_format fmt = flow_effective_pixel_format(bitmap);
+    if (fmt != flow_bgra32 && fmt != flow_bgr32 && fmt != flow_bgr24) {
+        FLOW_error(c, flow_status_Unsupported_pixel_format);
+        return NULL;
+    }
+    if (band_count < 1) {
+        band_count = 1;
+    }
+    band_count = umin(band_count, umin(bitmap->h, (bitmap->w + FLOW_GAUSSIAN_BLUR_COLUMN_BAND_ALIGN - 1)
+                                                      / FLOW_GAUSSIAN_BLUR_COLUMN_BAND_ALIGN));
+
+    struct flow_gaussian_blur_job * job = FLOW_calloc_array(c, 1, struct flow_gaussian_blur_job);
+    if (job == NULL) {
+        FLOW_error_return_null(c);
+    }
+    job->bitmap = bitmap;
+    job->sigma = sigma;
+    job->unsharp_amount = unsharp_amount;
+    job->band_count = band_count;
+    flow_colorcontext_init(c, &job->colorcontext, space, 0, 0, 0);
+
+    job->frame = flow_bitmap_float_create_header(c, bitmap->w, bitmap->h, 4);
+    if (job->frame == NULL || !flow_set_owner(c, job->frame, job)) {
+        FLOW_destroy(c, job);
+        FLOW_error_return_null(c);
+    }
+    // The column pass reads one pixel strip per row. With a stride that is a multiple of 4KiB, every row of a strip
+    // maps to the same L1 cache set, and the strip evicts itself; skew each row by a cache line instead.
+    if (job->frame->float_stride % 1024 == 0) {
+        job->frame->float_stride += 16;
+        job->frame->float_count = job->frame->float_stride * job->frame->h;
+    }
+    // Zeroed, so that images without alpha blur a constant 0 in the unused channel
+    job->frame->pixels = (float *)FLOW_calloc_owned(c, job->frame->float_count, sizeof(float), job->frame);
+    if (job->frame->pixels == NULL) {
+        FLOW_destroy(c, job);
+        FLOW_error_return_null(c);
+    }
+    job->frame->pixels_borrowed = false;
+    job->frame->alpha_meaningful = fmt == flow_bgra32;
+    job->frame->alpha_premultiplied = true;
+
+    job->row_buffer_element_count = flow_bitmap_float_approx_gaussian_buffer_element_count_required(sigma, bitmap->w);
+    job->column_buffer_element_count
+        = flow_bitmap_float_approx_gaussian_column_buffer_element_count_required(sigma, bitmap->h);
+    job->row_buffers
+        = (float *)FLOW_malloc_owned(c, sizeof(float) * job->row_buffer_element_count * band_count, job);
+    job->column_buffers
+        = (float *)FLOW_malloc_owned(c, sizeof(float) * job->column_buffer_element_count * band_count, job);
+    if (job->row_buffers == NULL || job->column_buffers == NULL) {
+        FLOW_destroy(c, job);
+        FLOW_error_return_null(c);
+    }
+    if (unsharp_amount != 0) {
+        // Zeroed like the frame, for the unused channel
+        job->originals = flow_bitmap_float_create(c, bitmap->w, band_count, 4, true);
+        if (job->originals == NULL || !flow_set_owner(c, job->originals, job)) {
+            FLOW_destroy(c, job);
+            FLOW_error_return_null(c);
+        }
+    }
+    return job;
+}
+
+struct flow_gaussian_blur_job * flow_gaussian_blur_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                              float sigma, flow_working_floatspace space,
+                                                              uint32_t band_count)
+{
+    return gaussian_blur_job_create(c, bitmap, sigma, 0, space, band_count);
+}
+
+struct flow_gaussian_blur_job * flow_unsharp_mask_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap, float sigma,
+                                                             float amount, flow_working_floatspace space,
+                                                             uint32_t band_count)
+{
+    if (!(amount > 0)) {
+        FLOW_error_msg(c, flow_status_Invalid_argument, "Unsharp mask amount must be positive, got %f", amount);
+        return NULL;
+    }
+    return gaussian_blur_job_create(c, bitmap, sigma, amount, space, band_count);
+}
+
+// Replaces each blurred row with original + amount * (original - blurred), in premultiplied floats
+static bool unsharp_rows(flow_c * c, struct flow_gaussian_blur_job * job, uint32_t band_index, uint32_t from_row,
+                         uint32_t row_count)
+{
+    const uint32_t floats = job->frame->w * 4;
+    const float amount = job->unsharp_amount;
+    const float * original = job->originals->pixels + job->originals->float_stride * band_index;
+    for (uint32_t row = from_row; row < from_row + row_count; row++) {
+        if (!flow_bitmap_float_convert_srgb_to_linear(c, &job->colorcontext, job->bitmap, row, job->originals,
+                                                      band_index, 1)) {
+            FLOW_error_return(c);
+        }
+        float * blurred = job->frame->pixels + job->frame->float_stride * row;
+        for (uint32_t i = 0; i < floats; i++) {
+            blurred[i] = original[i] + amount * (original[i] - blurred[i]);
+        }
+    }
+    return true;
+}
+
+uint32_t flow_gaussian_blur_job_band_count(struct flow_gaussian_blur_job * job)
+{
+    return job->band_count;
+}
+
+bool flow_gaussian_blur_job_run_band(flow_c * c, struct flow_gaussian_blur_job * job, flow_gaussian_blur_stage stage,
+                                     uint32_t band_index)
+{
+    if (band_index >= job->band_count) {
+        FLOW_error(c, flow_status_Invalid_argument);
+        return false;
+    }
+    uint32_t from;
+    uint32_t count;
+    switch (stage) {
+        case flow_gaussian_blur_stage_rows:
+            flow_band_bounds(job->frame->h, job->band_count, band_index, 1, &from, &count);
+            if (!flow_bitmap_float_convert_srgb_to_linear(c, &job->colorcontext, job->bitmap, from, job->frame, from,
+                                                          count)) {
+                FLOW_error_return(c);
+            }
+            if (!flow_bitmap_float_approx_gaussian_blur_rows(
+                    c, job->frame, job->sigma, &job->row_buffers[job->row_buffer_element_count * band_index],
+                    job->row_buffer_element_count, from, (int)count)) {
+                FLOW_error_return(c);
+            }
+            return true;
+        case flow_gaussian_blur_stage_columns:
+            flow_band_bounds(job->frame->w, job->band_count, band_index, FLOW_GAUSSIAN_BLUR_COLUMN_BAND_ALIGN,
+                             &from, &count);
+            if (!flow_bitmap_float_approx_gaussian_blur_columns(
+                    c, job->frame, job->sigma, &job->column_buffers[job->column_buffer_element_count * band_index],
+                    job->column_buffer_element_count, from, count)) {
+                FLOW_error_return(c);
+            }
+            return true;
+        case flow_gaussian_blur_stage_output:
+            flow_band_bounds(job->frame->h, job->band_count, band_index, 1, &from, &count);
+            if (job->originals != NULL && !unsharp_rows(c, job, band_index, from, count)) {
+                FLOW_error_return(c);
+            }
+            if (job->frame->alpha_meaningful && !flow_bitmap_float_demultiply_alpha(c, job->frame, from, count)) {
+                FLOW_error_return(c);
+            }
+            if (!flow_bitmap_float_copy_linear_over_srgb(c, &job->colorcontext, job->frame, from, job->bitmap, from,
+                                                         count, 0, job->frame->w, false)) {
+                FLOW_error_return(c);
+            }
+            return true;
+    }
+    FLOW_error(c, flow_status_Invalid_argument);
+    return false;
+}
+
+static bool run_job_on_one_thread(flow_c * c, struct flow_gaussian_blur_job * job)
+{
+    if (job == NULL) {
+        FLOW_error_return(c);
+    }
+    for (int stage = flow_gaussian_blur_stage_rows; stage <= flow_gaussian_blur_stage_output; stage++) {
+        if (!flow_gaussian_blur_job_run_band(c, job, (flow_gaussian_blur_stage)stage, 0)) {
+            FLOW_destroy(c, job);
+            FLOW_error_return(c);
+        }
+    }
+    FLOW_destroy(c, job);
+    return true;
+}
+
+bool flow_bitmap_bgra_gaussian_blur(flow_c * c, struct flow_bitmap_bgra * bitmap, float sigma,
+                                    flow_working_floatspace space)
+{
+    return run_job_on_one_thread(c, flow_gaussian_blur_job_create(c, bitmap, sigma, space, 1));
+}
+
+bool flow_bitmap_bgra_unsharp_mask(flow_c * c, struct flow_bitmap_bgra * bitmap, float sigma, float amount,
+                                   flow_working_floatspace space)
+{
+    return run_job_on_one_thread(c, flow_unsharp_mask_job_create(c, bitmap, sigma, amount, space, 1));
+}
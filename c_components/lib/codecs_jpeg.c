@@ -589,41 +589,42 @@ static bool flow_codecs_jpg_decoder_FinishRead(flow_c * c, struct flow_codecs_jp
     // Least bad configuration (4) for 4/8: (worst dssim 0.0014033400, rank 0.000) - sharpen=-7.00
     // Least bad configuration (5) for 5/8: (worst dssim 0.0011648900, rank 0.000) - sharpen=-6.00
     // Least bad configuration (7) for 6/8: (worst dssim 0.0017093100, rank 0.000) - sharpen=-4.00
+    // Spatial luma scaling replaces the luma IDCT with a filter that leaves no block grid, so it is left alone.
+
+    if (state->cinfo->scale_num != 8 && state->cinfo->scale_denom == 8 && !state->hints.scale_luma_spatially) {
+        float blur = 0;
+        switch (state->cinfo->scale_num) {
+            case 7:
+                blur = 14;
+                break;
+            case 6:
+                blur = 4;
+                break;
+            case 5:
+                blur = 6;
+                break;
+            case 4:
+                blur = 7;
+                break;
+            case 3:
+                blur = 14;
+                break;
+            case 2:
+                blur = 15;
+                break;
+            case 1:
+                blur = 15;
+                break;
+        }
 
-    // TODO: This is far too slow
-    //    if (state->cinfo->scale_num != 8 && state->cinfo->scale_denom == 8) {
-    //        float blur = 0;
-    //        switch (state->cinfo->scale_num) {
-    //            case 7:
-    //                blur = 14;
-    //                break;
-    //            case 6:
-    //                blur = 4;
-    //                break;
-    //            case 5:
-    //                blur = 6;
-    //                break;
-    //            case 4:
-    //                blur = 7;
-    //                break;
-    //            case 3:
-    //                blur = 14;
-    //                break;
-    //            case 2:
-    //                blur = 15;
-    //                break;
-    //            case 1:
-    //                blur = 15;
-    //                break;
-    //        }
-    //
-    //        if (blur != 0) {
-    //            if (!flow_bitmap_bgra_sharpen_block_edges(c, state->canvas, state->cinfo->scale_num, -blur)) {
-    //                FLOW_add_to_callstack(c);
-    //                return false;
-    //            }
-    //        }
-    //    }
+        if (blur != 0) {
+            if (!flow_bitmap_bgra_sharpen_block_edges(c, state->canvas, state->cinfo->scale_num, -blur)) {
+                flow_codecs_jpg_decoder_reset(c, state);
+                state->stage = flow_codecs_jpg_decoder_stage_Failed;
+                FLOW_error_return(c);
+            }
+        }
+    }
 
     jpeg_destroy_decompress(state->cinfo);
     FLOW_free(c, state->cinfo);
@@ -101,6 +101,18 @@ static boolean _flow_jpeg_io_source_fill_input_buffer(j_decompress_ptr cinfo)
 {
     struct flow_jpeg_source_manager * src = (struct flow_jpeg_source_manager *)cinfo->src;
 
+    // Memory-backed and mapped inputs are handed to libjpeg in place instead of being copied through our buffer
+    const uint8_t * remaining = NULL;
+    size_t remaining_length = 0;
+    if (flow_io_get_remaining_memory(src->io->context, src->io, &remaining, &remaining_length)
+        && remaining_length > 0) {
+        src->io->read_func(src->io->context, src->io, NULL, remaining_length);
+        src->pub.next_input_byte = (const JOCTET *)remaining;
+        src->pub.bytes_in_buffer = remaining_length;
+        src->bytes_have_been_read = TRUE;
+        return TRUE;
+    }
+
     size_t bytes_read = src->io->read_func(src->io->context, src->io, src->buffer, FLOW_JPEG_INPUT_BUFFER_SIZE);
     if (bytes_read <= 0) {
         // Empty file is a critical error - die fast and release resources/temp files
@@ -10,6 +10,7 @@
 #endif
 
 #include "imageflow_private.h"
+#include <immintrin.h>
 
 bool flow_bitmap_float_linear_to_luv_rows(flow_c * context, struct flow_bitmap_float * bit, const uint32_t start_row,
                                           const uint32_t row_count)
@@ -53,6 +54,111 @@ bool flow_bitmap_float_luv_to_linear_rows(flow_c * context, struct flow_bitmap_f
     return true;
 }
 
+// 256-entry tables are too wide for byte shuffles, so each 4-byte pixel looks up its channels with 4 gathers of 8 at a
+// time, from tables pre-shifted into their byte of the pixel
+FLOW_HINT_HOT FLOW_HINT_TARGET_AVX2 static void apply_channel_luts_row_AVX2(uint32_t * row, uint32_t w,
+                                                                            const uint32_t wide[4][256])
+{
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    uint32_t x = 0;
+    for (; x + 8 <= w; x += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+        __m256i out = _mm256_i32gather_epi32((const int *)wide[0], _mm256_and_si256(v, low_byte), 4);
+        out = _mm256_or_si256(out, _mm256_i32gather_epi32((const int *)wide[1],
+                                                          _mm256_and_si256(_mm256_srli_epi32(v, 8), low_byte), 4));
+        out = _mm256_or_si256(out, _mm256_i32gather_epi32((const int *)wide[2],
+                                                          _mm256_and_si256(_mm256_srli_epi32(v, 16), low_byte), 4));
+        out = _mm256_or_si256(out, _mm256_i32gather_epi32((const int *)wide[3], _mm256_srli_epi32(v, 24), 4));
+        _mm256_storeu_si256((__m256i *)(row + x), out);
+    }
+    for (; x < w; x++) {
+        const uint32_t v = row[x];
+        row[x] = wide[0][v & 0xff] | wide[1][(v >> 8) & 0xff] | wide[2][(v >> 16) & 0xff] | wide[3][v >> 24];
+    }
+}
+
+FLOW_HINT_HOT static void apply_channel_luts_row(uint8_t * row, uint32_t w, uint32_t ch, const uint8_t * luts)
+{
+    const uint8_t * __restrict b = luts;
+    const uint8_t * __restrict g = luts + 256;
+    const uint8_t * __restrict r = luts + 512;
+    const uint8_t * __restrict a = luts + 768;
+    uint8_t * const end = row + (size_t)w * ch;
+    if (ch == 4) {
+        for (uint8_t * p = row; p < end; p += 4) {
+            p[0] = b[p[0]];
+            p[1] = g[p[1]];
+            p[2] = r[p[2]];
+            p[3] = a[p[3]];
+        }
+    } else {
+        for (uint8_t * p = row; p < end; p += 3) {
+            p[0] = b[p[0]];
+            p[1] = g[p[1]];
+            p[2] = r[p[2]];
+        }
+    }
+}
+
+bool flow_bitmap_bgra_apply_channel_luts(flow_c * c, struct flow_bitmap_bgra * bitmap, uint32_t from_row,
+                                         uint32_t row_count, const uint8_t * luts)
+{
+    flow_pixel_format fmt = bitmap->fmt;
+    if (fmt != flow_bgra32 && fmt != flow_bgr32 && fmt != flow_bgr24) {
+        FLOW_error(c, flow_status_Unsupported_pixel_format);
+        return false;
+    }
+    if (from_row > bitmap->h || row_count > bitmap->h - from_row) {
+        FLOW_error_msg(c, flow_status_Invalid_argument, "Rows %u to %u are outside a bitmap of height %u", from_row,
+                       from_row + row_count, bitmap->h);
+        return false;
+    }
+    const uint32_t ch = flow_pixel_format_bytes_per_pixel(fmt);
+    if (ch == 4 && flow_cpu_supports_avx2()) {
+        // Pixels are little-endian words, so byte i of a pixel is bits 8i to 8i + 7
+        uint32_t wide[4][256];
+        for (uint32_t channel = 0; channel < 4; channel++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                wide[channel][v] = (uint32_t)luts[channel * 256 + v] << (8 * channel);
+            }
+        }
+        for (uint32_t y = from_row; y < from_row + row_count; y++) {
+            apply_channel_luts_row_AVX2((uint32_t *)(bitmap->pixels + (size_t)bitmap->stride * y), bitmap->w,
+                                        (const uint32_t(*)[256])wide);
+        }
+        return true;
+    }
+    for (uint32_t y = from_row; y < from_row + row_count; y++) {
+        apply_channel_luts_row(bitmap->pixels + (size_t)bitmap->stride * y, bitmap->w, ch, luts);
+    }
+    return true;
+}
+
+// When each output channel depends only on the same input channel, fills luts (b, g, r, a order) with what the matrix
+// maps each value to, so the matrix can be applied with flow_bitmap_bgra_apply_channel_luts.
+static bool color_matrix_to_channel_luts(float * const __restrict m[5], uint32_t ch, uint8_t * luts)
+{
+    const uint32_t channels = ch == 4 ? 4 : 3;
+    for (uint32_t from = 0; from < channels; from++) {
+        for (uint32_t to = 0; to < channels; to++) {
+            if (from != to && m[from][to] != 0) {
+                return false;
+            }
+        }
+    }
+    // Matrix channels are r, g, b, a; table channels follow the bytes, b, g, r, a
+    static const uint32_t byte_of_channel[4] = { 2, 1, 0, 3 };
+    for (uint32_t channel = 0; channel < 4; channel++) {
+        uint8_t * lut = luts + 256 * byte_of_channel[channel];
+        const float scale = m[channel][channel];
+        const float offset = m[4][channel] * 255.0f;
+        for (uint32_t v = 0; v < 256; v++) {
+            lut[v] = uchar_clamp_ff(scale * v + offset);
+        }
+    }
+    return true;
+}
+
 bool flow_bitmap_bgra_apply_color_matrix(flow_c * context, struct flow_bitmap_bgra * bmp, const uint32_t row,
                                          const uint32_t count, float * const __restrict m[5])
 {
@@ -60,6 +166,14 @@ bool flow_bitmap_bgra_apply_color_matrix(flow_c * context, struct flow_bitmap_bg
     const uint32_t ch = flow_pixel_format_bytes_per_pixel(bmp->fmt);
     const uint32_t w = bmp->w;
     const uint32_t h = umin(row + count, bmp->h);
+
+    if ((ch == 4 || ch == 3) && row < h) {
+        // Contrast, brightness, invert, alpha and color shifts only scale and offset each channel
+        uint8_t luts[4 * 256];
+        if (color_matrix_to_channel_luts(m, ch, luts)) {
+            return flow_bitmap_bgra_apply_channel_luts(context, bmp, row, h - row, luts);
+        }
+    }
     const float m40 = m[4][0] * 255.0f;
     const float m41 = m[4][1] * 255.0f;
     const float m42 = m[4][2] * 255.0f;
@@ -163,69 +277,6 @@ bool flow_bitmap_float_apply_color_matrix(flow_c * context, struct flow_bitmap_f
     }
 }
 
-bool flow_bitmap_bgra_populate_histogram(flow_c * context, struct flow_bitmap_bgra * bmp, uint64_t * histograms,
-                                         uint32_t histogram_size_per_channel, uint32_t histogram_count,
-                                         uint64_t * pixels_sampled)
-{
-    const uint32_t row = 0;
-    const uint32_t count = bmp->h;
-    const uint32_t stride = bmp->stride;
-    const uint32_t ch = flow_pixel_format_bytes_per_pixel(bmp->fmt);
-    const uint32_t w = bmp->w;
-    const uint32_t h = umin(row + count, bmp->h);
-
-    if (histogram_size_per_channel != 256) {
-        // We're restricting it to this for speed
-        FLOW_error(context, flow_status_Invalid_argument);
-        return false;
-    }
-
-    const int shift = 0; // 8 - intlog2(histogram_size_per_channel);
-
-    if (ch == 4 || ch == 3) {
-
-        if (histogram_count == 1) {
-
-            for (uint32_t y = row; y < h; y++) {
-                for (uint32_t x = 0; x < w; x++) {
-                    uint8_t * const __restrict data = bmp->pixels + stride * y + x * ch;
-
-                    histograms[(306 * data[2] + 601 * data[1] + 117 * data[0]) >> shift]++;
-                }
-            }
-        } else if (histogram_count == 3) {
-            for (uint32_t y = row; y < h; y++) {
-                for (uint32_t x = 0; x < w; x++) {
-                    uint8_t * const __restrict data = bmp->pixels + stride * y + x * ch;
-                    histograms[data[2] >> shift]++;
-                    histograms[(data[1] >> shift) + histogram_size_per_channel]++;
-                    histograms[(data[0] >> shift) + 2 * histogram_size_per_channel]++;
-                }
-            }
-        } else if (histogram_count == 2) {
-            for (uint32_t y = row; y < h; y++) {
-                for (uint32_t x = 0; x < w; x++) {
-                    uint8_t * const __restrict data = bmp->pixels + stride * y + x * ch;
-                    // Calculate luminosity and saturation
-                    histograms[(306 * data[2] + 601 * data[1] + 117 * data[0]) >> shift]++;
-                    histograms[histogram_size_per_channel
-                               + (int_max(255, int_max(abs((int)data[2] - (int)data[1]),
-                                                       abs((int)data[1] - (int)data[0]))) >> shift)]++;
-                }
-            }
-        } else {
-            FLOW_error(context, flow_status_Invalid_internal_state);
-            return false;
-        }
-
-        *(pixels_sampled) = (h - row) * w;
-    } else {
-        FLOW_error(context, flow_status_Unsupported_pixel_format);
-        return false;
-    }
-    return true;
-}
-
 // Gamma correction  http://www.4p8.com/eric.brasseur/gamma.html#formulas
 
 #ifdef EXPOSE_SIGMOID
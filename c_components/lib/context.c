@@ -299,6 +299,7 @@ void flow_context_initialize(flow_c * context)
     context->error.locked = false;
     flow_heap_set_default(context);
     flow_context_objtracking_initialize(&context->object_tracking);
+    flow_bitmap_pool_initialize(&context->bitmap_pool);
     context->codec_set = flow_context_get_default_codec_set();
 }
 
@@ -322,6 +323,7 @@ bool flow_context_begin_terminate(flow_c * context)
         return true;
 
     bool success = true;
+    flow_bitmap_pool_begin_terminate(context);
     if (!flow_destroy_by_owner(context, context, __FILE__, __LINE__)) {
         FLOW_add_to_callstack(context);
         success = false;
@@ -336,6 +338,7 @@ void flow_context_end_terminate(flow_c * context)
         return;
 
     flow_context_objtracking_terminate(context);
+    flow_bitmap_pool_end_terminate(context);
 
     if (context->underlying_heap._context_terminate != NULL) {
         context->underlying_heap._context_terminate(context, &context->underlying_heap);
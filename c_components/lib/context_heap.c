@@ -1,7 +1,5 @@
 #include "imageflow_private.h"
 
-struct flow_heap_object_record * flow_objtracking_get_record_by_ptr(flow_c * context, void * ptr);
-
 int64_t flow_objtracking_get_record_id_by_ptr(flow_c * context, void * ptr);
 
 bool flow_objtracking_partial_destroy_by_record(flow_c * context, struct flow_heap_object_record * record,
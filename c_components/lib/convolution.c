@@ -169,7 +169,7 @@ bool flow_bitmap_float_convolve_rows(flow_c * context, struct flow_bitmap_float
                         float total_weight = 0;
                         /* Accumulate each channel */
                         for (i = left; i <= right; i++) {
-                            if (i > 0 && i < int_w) {
+                            if (i >= 0 && i < int_w) {
                                 const float weight = kern[i - left];
                                 total_weight += weight;
                                 for (uint32_t j = 0; j < ch_used; j++)
@@ -216,6 +216,7 @@ bool flow_bitmap_float_convolve_rows(flow_c * context, struct flow_bitmap_float
     return true;
 }
 
+FLOW_HINT_STRICT_MATH
 static bool BitmapFloat_boxblur_rows(flow_c * context, struct flow_bitmap_float * image, uint32_t radius,
                                      uint32_t passes, const uint32_t convolve_channels, float * work_buffer,
                                      uint32_t from_row, int row_count)
@@ -276,6 +277,7 @@ static bool BitmapFloat_boxblur_rows(flow_c * context, struct flow_bitmap_float
     }
     return true;
 }
+FLOW_HINT_STRICT_MATH
 static bool BitmapFloat_boxblur_misaligned_rows(flow_c * context, struct flow_bitmap_float * image, uint32_t radius,
                                                 int align, const uint32_t convolve_channels, float * work_buffer,
                                                 uint32_t from_row, int row_count)
@@ -303,6 +305,13 @@ static bool BitmapFloat_boxblur_misaligned_rows(flow_c * context, struct flow_bi
             }
             count += factor;
         }
+        // When shifted right, pixel 0 is flushed from the last slot before anything is enqueued there. It gets the
+        // window one to the left - what has been summed so far - instead of whatever an earlier row left in the slot.
+        if (write_offset == 1) {
+            for (uint32_t ch = 0; ch < convolve_channels; ch++) {
+                buffer[(buffer_count - 1) * ch_used + ch] = count > 0 ? sum[ch] / (float)count : source_buffer[ch];
+            }
+        }
         for (uint32_t ndx = 0; ndx < w + buffer_count - write_offset; ndx++) { // Pixels
             // Calculate new value
             if (ndx < w) {
@@ -349,6 +358,189 @@ static bool BitmapFloat_boxblur_misaligned_rows(flow_c * context, struct flow_bi
     return true;
 }
 
+// The 4-channel kernels below perform the same float operations, in the same order, as the scalar kernels above, so
+// their output is identical. (Both differ from earlier releases at pixel 0 of right-shifted misaligned passes, which
+// used to read a stale slot.) All four must be built without -ffast-math, which would otherwise let the compiler
+// reorder each path's sums and divisions differently; see STRICT_MATH_SRCS in CMakeLists.txt. Each pixel is one __m128. A kernel blurs several independent 'lanes' in
+// lockstep: a lane's running sum is a chain of dependent adds, and interleaving lanes hides their latency. The lanes
+// also share the edge divisor, and the circular buffer wraps with a compare instead of a modulo.
+//
+// A lane is a row (`step` = 4 floats between samples) or a column (`step` = float_stride). Blurring a strip of
+// adjacent columns this way reads whole cache lines from each row, so the vertical pass needs no transpose.
+// Lane r's circular buffer slot i lives at work_buffer[r * lane_stride + i * slot_stride].
+#define FLOW_BOXBLUR_ROWS_AT_ONCE 4
+#define FLOW_BOXBLUR_COLUMNS_AT_ONCE 16
+
+FLOW_HINT_HOT FLOW_HINT_STRICT_MATH
+static void BitmapFloat_boxblur_bgra_lanes(float * const * lanes, const uint32_t lane_count, const uint32_t w,
+                                           const uint32_t step, const uint32_t radius, const uint32_t passes,
+                                           float * work_buffer, const uint32_t lane_stride,
+                                           const uint32_t slot_stride)
+{
+    const uint32_t buffer_count = radius + 1;
+    const uint32_t std_count = radius * 2 + 1;
+    const __m128 std_factor = _mm_set1_ps(1.0f / (float)(std_count));
+    __m128 sum[FLOW_BOXBLUR_COLUMNS_AT_ONCE];
+    for (uint32_t pass_index = 0; pass_index < passes; pass_index++) {
+        uint32_t circular_idx = 0;
+        uint32_t count = 0;
+        for (uint32_t r = 0; r < lane_count; r++) {
+            sum[r] = _mm_setzero_ps();
+        }
+        for (uint32_t ndx = 0; ndx < radius; ndx++) {
+            for (uint32_t r = 0; r < lane_count; r++) {
+                sum[r] = _mm_add_ps(sum[r], _mm_loadu_ps(&lanes[r][ndx * step]));
+            }
+            count++;
+        }
+        for (uint32_t ndx = 0; ndx < w + buffer_count; ndx++) {
+            float * slots = &work_buffer[circular_idx * slot_stride];
+            if (ndx >= buffer_count) {
+                // Remove trailing item from average, then flush the old value over it
+                for (uint32_t r = 0; r < lane_count; r++) {
+                    float * trailing = &lanes[r][(ndx - buffer_count) * step];
+                    sum[r] = _mm_sub_ps(sum[r], _mm_loadu_ps(trailing));
+                    _mm_storeu_ps(trailing, _mm_loadu_ps(&slots[r * lane_stride]));
+                }
+                count--;
+            }
+            if (ndx < w) {
+                if (ndx < w - radius) {
+                    for (uint32_t r = 0; r < lane_count; r++) {
+                        sum[r] = _mm_add_ps(sum[r], _mm_loadu_ps(&lanes[r][(ndx + radius) * step]));
+                    }
+                    count++;
+                }
+                if (count != std_count) {
+                    const __m128 divisor = _mm_set1_ps((float)count);
+                    for (uint32_t r = 0; r < lane_count; r++) {
+                        _mm_storeu_ps(&slots[r * lane_stride], _mm_div_ps(sum[r], divisor));
+                    }
+                } else {
+                    for (uint32_t r = 0; r < lane_count; r++) {
+                        _mm_storeu_ps(&slots[r * lane_stride], _mm_mul_ps(sum[r], std_factor));
+                    }
+                }
+            }
+            if (++circular_idx == buffer_count)
+                circular_idx = 0;
+        }
+    }
+}
+
+FLOW_HINT_HOT FLOW_HINT_STRICT_MATH
+static void BitmapFloat_boxblur_misaligned_bgra_lanes(float * const * lanes, const uint32_t lane_count,
+                                                      const uint32_t w, const uint32_t step, const uint32_t radius,
+                                                      const int align, float * work_buffer,
+                                                      const uint32_t lane_stride, const uint32_t slot_stride)
+{
+    const uint32_t buffer_count = radius + 2;
+    const uint32_t write_offset = align == -1 ? 0 : 1;
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 sum[FLOW_BOXBLUR_COLUMNS_AT_ONCE];
+    uint32_t circular_idx = 0;
+    float count = 0;
+    for (uint32_t r = 0; r < lane_count; r++) {
+        sum[r] = _mm_setzero_ps();
+    }
+    for (uint32_t ndx = 0; ndx < radius; ndx++) {
+        const __m128 factor = (ndx == radius - 1) ? half : _mm_set1_ps(1);
+        for (uint32_t r = 0; r < lane_count; r++) {
+            sum[r] = _mm_add_ps(sum[r], _mm_mul_ps(_mm_loadu_ps(&lanes[r][ndx * step]), factor));
+        }
+        count += (ndx == radius - 1) ? 0.5f : 1;
+    }
+    if (write_offset == 1) {
+        const __m128 divisor = _mm_set1_ps(count);
+        float * slots = &work_buffer[(buffer_count - 1) * slot_stride];
+        for (uint32_t r = 0; r < lane_count; r++) {
+            _mm_storeu_ps(&slots[r * lane_stride], _mm_div_ps(sum[r], divisor));
+        }
+    }
+    for (uint32_t ndx = 0; ndx < w + buffer_count - write_offset; ndx++) {
+        float * slots = &work_buffer[circular_idx * slot_stride];
+        if (ndx < w) {
+            if (ndx < w - radius) {
+                for (uint32_t r = 0; r < lane_count; r++) {
+                    sum[r] = _mm_add_ps(sum[r], _mm_mul_ps(_mm_loadu_ps(&lanes[r][(ndx + radius) * step]), half));
+                }
+                count += 0.5f;
+            }
+            if (ndx < w - radius + 1) {
+                for (uint32_t r = 0; r < lane_count; r++) {
+                    sum[r]
+                        = _mm_add_ps(sum[r], _mm_mul_ps(_mm_loadu_ps(&lanes[r][(ndx - 1 + radius) * step]), half));
+                }
+                count += 0.5f;
+            }
+            // Remove trailing items from average
+            if (ndx >= radius) {
+                for (uint32_t r = 0; r < lane_count; r++) {
+                    sum[r] = _mm_sub_ps(sum[r], _mm_mul_ps(_mm_loadu_ps(&lanes[r][(ndx - radius) * step]), half));
+                }
+                count -= 0.5f;
+            }
+            if (ndx >= radius + 1) {
+                for (uint32_t r = 0; r < lane_count; r++) {
+                    sum[r]
+                        = _mm_sub_ps(sum[r], _mm_mul_ps(_mm_loadu_ps(&lanes[r][(ndx - 1 - radius) * step]), half));
+                }
+                count -= 0.5f;
+            }
+        }
+        // Flush old value
+        if (ndx >= buffer_count - write_offset) {
+            for (uint32_t r = 0; r < lane_count; r++) {
+                _mm_storeu_ps(&lanes[r][(ndx + write_offset - buffer_count) * step],
+                              _mm_loadu_ps(&slots[r * lane_stride]));
+            }
+        }
+        // enqueue new value
+        if (ndx < w) {
+            const __m128 divisor = _mm_set1_ps(count);
+            for (uint32_t r = 0; r < lane_count; r++) {
+                _mm_storeu_ps(&slots[r * lane_stride], _mm_div_ps(sum[r], divisor));
+            }
+        }
+        if (++circular_idx == buffer_count)
+            circular_idx = 0;
+    }
+}
+
+// `length` is the number of samples in each lane
+static void BitmapFloat_approx_gaussian_blur_bgra_lanes(float * const * lanes, uint32_t lane_count, uint32_t length,
+                                                        uint32_t step, uint32_t d, float * buffer,
+                                                        uint32_t lane_stride, uint32_t slot_stride)
+{
+    if (d % 2 > 0) {
+        BitmapFloat_boxblur_bgra_lanes(lanes, lane_count, length, step, d / 2, 3, buffer, lane_stride, slot_stride);
+    } else {
+        BitmapFloat_boxblur_misaligned_bgra_lanes(lanes, lane_count, length, step, d / 2, -1, buffer, lane_stride,
+                                                  slot_stride);
+        BitmapFloat_boxblur_misaligned_bgra_lanes(lanes, lane_count, length, step, d / 2, 1, buffer, lane_stride,
+                                                  slot_stride);
+        BitmapFloat_boxblur_bgra_lanes(lanes, lane_count, length, step, d / 2 + 1, 1, buffer, lane_stride,
+                                       slot_stride);
+    }
+}
+
+static void BitmapFloat_approx_gaussian_blur_bgra_rows(struct flow_bitmap_float * image, uint32_t d, float * buffer,
+                                                       size_t buffer_element_count, uint32_t from_row,
+                                                       uint32_t until_row)
+{
+    // Each circular buffer needs at most (d / 2 + 2) pixels; keep the scalar path's per-row allowance
+    const uint32_t buffer_stride = d * 2 + 12;
+    const uint32_t rows_at_once = umin(FLOW_BOXBLUR_ROWS_AT_ONCE, (uint32_t)(buffer_element_count / buffer_stride));
+    float * rows[FLOW_BOXBLUR_ROWS_AT_ONCE];
+    for (uint32_t row = from_row; row < until_row; row += rows_at_once) {
+        const uint32_t row_count = umin(rows_at_once, until_row - row);
+        for (uint32_t r = 0; r < row_count; r++) {
+            rows[r] = &image->pixels[(row + r) * image->float_stride];
+        }
+        BitmapFloat_approx_gaussian_blur_bgra_lanes(rows, row_count, image->w, 4, d, buffer, buffer_stride, 4);
+    }
+}
+
 uint32_t flow_bitmap_float_approx_gaussian_calculate_d(float sigma, uint32_t bitmap_width)
 {
     uint32_t d = (int)floorf(1.8799712059732503768118239636082839397552400554574537f * sigma + 0.5f);
@@ -356,10 +548,17 @@ uint32_t flow_bitmap_float_approx_gaussian_calculate_d(float sigma, uint32_t bit
     return d;
 }
 
-uint32_t flow_bitmap_float_approx_gaussian_buffer_element_count_required(float sigma, uint32_t bitmap_width)
+static uint32_t flow_bitmap_float_approx_gaussian_row_buffer_element_count(float sigma, uint32_t bitmap_width)
 {
     return flow_bitmap_float_approx_gaussian_calculate_d(sigma, bitmap_width) * 2 + 12; // * sizeof(float);
 }
+
+// Enough for 4-channel images to blur FLOW_BOXBLUR_ROWS_AT_ONCE rows together. Smaller buffers still work, down to
+// one row's worth, but blur fewer rows at a time.
+uint32_t flow_bitmap_float_approx_gaussian_buffer_element_count_required(float sigma, uint32_t bitmap_width)
+{
+    return flow_bitmap_float_approx_gaussian_row_buffer_element_count(sigma, bitmap_width) * FLOW_BOXBLUR_ROWS_AT_ONCE;
+}
 bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * context, struct flow_bitmap_float * image, float sigma,
                                                  float * buffer, size_t buffer_element_count, uint32_t from_row,
                                                  int row_count)
@@ -371,7 +570,7 @@ bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * context, struct flow_b
     }
 
     // Ensure the buffer is large enough
-    if (flow_bitmap_float_approx_gaussian_buffer_element_count_required(sigma, image->w) > buffer_element_count) {
+    if (flow_bitmap_float_approx_gaussian_row_buffer_element_count(sigma, image->w) > buffer_element_count) {
         FLOW_error(context, flow_status_Invalid_internal_state);
         return false;
     }
@@ -381,6 +580,12 @@ bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * context, struct flow_b
     // Three successive box - blurs build a piece - wise quadratic convolution kernel, which approximates the Gaussian
     // kernel to within roughly 3 % .
     uint32_t d = flow_bitmap_float_approx_gaussian_calculate_d(sigma, image->w);
+    // Box radii below 1 only occur in images a few pixels wide; leave those to the scalar kernels
+    if (image->channels == 4 && d >= 2) {
+        const uint32_t until_row = row_count < 0 ? image->h : from_row + (unsigned)row_count;
+        BitmapFloat_approx_gaussian_blur_bgra_rows(image, d, buffer, buffer_element_count, from_row, until_row);
+        return true;
+    }
     //... if d is odd, use three box - blurs of size 'd', centered on the output pixel.
     if (d % 2 > 0) {
         if (!BitmapFloat_boxblur_rows(context, image, d / 2, 3, image->channels, buffer, from_row, row_count)) {
@@ -406,6 +611,62 @@ bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * context, struct flow_b
     return true;
 }
 
+static uint32_t flow_bitmap_float_approx_gaussian_column_slot_count(float sigma, uint32_t bitmap_height)
+{
+    // The widest circular buffer, that of the misaligned passes, needs (d / 2 + 2) pixels per column
+    return flow_bitmap_float_approx_gaussian_calculate_d(sigma, bitmap_height) / 2 + 2;
+}
+
+// Enough to blur FLOW_BOXBLUR_COLUMNS_AT_ONCE columns together. Smaller buffers blur narrower strips.
+uint32_t flow_bitmap_float_approx_gaussian_column_buffer_element_count_required(float sigma, uint32_t bitmap_height)
+{
+    return flow_bitmap_float_approx_gaussian_column_slot_count(sigma, bitmap_height) * 4
+           * FLOW_BOXBLUR_COLUMNS_AT_ONCE;
+}
+
+bool flow_bitmap_float_approx_gaussian_blur_columns(flow_c * context, struct flow_bitmap_float * image, float sigma,
+                                                    float * buffer, size_t buffer_element_count, uint32_t from_col,
+                                                    uint32_t col_count)
+{
+    if (sigma < 2) {
+        FLOW_error(context, flow_status_Invalid_internal_state);
+        return false;
+    }
+    if (image->channels != 4) {
+        FLOW_error(context, flow_status_Unsupported_pixel_format);
+        return false;
+    }
+    if (from_col + col_count > image->w) {
+        FLOW_error(context, flow_status_Invalid_argument);
+        return false;
+    }
+    const uint32_t slot_floats = flow_bitmap_float_approx_gaussian_column_slot_count(sigma, image->h) * 4;
+    const uint32_t cols_at_once
+        = umin(FLOW_BOXBLUR_COLUMNS_AT_ONCE, (uint32_t)(buffer_element_count / slot_floats));
+    if (cols_at_once == 0) {
+        FLOW_error(context, flow_status_Invalid_internal_state);
+        return false;
+    }
+    uint32_t d = flow_bitmap_float_approx_gaussian_calculate_d(sigma, image->h);
+    // Images under 5 pixels tall; the row pass would hand these to the scalar kernels, which barely change them
+    if (d < 2) {
+        return true;
+    }
+    // Each strip of adjacent columns is walked top to bottom, one row (a few cache lines) at a time. The strip's
+    // circular buffers are interleaved so that each slot is also contiguous.
+    float * cols[FLOW_BOXBLUR_COLUMNS_AT_ONCE];
+    const uint32_t until_col = from_col + col_count;
+    for (uint32_t col = from_col; col < until_col; col += cols_at_once) {
+        const uint32_t strip_count = umin(cols_at_once, until_col - col);
+        for (uint32_t i = 0; i < strip_count; i++) {
+            cols[i] = &image->pixels[(col + i) * 4];
+        }
+        BitmapFloat_approx_gaussian_blur_bgra_lanes(cols, strip_count, image->h, image->float_stride, d, buffer, 4,
+                                                    strip_count * 4);
+    }
+    return true;
+}
+
 // static void flow_bitmap_bgra_sharpen_in_place_x(struct flow_bitmap_bgra * im, float pct)
 //{
 //    const float n = (float)(-pct / (pct - 1)); //if 0 < pct < 1
@@ -443,63 +704,147 @@ bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * context, struct flow_b
 //    }
 //}
 
-static void flow_bitmap_bgra32_sharpen_block_edges_x(struct flow_bitmap_bgra * im, int block_size, float pct)
+// Block edge sharpening (or, with a negative pct, deblocking) only touches the pixels on either side of a block
+// boundary: each moves away from (or toward) its neighbour across the boundary by `e` times their difference. `e` is
+// applied in Q12 fixed point as (diff * 8 * weight + 2^14) >> 15, which is exactly what _mm_mulhrs_epi16 computes, so
+// the scalar and SSSE3 paths agree to the byte. Alpha is never changed.
+#define FLOW_BLOCK_EDGE_WEIGHT_BITS 12
+
+static inline int block_edge_delta(int diff, int weight)
 {
-    pct = pct / 100.0f;
-    if (pct < -1.0f)
-        pct = -1;
-    if (pct > 1.0f)
-        pct = 1;
-    const float n = (float)(-pct / (pct - 1.0)); // if 0 < pct < 1
-    // indexes used are coord % block_size
-    float c_l[7]; // left coefficient
-    float c_c[7]; // center
-    float c_r[7]; // right
-    for (int i = 0; i < block_size; i++) {
-        c_c[i] = 1;
-        c_l[i] = 0;
-        c_r[i] = 0;
-    }
-    if (block_size == 1) {
-        c_c[0] = n + 1;
-        c_r[0] = c_l[0] = n / -2.0f;
-    } else {
-        // Only adjust edge pixels for each block;
-        c_c[0] = c_c[block_size - 1] = n / 2.0f + 1;
-        c_l[0] = c_r[block_size - 1] = n / -2.0f;
+    return (diff * 8 * weight + (1 << 14)) >> 15;
+}
+
+static inline uint8_t block_edge_clamp(int v)
+{
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Filters pixels [from_x, until_x) of a row across vertical block boundaries, in place. `left_original` is the
+// unfiltered pixel at from_x - 1 (ignored when from_x is 0); pixel until_x must not have been filtered yet.
+static void block_edges_row_scalar(uint8_t * row, uint32_t from_x, uint32_t until_x, uint32_t w, uint32_t block_size,
+                                   int weight, const uint8_t * left_original)
+{
+    uint8_t left[4] = { 0, 0, 0, 0 };
+    if (from_x > 0) {
+        memcpy(left, left_original, 4);
+    }
+    for (uint32_t x = from_x; x < until_x; x++) {
+        uint8_t * px = row + x * 4;
+        const uint32_t phase = x % block_size;
+        const bool has_left = x > 0 && phase == 0;
+        const bool has_right = x + 1 < w && phase == block_size - 1;
+        uint8_t original[4];
+        memcpy(original, px, 4);
+        for (int ch = 0; ch < 3; ch++) {
+            int delta = 0;
+            if (has_left) {
+                delta += block_edge_delta(left[ch] - original[ch], weight);
+            }
+            if (has_right) {
+                delta += block_edge_delta(px[4 + ch] - original[ch], weight);
+            }
+            px[ch] = block_edge_clamp(original[ch] + delta);
+        }
+        memcpy(left, original, 4);
     }
+}
+
+// Filters a row across the horizontal block boundaries above and below it, in place. `above` and `below` hold the
+// neighbouring rows as they were before this filter; pass `row` itself for a side without a boundary.
+static void block_edges_across_rows_scalar(uint8_t * row, const uint8_t * above, const uint8_t * below,
+                                           uint32_t from_x, uint32_t w, int weight)
+{
+    for (uint32_t i = from_x * 4; i < w * 4; i++) {
+        if (i % 4 == 3) {
+            continue;
+        }
+        const int v = row[i];
+        row[i] = block_edge_clamp(v + block_edge_delta(above[i] - v, weight) + block_edge_delta(below[i] - v, weight));
+    }
+}
 
-    uint32_t y, current, next;
-    const uint32_t sy = im->h;
-    const uint32_t stride = im->stride;
-    const uint32_t bytes_pp = 4;
+// With blocks of 2 or more pixels, the pairs of pixels straddling each boundary don't overlap, and are all that changes
+FLOW_HINT_HOT FLOW_HINT_TARGET_SSSE3 static void block_edges_row_pairs_SSSE3(uint8_t * row, uint32_t w,
+                                                                              uint32_t block_size, int weight)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16((short)weight, (short)weight, (short)weight, 0, (short)weight,
+                                           (short)weight, (short)weight, 0);
+    for (uint32_t x = block_size; x < w; x += block_size) {
+        uint8_t * pair = row + (x - 1) * 4;
+        const __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pair), zero);
+        const __m128i partners = _mm_shuffle_epi32(pixels, _MM_SHUFFLE(1, 0, 3, 2));
+        const __m128i moved = _mm_add_epi16(
+            pixels, _mm_mulhrs_epi16(_mm_slli_epi16(_mm_sub_epi16(partners, pixels), 3), weights));
+        _mm_storel_epi64((__m128i *)pair, _mm_packus_epi16(moved, moved));
+    }
+}
 
-    if (im->w < 3 || flow_pixel_format_bytes_per_pixel(im->fmt) != 4)
+// With 1-pixel blocks, every pixel moves relative to both neighbours
+FLOW_HINT_HOT FLOW_HINT_TARGET_SSSE3 static void block_edges_row_pixels_SSSE3(uint8_t * row, uint32_t w, int weight)
+{
+    // Groups of 4 pixels from pixel 4 on, as long as the pixel right of the group is in the row
+    const uint32_t end = (w - 1) / 4 * 4;
+    if (end <= 4) {
+        block_edges_row_scalar(row, 0, w, w, 1, weight, NULL);
         return;
+    }
+    uint8_t tail_left[4];
+    memcpy(tail_left, row + (end - 1) * 4, 4);
+    // Each group's left neighbours come from the previous group, loaded before it was overwritten
+    __m128i previous = _mm_loadu_si128((const __m128i *)row);
+    block_edges_row_scalar(row, 0, 4, w, 1, weight, NULL);
 
-    for (y = 0; y < sy; y++) {
-        unsigned char * row = im->pixels + y * stride;
-        float left_b = (float)row[0];
-        float left_g = (float)row[1];
-        float left_r = (float)row[2];
-        int coord = 0;
-        for (current = bytes_pp, next = bytes_pp + bytes_pp; next < stride; current = next, next += bytes_pp) {
-            const float b = row[current + 0];
-            const float g = row[current + 1];
-            const float r = row[current + 2];
-            const int weight_ix = coord % block_size;
-            row[current + 0] = uchar_clamp_ff(left_b * c_l[weight_ix] + b * c_c[weight_ix]
-                                              + row[current + bytes_pp + 0] * c_r[weight_ix]);
-            row[current + 1] = uchar_clamp_ff(left_g * c_l[weight_ix] + g * c_c[weight_ix]
-                                              + row[current + bytes_pp + 1] * c_r[weight_ix]);
-            row[current + 2] = uchar_clamp_ff(left_r * c_l[weight_ix] + r * c_c[weight_ix]
-                                              + row[current + bytes_pp + 2] * c_r[weight_ix]);
-            left_b = b;
-            left_g = g;
-            left_r = r;
-            coord++;
-        }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16((short)weight, (short)weight, (short)weight, 0, (short)weight,
+                                           (short)weight, (short)weight, 0);
+    for (uint32_t x = 4; x < end; x += 4) {
+        const __m128i center = _mm_loadu_si128((const __m128i *)(row + x * 4));
+        const __m128i right = _mm_loadu_si128((const __m128i *)(row + x * 4 + 4));
+        const __m128i left = _mm_alignr_epi8(center, previous, 12);
+        previous = center;
+
+        const __m128i c_lo = _mm_unpacklo_epi8(center, zero);
+        const __m128i c_hi = _mm_unpackhi_epi8(center, zero);
+        const __m128i l_lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(left, zero), c_lo), 3);
+        const __m128i l_hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(left, zero), c_hi), 3);
+        const __m128i r_lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(right, zero), c_lo), 3);
+        const __m128i r_hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(right, zero), c_hi), 3);
+        const __m128i lo
+            = _mm_add_epi16(c_lo, _mm_add_epi16(_mm_mulhrs_epi16(l_lo, weights), _mm_mulhrs_epi16(r_lo, weights)));
+        const __m128i hi
+            = _mm_add_epi16(c_hi, _mm_add_epi16(_mm_mulhrs_epi16(l_hi, weights), _mm_mulhrs_epi16(r_hi, weights)));
+        _mm_storeu_si128((__m128i *)(row + x * 4), _mm_packus_epi16(lo, hi));
+    }
+    block_edges_row_scalar(row, end, w, w, 1, weight, tail_left);
+}
+
+FLOW_HINT_HOT FLOW_HINT_TARGET_SSSE3 static void block_edges_across_rows_SSSE3(uint8_t * row, const uint8_t * above,
+                                                                                const uint8_t * below, uint32_t w,
+                                                                                int weight)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16((short)weight, (short)weight, (short)weight, 0, (short)weight,
+                                           (short)weight, (short)weight, 0);
+    uint32_t x = 0;
+    for (; x + 4 <= w; x += 4) {
+        const __m128i center = _mm_loadu_si128((const __m128i *)(row + x * 4));
+        const __m128i up = _mm_loadu_si128((const __m128i *)(above + x * 4));
+        const __m128i down = _mm_loadu_si128((const __m128i *)(below + x * 4));
+        const __m128i c_lo = _mm_unpacklo_epi8(center, zero);
+        const __m128i c_hi = _mm_unpackhi_epi8(center, zero);
+        const __m128i u_lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(up, zero), c_lo), 3);
+        const __m128i u_hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(up, zero), c_hi), 3);
+        const __m128i d_lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(down, zero), c_lo), 3);
+        const __m128i d_hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(down, zero), c_hi), 3);
+        const __m128i lo
+            = _mm_add_epi16(c_lo, _mm_add_epi16(_mm_mulhrs_epi16(u_lo, weights), _mm_mulhrs_epi16(d_lo, weights)));
+        const __m128i hi
+            = _mm_add_epi16(c_hi, _mm_add_epi16(_mm_mulhrs_epi16(u_hi, weights), _mm_mulhrs_epi16(d_hi, weights)));
+        _mm_storeu_si128((__m128i *)(row + x * 4), _mm_packus_epi16(lo, hi));
     }
+    block_edges_across_rows_scalar(row, above, below, x, w, weight);
 }
 
 FLOW_HINT_HOT FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS static inline void transpose4x4_SSE(float * A, float * B,
@@ -520,13 +865,12 @@ FLOW_HINT_HOT
 static inline void transpose_block_SSE4x4(float * A, float * B, const int n, const int m, const int lda, const int ldb,
                                           const int block_size)
 {
-    //#pragma omp parallel for collapse(2)
     for (int i = 0; i < n; i += block_size) {
         for (int j = 0; j < m; j += block_size) {
             int max_i2 = i + block_size < n ? i + block_size : n;
             int max_j2 = j + block_size < m ? j + block_size : m;
-            for (int i2 = i; i2 < max_i2; i2 += 4) {
-                for (int j2 = j; j2 < max_j2; j2 += 4) {
+            for (int j2 = j; j2 < max_j2; j2 += 4) {
+                for (int i2 = i; i2 < max_i2; i2 += 4) {
                     transpose4x4_SSE(&A[i2 * lda + j2], &B[j2 * ldb + i2], lda, ldb);
                 }
             }
@@ -534,140 +878,223 @@ static inline void transpose_block_SSE4x4(float * A, float * B, const int n, con
     }
 }
 
-//
-// FLOW_HINT_HOT FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS
-// static inline void transpose8x8_AVX(float* mat,  float* matT, const int stride, const int matT_stride) {
-//    __m256  r0, r1, r2, r3, r4, r5, r6, r7;
-//    __m256  t0, t1, t2, t3, t4, t5, t6, t7;
-//
-//    r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[0*stride+0])), _mm_loadu_ps(&mat[4*stride+0]),
-//    1);
-//    r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[1*stride+0])), _mm_loadu_ps(&mat[5*stride+0]),
-//    1);
-//    r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[2*stride+0])), _mm_loadu_ps(&mat[6*stride+0]),
-//    1);
-//    r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[3*stride+0])), _mm_loadu_ps(&mat[7*stride+0]),
-//    1);
-//    r4 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[0*stride+4])), _mm_loadu_ps(&mat[4*stride+4]),
-//    1);
-//    r5 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[1*stride+4])), _mm_loadu_ps(&mat[5*stride+4]),
-//    1);
-//    r6 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[2*stride+4])), _mm_loadu_ps(&mat[6*stride+4]),
-//    1);
-//    r7 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[3*stride+4])), _mm_loadu_ps(&mat[7*stride+4]),
-//    1);
-//
-//    t0 = _mm256_unpacklo_ps(r0,r1);
-//    t1 = _mm256_unpackhi_ps(r0,r1);
-//    t2 = _mm256_unpacklo_ps(r2,r3);
-//    t3 = _mm256_unpackhi_ps(r2,r3);
-//    t4 = _mm256_unpacklo_ps(r4,r5);
-//    t5 = _mm256_unpackhi_ps(r4,r5);
-//    t6 = _mm256_unpacklo_ps(r6,r7);
-//    t7 = _mm256_unpackhi_ps(r6,r7);
-//
-//    //__m256 v;
-//
-//    r0 = _mm256_shuffle_ps(t0,t2, 0x44);
-//    r1 = _mm256_shuffle_ps(t0,t2, 0xEE);
-////    v = _mm256_shuffle_ps(t0,t2, 0x4E);
-////    r0 = _mm256_blend_ps(t0, v, 0xCC);
-////    r1 = _mm256_blend_ps(t2, v, 0x33);
-//
-//    r2 = _mm256_shuffle_ps(t1,t3, 0x44);
-//    r3 = _mm256_shuffle_ps(t1,t3, 0xEE);
-////    v = _mm256_shuffle_ps(t1,t3, 0x4E);
-////    r2 = _mm256_blend_ps(t1, v, 0xCC);
-////    r3 = _mm256_blend_ps(t3, v, 0x33);
-//
-//    r4 = _mm256_shuffle_ps(t4,t6, 0x44);
-//    r5 = _mm256_shuffle_ps(t4,t6, 0xEE);
-////    v = _mm256_shuffle_ps(t4,t6, 0x4E);
-////    r4 = _mm256_blend_ps(t4, v, 0xCC);
-////    r5 = _mm256_blend_ps(t6, v, 0x33);
-//
-//    r6 = _mm256_shuffle_ps(t5,t7, 0x44);
-//    r7 = _mm256_shuffle_ps(t5,t7, 0xEE);
-////    v = _mm256_shuffle_ps(t5,t7, 0x4E);
-////    r6 = _mm256_blend_ps(t5, v, 0xCC);
-////    r7 = _mm256_blend_ps(t7, v, 0x33);
-//
-//    _mm256_storeu_ps(&matT[0*matT_stride], r0);
-//    _mm256_storeu_ps(&matT[1*matT_stride], r1);
-//    _mm256_storeu_ps(&matT[2*matT_stride], r2);
-//    _mm256_storeu_ps(&matT[3*matT_stride], r3);
-//    _mm256_storeu_ps(&matT[4*matT_stride], r4);
-//    _mm256_storeu_ps(&matT[5*matT_stride], r5);
-//    _mm256_storeu_ps(&matT[6*matT_stride], r6);
-//    _mm256_storeu_ps(&matT[7*matT_stride], r7);
-//}
-//
-//
-// FLOW_HINT_HOT
-// static inline void transpose_block_AVX8x8(float *A, float *B, const int n, const int m, const int lda, const int ldb
-// ,const int block_size) {
-////#pragma omp parallel for
-//    for(int i=0; i<n; i+=block_size) {
-//        for(int j=0; j<m; j+=block_size) {
-//            int max_i2 = i+block_size < n ? i + block_size : n;
-//            int max_j2 = j+block_size < m ? j + block_size : m;
-//            for(int i2=i; i2<max_i2; i2+=8) {
-//                for(int j2=j; j2<max_j2; j2+=8) {
-//                    transpose8x8_AVX(&A[i2*lda +j2], &B[j2*ldb + i2], lda, ldb);
-//                }
-//            }
-//        }
-//    }
-//}
+// Pixels are only moved, never interpreted; the float casts just pick the widest shuffles available.
+FLOW_HINT_HOT FLOW_HINT_TARGET_AVX static inline void transpose8x8_AVX(float * mat, float * matT, const int stride,
+                                                                       const int matT_stride)
+{
+    __m256 r0, r1, r2, r3, r4, r5, r6, r7;
+    __m256 t0, t1, t2, t3, t4, t5, t6, t7;
 
-FLOW_HINT_HOT FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS
+    // Rows 0-3 in the low lanes, rows 4-7 in the high lanes; r0-r3 hold columns 0-3, r4-r7 columns 4-7
+    r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[0 * stride + 0])),
+                              _mm_loadu_ps(&mat[4 * stride + 0]), 1);
+    r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[1 * stride + 0])),
+                              _mm_loadu_ps(&mat[5 * stride + 0]), 1);
+    r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[2 * stride + 0])),
+                              _mm_loadu_ps(&mat[6 * stride + 0]), 1);
+    r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[3 * stride + 0])),
+                              _mm_loadu_ps(&mat[7 * stride + 0]), 1);
+    r4 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[0 * stride + 4])),
+                              _mm_loadu_ps(&mat[4 * stride + 4]), 1);
+    r5 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[1 * stride + 4])),
+                              _mm_loadu_ps(&mat[5 * stride + 4]), 1);
+    r6 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[2 * stride + 4])),
+                              _mm_loadu_ps(&mat[6 * stride + 4]), 1);
+    r7 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&mat[3 * stride + 4])),
+                              _mm_loadu_ps(&mat[7 * stride + 4]), 1);
 
-    bool
-    flow_bitmap_bgra_transpose(flow_c * c, struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to)
+    t0 = _mm256_unpacklo_ps(r0, r1);
+    t1 = _mm256_unpackhi_ps(r0, r1);
+    t2 = _mm256_unpacklo_ps(r2, r3);
+    t3 = _mm256_unpackhi_ps(r2, r3);
+    t4 = _mm256_unpacklo_ps(r4, r5);
+    t5 = _mm256_unpackhi_ps(r4, r5);
+    t6 = _mm256_unpacklo_ps(r6, r7);
+    t7 = _mm256_unpackhi_ps(r6, r7);
+
+    r0 = _mm256_shuffle_ps(t0, t2, 0x44);
+    r1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+    r2 = _mm256_shuffle_ps(t1, t3, 0x44);
+    r3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+    r4 = _mm256_shuffle_ps(t4, t6, 0x44);
+    r5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+    r6 = _mm256_shuffle_ps(t5, t7, 0x44);
+    r7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+
+    _mm256_storeu_ps(&matT[0 * matT_stride], r0);
+    _mm256_storeu_ps(&matT[1 * matT_stride], r1);
+    _mm256_storeu_ps(&matT[2 * matT_stride], r2);
+    _mm256_storeu_ps(&matT[3 * matT_stride], r3);
+    _mm256_storeu_ps(&matT[4 * matT_stride], r4);
+    _mm256_storeu_ps(&matT[5 * matT_stride], r5);
+    _mm256_storeu_ps(&matT[6 * matT_stride], r6);
+    _mm256_storeu_ps(&matT[7 * matT_stride], r7);
+}
+
+FLOW_HINT_HOT FLOW_HINT_TARGET_AVX static void transpose_block_AVX8x8(float * A, float * B, const int n, const int m,
+                                                                      const int lda, const int ldb,
+                                                                      const int block_size)
 {
-    if (from->w != to->h || from->h != to->w || from->fmt != to->fmt) {
-        FLOW_error(c, flow_status_Invalid_argument);
-        return false;
+    for (int i = 0; i < n; i += block_size) {
+        for (int j = 0; j < m; j += block_size) {
+            int max_i2 = i + block_size < n ? i + block_size : n;
+            int max_j2 = j + block_size < m ? j + block_size : m;
+            for (int j2 = j; j2 < max_j2; j2 += 8) {
+                for (int i2 = i; i2 < max_i2; i2 += 8) {
+                    transpose8x8_AVX(&A[i2 * lda + j2], &B[j2 * ldb + i2], lda, ldb);
+                }
+            }
+        }
+    }
+}
+
+// Four bgr24 pixels are exactly 12 bytes; neither touches the bytes after them
+static inline __m128i load_12_bytes(const uint8_t * p)
+{
+    int32_t tail;
+    memcpy(&tail, p + 8, 4);
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p), _mm_cvtsi32_si128(tail));
+}
+
+static inline void store_12_bytes(uint8_t * p, __m128i v)
+{
+    _mm_storel_epi64((__m128i *)p, v);
+    int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(p + 8, &tail, 4);
+}
+
+// Widens each row of a 4x4 bgr24 block to 32 bits per pixel, transposes it like bgra32, then packs it back
+FLOW_HINT_HOT FLOW_HINT_TARGET_SSSE3 static inline void transpose4x4_bgr24_SSSE3(uint8_t * A, uint8_t * B,
+                                                                                  const int lda, const int ldb)
+{
+    const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m128 row1 = _mm_castsi128_ps(_mm_shuffle_epi8(load_12_bytes(&A[0 * lda]), widen));
+    __m128 row2 = _mm_castsi128_ps(_mm_shuffle_epi8(load_12_bytes(&A[1 * lda]), widen));
+    __m128 row3 = _mm_castsi128_ps(_mm_shuffle_epi8(load_12_bytes(&A[2 * lda]), widen));
+    __m128 row4 = _mm_castsi128_ps(_mm_shuffle_epi8(load_12_bytes(&A[3 * lda]), widen));
+    _MM_TRANSPOSE4_PS(row1, row2, row3, row4);
+    store_12_bytes(&B[0 * ldb], _mm_shuffle_epi8(_mm_castps_si128(row1), narrow));
+    store_12_bytes(&B[1 * ldb], _mm_shuffle_epi8(_mm_castps_si128(row2), narrow));
+    store_12_bytes(&B[2 * ldb], _mm_shuffle_epi8(_mm_castps_si128(row3), narrow));
+    store_12_bytes(&B[3 * ldb], _mm_shuffle_epi8(_mm_castps_si128(row4), narrow));
+}
+
+FLOW_HINT_HOT FLOW_HINT_TARGET_SSSE3 static void transpose_block_bgr24_SSSE3(uint8_t * A, uint8_t * B, const int n,
+                                                                             const int m, const int lda,
+                                                                             const int ldb, const int block_size)
+{
+    for (int i = 0; i < n; i += block_size) {
+        for (int j = 0; j < m; j += block_size) {
+            int max_i2 = i + block_size < n ? i + block_size : n;
+            int max_j2 = j + block_size < m ? j + block_size : m;
+            for (int j2 = j; j2 < max_j2; j2 += 4) {
+                for (int i2 = i; i2 < max_i2; i2 += 4) {
+                    transpose4x4_bgr24_SSSE3(&A[i2 * lda + j2 * 3], &B[j2 * ldb + i2 * 3], lda, ldb);
+                }
+            }
+        }
     }
+}
 
-    if (from->fmt != flow_bgra32 && from->fmt != flow_bgr32) {
-        if (!flow_bitmap_bgra_transpose_slow(c, from, to)) {
-            FLOW_add_to_callstack(c);
-            return false;
+// Copies source rows [from_row, until_row) x columns [from_col, until_col) to their transposed positions
+static void transpose_region(struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to, uint32_t from_row,
+                             uint32_t until_row, uint32_t from_col, uint32_t until_col)
+{
+    if (from->fmt == flow_bgr24) {
+        for (uint32_t y = from_row; y < until_row; y++) {
+            for (uint32_t x = from_col; x < until_col; x++) {
+                memcpy(&to->pixels[x * to->stride + y * 3], &from->pixels[y * from->stride + x * 3], 3);
+            }
+        }
+    } else {
+        for (uint32_t y = from_row; y < until_row; y++) {
+            for (uint32_t x = from_col; x < until_col; x++) {
+                *((uint32_t *)&to->pixels[x * to->stride + y * 4])
+                    = *((uint32_t *)&from->pixels[y * from->stride + x * 4]);
+            }
         }
-        return true;
     }
+}
 
-    // We require 8 when we only need 4 - in case we ever want to enable avx (like if we make it faster)
-    const int min_block_size = 8;
+bool flow_transpose_kernel_supported(flow_transpose_kernel kernel, flow_pixel_format fmt)
+{
+    const bool four_bytes = fmt == flow_bgra32 || fmt == flow_bgr32;
+    if (!four_bytes && fmt != flow_bgr24) {
+        return false;
+    }
+    switch (kernel) {
+        case flow_transpose_kernel_auto:
+        case flow_transpose_kernel_scalar:
+            return true;
+        case flow_transpose_kernel_sse:
+            return four_bytes || flow_cpu_supports_ssse3();
+        case flow_transpose_kernel_avx:
+            return four_bytes && flow_cpu_supports_avx();
+    }
+    return false;
+}
 
-    // Strides must be multiple of required alignments
-    if (from->stride % min_block_size != 0 || to->stride % min_block_size != 0) {
+FLOW_HINT_HOT FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS
+
+    bool
+    flow_bitmap_bgra_transpose_rows(flow_c * c, struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to,
+                                    uint32_t from_row, uint32_t row_count, flow_transpose_kernel kernel)
+{
+    if (from->w != to->h || from->h != to->w || from->fmt != to->fmt || from_row + row_count > from->h) {
         FLOW_error(c, flow_status_Invalid_argument);
         return false;
     }
-    // 256 (1024x1024 bytes) at 18.18ms, 128 at 18.6ms,  64 at 20.4ms, 16 at 25.71ms
-    int block_size = 128;
+    if (kernel == flow_transpose_kernel_auto) {
+        kernel = flow_transpose_kernel_supported(flow_transpose_kernel_avx, from->fmt)
+                     ? flow_transpose_kernel_avx
+                     : flow_transpose_kernel_supported(flow_transpose_kernel_sse, from->fmt)
+                           ? flow_transpose_kernel_sse
+                           : flow_transpose_kernel_scalar;
+    }
+    if (!flow_transpose_kernel_supported(kernel, from->fmt)) {
+        FLOW_error_msg(c, flow_status_Invalid_argument, "Transpose kernel %d cannot handle pixel format %d",
+                       (int)kernel, (int)from->fmt);
+        return false;
+    }
+    const uint32_t until_row = from_row + row_count;
+    // Unaligned rows (like those of some views) can't be addressed as floats
+    if (kernel == flow_transpose_kernel_scalar
+        || (from->fmt != flow_bgr24 && (from->stride % 4 != 0 || to->stride % 4 != 0))) {
+        transpose_region(from, to, from_row, until_row, 0, from->w);
+        return true;
+    }
 
-    int cropped_h = from->h - from->h % min_block_size;
-    int cropped_w = from->w - from->w % min_block_size;
+    const uint32_t block = kernel == flow_transpose_kernel_avx ? 8 : 4;
+    const uint32_t cropped_rows = row_count - row_count % block;
+    const uint32_t cropped_w = from->w - from->w % block;
+    // Each kernel walks down the source so that every destination row is written in one run. 4000x3000 bgra32,
+    // sse/avx: 1024 at 30/31ms, 256 at 32/34ms, 128 at 34/42ms; walking across instead, 128 at 43/50ms
+    const int block_size = 1024;
 
-    transpose_block_SSE4x4((float *)from->pixels, (float *)to->pixels, cropped_h, cropped_w, from->stride / 4,
-                           to->stride / 4, block_size);
+    if (kernel == flow_transpose_kernel_avx) {
+        transpose_block_AVX8x8((float *)(from->pixels + from_row * from->stride), (float *)(to->pixels + from_row * 4),
+                               cropped_rows, cropped_w, from->stride / 4, to->stride / 4, block_size);
+    } else if (from->fmt == flow_bgr24) {
+        transpose_block_bgr24_SSSE3(from->pixels + from_row * from->stride, to->pixels + from_row * 3, cropped_rows,
+                                    cropped_w, from->stride, to->stride, block_size);
+    } else {
+        transpose_block_SSE4x4((float *)(from->pixels + from_row * from->stride), (float *)(to->pixels + from_row * 4),
+                               cropped_rows, cropped_w, from->stride / 4, to->stride / 4, block_size);
+    }
 
     // Copy missing bits
-    for (uint32_t x = cropped_h; x < to->w; x++) {
-        for (uint32_t y = 0; y < to->h; y++) {
-            *((uint32_t *)&to->pixels[x * 4 + y * to->stride]) = *((uint32_t *)&from->pixels[x * from->stride + y * 4]);
-        }
-    }
+    transpose_region(from, to, from_row, from_row + cropped_rows, cropped_w, from->w);
+    transpose_region(from, to, from_row + cropped_rows, until_row, 0, from->w);
+    return true;
+}
 
-    for (uint32_t x = 0; x < (uint32_t)cropped_h; x++) {
-        for (uint32_t y = cropped_w; y < to->h; y++) {
-            *((uint32_t *)&to->pixels[x * 4 + y * to->stride]) = *((uint32_t *)&from->pixels[x * from->stride + y * 4]);
-        }
+bool flow_bitmap_bgra_transpose(flow_c * c, struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to)
+{
+    if (!flow_bitmap_bgra_transpose_rows(c, from, to, 0, from->h, flow_transpose_kernel_auto)) {
+        FLOW_add_to_callstack(c);
+        return false;
     }
-
     return true;
 }
 
@@ -704,89 +1131,182 @@ bool flow_bitmap_bgra_transpose_slow(flow_c * c, struct flow_bitmap_bgra * from,
     }
 }
 
-FLOW_HINT_HOT FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS
+static inline void block_edges_row(uint8_t * row, uint32_t w, uint32_t block_size, int weight, bool simd)
+{
+    if (!simd) {
+        block_edges_row_scalar(row, 0, w, w, block_size, weight, NULL);
+    } else if (block_size == 1) {
+        block_edges_row_pixels_SSSE3(row, w, weight);
+    } else {
+        block_edges_row_pairs_SSSE3(row, w, block_size, weight);
+    }
+}
 
-    bool
-    flow_bitmap_bgra_sharpen_block_edges(flow_c * c, struct flow_bitmap_bgra * im, int block_size, float pct)
+// Filters across both the vertical and horizontal block boundaries in one top-to-bottom pass: each row is filtered
+// along its length, then against the row above it if a boundary lies between them.
+bool flow_bitmap_bgra_sharpen_block_edges(flow_c * c, struct flow_bitmap_bgra * im, int block_size, float pct)
 {
     if (pct == 0.0f)
         return true;
-    if (im->fmt != flow_bgra32 || im->fmt != flow_bgr32) {
+    if (im->fmt != flow_bgra32 && im->fmt != flow_bgr32) {
         FLOW_error(c, flow_status_Unsupported_pixel_format);
         return false;
     }
-    flow_bitmap_bgra32_sharpen_block_edges_x(im, block_size, pct);
-    struct flow_bitmap_bgra * temp = flow_bitmap_bgra_create(c, im->h, im->w, false, im->fmt);
-    if (temp == NULL) {
-        FLOW_add_to_callstack(c);
+    if (block_size < 1) {
+        FLOW_error_msg(c, flow_status_Invalid_argument, "Block size must be at least 1, got %d", block_size);
         return false;
     }
-    if (!flow_bitmap_bgra_transpose(c, im, temp)) {
-        flow_bitmap_bgra_destroy(c, temp);
-        FLOW_add_to_callstack(c);
-        return false;
+    pct = pct / 100.0f;
+    if (pct < -1.0f)
+        pct = -1;
+    if (pct > 1.0f)
+        pct = 1;
+    const float n = (float)(-pct / (pct - 1.0)); // if 0 < pct < 1
+    const float e = n / -2.0f;
+    const float scaled = e * (1 << FLOW_BLOCK_EDGE_WEIGHT_BITS);
+    const int weight = scaled > 32767.0f ? 32767 : (scaled < -32767.0f ? -32767 : (int)lroundf(scaled));
+
+    const uint32_t bs = (uint32_t)block_size;
+    const uint32_t w = im->w;
+    const size_t row_bytes = (size_t)w * 4;
+    const bool simd = flow_cpu_supports_ssse3();
+
+    // A row below a boundary is filtered against the row above it after that row was filtered itself, so keep a copy
+    // of each row above a boundary from before
+    uint8_t * copies = (uint8_t *)FLOW_malloc(c, row_bytes * 2);
+    if (copies == NULL) {
+        FLOW_error_return(c);
     }
-    flow_bitmap_bgra32_sharpen_block_edges_x(temp, block_size, pct);
-    if (!flow_bitmap_bgra_transpose(c, temp, im)) {
-        flow_bitmap_bgra_destroy(c, temp);
-        FLOW_add_to_callstack(c);
-        return false;
+    uint8_t * above_copy = copies;
+    uint8_t * row_copy = copies + row_bytes;
+
+    for (uint32_t y = 0; y < im->h; y++) {
+        uint8_t * row = im->pixels + (size_t)y * im->stride;
+        uint8_t * below = y + 1 < im->h ? row + im->stride : NULL;
+        // Rows are filtered along their length one row ahead, so that the row below is ready
+        if (y == 0) {
+            block_edges_row(row, w, bs, weight, simd);
+        }
+        if (below != NULL) {
+            block_edges_row(below, w, bs, weight, simd);
+        }
+        const bool has_above = y > 0 && y % bs == 0;
+        const bool has_below = below != NULL && y % bs == bs - 1;
+        if (!has_above && !has_below) {
+            continue;
+        }
+        if (has_below) {
+            memcpy(row_copy, row, row_bytes);
+        }
+        const uint8_t * up = has_above ? above_copy : row;
+        const uint8_t * down = has_below ? below : row;
+        if (simd) {
+            block_edges_across_rows_SSSE3(row, up, down, w, weight);
+        } else {
+            block_edges_across_rows_scalar(row, up, down, 0, w, weight);
+        }
+        if (has_below) {
+            uint8_t * swap = above_copy;
+            above_copy = row_copy;
+            row_copy = swap;
+        }
     }
-    flow_bitmap_bgra_destroy(c, temp);
+    FLOW_free(c, copies);
     return true;
 }
-FLOW_HINT_HOT
+// The 3-tap sharpen moves every float away from the same channel of the pixels on either side:
+// out = left * c_o + center * c_i + right * c_o. The vector kernels load each right neighbour before it is
+// overwritten and take each left neighbour from the previous iteration's registers, so no arithmetic carries from one
+// iteration to the next. Every path evaluates the same expression in the same order, so they agree exactly.
 
-static void SharpenBgraFloatInPlace(float * buf, unsigned int count, double pct, int step)
+// Floats [from, until) of a row, in place. `before` holds the original `channels` floats before `from`.
+FLOW_HINT_STRICT_MATH static void sharpen_row_floats_scalar(float * buf, uint32_t from, uint32_t until,
+                                                            uint32_t channels, const float * before, float c_o,
+                                                            float c_i)
 {
+    // The previous `channels` original floats, indexed by float % channels
+    float left[4];
+    for (uint32_t i = 0; i < channels; i++) {
+        left[(from - channels + i) % channels] = before[i];
+    }
+    for (uint32_t k = from; k < until; k++) {
+        const float center = buf[k];
+        buf[k] = left[k % channels] * c_o + center * c_i + buf[k + channels] * c_o;
+        left[k % channels] = center;
+    }
+}
 
-    const float n = (float)(-pct / (pct - 1)); // if 0 < pct < 1
-    const float c_o = n / -2.0f;
-    const float c_i = n + 1;
+// The left neighbours of the floats in `center`, given the vector before it
+static inline __m128 sharpen_left_SSE(__m128 previous, __m128 center, const uint32_t channels)
+{
+    if (channels == 4) {
+        return previous;
+    }
+    const __m128 t = _mm_shuffle_ps(previous, center, _MM_SHUFFLE(0, 0, 3, 3));
+    return _mm_shuffle_ps(previous, t, _MM_SHUFFLE(2, 0, 2, 1));
+}
 
-    unsigned int ndx;
-
-    // if both have alpha, process it
-    if (step == 4) {
-        float left_b = buf[0 * 4 + 0];
-        float left_g = buf[0 * 4 + 1];
-        float left_r = buf[0 * 4 + 2];
-        float left_a = buf[0 * 4 + 3];
-
-        for (ndx = 1; ndx < count - 1; ndx++) {
-            const float b = buf[ndx * 4 + 0];
-            const float g = buf[ndx * 4 + 1];
-            const float r = buf[ndx * 4 + 2];
-            const float a = buf[ndx * 4 + 3];
-            buf[ndx * 4 + 0] = left_b * c_o + b * c_i + buf[(ndx + 1) * 4 + 0] * c_o;
-            buf[ndx * 4 + 1] = left_g * c_o + g * c_i + buf[(ndx + 1) * 4 + 1] * c_o;
-            buf[ndx * 4 + 2] = left_r * c_o + r * c_i + buf[(ndx + 1) * 4 + 2] * c_o;
-            buf[ndx * 4 + 3] = left_a * c_o + a * c_i + buf[(ndx + 1) * 4 + 3] * c_o;
-            left_b = b;
-            left_g = g;
-            left_r = r;
-            left_a = a;
-        }
-    }
-    // otherwise do the same thing without 4th chan
-    // (ifs in loops are expensive..)
-    else {
-        float left_b = buf[0 * 3 + 0];
-        float left_g = buf[0 * 3 + 1];
-        float left_r = buf[0 * 3 + 2];
-
-        for (ndx = 1; ndx < count - 1; ndx++) {
-            const float b = buf[ndx * 3 + 0];
-            const float g = buf[ndx * 3 + 1];
-            const float r = buf[ndx * 3 + 2];
-            buf[ndx * 3 + 0] = left_b * c_o + b * c_i + buf[(ndx + 1) * 3 + 0] * c_o;
-            buf[ndx * 3 + 1] = left_g * c_o + g * c_i + buf[(ndx + 1) * 3 + 1] * c_o;
-            buf[ndx * 3 + 2] = left_r * c_o + r * c_i + buf[(ndx + 1) * 3 + 2] * c_o;
-            left_b = b;
-            left_g = g;
-            left_r = r;
-        }
+FLOW_HINT_HOT FLOW_HINT_STRICT_MATH static inline void sharpen_row_SSE(float * buf, uint32_t count,
+                                                                       const uint32_t channels, float c_o, float c_i)
+{
+    const uint32_t until = count * channels - channels;
+    if (until < 8) {
+        sharpen_row_floats_scalar(buf, channels, until, channels, buf, c_o, c_i);
+        return;
+    }
+    // Whole vectors from float 4, while their right neighbours stay in the row
+    const uint32_t end = 4 + (until - 4) / 4 * 4;
+    __m128 previous = _mm_loadu_ps(buf);
+    sharpen_row_floats_scalar(buf, channels, 4, channels, buf, c_o, c_i);
+    const __m128 outer = _mm_set1_ps(c_o);
+    const __m128 inner = _mm_set1_ps(c_i);
+    for (uint32_t k = 4; k < end; k += 4) {
+        const __m128 center = _mm_loadu_ps(buf + k);
+        const __m128 right = _mm_loadu_ps(buf + k + channels);
+        const __m128 left = sharpen_left_SSE(previous, center, channels);
+        previous = center;
+        _mm_storeu_ps(buf + k,
+                      _mm_add_ps(_mm_add_ps(_mm_mul_ps(left, outer), _mm_mul_ps(center, inner)), _mm_mul_ps(right, outer)));
+    }
+    float before[4];
+    _mm_storeu_ps(before, previous);
+    sharpen_row_floats_scalar(buf, end, until, channels, before + 4 - channels, c_o, c_i);
+}
+
+FLOW_HINT_TARGET_AVX static inline __m256 sharpen_left_AVX(__m256 previous, __m256 center, const uint32_t channels)
+{
+    const __m256 shifted = _mm256_permute2f128_ps(previous, center, 0x21);
+    if (channels == 4) {
+        return shifted;
     }
+    const __m256 t = _mm256_shuffle_ps(shifted, center, _MM_SHUFFLE(0, 0, 3, 3));
+    return _mm256_shuffle_ps(shifted, t, _MM_SHUFFLE(2, 0, 2, 1));
+}
+
+FLOW_HINT_HOT FLOW_HINT_STRICT_MATH FLOW_HINT_TARGET_AVX static inline void
+sharpen_row_AVX(float * buf, uint32_t count, const uint32_t channels, float c_o, float c_i)
+{
+    const uint32_t until = count * channels - channels;
+    if (until < 16) {
+        sharpen_row_SSE(buf, count, channels, c_o, c_i);
+        return;
+    }
+    const uint32_t end = 8 + (until - 8) / 8 * 8;
+    __m256 previous = _mm256_loadu_ps(buf);
+    sharpen_row_floats_scalar(buf, channels, 8, channels, buf, c_o, c_i);
+    const __m256 outer = _mm256_set1_ps(c_o);
+    const __m256 inner = _mm256_set1_ps(c_i);
+    for (uint32_t k = 8; k < end; k += 8) {
+        const __m256 center = _mm256_loadu_ps(buf + k);
+        const __m256 right = _mm256_loadu_ps(buf + k + channels);
+        const __m256 left = sharpen_left_AVX(previous, center, channels);
+        previous = center;
+        _mm256_storeu_ps(buf + k, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(left, outer), _mm256_mul_ps(center, inner)),
+                                                _mm256_mul_ps(right, outer)));
+    }
+    float before[8];
+    _mm256_storeu_ps(before, previous);
+    sharpen_row_floats_scalar(buf, end, until, channels, before + 8 - channels, c_o, c_i);
 }
 
 bool flow_bitmap_float_sharpen_rows(flow_c * context, struct flow_bitmap_float * im, uint32_t start_row,
@@ -796,8 +1316,31 @@ bool flow_bitmap_float_sharpen_rows(flow_c * context, struct flow_bitmap_float *
         FLOW_error(context, flow_status_Invalid_internal_state);
         return false;
     }
+    // The first and last pixels of a row are left alone
+    if (im->w < 3) {
+        return true;
+    }
+    const float n = (float)(-pct / (pct - 1)); // if 0 < pct < 1
+    const float c_o = n / -2.0f;
+    const float c_i = n + 1;
+    const bool avx = flow_cpu_supports_avx();
     for (uint32_t row = start_row; row < start_row + row_count; row++) {
-        SharpenBgraFloatInPlace(im->pixels + (im->float_stride * row), im->w, pct, im->channels);
+        float * buf = im->pixels + (im->float_stride * row);
+        if (im->channels == 4) {
+            if (avx) {
+                sharpen_row_AVX(buf, im->w, 4, c_o, c_i);
+            } else {
+                sharpen_row_SSE(buf, im->w, 4, c_o, c_i);
+            }
+        } else if (im->channels == 3) {
+            if (avx) {
+                sharpen_row_AVX(buf, im->w, 3, c_o, c_i);
+            } else {
+                sharpen_row_SSE(buf, im->w, 3, c_o, c_i);
+            }
+        } else {
+            sharpen_row_floats_scalar(buf, im->channels, (im->w - 1) * im->channels, im->channels, buf, c_o, c_i);
+        }
     }
     return true;
 }
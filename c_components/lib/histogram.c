@@ -0,0 +1,278 @@
+#include "imageflow_private.h"
+#include "bands.h"
+
+// Histograms of a bgra/bgr bitmap, counted in row bands that can run on separate threads.
+//
+// Incrementing one shared array pixel by pixel stalls whenever neighbouring pixels land in the same bin, since each
+// increment has to wait for the previous store. Each band therefore counts into several private banks instead
+// (pixel i goes to bank i % bank_count), stored side by side so that a bin's banks share a cache line. Banks are
+// 32-bit and folded into the band's 64-bit totals before they could overflow; bands are summed by
+// flow_histogram_job_merge.
+//
+// Bins cover 16-bit sample values. An 8-bit sample v counts as v * 257, and its bin is the top log2(bins) bits of that,
+// so 256 bins hold the 8-bit values themselves and up to 65536 bins are available for deeper samples.
+//
+// With a sample step of n, only every nth pixel of every nth row is counted.
+
+#define FLOW_HISTOGRAM_BANKS 4
+
+struct flow_histogram_band {
+    uint32_t * banks;
+    uint64_t * totals;
+    uint64_t pixels_sampled;
+};
+
+struct flow_histogram_job {
+    struct flow_bitmap_bgra * bitmap;
+    uint32_t bytes_per_pixel;
+    uint32_t bins;
+    // 16 - log2(bins)
+    uint32_t bin_shift;
+    uint32_t histogram_count;
+    uint32_t bank_count;
+    uint32_t sample_step;
+    uint32_t sampled_rows;
+    uint32_t samples_per_row;
+    uint32_t band_count;
+    struct flow_histogram_band * bands;
+    // The bin of each 8-bit channel value
+    uint16_t channel_bins[256];
+};
+
+struct flow_histogram_job * flow_histogram_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                      uint32_t histogram_size_per_channel, uint32_t histogram_count,
+                                                      uint32_t sample_step, uint32_t band_count)
+{
+    uint32_t bytes_per_pixel = flow_pixel_format_bytes_per_pixel(bitmap->fmt);
+    if (bytes_per_pixel != 3 && bytes_per_pixel != 4) {
+        FLOW_error(c, flow_status_Unsupported_pixel_format);
+        return NULL;
+    }
+    if (histogram_size_per_channel < 2 || histogram_size_per_channel > 65536
+        || !isPowerOfTwo(histogram_size_per_channel)) {
+        FLOW_error_msg(c, flow_status_Invalid_argument,
+                       "Histograms must have a power of two from 2 to 65536 bins, got %u", histogram_size_per_channel);
+        return NULL;
+    }
+    if (histogram_count < 1 || histogram_count > 3) {
+        FLOW_error_msg(c, flow_status_Invalid_argument,
+                       "histogram_count must be 1 (luma), 2 (luma, saturation) or 3 (red, green, blue), got %u",
+                       histogram_count);
+        return NULL;
+    }
+    if (sample_step < 1) {
+        sample_step = 1;
+    }
+    uint32_t sampled_rows = (bitmap->h + sample_step - 1) / sample_step;
+    band_count = umax(1, umin(band_count, sampled_rows));
+
+    struct flow_histogram_job * job = FLOW_calloc_array(c, 1, struct flow_histogram_job);
+    if (job == NULL) {
+        FLOW_error_return_null(c);
+    }
+    job->bitmap = bitmap;
+    job->bytes_per_pixel = bytes_per_pixel;
+    job->bins = histogram_size_per_channel;
+    job->bin_shift = 16 - (uint32_t)intlog2(histogram_size_per_channel);
+    job->histogram_count = histogram_count;
+    // Wide histograms rarely see the same bin twice in a row, and would be costly to copy
+    job->bank_count = histogram_size_per_channel <= 256 ? FLOW_HISTOGRAM_BANKS : 1;
+    job->sample_step = sample_step;
+    job->sampled_rows = sampled_rows;
+    job->samples_per_row = (bitmap->w + sample_step - 1) / sample_step;
+    job->band_count = band_count;
+    for (uint32_t v = 0; v < 256; v++) {
+        job->channel_bins[v] = (uint16_t)((v * 257) >> job->bin_shift);
+    }
+
+    const size_t bin_count = (size_t)job->bins * histogram_count;
+    job->bands = FLOW_calloc_array_owned(c, band_count, struct flow_histogram_band, job);
+    if (job->bands == NULL) {
+        FLOW_destroy(c, job);
+        FLOW_error_return_null(c);
+    }
+    for (uint32_t i = 0; i < band_count; i++) {
+        job->bands[i].banks = (uint32_t *)FLOW_calloc_owned(c, bin_count * job->bank_count, sizeof(uint32_t), job);
+        job->bands[i].totals = (uint64_t *)FLOW_calloc_owned(c, bin_count, sizeof(uint64_t), job);
+        if (job->bands[i].banks == NULL || job->bands[i].totals == NULL) {
+            FLOW_destroy(c, job);
+            FLOW_error_return_null(c);
+        }
+    }
+    return job;
+}
+
+uint32_t flow_histogram_job_band_count(struct flow_histogram_job * job)
+{
+    return job->band_count;
+}
+
+// BT.601 luma of an 8-bit bgr pixel, scaled to 16 bits
+static inline uint32_t luma16(const uint8_t * bgr)
+{
+    return ((306 * bgr[2] + 601 * bgr[1] + 117 * bgr[0]) * 257) >> 10;
+}
+
+// Red, green and blue into 256 bins of FLOW_HISTOGRAM_BANKS banks; each group of 4 samples uses every bank once
+static void count_row_rgb256(const uint8_t * row, size_t step_bytes, uint32_t samples, uint32_t * banks)
+{
+    uint32_t * red = banks;
+    uint32_t * green = banks + 256 * FLOW_HISTOGRAM_BANKS;
+    uint32_t * blue = banks + 512 * FLOW_HISTOGRAM_BANKS;
+    uint32_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        const uint8_t * a = row + i * step_bytes;
+        const uint8_t * b = a + step_bytes;
+        const uint8_t * c = b + step_bytes;
+        const uint8_t * d = c + step_bytes;
+        red[a[2] * FLOW_HISTOGRAM_BANKS]++;
+        red[b[2] * FLOW_HISTOGRAM_BANKS + 1]++;
+        red[c[2] * FLOW_HISTOGRAM_BANKS + 2]++;
+        red[d[2] * FLOW_HISTOGRAM_BANKS + 3]++;
+        green[a[1] * FLOW_HISTOGRAM_BANKS]++;
+        green[b[1] * FLOW_HISTOGRAM_BANKS + 1]++;
+        green[c[1] * FLOW_HISTOGRAM_BANKS + 2]++;
+        green[d[1] * FLOW_HISTOGRAM_BANKS + 3]++;
+        blue[a[0] * FLOW_HISTOGRAM_BANKS]++;
+        blue[b[0] * FLOW_HISTOGRAM_BANKS + 1]++;
+        blue[c[0] * FLOW_HISTOGRAM_BANKS + 2]++;
+        blue[d[0] * FLOW_HISTOGRAM_BANKS + 3]++;
+    }
+    for (; i < samples; i++) {
+        const uint8_t * pixel = row + i * step_bytes;
+        red[pixel[2] * FLOW_HISTOGRAM_BANKS]++;
+        green[pixel[1] * FLOW_HISTOGRAM_BANKS]++;
+        blue[pixel[0] * FLOW_HISTOGRAM_BANKS]++;
+    }
+}
+
+static void count_row(const struct flow_histogram_job * job, const uint8_t * row, uint32_t * banks)
+{
+    const size_t step_bytes = (size_t)job->bytes_per_pixel * job->sample_step;
+    const uint32_t samples = job->samples_per_row;
+    const uint32_t banks_per_bin = job->bank_count;
+    const uint32_t bank_mask = job->bank_count - 1;
+    const uint32_t bins = job->bins;
+    const uint32_t shift = job->bin_shift;
+    const uint16_t * channel_bins = job->channel_bins;
+
+    switch (job->histogram_count) {
+        case 3:
+            if (bins == 256 && banks_per_bin == FLOW_HISTOGRAM_BANKS) {
+                count_row_rgb256(row, step_bytes, samples, banks);
+                break;
+            }
+            for (uint32_t i = 0; i < samples; i++) {
+                const uint8_t * pixel = row + i * step_bytes;
+                uint32_t * bank = banks + (i & bank_mask);
+                bank[channel_bins[pixel[2]] * banks_per_bin]++;
+                bank[(bins + channel_bins[pixel[1]]) * banks_per_bin]++;
+                bank[(2 * bins + channel_bins[pixel[0]]) * banks_per_bin]++;
+            }
+            break;
+        case 2:
+            for (uint32_t i = 0; i < samples; i++) {
+                const uint8_t * pixel = row + i * step_bytes;
+                uint32_t * bank = banks + (i & bank_mask);
+                int saturation = int_max(abs((int)pixel[2] - (int)pixel[1]), abs((int)pixel[1] - (int)pixel[0]));
+                bank[(luma16(pixel) >> shift) * banks_per_bin]++;
+                bank[(bins + channel_bins[saturation]) * banks_per_bin]++;
+            }
+            break;
+        default:
+            for (uint32_t i = 0; i < samples; i++) {
+                const uint8_t * pixel = row + i * step_bytes;
+                banks[(luma16(pixel) >> shift) * banks_per_bin + (i & bank_mask)]++;
+            }
+            break;
+    }
+}
+
+static void fold_banks(const struct flow_histogram_job * job, struct flow_histogram_band * band)
+{
+    const size_t bin_count = (size_t)job->bins * job->histogram_count;
+    for (size_t bin = 0; bin < bin_count; bin++) {
+        uint32_t * banks = band->banks + bin * job->bank_count;
+        for (uint32_t i = 0; i < job->bank_count; i++) {
+            band->totals[bin] += banks[i];
+            banks[i] = 0;
+        }
+    }
+}
+
+bool flow_histogram_job_run_band(flow_c * c, struct flow_histogram_job * job, uint32_t band_index)
+{
+    if (band_index >= job->band_count) {
+        FLOW_error(c, flow_status_Invalid_argument);
+        return false;
+    }
+    struct flow_histogram_band * band = &job->bands[band_index];
+    uint32_t from;
+    uint32_t count;
+    flow_band_bounds(job->sampled_rows, job->band_count, band_index, 1, &from, &count);
+
+    // Every bank could see every sample of a row
+    const uint32_t rows_per_fold = umax(1, UINT32_MAX / umax(1, job->samples_per_row));
+    const size_t row_stride = (size_t)job->bitmap->stride * job->sample_step;
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t rows = umin(count - done, rows_per_fold);
+        for (uint32_t i = 0; i < rows; i++) {
+            count_row(job, job->bitmap->pixels + (from + done + i) * row_stride, band->banks);
+        }
+        fold_banks(job, band);
+        done += rows;
+    }
+    band->pixels_sampled += (uint64_t)count * job->samples_per_row;
+    return true;
+}
+
+bool flow_histogram_job_merge(flow_c * c, struct flow_histogram_job * job, uint64_t * histograms,
+                              uint64_t * pixels_sampled)
+{
+    const size_t bin_count = (size_t)job->bins * job->histogram_count;
+    uint64_t sampled = 0;
+    for (uint32_t b = 0; b < job->band_count; b++) {
+        const uint64_t * totals = job->bands[b].totals;
+        for (size_t bin = 0; bin < bin_count; bin++) {
+            histograms[bin] += totals[bin];
+        }
+        sampled += job->bands[b].pixels_sampled;
+    }
+    *pixels_sampled = sampled;
+    return true;
+}
+
+uint32_t flow_histogram_sample_step_for_error(uint32_t w, uint32_t h, double max_error)
+{
+    // The share of n random samples landing in a bin has a standard error of at most 0.5 / sqrt(n). Keep three of
+    // those within max_error. A sampling grid is only as good as a random sample when the image has no detail
+    // repeating at the step's own period.
+    if (!(max_error > 0)) {
+        return 1;
+    }
+    double samples_required = 2.25 / (max_error * max_error);
+    double step = floor(sqrt((double)w * (double)h / samples_required));
+    if (step < 1) {
+        return 1;
+    }
+    return (uint32_t)fmin(step, (double)umax(1, umin(w, h)));
+}
+
+bool flow_bitmap_bgra_populate_histogram(flow_c * context, struct flow_bitmap_bgra * bmp, uint64_t * histograms,
+                                         uint32_t histogram_size_per_channel, uint32_t histogram_count,
+                                         uint64_t * pixels_sampled)
+{
+    struct flow_histogram_job * job
+        = flow_histogram_job_create(context, bmp, histogram_size_per_channel, histogram_count, 1, 1);
+    if (job == NULL) {
+        FLOW_error_return(context);
+    }
+    if (!flow_histogram_job_run_band(context, job, 0)
+        || !flow_histogram_job_merge(context, job, histograms, pixels_sampled)) {
+        FLOW_destroy(context, job);
+        FLOW_error_return(context);
+    }
+    FLOW_destroy(context, job);
+    return true;
+}
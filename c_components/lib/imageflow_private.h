@@ -36,8 +36,53 @@ extern "C" {
 
 #if defined(__GNUC__) && !defined(__clang__)
 #define FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS __attribute__((optimize("-funsafe-math-optimizations")))
+// For code whose results must not depend on how the compiler chose to reassociate, fuse or take reciprocals. Not
+// reliable by itself; CMakeLists.txt also compiles the files that use it without fast math (STRICT_MATH_SRCS).
+#define FLOW_HINT_STRICT_MATH __attribute__((optimize("-fno-unsafe-math-optimizations", "-ffp-contract=off")))
 #else
 #define FLOW_HINT_UNSAFE_MATH_OPTIMIZATIONS
+// No per-function equivalent; CMakeLists.txt compiles the files that use it without fast math (STRICT_MATH_SRCS)
+#define FLOW_HINT_STRICT_MATH
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Compiles one function for a newer instruction set than the rest of the build. Only call it after the matching
+// flow_cpu_supports_* check.
+#define FLOW_HINT_TARGET_AVX __attribute__((target("avx")))
+#define FLOW_HINT_TARGET_AVX2 __attribute__((target("avx2")))
+#define FLOW_HINT_TARGET_SSSE3 __attribute__((target("ssse3")))
+static inline bool flow_cpu_supports_avx(void) { return __builtin_cpu_supports("avx"); }
+static inline bool flow_cpu_supports_avx2(void) { return __builtin_cpu_supports("avx2"); }
+static inline bool flow_cpu_supports_ssse3(void) { return __builtin_cpu_supports("ssse3"); }
+#else
+// Without per-function targets, only what the whole build was compiled for can be used
+#define FLOW_HINT_TARGET_AVX
+#define FLOW_HINT_TARGET_AVX2
+#define FLOW_HINT_TARGET_SSSE3
+static inline bool flow_cpu_supports_avx(void)
+{
+#if defined(__AVX__)
+    return true;
+#else
+    return false;
+#endif
+}
+static inline bool flow_cpu_supports_avx2(void)
+{
+#if defined(__AVX2__)
+    return true;
+#else
+    return false;
+#endif
+}
+static inline bool flow_cpu_supports_ssse3(void)
+{
+#if defined(__SSSE3__) || defined(__AVX__)
+    return true;
+#else
+    return false;
+#endif
+}
 #endif
 
 // floating-point bitmap, typically linear RGBA, premultiplied
@@ -76,6 +121,7 @@ struct flow_heap {
 struct flow_objtracking_info;
 void flow_context_objtracking_initialize(struct flow_objtracking_info * heap_tracking);
 void flow_context_objtracking_terminate(flow_c * c);
+struct flow_heap_object_record * flow_objtracking_get_record_by_ptr(flow_c * context, void * ptr);
 
 /** flow_context: struct flow_error_info **/
 
@@ -146,6 +192,38 @@ struct flow_objtracking_info {
     size_t bytes_allocated_net_peak;
 };
 
+/** flow_context: Bitmap buffer pool **/
+
+// Pixel buffers smaller than this are left to the underlying heap
+#define FLOW_BITMAP_POOL_MIN_BYTES 16384
+#define FLOW_BITMAP_POOL_SLOTS 32
+#define FLOW_BITMAP_POOL_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+// A pixel buffer released by its bitmap, waiting for the next bitmap of the same size class
+struct flow_bitmap_pool_slot {
+    void * buffer;
+    size_t capacity;
+};
+
+// slots[] comes from the underlying heap on first release, so the context struct stays small
+struct flow_bitmap_pool {
+    struct flow_bitmap_pool_slot * slots;
+    size_t slot_count;
+    size_t bytes_pooled;
+    size_t max_bytes_pooled;
+    bool enabled;
+    size_t hits;
+    size_t misses;
+    size_t bytes_reused;
+};
+
+void flow_bitmap_pool_initialize(struct flow_bitmap_pool * pool);
+void flow_bitmap_pool_begin_terminate(flow_c * c);
+void flow_bitmap_pool_end_terminate(flow_c * c);
+size_t flow_bitmap_pool_size_class(size_t byte_count);
+void * flow_bitmap_pool_acquire(flow_c * c, size_t byte_count, bool zeroed, void * owner);
+bool flow_bitmap_pool_release_owned_by(flow_c * c, void * owner);
+
 /** flow_context: main structure **/
 
 struct flow_context {
@@ -154,6 +232,7 @@ struct flow_context {
     struct flow_objtracking_info object_tracking;
     struct flow_profiling_log log;
     struct flow_error_info error;
+    struct flow_bitmap_pool bitmap_pool;
 };
 
 typedef struct flow_context flow_c;
@@ -223,6 +302,89 @@ PUB uint32_t flow_bitmap_float_approx_gaussian_buffer_element_count_required(flo
 PUB bool flow_bitmap_float_approx_gaussian_blur_rows(flow_c * c, struct flow_bitmap_float * image, float sigma,
                                                      float * buffer, size_t buffer_element_count, uint32_t from_row,
                                                      int row_count);
+
+typedef enum flow_transpose_kernel {
+    // The fastest kernel the CPU supports for the pixel format
+    flow_transpose_kernel_auto = 0,
+    flow_transpose_kernel_scalar = 1,
+    // 4x4 blocks; bgr24 requires SSSE3
+    flow_transpose_kernel_sse = 2,
+    // 8x8 blocks, 32-bit formats only
+    flow_transpose_kernel_avx = 3
+} flow_transpose_kernel;
+
+PUB bool flow_transpose_kernel_supported(flow_transpose_kernel kernel, flow_pixel_format fmt);
+
+// Transposes source rows [from_row, from_row + row_count) into the same range of destination columns. Separate
+// row ranges can be transposed concurrently; ranges that start on a multiple of 8 keep the SIMD kernels busiest.
+PUB bool flow_bitmap_bgra_transpose_rows(flow_c * c, struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to,
+                                         uint32_t from_row, uint32_t row_count, flow_transpose_kernel kernel);
+
+PUB uint32_t flow_bitmap_float_approx_gaussian_column_buffer_element_count_required(float sigma,
+                                                                                  uint32_t bitmap_height);
+
+// 4-channel images only
+PUB bool flow_bitmap_float_approx_gaussian_blur_columns(flow_c * c, struct flow_bitmap_float * image, float sigma,
+                                                        float * buffer, size_t buffer_element_count,
+                                                        uint32_t from_col, uint32_t col_count);
+
+typedef enum flow_gaussian_blur_stage {
+    flow_gaussian_blur_stage_rows = 0,
+    flow_gaussian_blur_stage_columns = 1,
+    flow_gaussian_blur_stage_output = 2
+} flow_gaussian_blur_stage;
+
+struct flow_gaussian_blur_job;
+
+// band_count is reduced to what the bitmap's dimensions allow; destroy the job with FLOW_destroy
+PUB struct flow_gaussian_blur_job * flow_gaussian_blur_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                                  float sigma, flow_working_floatspace space,
+                                                                  uint32_t band_count);
+
+// Sharpens by `amount` times each pixel's difference from a gaussian blur of it; runs the same stages as a blur
+PUB struct flow_gaussian_blur_job * flow_unsharp_mask_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                                 float sigma, float amount,
+                                                                 flow_working_floatspace space, uint32_t band_count);
+
+PUB uint32_t flow_gaussian_blur_job_band_count(struct flow_gaussian_blur_job * job);
+
+// Every band of a stage must complete before any band of the next stage runs
+PUB bool flow_gaussian_blur_job_run_band(flow_c * c, struct flow_gaussian_blur_job * job,
+                                         flow_gaussian_blur_stage stage, uint32_t band_index);
+
+struct flow_histogram_job;
+
+// Counts histogram_count histograms of histogram_size_per_channel bins: 1 for luma; 2 for luma, then saturation; or 3
+// for red, green, then blue. Only every sample_step-th pixel of every sample_step-th row is counted. band_count is
+// reduced to the number of sampled rows; destroy the job with FLOW_destroy.
+PUB struct flow_histogram_job * flow_histogram_job_create(flow_c * c, struct flow_bitmap_bgra * bitmap,
+                                                          uint32_t histogram_size_per_channel,
+                                                          uint32_t histogram_count, uint32_t sample_step,
+                                                          uint32_t band_count);
+
+PUB uint32_t flow_histogram_job_band_count(struct flow_histogram_job * job);
+
+// Bands may run concurrently, each exactly once
+PUB bool flow_histogram_job_run_band(flow_c * c, struct flow_histogram_job * job, uint32_t band_index);
+
+// Once every band has run, adds their counts to histograms and sets *pixels_sampled
+PUB bool flow_histogram_job_merge(flow_c * c, struct flow_histogram_job * job, uint64_t * histograms,
+                                  uint64_t * pixels_sampled);
+
+// The largest sample step that keeps each bin's share of the sampled pixels within max_error of its share of the whole
+// w x h frame (at three standard errors)
+PUB uint32_t flow_histogram_sample_step_for_error(uint32_t w, uint32_t h, double max_error);
+
+// Replaces each byte of rows [from_row, from_row + row_count) with its entry in the 256-byte table for its channel.
+// luts holds 4 tables in b, g, r, a order; bgr24 uses the first 3, and bgr32 maps its unused byte like alpha.
+PUB bool flow_bitmap_bgra_apply_channel_luts(flow_c * c, struct flow_bitmap_bgra * bitmap, uint32_t from_row,
+                                             uint32_t row_count, const uint8_t * luts);
+
+PUB bool flow_bitmap_bgra_gaussian_blur(flow_c * c, struct flow_bitmap_bgra * bitmap, float sigma,
+                                        flow_working_floatspace space);
+
+PUB bool flow_bitmap_bgra_unsharp_mask(flow_c * c, struct flow_bitmap_bgra * bitmap, float sigma, float amount,
+                                       flow_working_floatspace space);
 PUB bool flow_bitmap_float_composite_linear_over_srgb(flow_c * c, struct flow_colorcontext_info * colorcontext,
                                                       struct flow_bitmap_float * src, uint32_t from_row,
                                                       struct flow_bitmap_bgra * dest, uint32_t dest_row,
@@ -246,6 +408,16 @@ PUB bool flow_halve(flow_c * c, struct flow_colorcontext_info * colorcontext, co
 PUB bool flow_halve_in_place(flow_c * c, struct flow_colorcontext_info * colorcontext, struct flow_bitmap_bgra * from,
                              int divisor);
 
+// Box-downscales rows [to_row, to_row + row_count) of `to` from divisor x divisor blocks of `from`, averaged in the
+// colorcontext's floatspace. `to` must be a separate bitmap of the same format; separate row ranges can be halved
+// concurrently.
+PUB bool flow_halve_rows(flow_c * c, struct flow_colorcontext_info * colorcontext, const struct flow_bitmap_bgra * from,
+                         struct flow_bitmap_bgra * to, uint32_t to_row, uint32_t row_count, int divisor);
+
+// Per-channel, with a row buffer; the reference the flow_halve kernels are tested and profiled against
+PUB bool flow_halve_slow(flow_c * c, struct flow_colorcontext_info * colorcontext, const struct flow_bitmap_bgra * from,
+                         struct flow_bitmap_bgra * to, int divisor);
+
 PUB void flow_scale_spatial_srgb_7x7(uint8_t input[64], uint8_t ** output_rows, uint32_t output_col);
 
 PUB void flow_scale_spatial_srgb_6x6(uint8_t input[64], uint8_t ** output_rows, uint32_t output_col);
@@ -310,6 +482,11 @@ struct flow_io {
     // wish. useful for resource estimation.
 };
 
+// For memory-backed (including mapped) flow_io instances, exposes the unread bytes so they can be consumed in place.
+// Returns false for any other kind of flow_io. Advance past consumed bytes with read_func(c, io, NULL, count).
+PUB bool flow_io_get_remaining_memory(flow_c * c, struct flow_io * io, const uint8_t ** out_pointer,
+                                      size_t * out_length);
+
 struct flow_codec_instance {
     int32_t io_id;
     int64_t codec_id;
@@ -350,6 +527,9 @@ struct flow_sanity_check {
 
 PUB void flow_sanity_check(struct flow_sanity_check * info);
 
+// Caps the bytes of released pixel buffers kept for reuse by later bitmaps. 0 disables pooling.
+PUB bool flow_context_set_bitmap_pool_limit(flow_c * c, size_t max_bytes_pooled);
+
 #undef PUB
 
 #ifndef _TIMERS_IMPLEMENTED
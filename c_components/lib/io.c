@@ -1,38 +1,155 @@
 #include "imageflow_private.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static struct flow_io * flow_io_try_create_for_mapped_file(flow_c * c, flow_io_mode mode, const char * filename,
+                                                           void * owner);
 
 // struct flow_io * flow_io_create_for_file(flow_context * c, flow_io_mode mode, const char *filename, void * owner);
 
 ////////////////////////////////////////////////////////////////////////
 // flow_io_create_for_output_buffer section
 
+// Output is kept as a list of segments instead of one buffer that is reallocated (and copied) as it grows. Every
+// segment but the last is full. A single, correctly reserved segment is the common case.
 struct flow_io_obuf {
-    uint8_t * buffer;
+    struct flow_io_buffer_segment * segments;
+    size_t segment_count;
+    size_t segments_allocated;
+    size_t last_capacity;
     int64_t cursor;
     size_t uncleared_memory_begins;
-    size_t length;
 };
 
+#define FLOW_IO_OBUF_MIN_SEGMENT 4096
+
+static bool flow_io_obuf_dispose(flow_c * c, void * io)
+{
+    // nada, we're using ownership :)
+    return true;
+}
+
+// Adds an empty segment that can hold at least 'capacity' bytes
+static bool flow_io_obuf_add_segment(flow_c * c, struct flow_io * io, size_t capacity)
+{
+    struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
+    if (state->segment_count == state->segments_allocated) {
+        size_t new_count = state->segments_allocated < 4 ? 4 : state->segments_allocated * 2;
+        size_t bytes = new_count * sizeof(struct flow_io_buffer_segment);
+        struct flow_io_buffer_segment * segments
+            = (struct flow_io_buffer_segment *)(state->segments == NULL ? FLOW_malloc_owned(c, bytes, io)
+                                                                        : FLOW_realloc(c, state->segments, bytes));
+        if (segments == NULL) {
+            FLOW_error(c, flow_status_Out_of_memory);
+            return false;
+        }
+        state->segments = segments;
+        state->segments_allocated = new_count;
+    }
+    if (capacity < FLOW_IO_OBUF_MIN_SEGMENT)
+        capacity = FLOW_IO_OBUF_MIN_SEGMENT;
+    uint8_t * data = (uint8_t *)FLOW_malloc_owned(c, capacity, io);
+    if (data == NULL) {
+        FLOW_error_msg(c, flow_status_Out_of_memory, "Failed to allocate %" PRIu64 " bytes for output buffer",
+                       (uint64_t)capacity);
+        return false;
+    }
+    state->segments[state->segment_count].data = data;
+    state->segments[state->segment_count].length = 0;
+    state->segment_count++;
+    state->last_capacity = capacity;
+    return true;
+}
+
+// Merges all segments into one, for callers that need a contiguous buffer
+static bool flow_io_obuf_coalesce(flow_c * c, struct flow_io * io)
+{
+    struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
+    if (state->segment_count < 2)
+        return true;
+    size_t total = state->uncleared_memory_begins;
+    uint8_t * data = (uint8_t *)FLOW_malloc_owned(c, total, io);
+    if (data == NULL) {
+        FLOW_error_msg(c, flow_status_Out_of_memory, "Failed to allocate %" PRIu64 " bytes for output buffer",
+                       (uint64_t)total);
+        return false;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < state->segment_count; i++) {
+        memcpy(data + offset, state->segments[i].data, state->segments[i].length);
+        offset += state->segments[i].length;
+        FLOW_destroy(c, state->segments[i].data);
+    }
+    state->segments[0].data = data;
+    state->segments[0].length = total;
+    state->segment_count = 1;
+    state->last_capacity = total;
+    return true;
+}
+
 bool flow_io_get_output_buffer(flow_c * c, struct flow_io * io, uint8_t ** out_pointer_to_buffer, size_t * out_length)
 {
     struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
-    *out_pointer_to_buffer = state->buffer;
+    if (!flow_io_obuf_coalesce(c, io)) {
+        FLOW_error_return(c);
+    }
+    *out_pointer_to_buffer = state->segment_count > 0 ? state->segments[0].data : NULL;
     *out_length = state->uncleared_memory_begins;
     return true;
 }
 
+bool flow_io_get_output_buffer_segments(flow_c * c, struct flow_io * io,
+                                        const struct flow_io_buffer_segment ** out_segments, size_t * out_count)
+{
+    struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
+    *out_segments = state->segments;
+    // An empty trailing segment (from reserving) is left out
+    *out_count = state->segment_count;
+    if (*out_count > 0 && state->segments[*out_count - 1].length == 0)
+        (*out_count)--;
+    return true;
+}
+
+bool flow_io_output_buffer_reserve(flow_c * c, struct flow_io * io, size_t byte_count)
+{
+    if (io->dispose_func != flow_io_obuf_dispose) {
+        return true; // Only output buffers can be reserved
+    }
+    struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
+    if (state->segment_count > 0) {
+        struct flow_io_buffer_segment * last = &state->segments[state->segment_count - 1];
+        if (state->last_capacity - last->length >= byte_count)
+            return true;
+        if (last->length == 0) {
+            // Nothing to preserve, so replace it
+            FLOW_destroy(c, last->data);
+            state->segment_count--;
+        }
+    }
+    if (!flow_io_obuf_add_segment(c, io, byte_count)) {
+        FLOW_error_return(c);
+    }
+    return true;
+}
+
 bool flow_io_write_output_buffer_to_file(flow_c * c, struct flow_io * io, const char * file_path)
 {
     struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
     FILE * fh = fopen(file_path, "wb");
     if (fh != NULL) {
-        int64_t expected_items_written = state->uncleared_memory_begins;
-        int64_t items_written = fwrite(state->buffer, 1, expected_items_written, fh);
-        if (items_written != expected_items_written) {
-            FLOW_error_msg(c, flow_status_IO_error,
-                           "Failed to write buffer to file %s. fwrite returned %i instead of %i. errno=%i", file_path,
-                           items_written, expected_items_written, errno);
-            fclose(fh);
-            return false;
+        for (size_t i = 0; i < state->segment_count; i++) {
+            int64_t expected_items_written = state->segments[i].length;
+            int64_t items_written = fwrite(state->segments[i].data, 1, expected_items_written, fh);
+            if (items_written != expected_items_written) {
+                FLOW_error_msg(c, flow_status_IO_error,
+                               "Failed to write buffer to file %s. fwrite returned %i instead of %i. errno=%i",
+                               file_path, items_written, expected_items_written, errno);
+                fclose(fh);
+                return false;
+            }
         }
     } else {
         FLOW_error_msg(c, flow_status_IO_error, "Failed to open file %s for binary writing", file_path);
@@ -44,11 +161,6 @@ bool flow_io_write_output_buffer_to_file(flow_c * c, struct flow_io * io, const
     }
     return true;
 }
-static bool flow_io_obuf_dispose(flow_c * c, void * io)
-{
-    // nada, we're using ownership :)
-    return true;
-}
 static bool flow_io_obuf_seek(flow_c * c, struct flow_io * io, int64_t position)
 {
     struct flow_io_obuf * state = (struct flow_io_obuf *)io->user_data;
@@ -57,7 +169,7 @@ static bool flow_io_obuf_seek(flow_c * c, struct flow_io * io, int64_t position)
                        "Codec tried to seek to position %" PRId64 " - valid values are between 0 and "
                        "%" PRId64 " inclusive (You cannot seek past the written area of an output "
                        "buffer).",
-                       position, state->length);
+                       position, state->uncleared_memory_begins);
         return false;
     }
     state->cursor = position;
@@ -67,6 +179,21 @@ static int64_t flow_io_obuf_position(flow_c * c, struct flow_io * io)
 {
     return ((struct flow_io_obuf *)io->user_data)->cursor;
 }
+
+// Finds the segment holding 'position', and the offset within it. Returns false at or past the end of written data.
+static bool flow_io_obuf_locate(struct flow_io_obuf * state, size_t position, size_t * out_index, size_t * out_offset)
+{
+    for (size_t i = 0; i < state->segment_count; i++) {
+        if (position < state->segments[i].length) {
+            *out_index = i;
+            *out_offset = position;
+            return true;
+        }
+        position -= state->segments[i].length;
+    }
+    return false;
+}
+
 // Returns the number of bytes read into the buffer. Failure to read 'count' bytes could mean EOF or failure. Check
 // context status. Pass NULL to buffer if you want to skip 'count' many bytes, seeking ahead.
 static int64_t flow_io_obuf_read(flow_c * c, struct flow_io * io, uint8_t * buffer, size_t count)
@@ -85,9 +212,15 @@ static int64_t flow_io_obuf_read(flow_c * c, struct flow_io * io, uint8_t * buff
         }
         return allowed_count;
     } else {
-        if (allowed_count > 0) {
-            memcpy(buffer, &state->buffer[state->cursor], allowed_count);
-            state->cursor += allowed_count;
+        size_t remaining = (size_t)allowed_count;
+        size_t index;
+        size_t offset;
+        while (remaining > 0 && flow_io_obuf_locate(state, (size_t)state->cursor, &index, &offset)) {
+            size_t chunk = umin64(remaining, state->segments[index].length - offset);
+            memcpy(buffer, state->segments[index].data + offset, chunk);
+            buffer += chunk;
+            remaining -= chunk;
+            state->cursor += chunk;
         }
         return allowed_count;
     }
@@ -100,32 +233,39 @@ static int64_t flow_io_obuf_write(flow_c * c, struct flow_io * io, const uint8_t
         FLOW_error_msg(c, flow_status_Null_argument, "Buffer pointer was null");
         return 0;
     }
-    if (state->length - state->cursor < count) {
-        // We need to expand the buffer at least enough to accomodate this write
-        size_t new_size = state->cursor + count;
-        // Increase the buffer size by a minimum of 50% each time
-        if (new_size < (state->length * 3 / 2))
-            new_size = state->length * 3 / 2 + 1;
-        // And always a minimum of 4kb
-        if (new_size < 4096)
-            new_size = 4096;
-
-        // Normally this would be a memory leak on failure, but our objtracker will dispose of the old buffer if
-        // non-null
-        state->buffer = (uint8_t *)FLOW_realloc(c, state->buffer, new_size);
-
-        if (state->buffer == NULL) {
-            FLOW_error_msg(c, flow_status_Out_of_memory, "Failed to allocate %" PRIu64 " bytes for output buffer",
-                           new_size);
-            return 0;
-        } else {
-            state->length = new_size;
-        }
+    size_t remaining = count;
+    size_t index;
+    size_t offset;
+    // Overwrite anything already written after the cursor
+    while (remaining > 0 && flow_io_obuf_locate(state, (size_t)state->cursor, &index, &offset)) {
+        size_t chunk = umin64(remaining, state->segments[index].length - offset);
+        memcpy(state->segments[index].data + offset, buffer, chunk);
+        buffer += chunk;
+        remaining -= chunk;
+        state->cursor += chunk;
     }
-    memcpy(&state->buffer[state->cursor], buffer, count);
-    state->cursor += count;
-    if (state->uncleared_memory_begins < (size_t)state->cursor) {
-        state->uncleared_memory_begins = state->cursor;
+    // Then append, adding a segment whenever the last one fills up
+    while (remaining > 0) {
+        struct flow_io_buffer_segment * last
+            = state->segment_count > 0 ? &state->segments[state->segment_count - 1] : NULL;
+        if (last == NULL || last->length == state->last_capacity) {
+            // Grow by at least 50% of what we have so far
+            size_t capacity = remaining;
+            if (capacity < state->uncleared_memory_begins / 2)
+                capacity = state->uncleared_memory_begins / 2;
+            if (!flow_io_obuf_add_segment(c, io, capacity)) {
+                FLOW_add_to_callstack(c);
+                return count - remaining;
+            }
+            continue;
+        }
+        size_t chunk = umin64(remaining, state->last_capacity - last->length);
+        memcpy(last->data + last->length, buffer, chunk);
+        last->length += chunk;
+        buffer += chunk;
+        remaining -= chunk;
+        state->cursor += chunk;
+        state->uncleared_memory_begins += chunk;
     }
     io->optional_file_length = state->uncleared_memory_begins;
     return count;
@@ -138,7 +278,7 @@ struct flow_io * flow_io_create_for_output_buffer(flow_c * c, void * owner)
         FLOW_error(c, flow_status_Out_of_memory);
         return NULL;
     }
-    io->user_data = FLOW_malloc_owned(c, sizeof(struct flow_io_obuf), io);
+    io->user_data = FLOW_calloc_owned(c, 1, sizeof(struct flow_io_obuf), io);
     if (io->user_data == NULL) {
         FLOW_error(c, flow_status_Out_of_memory);
         FLOW_destroy(c, io);
@@ -152,12 +292,7 @@ struct flow_io * flow_io_create_for_output_buffer(flow_c * c, void * owner)
     io->seek_function = flow_io_obuf_seek;
     io->position_func = flow_io_obuf_position;
     io->mode = flow_io_mode_read_write_seekable;
-
-    struct flow_io_obuf * info = (struct flow_io_obuf *)io->user_data;
-    info->buffer = NULL;
-    info->length = 0;
-    info->uncleared_memory_begins = 0;
-    info->cursor = 0;
+    io->optional_file_length = 0;
     return io;
 }
 
@@ -451,6 +586,13 @@ static bool flow_io_filename_dispose(flow_c * c, void * io)
 
 struct flow_io * flow_io_create_for_file(flow_c * c, flow_io_mode mode, const char * filename, void * owner)
 {
+    // Read-only files are mapped, so decoders can read them in place; fall back to stdio if that fails
+    if (mode == flow_io_mode_read_sequential || mode == flow_io_mode_read_seekable) {
+        struct flow_io * mapped = flow_io_try_create_for_mapped_file(c, mode, filename, owner);
+        if (mapped != NULL || flow_context_has_error(c)) {
+            return mapped;
+        }
+    }
     struct flow_io * io = (struct flow_io *)FLOW_malloc_owned(c, sizeof(struct flow_io), owner);
     if (io == NULL) {
         FLOW_error(c, flow_status_Out_of_memory);
@@ -496,3 +638,147 @@ struct flow_io * flow_io_create_for_file(flow_c * c, flow_io_mode mode, const ch
     }
     return io;
 }
+
+////////////////////////////////////////////////////////////////////////
+// flow_io_create_for_mapped_file section
+
+// Reads are served by the flow_io_memory functions, so the memory struct must come first
+struct flow_io_mapped {
+    struct flow_io_memory mem;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
+
+static bool flow_io_mapped_dispose(flow_c * c, void * io)
+{
+    struct flow_io_mapped * state = (struct flow_io_mapped *)((struct flow_io *)io)->user_data;
+    if (state == NULL)
+        return false;
+    bool success = true;
+    if (state->mem.memory != NULL) {
+#ifdef _WIN32
+        success = UnmapViewOfFile(state->mem.memory) && CloseHandle(state->mapping);
+#else
+        success = munmap(state->mem.memory, state->mem.length) == 0;
+#endif
+        if (!success) {
+            FLOW_error_msg(c, flow_status_IO_error, "Failed to unmap %" PRIu64 " byte file, errno=%d",
+                           (uint64_t)state->mem.length, errno);
+        }
+        state->mem.memory = NULL;
+        state->mem.length = 0;
+        state->mem.cursor = 0;
+    }
+    return success;
+}
+
+// Maps the whole file read-only. Returns false (without raising an error) if the file can't be mapped; empty files
+// can't be.
+static bool flow_io_map_file(const char * filename, struct flow_io_mapped * state)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                              NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+    // The mapping keeps the file open
+    state->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (state->mapping == NULL)
+        return false;
+    state->mem.memory = (uint8_t *)MapViewOfFile(state->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (state->mem.memory == NULL) {
+        CloseHandle(state->mapping);
+        return false;
+    }
+    state->mem.length = (size_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0
+        || (uint64_t)info.st_size > SIZE_MAX) {
+        close(fd);
+        return false;
+    }
+    // The mapping keeps its own reference to the file
+    void * memory = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+    // Decoders read front to back; ask for aggressive read-ahead. Only a hint, so failure doesn't matter.
+    (void)madvise(memory, (size_t)info.st_size, MADV_SEQUENTIAL);
+    state->mem.memory = (uint8_t *)memory;
+    state->mem.length = (size_t)info.st_size;
+#endif
+    state->mem.cursor = 0;
+    state->mem.free = NULL;
+    return true;
+}
+
+static struct flow_io * flow_io_try_create_for_mapped_file(flow_c * c, flow_io_mode mode, const char * filename,
+                                                           void * owner)
+{
+    struct flow_io * io = (struct flow_io *)FLOW_malloc_owned(c, sizeof(struct flow_io), owner);
+    if (io == NULL) {
+        FLOW_error(c, flow_status_Out_of_memory);
+        return NULL;
+    }
+    io->user_data = FLOW_calloc_owned(c, 1, sizeof(struct flow_io_mapped), io);
+    if (io->user_data == NULL) {
+        FLOW_error(c, flow_status_Out_of_memory);
+        FLOW_destroy(c, io);
+        return NULL;
+    }
+    struct flow_io_mapped * state = (struct flow_io_mapped *)io->user_data;
+    if (!flow_io_map_file(filename, state)) {
+        FLOW_destroy(c, io);
+        return NULL;
+    }
+    if (!flow_set_destructor(c, io, flow_io_mapped_dispose)) {
+        flow_io_mapped_dispose(c, io);
+        FLOW_destroy(c, io);
+        return NULL;
+    }
+
+    io->context = c;
+    io->dispose_func = flow_io_mapped_dispose;
+    io->write_func = NULL;
+    io->read_func = flow_io_memory_read;
+    io->seek_function = flow_io_memory_seek;
+    io->position_func = flow_io_memory_position;
+    io->mode = mode;
+    io->optional_file_length = (int64_t)state->mem.length;
+    return io;
+}
+
+struct flow_io * flow_io_create_for_mapped_file(flow_c * c, const char * filename, void * owner)
+{
+    struct flow_io * io = flow_io_try_create_for_mapped_file(c, flow_io_mode_read_seekable, filename, owner);
+    if (io == NULL && !flow_context_has_error(c)) {
+        FLOW_error_msg(c, flow_status_IO_error, "Failed to map file %s (it may be missing or empty), errno=%d",
+                       filename, errno);
+    }
+    return io;
+}
+
+bool flow_io_get_remaining_memory(flow_c * c, struct flow_io * io, const uint8_t ** out_pointer, size_t * out_length)
+{
+    if (io->read_func != flow_io_memory_read) {
+        return false;
+    }
+    struct flow_io_memory * state = (struct flow_io_memory *)io->user_data;
+    if (state->memory == NULL || state->cursor < 0 || (size_t)state->cursor > state->length) {
+        return false;
+    }
+    *out_pointer = state->memory + state->cursor;
+    *out_length = state->length - (size_t)state->cursor;
+    return true;
+}
@@ -164,8 +164,10 @@ This halves in sRGB space instead of linear. Not significantly faster on modern
     if (divisor == 2) {
         if (to_count % 2 == 0) {
             for (to_b = 0, from_b = 0; to_b < to_bytes; to_b += 2 * step, from_b += 4 * step) {
-                for (int i = 0; i < 2 * step; i++) {
+                for (int i = 0; i < step; i++) {
                     to[to_b + i] += TO_HALVING_TYPE(from[from_b + i]) + TO_HALVING_TYPE(from[from_b + i + step]);
+                    to[to_b + i + step] += TO_HALVING_TYPE(from[from_b + i + 2 * step])
+                                           + TO_HALVING_TYPE(from[from_b + i + 3 * step]);
                 }
             }
         } else {
@@ -310,8 +312,10 @@ static inline void HALVE_ROW_NAME(flow_c * context, const unsigned char * from,
     if (divisor == 2) {
         if (to_count % 2 == 0) {
             for (to_b = 0, from_b = 0; to_b < to_bytes; to_b += 2 * step, from_b += 4 * step) {
-                for (int i = 0; i < 2 * step; i++) {
+                for (int i = 0; i < step; i++) {
                     to[to_b + i] += TO_HALVING_TYPE(from[from_b + i]) + TO_HALVING_TYPE(from[from_b + i + step]);
+                    to[to_b + i + step] += TO_HALVING_TYPE(from[from_b + i + 2 * step])
+                                           + TO_HALVING_TYPE(from[from_b + i + 3 * step]);
                 }
             }
         } else {
@@ -409,8 +413,8 @@ static bool HALVE_INTERNAL_NAME(flow_c * context, const struct flow_bitmap_bgra
 
 //** Do not edit the above two functions; they are copy/pasted. **//
 
-bool flow_halve(flow_c * context, struct flow_colorcontext_info * colorcontext, const struct flow_bitmap_bgra * from,
-                struct flow_bitmap_bgra * to, int divisor)
+bool flow_halve_slow(flow_c * context, struct flow_colorcontext_info * colorcontext,
+                     const struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to, int divisor)
 {
 
     bool r = false;
@@ -425,23 +429,239 @@ bool flow_halve(flow_c * context, struct flow_colorcontext_info * colorcontext,
     return r;
 }
 
+// The kernels below compute what the functions above do, but a whole divisor x divisor block at a time: each source
+// byte goes through the byte_to_float table once and is summed in registers, with no row buffer to add into.
+// Sums are taken row by row, in the same order as above.
+
+// Any divisor, 3 or 4 bytes per pixel; output pixels [from_x, to_w)
+static void halve_row_scalar(struct flow_colorcontext_info * colorcontext, const uint8_t * from, size_t from_stride,
+                             uint8_t * to, uint32_t from_x, uint32_t to_w, uint32_t bytes_pp, uint32_t divisor)
+{
+    const bool as_is = colorcontext->floatspace == flow_working_floatspace_as_is;
+    const uint32_t area = divisor * divisor;
+    for (uint32_t x = from_x; x < to_w; x++) {
+        const uint8_t * block = from + (size_t)x * divisor * bytes_pp;
+        for (uint32_t ch = 0; ch < bytes_pp; ch++) {
+            if (as_is) {
+                uint32_t sum = 0;
+                for (uint32_t r = 0; r < divisor; r++) {
+                    for (uint32_t k = 0; k < divisor; k++) {
+                        sum += block[r * from_stride + k * bytes_pp + ch];
+                    }
+                }
+                to[x * bytes_pp + ch] = (uint8_t)(sum / area);
+            } else {
+                float sum = 0;
+                for (uint32_t r = 0; r < divisor; r++) {
+                    const uint8_t * p = block + r * from_stride + ch;
+                    float row = colorcontext->byte_to_float[p[0]];
+                    for (uint32_t k = 1; k < divisor; k++) {
+                        row += colorcontext->byte_to_float[p[k * bytes_pp]];
+                    }
+                    sum += row;
+                }
+                to[x * bytes_pp + ch] = flow_colorcontext_floatspace_to_srgb(colorcontext, sum / area);
+            }
+        }
+    }
+}
+
+// Divisors 2, 3 and 4 of 4-byte pixels, averaged as bytes in 16-bit lanes (4 x 4 x 255 fits). Returns how many
+// output pixels were written; the rest need halve_row_scalar.
+static uint32_t halve_row_bgra_as_is_SSE2(const uint8_t * from, size_t from_stride, uint32_t from_w, uint8_t * to,
+                                          uint32_t to_w, uint32_t divisor)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+    if (divisor == 2) {
+        // Four output pixels from eight source pixels per row
+        for (; x + 4 <= to_w && (x + 4) * 2 <= from_w; x += 4) {
+            __m128i pairs[4] = { zero, zero, zero, zero };
+            for (uint32_t r = 0; r < 2; r++) {
+                const uint8_t * p = from + r * from_stride + x * 8;
+                const __m128i a = _mm_loadu_si128((const __m128i *)p);
+                const __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+                pairs[0] = _mm_add_epi16(pairs[0], _mm_unpacklo_epi8(a, zero));
+                pairs[1] = _mm_add_epi16(pairs[1], _mm_unpackhi_epi8(a, zero));
+                pairs[2] = _mm_add_epi16(pairs[2], _mm_unpacklo_epi8(b, zero));
+                pairs[3] = _mm_add_epi16(pairs[3], _mm_unpackhi_epi8(b, zero));
+            }
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(pairs[0], pairs[1]), _mm_unpackhi_epi64(pairs[0], pairs[1]));
+            __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(pairs[2], pairs[3]), _mm_unpackhi_epi64(pairs[2], pairs[3]));
+            _mm_storeu_si128((__m128i *)(to + x * 4),
+                             _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+        }
+        return x;
+    }
+    // One 16-byte load per output pixel per row. With a divisor of 3 it takes a pixel too many, which is masked off,
+    // so stop while that pixel is still inside the row.
+    const __m128i keep_high = divisor == 3 ? _mm_set_epi32(0, 0, -1, -1) : _mm_set1_epi32(-1);
+    for (; x + 4 <= to_w && (x + 3) * divisor + 4 <= from_w; x += 4) {
+        __m128i sums[4];
+        for (uint32_t k = 0; k < 4; k++) {
+            __m128i lo = zero;
+            __m128i hi = zero;
+            for (uint32_t r = 0; r < divisor; r++) {
+                const __m128i v = _mm_loadu_si128((const __m128i *)(from + r * from_stride + (x + k) * divisor * 4));
+                lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+                hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+            }
+            sums[k] = _mm_add_epi16(lo, _mm_and_si128(hi, keep_high));
+        }
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(sums[0], sums[1]), _mm_unpackhi_epi64(sums[0], sums[1]));
+        __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(sums[2], sums[3]), _mm_unpackhi_epi64(sums[2], sums[3]));
+        if (divisor == 4) {
+            lo = _mm_srli_epi16(lo, 4);
+            hi = _mm_srli_epi16(hi, 4);
+        } else {
+            // Exactly sum / 9 for every sum up to 9 x 255
+            lo = _mm_mulhi_epu16(lo, _mm_set1_epi16(7282));
+            hi = _mm_mulhi_epu16(hi, _mm_set1_epi16(7282));
+        }
+        _mm_storeu_si128((__m128i *)(to + x * 4), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+#ifdef __SSE2__
+// uchar_clamp_ff(linear_to_srgb(v)) for 4 values, as 32-bit lanes
+static inline __m128i linear_to_srgb_bytes_SSE2(__m128 linear)
+{
+    const __m128 low = _mm_mul_ps(linear, _mm_set1_ps(12.92f * 255.0f));
+    const __m128 high = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(1.055f * 255.0f), vfastpow(linear, v4sfl(0.41666666f))),
+                                   _mm_set1_ps(14.025f));
+    const __m128 is_low = _mm_cmple_ps(linear, _mm_set1_ps(0.0031308f));
+    const __m128 srgb = _mm_or_ps(_mm_and_ps(is_low, low), _mm_andnot_ps(is_low, high));
+    return _mm_cvttps_epi32(_mm_add_ps(srgb, _mm_set1_ps(0.5f)));
+}
+#endif
+
+// Any divisor of 4-byte pixels, averaged as 4-channel floats. Inlined for each constant divisor, so that the block loops
+// unroll.
+static inline uint32_t halve_row_bgra_floats_SSE2(struct flow_colorcontext_info * colorcontext, const uint8_t * from,
+                                           size_t from_stride, uint8_t * to, uint32_t to_w, uint32_t divisor)
+{
+    const float * lut = colorcontext->byte_to_float;
+    const __m128 area = _mm_set1_ps((float)(divisor * divisor));
+#if defined(__SSE2__) && !defined(EXPOSE_SIGMOID)
+    const bool encode_srgb = colorcontext->apply_srgb && !colorcontext->apply_gamma;
+#endif
+    for (uint32_t x = 0; x < to_w; x++) {
+        const uint8_t * block = from + (size_t)x * divisor * 4;
+        __m128 sum = _mm_setzero_ps();
+        for (uint32_t r = 0; r < divisor; r++) {
+            const uint8_t * p = block + r * from_stride;
+            __m128 row = _mm_setr_ps(lut[p[0]], lut[p[1]], lut[p[2]], lut[p[3]]);
+            for (uint32_t k = 1; k < divisor; k++) {
+                p += 4;
+                row = _mm_add_ps(row, _mm_setr_ps(lut[p[0]], lut[p[1]], lut[p[2]], lut[p[3]]));
+            }
+            sum = _mm_add_ps(sum, row);
+        }
+        sum = _mm_div_ps(sum, area);
+#if defined(__SSE2__) && !defined(EXPOSE_SIGMOID)
+        if (encode_srgb) {
+            __m128i bytes = linear_to_srgb_bytes_SSE2(sum);
+            bytes = _mm_packs_epi32(bytes, bytes);
+            const int32_t pixel = _mm_cvtsi128_si32(_mm_packus_epi16(bytes, bytes));
+            memcpy(to + x * 4, &pixel, 4);
+            continue;
+        }
+#endif
+        float channels[4];
+        _mm_storeu_ps(channels, sum);
+        for (uint32_t ch = 0; ch < 4; ch++) {
+            to[x * 4 + ch] = flow_colorcontext_floatspace_to_srgb(colorcontext, channels[ch]);
+        }
+    }
+    return to_w;
+}
+
+static uint32_t halve_row_bgra_floats(struct flow_colorcontext_info * colorcontext, const uint8_t * from,
+                                      size_t from_stride, uint8_t * to, uint32_t to_w, uint32_t divisor)
+{
+    switch (divisor) {
+        case 2:
+            return halve_row_bgra_floats_SSE2(colorcontext, from, from_stride, to, to_w, 2);
+        case 3:
+            return halve_row_bgra_floats_SSE2(colorcontext, from, from_stride, to, to_w, 3);
+        case 4:
+            return halve_row_bgra_floats_SSE2(colorcontext, from, from_stride, to, to_w, 4);
+        default:
+            return halve_row_bgra_floats_SSE2(colorcontext, from, from_stride, to, to_w, divisor);
+    }
+}
+
+// Output rows are written in order, and each block is read before its output pixel is stored, so `to_pixels` may be
+// the start of `from`'s own pixels when all rows are halved at once.
+static bool halve_rows(flow_c * context, struct flow_colorcontext_info * colorcontext,
+                       const struct flow_bitmap_bgra * from, uint8_t * to_pixels, uint32_t to_stride, uint32_t to_w,
+                       uint32_t to_row, uint32_t row_count, int divisor)
+{
+    const uint32_t bytes_pp = flow_pixel_format_bytes_per_pixel(from->fmt);
+    if (bytes_pp != 3 && bytes_pp != 4) {
+        FLOW_error(context, flow_status_Unsupported_pixel_format);
+        return false;
+    }
+    if (divisor < 2 || (uint64_t)to_w * divisor > from->w || ((uint64_t)to_row + row_count) * divisor > from->h) {
+        FLOW_error_msg(context, flow_status_Invalid_argument,
+                       "Cannot halve rows %u..%u of width %u by %d from a %ux%u bitmap", to_row, to_row + row_count,
+                       to_w, divisor, from->w, from->h);
+        return false;
+    }
+    const uint32_t d = (uint32_t)divisor;
+    const bool as_is = colorcontext->floatspace == flow_working_floatspace_as_is;
+    for (uint32_t y = to_row; y < to_row + row_count; y++) {
+        const uint8_t * source = from->pixels + (size_t)y * d * from->stride;
+        uint8_t * dest = to_pixels + (size_t)y * to_stride;
+        uint32_t done = 0;
+        if (bytes_pp == 4) {
+            done = as_is ? (d <= 4 ? halve_row_bgra_as_is_SSE2(source, from->stride, from->w, dest, to_w, d) : 0)
+                         : halve_row_bgra_floats(colorcontext, source, from->stride, dest, to_w, d);
+        }
+        halve_row_scalar(colorcontext, source, from->stride, dest, done, to_w, bytes_pp, d);
+    }
+    return true;
+}
+
+bool flow_halve_rows(flow_c * context, struct flow_colorcontext_info * colorcontext,
+                     const struct flow_bitmap_bgra * from, struct flow_bitmap_bgra * to, uint32_t to_row,
+                     uint32_t row_count, int divisor)
+{
+    if (from->fmt != to->fmt || from->pixels == to->pixels || (uint64_t)to_row + row_count > to->h) {
+        FLOW_error(context, flow_status_Invalid_argument);
+        return false;
+    }
+    if (!halve_rows(context, colorcontext, from, to->pixels, to->stride, to->w, to_row, row_count, divisor)) {
+        FLOW_error_return(context);
+    }
+    return true;
+}
+
+bool flow_halve(flow_c * context, struct flow_colorcontext_info * colorcontext, const struct flow_bitmap_bgra * from,
+                struct flow_bitmap_bgra * to, int divisor)
+{
+    if (!flow_halve_rows(context, colorcontext, from, to, 0, to->h, divisor)) {
+        FLOW_error_return(context);
+    }
+    return true;
+}
+
 bool flow_halve_in_place(flow_c * context, struct flow_colorcontext_info * colorcontext, struct flow_bitmap_bgra * from,
                          int divisor)
 {
-    int to_w = from->w / divisor;
-    int to_h = from->h / divisor;
-    int to_stride = to_w * flow_pixel_format_bytes_per_pixel(from->fmt);
-    bool r = false;
-    if (colorcontext->floatspace == flow_working_floatspace_as_is) {
-        r = HalveInternal(context, from, from, to_w, to_h, to_stride, divisor);
-    } else {
-        r = HalveInternalColorSpaceAware(context, colorcontext, from, from, to_w, to_h, to_stride, divisor);
+    if (divisor < 2) {
+        FLOW_error(context, flow_status_Invalid_argument);
+        return false;
     }
-    if (!r) {
-        FLOW_add_to_callstack(context);
+    uint32_t to_w = from->w / divisor;
+    uint32_t to_h = from->h / divisor;
+    uint32_t to_stride = to_w * flow_pixel_format_bytes_per_pixel(from->fmt);
+    if (!halve_rows(context, colorcontext, from, from->pixels, to_stride, to_w, 0, to_h, divisor)) {
+        FLOW_error_return(context);
     }
     from->w = to_w;
     from->h = to_h;
     from->stride = to_stride;
-    return r;
+    return true;
 }
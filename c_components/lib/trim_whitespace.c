@@ -7,6 +7,7 @@
  */
 
 #include "trim_whitespace.h"
+#include <emmintrin.h>
 
 #ifdef _MSC_VER
 #pragma unmanaged
@@ -137,6 +138,41 @@ struct flow_rect detect_content(flow_c * context, struct flow_bitmap_bgra * b, u
     FLOW_free(context, info.buf);
     return result;
 }
+// The luma of 16 pixels at a time, as fill_buffer computes it: weights summing to 2048, then for bgra32, the product
+// with alpha rounded up. Returns how many pixels were converted; the rest need the scalar loops.
+static uint32_t gray_row_SSE2(const uint8_t * bgra, uint8_t * gray, uint32_t count, bool alpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(233, 1197, 610, 0, 233, 1197, 610, 0);
+    const __m128i round_up = _mm_set_epi32(0, 524287, 0, 524287);
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        __m128i quads[4];
+        for (int q = 0; q < 4; q++) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(bgra + (x + q * 4) * 4));
+            // b * 233 + g * 1197 and r * 610 for each pixel, then added in pairs
+            const __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights));
+            const __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights));
+            __m128i sums = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                         _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+            if (alpha) {
+                // Up to 2040 * 255 * 255, so the products need 64-bit lanes
+                const __m128i a = _mm_srli_epi32(v, 24);
+                const __m128i even = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(sums, a), round_up), 19);
+                const __m128i odd = _mm_srli_epi64(
+                    _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(sums, 32), _mm_srli_epi64(a, 32)), round_up), 19);
+                sums = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+            } else {
+                sums = _mm_srli_epi32(sums, 11);
+            }
+            quads[q] = sums;
+        }
+        const __m128i words = _mm_packs_epi32(quads[0], quads[1]);
+        _mm_storeu_si128((__m128i *)(gray + x), _mm_packus_epi16(words, _mm_packs_epi32(quads[2], quads[3])));
+    }
+    return x;
+}
+
 bool fill_buffer(flow_c * context, struct flow_SearchInfo * __restrict info)
 {
 
@@ -162,7 +198,10 @@ bool fill_buffer(flow_c * context, struct flow_SearchInfo * __restrict info)
     if (effective_format == flow_bgra32) {
         uint32_t buf_ix = 0;
         for (uint32_t y = 0; y < h; y++) {
-            for (uint32_t x = 0; x < w; x++) {
+            const uint32_t done = gray_row_SSE2(bgra, &info->buf[buf_ix], w, true);
+            bgra += 4 * done;
+            buf_ix += done;
+            for (uint32_t x = done; x < w; x++) {
                 // We're rounding up. Should we?
                 uint16_t gray
                     = (uint16_t)(((233 * bgra[0] + 1197 * bgra[1] + 610 * bgra[2]) * bgra[3] + 524288 - 1) / 524288);
@@ -185,7 +224,10 @@ bool fill_buffer(flow_c * context, struct flow_SearchInfo * __restrict info)
     } else if (effective_format == flow_bgr32) {
         uint32_t buf_ix = 0;
         for (uint32_t y = 0; y < h; y++) {
-            for (uint32_t x = 0; x < w; x++) {
+            const uint32_t done = gray_row_SSE2(bgra, &info->buf[buf_ix], w, false);
+            bgra += 4 * done;
+            buf_ix += done;
+            for (uint32_t x = done; x < w; x++) {
                 info->buf[buf_ix] = (233 * bgra[0] + 1197 * bgra[1] + 610 * bgra[2]) / 2048;
                 bgra += 4;
                 buf_ix++;
@@ -216,26 +258,152 @@ bool fill_buffer(flow_c * context, struct flow_SearchInfo * __restrict info)
 //    return (uint32_t)(abs((int)a11 - (int)a22) + abs((int)a12 - (int)a21));
 //}
 
+// Once a pixel's Scharr value passes the threshold, uses differences between its 3x3 neighbours to find the exact
+// pixels the edge lies between, and grows the content bounds to include them
+static void localize_edge(struct flow_SearchInfo * info, const uint8_t * buf, uint32_t buf_ix, uint32_t x, uint32_t y)
+{
+    const uint32_t w = info->buf_w;
+    const uint8_t matrix[] = { buf[buf_ix - w - 1], buf[buf_ix - w], buf[buf_ix - w + 1],
+                               buf[buf_ix - 1],     buf[buf_ix],     buf[buf_ix + 1],
+                               buf[buf_ix + w - 1], buf[buf_ix + w], buf[buf_ix + w + 1] };
+    int thresh = info->threshold; // Maybe it should be smaller?
+
+    uint32_t local_min_x = 2, local_min_y = 2, local_max_x = 1, local_max_y = 1;
+
+    // Check horizontal and vertical differences.
+    for (uint32_t my = 0; my < 3; my++) {
+        bool edge_found = false;
+        if (abs((int)matrix[my * 3] - (int)matrix[my * 3 + 1]) > thresh) {
+            // vertical edge between x = 0,1
+            local_min_x = umin(local_min_x, 1);
+            local_max_x = umax(local_max_x, 1);
+            edge_found = true;
+        }
+        if (abs((int)matrix[my * 3 + 1] - (int)matrix[my * 3 + 2]) > thresh) {
+            // vertical edge between x = 1,2
+            local_min_x = umin(local_min_x, 2);
+            local_max_x = umax(local_max_x, 2);
+            edge_found = true;
+        }
+        if (edge_found) {
+            local_min_y = umin(local_min_y, my);
+            local_max_y = umax(local_max_y, my + 1);
+        }
+    }
+    for (uint32_t mx = 0; mx < 3; mx++) {
+        bool edge_found = false;
+        if (abs((int)matrix[mx] - (int)matrix[mx + 3]) > thresh) {
+            // horizontal edge between y = 0,1
+            local_min_y = umin(local_min_y, 1);
+            local_max_y = umax(local_max_y, 1);
+            edge_found = true;
+        }
+        if (abs((int)matrix[mx + 3] - (int)matrix[mx + 6]) > thresh) {
+            // horizontal edge between y = 1,2
+            local_min_y = umin(local_min_y, 2);
+            local_max_y = umax(local_max_y, 2);
+            edge_found = true;
+        }
+        if (edge_found) {
+            local_min_x = umin(local_min_x, mx);
+            local_max_x = umax(local_max_x, mx + 1);
+        }
+    }
+
+    local_min_x += info->buf_x + x - 1;
+    local_max_x += info->buf_x + x - 1;
+    local_min_y += info->buf_y + y - 1;
+    local_max_y += info->buf_y + y - 1;
+
+    if (local_min_x < info->min_x) {
+        info->min_x = local_min_x;
+    }
+    if (local_max_x > info->max_x) {
+        info->max_x = local_max_x;
+    }
+    if (local_min_y < info->min_y) {
+        info->min_y = local_min_y;
+    }
+    if (local_max_y > info->max_y) {
+        info->max_y = local_max_y;
+    }
+}
+
+static inline __m128i abs_epi16_SSE2(__m128i v) { return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v)); }
+
+// |gx| + |gy| for 8 pixels in 16-bit lanes; up to 2 x 16 x 255, so nothing overflows
+static inline __m128i scharr_SSE2(__m128i a11, __m128i a12, __m128i a13, __m128i a21, __m128i a23, __m128i a31,
+                                  __m128i a32, __m128i a33)
+{
+    const __m128i three = _mm_set1_epi16(3);
+    const __m128i ten = _mm_set1_epi16(10);
+    const __m128i gx = _mm_add_epi16(
+        _mm_mullo_epi16(three, _mm_add_epi16(_mm_sub_epi16(a11, a13), _mm_sub_epi16(a31, a33))),
+        _mm_mullo_epi16(ten, _mm_sub_epi16(a21, a23)));
+    const __m128i gy = _mm_add_epi16(
+        _mm_mullo_epi16(three, _mm_add_epi16(_mm_sub_epi16(a11, a31), _mm_sub_epi16(a13, a33))),
+        _mm_mullo_epi16(ten, _mm_sub_epi16(a12, a32)));
+    return _mm_add_epi16(abs_epi16_SSE2(gx), abs_epi16_SSE2(gy));
+}
+
+// One bit per pixel x..x+15 of row y whose Scharr value passes the threshold
+static inline uint32_t scharr_mask_SSE2(const uint8_t * buf, uint32_t w, uint32_t buf_ix, __m128i threshold)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t * above = buf + buf_ix - w;
+    const uint8_t * row = buf + buf_ix;
+    const uint8_t * below = buf + buf_ix + w;
+    const __m128i v11 = _mm_loadu_si128((const __m128i *)(above - 1));
+    const __m128i v12 = _mm_loadu_si128((const __m128i *)above);
+    const __m128i v13 = _mm_loadu_si128((const __m128i *)(above + 1));
+    const __m128i v21 = _mm_loadu_si128((const __m128i *)(row - 1));
+    const __m128i v23 = _mm_loadu_si128((const __m128i *)(row + 1));
+    const __m128i v31 = _mm_loadu_si128((const __m128i *)(below - 1));
+    const __m128i v32 = _mm_loadu_si128((const __m128i *)below);
+    const __m128i v33 = _mm_loadu_si128((const __m128i *)(below + 1));
+    const __m128i lo = scharr_SSE2(_mm_unpacklo_epi8(v11, zero), _mm_unpacklo_epi8(v12, zero),
+                                   _mm_unpacklo_epi8(v13, zero), _mm_unpacklo_epi8(v21, zero),
+                                   _mm_unpacklo_epi8(v23, zero), _mm_unpacklo_epi8(v31, zero),
+                                   _mm_unpacklo_epi8(v32, zero), _mm_unpacklo_epi8(v33, zero));
+    const __m128i hi = scharr_SSE2(_mm_unpackhi_epi8(v11, zero), _mm_unpackhi_epi8(v12, zero),
+                                   _mm_unpackhi_epi8(v13, zero), _mm_unpackhi_epi8(v21, zero),
+                                   _mm_unpackhi_epi8(v23, zero), _mm_unpackhi_epi8(v31, zero),
+                                   _mm_unpackhi_epi8(v32, zero), _mm_unpackhi_epi8(v33, zero));
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_packs_epi16(_mm_cmpgt_epi16(lo, threshold), _mm_cmpgt_epi16(hi, threshold)));
+}
+
 bool sobel_scharr_detect(flow_c * context, struct flow_SearchInfo * info)
 {
-#define COEFFA = 3
-#define COEFFB = 10;
     const uint32_t w = info->buf_w;
     const uint32_t h = info->buf_h;
     const uint32_t y_end = h - 1;
     const uint32_t x_end = w - 1;
     const uint32_t threshold = info->threshold;
+    // No Scharr value exceeds 2 x 16 x 255
+    if (threshold >= 8160) {
+        return true;
+    }
+    const __m128i threshold_x8 = _mm_set1_epi16((int16_t)threshold);
 
     uint8_t * __restrict buf = info->buf;
-    uint32_t buf_ix = w + 1;
     for (uint32_t y = 1; y < y_end; y++) {
-        for (uint32_t x = 1; x < x_end; x++) {
-
+        uint32_t x = 1;
+        for (; x + 16 <= x_end; x += 16) {
+            // Most of a whitespace search finds nothing, 16 pixels at a time
+            uint32_t mask = scharr_mask_SSE2(buf, w, y * w + x, threshold_x8);
+            for (uint32_t bit = 0; mask != 0; bit++, mask >>= 1) {
+                if (mask & 1) {
+                    localize_edge(info, buf, y * w + x + bit, x + bit, y);
+                }
+            }
+        }
+        for (; x < x_end; x++) {
+            const uint32_t buf_ix = y * w + x;
             const uint8_t a11 = buf[buf_ix - w - 1];
             const uint8_t a12 = buf[buf_ix - w];
             const uint8_t a13 = buf[buf_ix - w + 1];
             const uint8_t a21 = buf[buf_ix - 1];
-            const uint8_t a22 = buf[buf_ix];
             const uint8_t a23 = buf[buf_ix + 1];
             const uint8_t a31 = buf[buf_ix + w - 1];
             const uint8_t a32 = buf[buf_ix + w];
@@ -249,73 +417,32 @@ bool sobel_scharr_detect(flow_c * context, struct flow_SearchInfo * info)
             const uint32_t scharr_value = (uint32_t)abs(gx) + (uint32_t)abs(gy);
 
             if (scharr_value > threshold) {
-                // Now use differences to find the exact pixel
-                int thresh = threshold; // Maybe it should be smaller?
-                const uint8_t matrix[] = { a11, a12, a13, a21, a22, a23, a31, a32, a33 };
-
-                uint32_t local_min_x = 2, local_min_y = 2, local_max_x = 1, local_max_y = 1;
-
-                // Check horizontal and vertical differences.
-                for (uint32_t my = 0; my < 3; my++) {
-                    bool edge_found = false;
-                    if (abs((int)matrix[my * 3] - (int)matrix[my * 3 + 1]) > thresh) {
-                        // vertical edge between x = 0,1
-                        local_min_x = umin(local_min_x, 1);
-                        local_max_x = umax(local_max_x, 1);
-                        edge_found = true;
-                    }
-                    if (abs((int)matrix[my * 3 + 1] - (int)matrix[my * 3 + 2]) > thresh) {
-                        // vertical edge between x = 1,2
-                        local_min_x = umin(local_min_x, 2);
-                        local_max_x = umax(local_max_x, 2);
-                        edge_found = true;
-                    }
-                    if (edge_found) {
-                        local_min_y = umin(local_min_y, my);
-                        local_max_y = umax(local_max_y, my + 1);
-                    }
-                }
-                for (uint32_t mx = 0; mx < 3; mx++) {
-                    bool edge_found = false;
-                    if (abs((int)matrix[mx] - (int)matrix[mx + 3]) > thresh) {
-                        // horizontal edge between y = 0,1
-                        local_min_y = umin(local_min_y, 1);
-                        local_max_y = umax(local_max_y, 1);
-                        edge_found = true;
-                    }
-                    if (abs((int)matrix[mx + 3] - (int)matrix[mx + 6]) > thresh) {
-                        // horizontal edge between y = 1,2
-                        local_min_y = umin(local_min_y, 2);
-                        local_max_y = umax(local_max_y, 2);
-                        edge_found = true;
-                    }
-                    if (edge_found) {
-                        local_min_x = umin(local_min_x, mx);
-                        local_max_x = umax(local_max_x, mx + 1);
-                    }
-                }
-
-                local_min_x += info->buf_x + x - 1;
-                local_max_x += info->buf_x + x - 1;
-                local_min_y += info->buf_y + y - 1;
-                local_max_y += info->buf_y + y - 1;
-
-                if (local_min_x < info->min_x) {
-                    info->min_x = local_min_x;
-                }
-                if (local_max_x > info->max_x) {
-                    info->max_x = local_max_x;
-                }
-                if (local_min_y < info->min_y) {
-                    info->min_y = local_min_y;
-                }
-                if (local_max_y > info->max_y) {
-                    info->max_y = local_max_y;
-                }
+                localize_edge(info, buf, buf_ix, x, y);
             }
-            buf_ix++;
         }
-        buf_ix += 2;
+    }
+    return true;
+}
+
+// True if every pixel in the window is byte-for-byte the same, so no gradient inside it can pass any threshold. Blank
+// margins are skipped this way without converting them to grayscale.
+static bool window_is_uniform(const struct flow_SearchInfo * info)
+{
+    const struct flow_bitmap_bgra * b = info->bitmap;
+    const uint32_t bytes_pp = flow_pixel_format_bytes_per_pixel(b->fmt);
+    if (info->buf_x + info->buf_w > b->w || info->buf_y + info->buf_h > b->h) {
+        return false; // fill_buffer reports it
+    }
+    const size_t row_bytes = (size_t)info->buf_w * bytes_pp;
+    const uint8_t * first = b->pixels + (size_t)info->buf_y * b->stride + (size_t)info->buf_x * bytes_pp;
+    // Each pixel of the first row equals the one before it, and every other row equals the first
+    if (memcmp(first, first + bytes_pp, row_bytes - bytes_pp) != 0) {
+        return false;
+    }
+    for (uint32_t y = 1; y < info->buf_h; y++) {
+        if (memcmp(first + (size_t)y * b->stride, first, row_bytes) != 0) {
+            return false;
+        }
     }
     return true;
 }
@@ -427,6 +554,9 @@ bool check_region(flow_c * context, int edgeTRBL, float x_1_percent, float x_2_p
                 }
             }
 
+            if (window_is_uniform(info)) {
+                continue;
+            }
             if (!fill_buffer(context, info)) {
                 FLOW_add_to_callstack(context);
                 return false;
@@ -1,41 +1,283 @@
 #include <assert.h>
 #include "imageflow_private.h"
+#include "trim_whitespace.h"
 
 #define ERR2(c)                                                                                                        \
     if (has_err(c, __FILE__, __LINE__, __func__)) {                                                                    \
         return 42;                                                                                                     \
     }
 
-static int64_t transpose(int w, int h, flow_pixel_format fmt, int runs)
+// The fastest of `runs` transposes with `kernel`; sets *matches if the output equals flow_bitmap_bgra_transpose_slow's
+static int64_t transpose(int w, int h, flow_pixel_format fmt, flow_transpose_kernel kernel, int runs, bool * matches)
 {
 
     flow_c * c = flow_context_create();
 
     struct flow_bitmap_bgra * a = flow_bitmap_bgra_create(c, w, h, true, fmt);
-    flow_bitmap_bgra_fill_rect(c, a, 0, 0, a->w, a->h, 0xFF0000FF);
-
     struct flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, h, w, true, fmt);
-    int64_t start = flow_get_high_precision_ticks();
+    struct flow_bitmap_bgra * reference = flow_bitmap_bgra_create(c, h, w, true, fmt);
+    if (a == NULL || b == NULL || reference == NULL)
+        exit(77);
+    for (uint32_t y = 0; y < a->h; y++) {
+        for (uint32_t x = 0; x < a->stride; x++) {
+            a->pixels[y * a->stride + x] = (uint8_t)(x * 7 + y * 131);
+        }
+    }
+    if (!flow_bitmap_bgra_transpose_slow(c, a, reference))
+        exit(77);
 
+    int64_t fastest = INT64_MAX;
     for (int i = 0; i < runs; i++) {
-        if (!flow_bitmap_bgra_transpose(c, a, b))
+        int64_t start = flow_get_high_precision_ticks();
+        if (!flow_bitmap_bgra_transpose_rows(c, a, b, 0, a->h, kernel))
             exit(77);
+        int64_t ticks = flow_get_high_precision_ticks() - start;
+        fastest = ticks < fastest ? ticks : fastest;
     }
-    int64_t end = flow_get_high_precision_ticks();
+    if (!flow_bitmap_bgra_compare(c, b, reference, matches))
+        exit(77);
 
     flow_bitmap_bgra_destroy(c, a);
     flow_bitmap_bgra_destroy(c, b);
+    flow_bitmap_bgra_destroy(c, reference);
+    flow_context_destroy(c);
+
+    return fastest;
+}
+
+// Fails if any transpose kernel disagrees with flow_bitmap_bgra_transpose_slow, or if, on a large image, a SIMD kernel
+// is more than 15% slower than the baseline: the SSE kernel for 32-bit formats, the scalar one for bgr24.
+static int transpose_regression_gate(void)
+{
+    const char * kernel_names[] = { "auto", "scalar", "sse", "avx" };
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr24 };
+    const int sizes[][2] = { { 640, 480 }, { 1920, 1080 }, { 3001, 4999 }, { 4000, 3000 } };
+    int failures = 0;
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        const flow_pixel_format fmt = formats[f];
+        const flow_transpose_kernel baseline = fmt == flow_bgr24 ? flow_transpose_kernel_scalar
+                                                                 : flow_transpose_kernel_sse;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            const int w = sizes[s][0];
+            const int h = sizes[s][1];
+            const int runs = 10;
+            bool matches = false;
+            int64_t baseline_ticks = transpose(w, h, fmt, baseline, runs, &matches);
+            for (int k = flow_transpose_kernel_scalar; k <= flow_transpose_kernel_avx; k++) {
+                const flow_transpose_kernel kernel = (flow_transpose_kernel)k;
+                if (!flow_transpose_kernel_supported(kernel, fmt))
+                    continue;
+                int64_t ticks = kernel == baseline ? baseline_ticks : transpose(w, h, fmt, kernel, runs, &matches);
+                const bool gated = kernel != baseline && kernel != flow_transpose_kernel_scalar && w * h >= 1000000;
+                if (gated && ticks > baseline_ticks * 1.15) {
+                    // Measure both again before calling it a regression; one noisy neighbour can cost 2x
+                    bool ignored;
+                    int64_t again = transpose(w, h, fmt, baseline, runs, &ignored);
+                    baseline_ticks = again < baseline_ticks ? again : baseline_ticks;
+                    again = transpose(w, h, fmt, kernel, runs, &ignored);
+                    ticks = again < ticks ? again : ticks;
+                }
+                double ms = ticks * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+                double ratio = (double)ticks / (double)baseline_ticks;
+                bool regressed = gated && ratio > 1.15;
+                fprintf(stdout, "Transposing %dx%d to %dx%d (fmt %d, %s) took %.05fms, %.2fx the baseline%s%s\n", w,
+                        h, h, w, fmt, kernel_names[k], ms, ratio, matches ? "" : " - OUTPUT MISMATCH",
+                        regressed ? " - REGRESSION" : "");
+                if (!matches || regressed)
+                    failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static int64_t approx_gaussian_blur(int w, int h, int channels, float sigma, bool columns, int runs)
+{
+    flow_c * c = flow_context_create();
+
+    struct flow_bitmap_float * image = flow_bitmap_float_create(c, w, h, channels, true);
+    for (uint32_t i = 0; i < image->float_stride * image->h; i++) {
+        image->pixels[i] = (float)(i % 13) / 12.0f;
+    }
+    uint32_t buffer_elements = columns ? flow_bitmap_float_approx_gaussian_column_buffer_element_count_required(sigma, h)
+                                       : flow_bitmap_float_approx_gaussian_buffer_element_count_required(sigma, w);
+    float * buffer = FLOW_calloc_array(c, buffer_elements, float);
+    if (buffer == NULL)
+        exit(77);
+    int64_t start = flow_get_high_precision_ticks();
+
+    for (int i = 0; i < runs; i++) {
+        if (columns) {
+            if (!flow_bitmap_float_approx_gaussian_blur_columns(c, image, sigma, buffer, buffer_elements, 0, w))
+                exit(77);
+        } else if (!flow_bitmap_float_approx_gaussian_blur_rows(c, image, sigma, buffer, buffer_elements, 0, -1)) {
+            exit(77);
+        }
+    }
+    int64_t end = flow_get_high_precision_ticks();
+
+    FLOW_free(c, buffer);
+    flow_bitmap_float_destroy(c, image);
+    flow_context_destroy(c);
 
     return end - start;
 }
+
+// The fastest of `runs` deblocking passes over a bgr32 image, as the jpeg decoder runs after a scaled IDCT
+static int64_t sharpen_block_edges(int w, int h, int block_size, float pct, int runs)
+{
+    flow_c * c = flow_context_create();
+    struct flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, flow_bgr32);
+    if (b == NULL)
+        exit(77);
+    for (uint32_t y = 0; y < b->h; y++) {
+        for (uint32_t x = 0; x < b->stride; x++) {
+            b->pixels[y * b->stride + x] = (uint8_t)(x * 7 + y * 131);
+        }
+    }
+    int64_t fastest = INT64_MAX;
+    for (int i = 0; i < runs; i++) {
+        int64_t start = flow_get_high_precision_ticks();
+        if (!flow_bitmap_bgra_sharpen_block_edges(c, b, block_size, pct))
+            exit(77);
+        int64_t ticks = flow_get_high_precision_ticks() - start;
+        fastest = ticks < fastest ? ticks : fastest;
+    }
+    flow_bitmap_bgra_destroy(c, b);
+    flow_context_destroy(c);
+    return fastest;
+}
+
+// The fastest of `runs` halvings of a bgra32 image by flow_halve, or by flow_halve_slow if `slow`
+static int64_t halve(int w, int h, int divisor, flow_working_floatspace space, bool slow, int runs)
+{
+    flow_c * c = flow_context_create();
+    struct flow_bitmap_bgra * from = flow_bitmap_bgra_create(c, w, h, true, flow_bgra32);
+    struct flow_bitmap_bgra * to = flow_bitmap_bgra_create(c, w / divisor, h / divisor, true, flow_bgra32);
+    if (from == NULL || to == NULL)
+        exit(77);
+    for (uint32_t y = 0; y < from->h; y++) {
+        for (uint32_t x = 0; x < from->stride; x++) {
+            from->pixels[y * from->stride + x] = (uint8_t)(x * 7 + y * 131);
+        }
+    }
+    struct flow_colorcontext_info colorcontext;
+    flow_colorcontext_init(c, &colorcontext, space, 0, 0, 0);
+    int64_t fastest = INT64_MAX;
+    for (int i = 0; i < runs; i++) {
+        int64_t start = flow_get_high_precision_ticks();
+        if (!(slow ? flow_halve_slow : flow_halve)(c, &colorcontext, from, to, divisor))
+            exit(77);
+        int64_t ticks = flow_get_high_precision_ticks() - start;
+        fastest = ticks < fastest ? ticks : fastest;
+    }
+    flow_bitmap_bgra_destroy(c, from);
+    flow_bitmap_bgra_destroy(c, to);
+    flow_context_destroy(c);
+    return fastest;
+}
+
+// The fastest of `runs` content detections on a white w x h image with a dark product (x1, y1, x2, y2), which may be
+// empty. A noisy background varies by up to 2 per channel, as after jpeg compression, and is searched at threshold 80.
+static int64_t detect_product(int w, int h, flow_pixel_format fmt, struct flow_rect product, bool noisy, int runs,
+                              bool * found)
+{
+    flow_c * c = flow_context_create();
+    struct flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, fmt);
+    if (b == NULL)
+        exit(77);
+    if (!flow_bitmap_bgra_fill_rect(c, b, 0, 0, w, h, 0xFFFFFFFF)
+        || (product.x1 < product.x2
+            && !flow_bitmap_bgra_fill_rect(c, b, product.x1, product.y1, product.x2, product.y2, 0xFF203040)))
+        exit(77);
+    const uint32_t bytes_pp = flow_pixel_format_bytes_per_pixel(fmt);
+    for (uint32_t y = 0; noisy && y < b->h; y++) {
+        for (uint32_t x = 0; x < b->w * bytes_pp; x++) {
+            if (x % 4 != 3 || bytes_pp == 3)
+                b->pixels[y * b->stride + x] -= (uint8_t)((x * 7 + y * 13) % 3);
+        }
+    }
+    int64_t fastest = INT64_MAX;
+    struct flow_rect r = { 0, 0, 0, 0 };
+    for (int i = 0; i < runs; i++) {
+        int64_t start = flow_get_high_precision_ticks();
+        r = detect_content(c, b, noisy ? 80 : 1);
+        int64_t ticks = flow_get_high_precision_ticks() - start;
+        fastest = ticks < fastest ? ticks : fastest;
+    }
+    // A blank image is all content
+    if (product.x1 == product.x2)
+        product = (struct flow_rect){ 0, 0, w, h };
+    *found = r.x1 == product.x1 && r.y1 == product.y1 && r.x2 == product.x2 && r.y2 == product.y2;
+    flow_bitmap_bgra_destroy(c, b);
+    flow_context_destroy(c);
+    return fastest;
+}
+
 int main(void)
 {
-    int fmt = 4;
-    for (int w = 1; w < 5000; w += 631)
-        for (int h = 1; h < 5000; h += 631) {
+    // 3-channel images take the scalar box blurs, 4-channel images the vectorized ones
+    const float sigmas[] = { 2.0f, 3.3f, 5.0f, 8.0f, 12.5f, 20.0f, 32.0f, 50.0f };
+    for (int channels = 3; channels <= 4; channels++)
+        for (size_t s = 0; s < sizeof(sigmas) / sizeof(float); s++) {
             int runs = 10;
-            int ticks = transpose(w, h, (flow_pixel_format)fmt, runs);
+            int64_t ticks = approx_gaussian_blur(2048, 512, channels, sigmas[s], false, runs);
             double ms = ticks / runs * 1000.0 / (float)flow_get_profiler_ticks_per_second();
-            fprintf(stdout, "Transposing %dx%d to %dx%d (fmt %d) took %.05fms\n", w, h, h, w, fmt, ms);
+            fprintf(stdout, "Blurring 2048x512 (%d channels) with sigma %.1f took %.05fms\n", channels, sigmas[s], ms);
+        }
+    // The vertical pass, in strips of columns. Widths whose stride is a multiple of 4KiB (like 256 or 512 pixels) run
+    // about twice as slow here; flow_gaussian_blur_job pads its frame to avoid them.
+    for (size_t s = 0; s < sizeof(sigmas) / sizeof(float); s++) {
+        int runs = 10;
+        int64_t ticks = approx_gaussian_blur(520, 2048, 4, sigmas[s], true, runs);
+        double ms = ticks / runs * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+        fprintf(stdout, "Blurring columns of 520x2048 (4 channels) with sigma %.1f took %.05fms\n", sigmas[s], ms);
+    }
+
+    // 12 megapixels decoded at 7/8, 4/8 and 1/8 scale
+    const int scales[] = { 7, 4, 1 };
+    for (size_t s = 0; s < sizeof(scales) / sizeof(int); s++) {
+        const int w = 4000 * scales[s] / 8;
+        const int h = 3000 * scales[s] / 8;
+        int64_t ticks = sharpen_block_edges(w, h, scales[s], -14.0f, 10);
+        double ms = ticks * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+        fprintf(stdout, "Deblocking %dx%d with %dx%d blocks took %.05fms\n", w, h, scales[s], scales[s], ms);
+    }
+
+    // 24 megapixels, averaged as bytes and in linear light
+    const flow_working_floatspace spaces[] = { flow_working_floatspace_as_is, flow_working_floatspace_linear };
+    for (int divisor = 2; divisor <= 4; divisor++) {
+        for (size_t s = 0; s < sizeof(spaces) / sizeof(spaces[0]); s++) {
+            int64_t slow_ticks = halve(6000, 4000, divisor, spaces[s], true, 5);
+            int64_t ticks = halve(6000, 4000, divisor, spaces[s], false, 5);
+            double ms = ticks * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+            double slow_ms = slow_ticks * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+            fprintf(stdout, "Halving 6000x4000 by %d (%s) took %.05fms (%.05fms with flow_halve_slow)\n", divisor,
+                    spaces[s] == flow_working_floatspace_as_is ? "as is" : "linear", ms, slow_ms);
+        }
+    }
+
+    // Product photos: centered, small and off-center, and a blank upload, which is scanned in full
+    const struct flow_rect products[] = {
+        { 1000, 1000, 3000, 3000 }, { 2500, 600, 2900, 1300 }, { 0, 0, 0, 0 },
+    };
+    const flow_pixel_format detect_formats[] = { flow_bgra32, flow_bgr32, flow_bgr24 };
+    for (size_t f = 0; f < sizeof(detect_formats) / sizeof(detect_formats[0]); f++) {
+        for (size_t p = 0; p < sizeof(products) / sizeof(products[0]); p++) {
+            for (int noisy = 0; noisy <= 1; noisy++) {
+                bool found = false;
+                int64_t ticks = detect_product(4000, 4000, detect_formats[f], products[p], noisy, 5, &found);
+                double ms = ticks * 1000.0 / (float)flow_get_profiler_ticks_per_second();
+                fprintf(stdout, "Detecting content (%d,%d,%d,%d) in %s4000x4000 (fmt %d) took %.05fms%s\n",
+                        products[p].x1, products[p].y1, products[p].x2, products[p].y2, noisy ? "noisy " : "",
+                        detect_formats[f], ms, found ? "" : " - WRONG RECT");
+            }
         }
+    }
+
+    if (transpose_regression_gate() > 0) {
+        fprintf(stderr, "Transpose regression gate failed\n");
+        return 1;
+    }
+    return 0;
 }
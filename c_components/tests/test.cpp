@@ -128,6 +128,230 @@ TEST_CASE("Test guassian blur approximation.", "[fastscaling]")
     REQUIRE(flow_context_begin_terminate(&context) == true);
     flow_context_end_terminate(&context);
 }
+
+TEST_CASE("Test 4-channel gaussian blur approximation matches the 3-channel path exactly", "[fastscaling]")
+{
+    flow_c context;
+    flow_context_initialize(&context);
+
+    // 3-channel images use the scalar box blurs, 4-channel images the vectorized multi-row ones
+    const uint32_t widths[] = { 7, 64, 301 };
+    const float sigmas[] = { 2.0f, 2.7f, 3.3f, 7.5f, 16.0f, 50.0f };
+    const uint32_t h = 7; // Not a multiple of the rows blurred at once
+    for (uint32_t w : widths) {
+        for (float sigma : sigmas) {
+            struct flow_bitmap_float * bgra = flow_bitmap_float_create(&context, w, h, 4, true);
+            struct flow_bitmap_float * bgr = flow_bitmap_float_create(&context, w, h, 3, true);
+            REQUIRE(bgra != NULL);
+            REQUIRE(bgr != NULL);
+            for (uint32_t y = 0; y < h; y++) {
+                for (uint32_t x = 0; x < w; x++) {
+                    for (uint32_t ch = 0; ch < 4; ch++) {
+                        float v = (float)((x * 7 + y * 13 + ch * 5) % 17) / 16.0f;
+                        bgra->pixels[y * bgra->float_stride + x * 4 + ch] = v;
+                        if (ch < 3)
+                            bgr->pixels[y * bgr->float_stride + x * 3 + ch] = v;
+                    }
+                }
+            }
+            uint32_t buffer_elements = flow_bitmap_float_approx_gaussian_buffer_element_count_required(sigma, w);
+            float * buffer = FLOW_calloc_array(&context, buffer_elements, float);
+            REQUIRE(buffer != NULL);
+
+            REQUIRE(flow_bitmap_float_approx_gaussian_blur_rows(&context, bgra, sigma, buffer, buffer_elements, 0, -1));
+            REQUIRE(flow_bitmap_float_approx_gaussian_blur_rows(&context, bgr, sigma, buffer, buffer_elements, 0, -1));
+
+            uint32_t mismatches = 0;
+            float max_delta = 0;
+            for (uint32_t y = 0; y < h; y++) {
+                for (uint32_t x = 0; x < w; x++) {
+                    for (uint32_t ch = 0; ch < 3; ch++) {
+                        float delta = std::fabs(bgra->pixels[y * bgra->float_stride + x * 4 + ch]
+                                                - bgr->pixels[y * bgr->float_stride + x * 3 + ch]);
+                        if (delta != 0)
+                            mismatches++;
+                        max_delta = std::max(max_delta, delta);
+                    }
+                }
+            }
+            CAPTURE(w);
+            CAPTURE(sigma);
+#if defined(__GNUC__) && !defined(__clang__)
+            CHECK(mismatches == 0);
+#else
+            // Only GCC can be told to keep -ffast-math away from the box blurs
+            CHECK(max_delta < 0.0001f);
+#endif
+
+            FLOW_free(&context, buffer);
+            flow_bitmap_float_destroy(&context, bgra);
+            flow_bitmap_float_destroy(&context, bgr);
+        }
+    }
+    REQUIRE(flow_context_begin_terminate(&context) == true);
+    flow_context_end_terminate(&context);
+}
+TEST_CASE("Test gaussian blur of columns matches blurring the rows of the transposed image", "[fastscaling]")
+{
+    flow_c context;
+    flow_context_initialize(&context);
+
+    // 37 columns: two full strips and a partial one
+    const uint32_t w = 37;
+    const uint32_t h = 53;
+    const float sigmas[] = { 2.0f, 3.3f, 7.5f, 50.0f };
+    for (float sigma : sigmas) {
+        struct flow_bitmap_float * image = flow_bitmap_float_create(&context, w, h, 4, true);
+        struct flow_bitmap_float * transposed = flow_bitmap_float_create(&context, h, w, 4, true);
+        REQUIRE(image != NULL);
+        REQUIRE(transposed != NULL);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                for (uint32_t ch = 0; ch < 4; ch++) {
+                    float v = (float)((x * 7 + y * 13 + ch * 5) % 17) / 16.0f;
+                    image->pixels[y * image->float_stride + x * 4 + ch] = v;
+                    transposed->pixels[x * transposed->float_stride + y * 4 + ch] = v;
+                }
+            }
+        }
+        uint32_t column_elements = flow_bitmap_float_approx_gaussian_column_buffer_element_count_required(sigma, h);
+        uint32_t row_elements = flow_bitmap_float_approx_gaussian_buffer_element_count_required(sigma, h);
+        float * buffer = FLOW_calloc_array(&context, std::max(column_elements, row_elements), float);
+        REQUIRE(buffer != NULL);
+
+        // In two bands, as separate threads would
+        REQUIRE(flow_bitmap_float_approx_gaussian_blur_columns(&context, image, sigma, buffer, column_elements, 0, 20));
+        REQUIRE(flow_bitmap_float_approx_gaussian_blur_columns(&context, image, sigma, buffer, column_elements, 20,
+                                                               w - 20));
+        REQUIRE(flow_bitmap_float_approx_gaussian_blur_rows(&context, transposed, sigma, buffer, row_elements, 0, -1));
+
+        float max_delta = 0;
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                for (uint32_t ch = 0; ch < 4; ch++) {
+                    max_delta = std::max(max_delta, std::fabs(image->pixels[y * image->float_stride + x * 4 + ch]
+                                                              - transposed->pixels[x * transposed->float_stride
+                                                                                   + y * 4 + ch]));
+                }
+            }
+        }
+        CAPTURE(sigma);
+#if defined(__GNUC__) && !defined(__clang__)
+        CHECK(max_delta == 0);
+#else
+        CHECK(max_delta < 0.0001f);
+#endif
+        FLOW_free(&context, buffer);
+        flow_bitmap_float_destroy(&context, image);
+        flow_bitmap_float_destroy(&context, transposed);
+    }
+    REQUIRE(flow_context_begin_terminate(&context) == true);
+    flow_context_end_terminate(&context);
+}
+
+TEST_CASE("Test banded gaussian blur job matches a single band", "[fastscaling]")
+{
+    flow_c context;
+    flow_context_initialize(&context);
+
+    // 256 pixels wide: the job pads the float frame's 4KiB stride
+    const uint32_t w = 256;
+    const uint32_t h = 61;
+    struct flow_bitmap_bgra * single = flow_bitmap_bgra_create(&context, w, h, true, flow_bgra32);
+    struct flow_bitmap_bgra * banded = flow_bitmap_bgra_create(&context, w, h, true, flow_bgra32);
+    REQUIRE(single != NULL);
+    REQUIRE(banded != NULL);
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w * 4; x++) {
+            uint8_t v = (uint8_t)(((x / 4) * 31 + y * 17 + (x % 4) * 71) % 256);
+            single->pixels[y * single->stride + x] = v;
+            banded->pixels[y * banded->stride + x] = v;
+        }
+    }
+    REQUIRE(flow_bitmap_bgra_gaussian_blur(&context, single, 4.5f, flow_working_floatspace_linear));
+
+    struct flow_gaussian_blur_job * job
+        = flow_gaussian_blur_job_create(&context, banded, 4.5f, flow_working_floatspace_linear, 5);
+    REQUIRE(job != NULL);
+    REQUIRE(flow_gaussian_blur_job_band_count(job) == 5);
+    // Bands in reverse order; only the stage boundaries matter
+    for (int stage = flow_gaussian_blur_stage_rows; stage <= flow_gaussian_blur_stage_output; stage++) {
+        for (uint32_t band = 5; band > 0; band--) {
+            REQUIRE(flow_gaussian_blur_job_run_band(&context, job, (flow_gaussian_blur_stage)stage, band - 1));
+        }
+    }
+    FLOW_destroy(&context, job);
+
+    REQUIRE(memcmp(single->pixels, banded->pixels, single->stride * h) == 0);
+    // The blur changed most pixels
+    uint32_t changed = 0;
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w * 4; x++) {
+            if (single->pixels[y * single->stride + x] != (uint8_t)(((x / 4) * 31 + y * 17 + (x % 4) * 71) % 256))
+                changed++;
+        }
+    }
+    REQUIRE(changed > w * h * 2);
+
+    REQUIRE(flow_gaussian_blur_job_create(&context, banded, 1.5f, flow_working_floatspace_linear, 1) == NULL);
+    REQUIRE(flow_context_error_reason(&context) == flow_status_Invalid_argument);
+    flow_context_clear_error(&context);
+
+    flow_bitmap_bgra_destroy(&context, single);
+    flow_bitmap_bgra_destroy(&context, banded);
+    REQUIRE(flow_context_begin_terminate(&context) == true);
+    flow_context_end_terminate(&context);
+}
+
+TEST_CASE("Test unsharp mask steepens an edge and leaves flat areas alone", "[fastscaling]")
+{
+    flow_c context;
+    flow_context_initialize(&context);
+
+    const uint32_t w = 64;
+    const uint32_t h = 24;
+    struct flow_bitmap_bgra * single = flow_bitmap_bgra_create(&context, w, h, true, flow_bgr32);
+    struct flow_bitmap_bgra * banded = flow_bitmap_bgra_create(&context, w, h, true, flow_bgr32);
+    REQUIRE(single != NULL);
+    REQUIRE(banded != NULL);
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w * 4; x++) {
+            uint8_t v = x / 4 < w / 2 ? 64 : 192;
+            single->pixels[y * single->stride + x] = v;
+            banded->pixels[y * banded->stride + x] = v;
+        }
+    }
+    REQUIRE(flow_bitmap_bgra_unsharp_mask(&context, single, 2.0f, 1.0f, flow_working_floatspace_srgb));
+
+    struct flow_gaussian_blur_job * job
+        = flow_unsharp_mask_job_create(&context, banded, 2.0f, 1.0f, flow_working_floatspace_srgb, 3);
+    REQUIRE(job != NULL);
+    for (int stage = flow_gaussian_blur_stage_rows; stage <= flow_gaussian_blur_stage_output; stage++) {
+        for (uint32_t band = 0; band < 3; band++) {
+            REQUIRE(flow_gaussian_blur_job_run_band(&context, job, (flow_gaussian_blur_stage)stage, band));
+        }
+    }
+    FLOW_destroy(&context, job);
+    REQUIRE(memcmp(single->pixels, banded->pixels, single->stride * h) == 0);
+
+    const uint8_t * row = single->pixels + (h / 2) * single->stride;
+    // Overshoot on both sides of the edge
+    REQUIRE(row[(w / 2 - 1) * 4] < 64);
+    REQUIRE(row[(w / 2) * 4] > 192);
+    // Far from it, nothing to sharpen
+    REQUIRE(abs(row[0] - 64) <= 1);
+    REQUIRE(abs(row[(w - 1) * 4] - 192) <= 1);
+
+    REQUIRE(flow_unsharp_mask_job_create(&context, banded, 2.0f, 0.0f, flow_working_floatspace_srgb, 1) == NULL);
+    REQUIRE(flow_context_error_reason(&context) == flow_status_Invalid_argument);
+    flow_context_clear_error(&context);
+
+    flow_bitmap_bgra_destroy(&context, single);
+    flow_bitmap_bgra_destroy(&context, banded);
+    REQUIRE(flow_context_begin_terminate(&context) == true);
+    flow_context_end_terminate(&context);
+}
+
 /*
 If we need to research fixed point, convert this test
 //Looks like we need an 11 bit integer to safely store a sRGB byte in linear form.
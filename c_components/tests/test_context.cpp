@@ -151,3 +151,50 @@ TEST_CASE("Test ownership", "")
     REQUIRE(flow_context_begin_terminate(c) == true);
     flow_context_destroy(c);
 }
+
+TEST_CASE("Test pixel buffers are reused through the bitmap pool", "")
+{
+    flow_c * c = flow_context_create();
+    ERR(c);
+
+    struct flow_bitmap_bgra * a = flow_bitmap_bgra_create(c, 400, 300, true, flow_bgra32);
+    ERR(c);
+    uint8_t * a_pixels = a->pixels;
+    // Cropping offsets the pixel pointer; the buffer must still find its way back to the pool
+    a->pixels += a->stride * 10;
+    flow_bitmap_bgra_destroy(c, a);
+    REQUIRE(c->bitmap_pool.slot_count == 1);
+
+    // Transposed dimensions land in the same size class
+    struct flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, 300, 400, true, flow_bgra32);
+    ERR(c);
+    REQUIRE(b->pixels == a_pixels);
+    REQUIRE(c->bitmap_pool.hits == 1);
+    REQUIRE(c->bitmap_pool.slot_count == 0);
+    for (size_t i = 0; i < b->stride * b->h; i++) {
+        REQUIRE(b->pixels[i] == 0);
+    }
+
+    // Much larger bitmaps don't claim smaller buffers
+    struct flow_bitmap_bgra * d = flow_bitmap_bgra_create(c, 4000, 300, false, flow_bgra32);
+    ERR(c);
+    REQUIRE(d->pixels != a_pixels);
+    flow_bitmap_bgra_destroy(c, b);
+    flow_bitmap_bgra_destroy(c, d);
+    REQUIRE(c->bitmap_pool.slot_count == 2);
+
+    // Lowering the limit frees pooled buffers
+    REQUIRE(flow_context_set_bitmap_pool_limit(c, 0));
+    REQUIRE(c->bitmap_pool.slot_count == 0);
+    REQUIRE(c->bitmap_pool.bytes_pooled == 0);
+
+    REQUIRE(flow_context_set_bitmap_pool_limit(c, FLOW_BITMAP_POOL_DEFAULT_MAX_BYTES));
+    b = flow_bitmap_bgra_create(c, 300, 400, false, flow_bgra32);
+    ERR(c);
+    flow_bitmap_bgra_destroy(c, flow_bitmap_bgra_create(c, 200, 200, false, flow_bgr24));
+
+    // Live bitmaps and pooled buffers are all freed with the context
+    REQUIRE(flow_context_begin_terminate(c) == true);
+    REQUIRE(c->object_tracking.bytes_allocated_net == 0);
+    flow_context_destroy(c);
+}
@@ -59,3 +59,107 @@ TEST_CASE("Test file read", "")
     flow_context_destroy(c);
     unlink("test_io_file.txt");
 }
+
+TEST_CASE("Test mapped file read", "")
+{
+    flow_c * c = flow_context_create();
+    uint8_t buf[] = { 3, 25, 1, 2, 3, 4, 5 };
+    write_all_byte("test_io_mapped.txt", (char *)&buf[0], sizeof(buf));
+
+    // Read-only files are mapped automatically
+    struct flow_io * mem = flow_io_create_for_file(c, flow_io_mode_read_seekable, "test_io_mapped.txt", c);
+    ERR(c);
+    REQUIRE(mem->optional_file_length == sizeof(buf));
+
+    const uint8_t * remaining = NULL;
+    size_t remaining_length = 0;
+    REQUIRE(flow_io_get_remaining_memory(c, mem, &remaining, &remaining_length));
+    REQUIRE(remaining_length == sizeof(buf));
+    REQUIRE(memcmp(remaining, &buf[0], sizeof(buf)) == 0);
+
+    uint8_t buf2[] = { 0, 0 };
+    REQUIRE(mem->read_func(c, mem, &buf2[0], sizeof(buf2)) == 2);
+    REQUIRE(buf2[0] == buf[0]);
+    REQUIRE(buf2[1] == buf[1]);
+
+    REQUIRE(flow_io_get_remaining_memory(c, mem, &remaining, &remaining_length));
+    REQUIRE(remaining_length == sizeof(buf) - 2);
+    REQUIRE(remaining[0] == 1);
+
+    REQUIRE(mem->seek_function(c, mem, 0) == true);
+    REQUIRE(mem->read_func(c, mem, &buf2[0], sizeof(buf2)) == 2);
+    REQUIRE(buf2[0] == buf[0]);
+
+    REQUIRE(FLOW_destroy(c, mem));
+    ERR(c);
+
+    // Empty files can't be mapped, but can still be opened
+    fclose(fopen("test_io_mapped.txt", "w"));
+    REQUIRE(flow_io_create_for_mapped_file(c, "test_io_mapped.txt", c) == NULL);
+    REQUIRE(flow_context_error_reason(c) == flow_status_IO_error);
+    flow_context_clear_error(c);
+
+    mem = flow_io_create_for_file(c, flow_io_mode_read_seekable, "test_io_mapped.txt", c);
+    ERR(c);
+    REQUIRE(mem->read_func(c, mem, &buf2[0], sizeof(buf2)) == 0);
+    REQUIRE_FALSE(flow_io_get_remaining_memory(c, mem, &remaining, &remaining_length));
+
+    ERR(c);
+    flow_context_destroy(c);
+    unlink("test_io_mapped.txt");
+}
+
+TEST_CASE("Test output buffer grows by segments", "")
+{
+    flow_c * c = flow_context_create();
+    struct flow_io * out = flow_io_create_for_output_buffer(c, c);
+    ERR(c);
+    REQUIRE(flow_io_output_buffer_reserve(c, out, 5000));
+
+    uint8_t chunk[1000];
+    for (int i = 0; i < 12; i++) {
+        memset(&chunk[0], i, sizeof(chunk));
+        REQUIRE(out->write_func(c, out, &chunk[0], sizeof(chunk)) == sizeof(chunk));
+    }
+    ERR(c);
+    REQUIRE(out->optional_file_length == 12000);
+
+    const struct flow_io_buffer_segment * segments = NULL;
+    size_t count = 0;
+    REQUIRE(flow_io_get_output_buffer_segments(c, out, &segments, &count));
+    REQUIRE(count > 1);
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += segments[i].length;
+    }
+    REQUIRE(total == 12000);
+
+    // Overwrite across the boundary between the first two segments, then read it back
+    REQUIRE(out->seek_function(c, out, segments[0].length - 10));
+    uint8_t marker[20];
+    memset(&marker[0], 0xAB, sizeof(marker));
+    REQUIRE(out->write_func(c, out, &marker[0], sizeof(marker)) == sizeof(marker));
+    REQUIRE(out->seek_function(c, out, segments[0].length - 11));
+    uint8_t readback[22];
+    REQUIRE(out->read_func(c, out, &readback[0], sizeof(readback)) == sizeof(readback));
+    REQUIRE(readback[0] != 0xAB);
+    REQUIRE(readback[1] == 0xAB);
+    REQUIRE(readback[20] == 0xAB);
+    REQUIRE(readback[21] != 0xAB);
+    REQUIRE(out->optional_file_length == 12000);
+
+    // Asking for a single buffer merges the segments
+    uint8_t * buffer = NULL;
+    size_t length = 0;
+    REQUIRE(flow_io_get_output_buffer(c, out, &buffer, &length));
+    REQUIRE(length == 12000);
+    REQUIRE(buffer[0] == 0);
+    REQUIRE(buffer[5500] == 5);
+    REQUIRE(buffer[11999] == 11);
+    REQUIRE(flow_io_get_output_buffer_segments(c, out, &segments, &count));
+    REQUIRE(count == 1);
+    REQUIRE(segments[0].data == buffer);
+
+    ERR(c);
+    flow_context_destroy(c);
+}
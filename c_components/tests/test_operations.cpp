@@ -104,6 +104,150 @@ TEST_CASE("Test detect_content", "")
     REQUIRE(r.y1 == 3);
 }
 
+TEST_CASE("Test detect_content finds single pixels across the vectorized scan", "")
+{
+    flow_c * c = flow_context_create();
+    const uint32_t widths[] = { 18, 19, 33, 50 };
+    for (uint32_t w : widths) {
+        const uint32_t h = 9;
+        flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, flow_bgr32);
+        REQUIRE(b != NULL);
+        for (uint32_t x = 0; x < w; x++) {
+            for (uint32_t y = 0; y < h; y += 4) {
+                flow_bitmap_bgra_fill_rect(c, b, 0, 0, w, h, 0xFF000000);
+                flow_bitmap_bgra_fill_rect(c, b, x, y, x + 1, y + 1, 0xFF0000FF);
+                flow_rect r = detect_content(c, b, 1);
+                CAPTURE(w);
+                CAPTURE(x);
+                CAPTURE(y);
+                REQUIRE(r.x1 == (int32_t)x);
+                REQUIRE(r.y1 == (int32_t)y);
+                REQUIRE(r.x2 == (int32_t)x + 1);
+                REQUIRE(r.y2 == (int32_t)y + 1);
+            }
+        }
+        FLOW_destroy(c, b);
+    }
+    flow_context_destroy(c);
+}
+
+TEST_CASE("Test fill_buffer converts 32-bit pixels to gray like the scalar formula", "")
+{
+    flow_c * c = flow_context_create();
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr32 };
+    for (flow_pixel_format fmt : formats) {
+        const uint32_t w = 37;
+        const uint32_t h = 5;
+        flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, fmt);
+        REQUIRE(b != NULL);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < b->stride; x++) {
+                b->pixels[y * b->stride + x] = (uint8_t)(x * 71 + y * 131 + (x * y) % 23);
+            }
+        }
+        uint8_t buf[w * h];
+        flow_SearchInfo info;
+        info.bitmap = b;
+        info.buf = buf;
+        info.buff_size = sizeof(buf);
+        info.buf_x = 1;
+        info.buf_y = 1;
+        info.buf_w = w - 1;
+        info.buf_h = h - 1;
+        REQUIRE(fill_buffer(c, &info));
+        for (uint32_t y = 0; y < info.buf_h; y++) {
+            for (uint32_t x = 0; x < info.buf_w; x++) {
+                const uint8_t * p = b->pixels + (y + 1) * b->stride + (x + 1) * 4;
+                const uint32_t luma = 233 * p[0] + 1197 * p[1] + 610 * p[2];
+                const uint32_t expected = fmt == flow_bgra32 ? (luma * p[3] + 524288 - 1) / 524288 : luma / 2048;
+                CAPTURE(fmt);
+                CAPTURE(x);
+                CAPTURE(y);
+                REQUIRE(buf[y * info.buf_w + x] == expected);
+            }
+        }
+        FLOW_destroy(c, b);
+    }
+    flow_context_destroy(c);
+}
+
+static flow_bitmap_bgra * copy_tight(flow_c * c, flow_bitmap_bgra * from)
+{
+    flow_bitmap_bgra * to = flow_bitmap_bgra_create(c, from->w, from->h, false, from->fmt);
+    uint32_t row_bytes = from->w * flow_pixel_format_bytes_per_pixel(from->fmt);
+    for (uint32_t y = 0; y < from->h; y++) {
+        memcpy(to->pixels + y * to->stride, from->pixels + y * from->stride, row_bytes);
+    }
+    return to;
+}
+
+TEST_CASE("Test operations on a view match a tightly packed copy", "")
+{
+    flow_c * c = flow_context_create();
+    flow_pixel_format formats[] = { flow_bgra32, flow_bgr32, flow_bgr24 };
+    for (size_t f = 0; f < sizeof(formats) / sizeof(flow_pixel_format); f++) {
+        CAPTURE(formats[f]);
+        flow_bitmap_bgra * source = flow_bitmap_bgra_create(c, 97, 47, true, formats[f]);
+        for (uint32_t i = 0; i < source->stride * source->h; i++) {
+            source->pixels[i] = (uint8_t)(i * 7 + i / 13);
+        }
+        // Ends at the last row and column, so nothing past the final pixel may be touched
+        flow_bitmap_bgra * view = flow_bitmap_bgra_create_view(c, source, 45, 14, 52, 33);
+        flow_context_print_and_exit_if_err(c);
+        REQUIRE(view->pixels_borrowed);
+        REQUIRE(view->stride == source->stride);
+        flow_bitmap_bgra * tight = copy_tight(c, view);
+        REQUIRE(tight->stride != view->stride);
+
+        bool equal = false;
+        REQUIRE(flow_bitmap_bgra_compare(c, view, tight, &equal));
+        REQUIRE(equal);
+
+        // Scale onto canvases holding the same background, compositing when there is alpha. (scale2d lacks bgr24)
+        if (formats[f] != flow_bgr24) {
+            flow_bitmap_bgra * canvas_a = flow_bitmap_bgra_create(c, 23, 19, true, formats[f]);
+            flow_bitmap_bgra * canvas_b = flow_bitmap_bgra_create(c, 23, 19, true, formats[f]);
+            flow_bitmap_bgra_fill_rect(c, canvas_a, 0, 0, 23, 19, 0x8033CC66);
+            flow_bitmap_bgra_fill_rect(c, canvas_b, 0, 0, 23, 19, 0x8033CC66);
+            flow_bitmap_compositing_mode mode = formats[f] == flow_bgra32 ? flow_bitmap_compositing_blend_with_self
+                                                                          : flow_bitmap_compositing_replace_self;
+            canvas_a->compositing_mode = mode;
+            canvas_b->compositing_mode = mode;
+
+            struct flow_nodeinfo_scale2d_render_to_canvas1d info;
+            info.interpolation_filter = flow_interpolation_filter_Robidoux;
+            info.scale_to_width = 23;
+            info.scale_to_height = 19;
+            info.scale_in_colorspace = flow_working_floatspace_linear;
+            info.sharpen_percent_goal = 0;
+            REQUIRE(flow_node_execute_scale2d_render1d(c, view, canvas_a, &info));
+            REQUIRE(flow_node_execute_scale2d_render1d(c, tight, canvas_b, &info));
+            flow_context_print_and_exit_if_err(c);
+            REQUIRE(flow_bitmap_bgra_compare(c, canvas_a, canvas_b, &equal));
+            REQUIRE(equal);
+        }
+
+        REQUIRE(flow_bitmap_bgra_flip_horizontal(c, view));
+        REQUIRE(flow_bitmap_bgra_flip_horizontal(c, tight));
+        REQUIRE(flow_bitmap_bgra_flip_vertical(c, view));
+        REQUIRE(flow_bitmap_bgra_flip_vertical(c, tight));
+        flow_context_print_and_exit_if_err(c);
+        REQUIRE(flow_bitmap_bgra_compare(c, view, tight, &equal));
+        REQUIRE(equal);
+
+        // The view wrote through to its source, and only within its window
+        uint32_t bpp = flow_pixel_format_bytes_per_pixel(formats[f]);
+        uint32_t before_window = 14 * source->stride + 45 * bpp - 1;
+        REQUIRE(source->pixels[before_window] == (uint8_t)(before_window * 7 + before_window / 13));
+        REQUIRE(memcmp(source->pixels + before_window + 1, tight->pixels, 52 * bpp) == 0);
+
+        flow_bitmap_bgra_destroy(c, view);
+        flow_bitmap_bgra_destroy(c, tight);
+        flow_bitmap_bgra_destroy(c, source);
+    }
+    flow_context_destroy(c);
+}
+
 // TODO: Compare to a reference scaling
 
 typedef void (*blockscale_fn)(uint8_t input[64], uint8_t ** output_rows, uint32_t output_col);
@@ -363,6 +507,376 @@ TEST_CASE("Benchmark vertical flip", "")
                 fprintf(stdout, "Vertical flipping %dx%d (fmt %d) took %.05fms\n", w, h, fmt, ms);
             }
 }
+TEST_CASE("Test each transpose kernel matches flow_bitmap_bgra_transpose_slow", "")
+{
+    flow_c * c = flow_context_create();
+    const uint32_t sizes[] = { 1, 3, 8, 13, 67 };
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr32, flow_bgr24 };
+    const flow_transpose_kernel kernels[] = { flow_transpose_kernel_auto, flow_transpose_kernel_scalar,
+                                              flow_transpose_kernel_sse, flow_transpose_kernel_avx };
+    for (flow_pixel_format fmt : formats) {
+        for (uint32_t w : sizes) {
+            for (uint32_t h : sizes) {
+                flow_bitmap_bgra * a = flow_bitmap_bgra_create(c, w, h, true, fmt);
+                flow_bitmap_bgra * reference = flow_bitmap_bgra_create(c, h, w, true, fmt);
+                REQUIRE(a != NULL);
+                REQUIRE(reference != NULL);
+                for (uint32_t y = 0; y < h; y++) {
+                    for (uint32_t x = 0; x < a->stride; x++) {
+                        a->pixels[y * a->stride + x] = (uint8_t)(x * 7 + y * 131);
+                    }
+                }
+                REQUIRE(flow_bitmap_bgra_transpose_slow(c, a, reference));
+
+                for (flow_transpose_kernel kernel : kernels) {
+                    if (!flow_transpose_kernel_supported(kernel, fmt))
+                        continue;
+                    flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, h, w, true, fmt);
+                    REQUIRE(b != NULL);
+                    // In two bands, the first ending off the SIMD block grid
+                    uint32_t split = h / 2;
+                    REQUIRE(flow_bitmap_bgra_transpose_rows(c, a, b, 0, split, kernel));
+                    REQUIRE(flow_bitmap_bgra_transpose_rows(c, a, b, split, h - split, kernel));
+                    bool equal = false;
+                    REQUIRE(flow_bitmap_bgra_compare(c, b, reference, &equal));
+                    CAPTURE(fmt);
+                    CAPTURE(w);
+                    CAPTURE(h);
+                    CAPTURE(kernel);
+                    REQUIRE(equal);
+                    flow_bitmap_bgra_destroy(c, b);
+                }
+                flow_bitmap_bgra_destroy(c, a);
+                flow_bitmap_bgra_destroy(c, reference);
+            }
+        }
+    }
+    REQUIRE_FALSE(flow_transpose_kernel_supported(flow_transpose_kernel_avx, flow_bgr24));
+    flow_context_destroy(c);
+}
+
+// The scalar 3-tap sharpen flow_bitmap_float_sharpen_rows used to run
+FLOW_HINT_STRICT_MATH static void sharpen_row_reference(float * buf, uint32_t count, double pct, uint32_t step)
+{
+    const float n = (float)(-pct / (pct - 1));
+    const float c_o = n / -2.0f;
+    const float c_i = n + 1;
+    std::vector<float> original(buf, buf + count * step);
+    for (uint32_t ndx = 1; ndx + 1 < count; ndx++) {
+        for (uint32_t ch = 0; ch < step; ch++) {
+            buf[ndx * step + ch] = original[(ndx - 1) * step + ch] * c_o + original[ndx * step + ch] * c_i
+                                   + original[(ndx + 1) * step + ch] * c_o;
+        }
+    }
+}
+
+TEST_CASE("Test flow_bitmap_float_sharpen_rows matches the scalar sharpen exactly", "")
+{
+    flow_c * c = flow_context_create();
+    for (uint32_t channels = 3; channels <= 4; channels++) {
+        for (uint32_t w = 1; w < 40; w++) {
+            flow_bitmap_float * im = flow_bitmap_float_create(c, w, 3, channels, true);
+            REQUIRE(im != NULL);
+            for (uint32_t i = 0; i < im->float_count; i++) {
+                im->pixels[i] = (float)((i * 37) % 101) / 100.0f;
+            }
+            std::vector<float> expected(im->pixels, im->pixels + im->float_count);
+            for (uint32_t row = 1; row < 3; row++) {
+                sharpen_row_reference(&expected[row * im->float_stride], w, 0.3, channels);
+            }
+            REQUIRE(flow_bitmap_float_sharpen_rows(c, im, 1, 2, 0.3));
+            CAPTURE(channels);
+            CAPTURE(w);
+            for (uint32_t i = 0; i < im->float_count; i++) {
+                CAPTURE(i);
+                REQUIRE(im->pixels[i] == expected[i]);
+            }
+            flow_bitmap_float_destroy(c, im);
+        }
+    }
+    flow_context_destroy(c);
+}
+
+// Filters in float across every block boundary, first along rows, then down columns of the row-filtered bytes
+static void sharpen_block_edges_reference(flow_bitmap_bgra * im, uint32_t block_size, float pct)
+{
+    pct = pct / 100.0f;
+    const float e = (float)(pct / (pct - 1.0)) / 2.0f;
+    const uint32_t w = im->w;
+    const uint32_t h = im->h;
+    std::vector<float> rows(w * h * 4);
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            for (uint32_t ch = 0; ch < 4; ch++) {
+                const uint8_t * p = im->pixels + y * im->stride + x * 4 + ch;
+                float v = *p;
+                if (ch < 3 && x > 0 && x % block_size == 0)
+                    v += e * (p[-4] - *p);
+                if (ch < 3 && x + 1 < w && x % block_size == block_size - 1)
+                    v += e * (p[4] - *p);
+                rows[(y * w + x) * 4 + ch] = uchar_clamp_ff(v);
+            }
+        }
+    }
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t i = 0; i < w * 4; i++) {
+            const float * p = &rows[y * w * 4 + i];
+            float v = *p;
+            if (i % 4 < 3 && y > 0 && y % block_size == 0)
+                v += e * (p[-(int)w * 4] - *p);
+            if (i % 4 < 3 && y + 1 < h && y % block_size == block_size - 1)
+                v += e * (p[w * 4] - *p);
+            im->pixels[y * im->stride + i] = uchar_clamp_ff(v);
+        }
+    }
+}
+
+TEST_CASE("Test sharpen_block_edges matches a float reference", "")
+{
+    flow_c * c = flow_context_create();
+    const uint32_t sizes[] = { 1, 5, 13, 67 };
+    const int block_sizes[] = { 1, 2, 3, 4, 7, 8, 24 };
+    const float pcts[] = { -15, 30 };
+    for (uint32_t w : sizes) {
+        for (uint32_t h : sizes) {
+            for (int block_size : block_sizes) {
+                for (float pct : pcts) {
+                    flow_bitmap_bgra * a = flow_bitmap_bgra_create(c, w, h, true, flow_bgra32);
+                    flow_bitmap_bgra * reference = flow_bitmap_bgra_create(c, w, h, true, flow_bgra32);
+                    REQUIRE(a != NULL);
+                    REQUIRE(reference != NULL);
+                    for (uint32_t y = 0; y < h; y++) {
+                        for (uint32_t x = 0; x < a->stride; x++) {
+                            a->pixels[y * a->stride + x] = reference->pixels[y * a->stride + x]
+                                = (uint8_t)(x * 7 + y * 131 + (x * y) % 23);
+                        }
+                    }
+                    REQUIRE(flow_bitmap_bgra_sharpen_block_edges(c, a, block_size, pct));
+                    sharpen_block_edges_reference(reference, block_size, pct);
+                    CAPTURE(w);
+                    CAPTURE(h);
+                    CAPTURE(block_size);
+                    CAPTURE(pct);
+                    int worst = 0;
+                    for (uint32_t y = 0; y < h; y++) {
+                        for (uint32_t x = 0; x < w * 4; x++) {
+                            int diff = abs(a->pixels[y * a->stride + x] - reference->pixels[y * a->stride + x]);
+                            worst = diff > worst ? diff : worst;
+                        }
+                    }
+                    // Fixed-point weights, and rounding after each pass (twice for one-pixel blocks)
+                    REQUIRE(worst <= 2);
+                    flow_bitmap_bgra_destroy(c, a);
+                    flow_bitmap_bgra_destroy(c, reference);
+                }
+            }
+        }
+    }
+    flow_bitmap_bgra * bgr24 = flow_bitmap_bgra_create(c, 8, 8, true, flow_bgr24);
+    REQUIRE_FALSE(flow_bitmap_bgra_sharpen_block_edges(c, bgr24, 8, -15));
+    REQUIRE(flow_context_error_reason(c) == flow_status_Unsupported_pixel_format);
+    flow_context_clear_error(c);
+    flow_bitmap_bgra_destroy(c, bgr24);
+    flow_context_destroy(c);
+}
+
+TEST_CASE("Test flow_halve matches flow_halve_slow", "")
+{
+    flow_c * c = flow_context_create();
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr24 };
+    const flow_working_floatspace spaces[] = { flow_working_floatspace_as_is, flow_working_floatspace_linear };
+    const uint32_t sizes[] = { 5, 12, 37, 70 };
+    for (flow_pixel_format fmt : formats) {
+        for (flow_working_floatspace space : spaces) {
+            flow_colorcontext_info colorcontext;
+            flow_colorcontext_init(c, &colorcontext, space, 0, 0, 0);
+            for (int divisor = 2; divisor <= 5; divisor++) {
+                for (uint32_t w : sizes) {
+                    const uint32_t h = 3 * divisor + 1;
+                    flow_bitmap_bgra * from = flow_bitmap_bgra_create(c, w, h, true, fmt);
+                    flow_bitmap_bgra * to = flow_bitmap_bgra_create(c, w / divisor, h / divisor, true, fmt);
+                    flow_bitmap_bgra * reference = flow_bitmap_bgra_create(c, w / divisor, h / divisor, true, fmt);
+                    REQUIRE(from != NULL);
+                    REQUIRE(to != NULL);
+                    REQUIRE(reference != NULL);
+                    for (uint32_t y = 0; y < h; y++) {
+                        for (uint32_t x = 0; x < from->stride; x++) {
+                            from->pixels[y * from->stride + x] = (uint8_t)(x * 7 + y * 131 + (x * y) % 23);
+                        }
+                    }
+                    REQUIRE(flow_halve_slow(c, &colorcontext, from, reference, divisor));
+                    // In two bands, as separate threads would
+                    REQUIRE(flow_halve_rows(c, &colorcontext, from, to, 0, 1, divisor));
+                    REQUIRE(flow_halve_rows(c, &colorcontext, from, to, 1, to->h - 1, divisor));
+                    REQUIRE(flow_halve_in_place(c, &colorcontext, from, divisor));
+                    CAPTURE(fmt);
+                    CAPTURE(space);
+                    CAPTURE(divisor);
+                    CAPTURE(w);
+                    int worst = 0;
+                    for (uint32_t y = 0; y < to->h; y++) {
+                        for (uint32_t x = 0; x < to->w * flow_pixel_format_bytes_per_pixel(fmt); x++) {
+                            const uint8_t expected = reference->pixels[y * reference->stride + x];
+                            int diff = abs(to->pixels[y * to->stride + x] - expected);
+                            worst = diff > worst ? diff : worst;
+                            REQUIRE(from->pixels[y * from->stride + x] == to->pixels[y * to->stride + x]);
+                        }
+                    }
+                    // Linear averages are encoded 4 channels at a time, by a vectorized approximate pow
+                    REQUIRE(worst <= (space == flow_working_floatspace_as_is ? 0 : 1));
+                    flow_bitmap_bgra_destroy(c, from);
+                    flow_bitmap_bgra_destroy(c, to);
+                    flow_bitmap_bgra_destroy(c, reference);
+                }
+            }
+        }
+    }
+    flow_bitmap_bgra * from = flow_bitmap_bgra_create(c, 8, 8, true, flow_bgra32);
+    flow_bitmap_bgra * to = flow_bitmap_bgra_create(c, 4, 4, true, flow_bgra32);
+    flow_colorcontext_info colorcontext;
+    flow_colorcontext_init(c, &colorcontext, flow_working_floatspace_linear, 0, 0, 0);
+    REQUIRE_FALSE(flow_halve(c, &colorcontext, from, to, 3));
+    REQUIRE(flow_context_error_reason(c) == flow_status_Invalid_argument);
+    flow_context_clear_error(c);
+    flow_bitmap_bgra_destroy(c, from);
+    flow_bitmap_bgra_destroy(c, to);
+    flow_context_destroy(c);
+}
+
+TEST_CASE("Test flow_histogram_job matches a direct count", "")
+{
+    flow_c * c = flow_context_create();
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr24 };
+    const uint32_t bin_sizes[] = { 256, 64, 1024 };
+    const uint32_t w = 67;
+    const uint32_t h = 45;
+    for (flow_pixel_format fmt : formats) {
+        flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, fmt);
+        REQUIRE(b != NULL);
+        const uint32_t bpp = flow_pixel_format_bytes_per_pixel(fmt);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < b->stride; x++) {
+                // Runs of repeated values, as in flat image areas, land in one bin several times in a row
+                b->pixels[y * b->stride + x] = (uint8_t)((x / 5) * 37 + y * 11);
+            }
+        }
+        for (uint32_t bins : bin_sizes) {
+            for (uint32_t count = 1; count <= 3; count++) {
+                for (uint32_t step = 1; step <= 3; step++) {
+                    std::vector<uint64_t> expected(bins * count, 0);
+                    const uint32_t shift = 16 - intlog2(bins);
+                    for (uint32_t y = 0; y < h; y += step) {
+                        for (uint32_t x = 0; x < w; x += step) {
+                            const uint8_t * p = b->pixels + y * b->stride + x * bpp;
+                            const uint32_t luma = ((306 * p[2] + 601 * p[1] + 117 * p[0]) * 257) >> 10;
+                            if (count == 3) {
+                                expected[(p[2] * 257) >> shift]++;
+                                expected[bins + ((p[1] * 257) >> shift)]++;
+                                expected[2 * bins + ((p[0] * 257) >> shift)]++;
+                            } else {
+                                expected[luma >> shift]++;
+                            }
+                            if (count == 2) {
+                                int saturation = std::max(abs(p[2] - p[1]), abs(p[1] - p[0]));
+                                expected[bins + ((saturation * 257) >> shift)]++;
+                            }
+                        }
+                    }
+                    CAPTURE(fmt);
+                    CAPTURE(bins);
+                    CAPTURE(count);
+                    CAPTURE(step);
+                    struct flow_histogram_job * job = flow_histogram_job_create(c, b, bins, count, step, 4);
+                    REQUIRE(job != NULL);
+                    REQUIRE(flow_histogram_job_band_count(job) == 4);
+                    // Out of order, as separate threads might finish
+                    for (uint32_t band = 4; band > 0; band--) {
+                        REQUIRE(flow_histogram_job_run_band(c, job, band - 1));
+                    }
+                    std::vector<uint64_t> actual(bins * count, 0);
+                    uint64_t sampled = 0;
+                    REQUIRE(flow_histogram_job_merge(c, job, actual.data(), &sampled));
+                    REQUIRE(sampled == (uint64_t)((w + step - 1) / step) * ((h + step - 1) / step));
+                    REQUIRE(actual == expected);
+                    FLOW_destroy(c, job);
+                }
+            }
+        }
+        flow_bitmap_bgra_destroy(c, b);
+    }
+    flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, 8, 8, true, flow_bgra32);
+    uint64_t histograms[300];
+    uint64_t sampled;
+    REQUIRE_FALSE(flow_bitmap_bgra_populate_histogram(c, b, histograms, 300, 3, &sampled));
+    REQUIRE(flow_context_error_reason(c) == flow_status_Invalid_argument);
+    flow_context_clear_error(c);
+    flow_bitmap_bgra_destroy(c, b);
+
+    REQUIRE(flow_histogram_sample_step_for_error(640, 480, 0.001) == 1);
+    // 2.25M samples keep 3 standard errors within 0.1%
+    uint32_t step = flow_histogram_sample_step_for_error(6000, 4000, 0.001);
+    REQUIRE(step == 3);
+    REQUIRE((6000 / step) * (4000 / step) >= 2250000);
+    flow_context_destroy(c);
+}
+
+TEST_CASE("Test flow_bitmap_bgra_apply_channel_luts matches a per-byte lookup", "")
+{
+    flow_c * c = flow_context_create();
+    const flow_pixel_format formats[] = { flow_bgra32, flow_bgr32, flow_bgr24 };
+    // Wider than one vector, with a remainder
+    const uint32_t w = 67;
+    const uint32_t h = 45;
+    uint8_t luts[4 * 256];
+    for (uint32_t i = 0; i < 4 * 256; i++) {
+        luts[i] = (uint8_t)((i % 256) * (i / 256 * 2 + 3) + i / 256 * 50);
+    }
+    for (flow_pixel_format fmt : formats) {
+        CAPTURE(fmt);
+        flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, w, h, true, fmt);
+        REQUIRE(b != NULL);
+        const uint32_t bpp = flow_pixel_format_bytes_per_pixel(fmt);
+        for (uint32_t i = 0; i < b->stride * h; i++) {
+            b->pixels[i] = (uint8_t)(i * 2654435761u >> 13);
+        }
+        std::vector<uint8_t> expected(b->pixels, b->pixels + b->stride * h);
+        for (uint32_t y = 5; y < 40; y++) {
+            for (uint32_t x = 0; x < w * bpp; x++) {
+                uint8_t & v = expected[y * b->stride + x];
+                v = luts[256 * (x % bpp) + v];
+            }
+        }
+        REQUIRE(flow_bitmap_bgra_apply_channel_luts(c, b, 5, 35, luts));
+        REQUIRE(std::vector<uint8_t>(b->pixels, b->pixels + b->stride * h) == expected);
+
+        // Diagonal matrices are applied through the same tables, and must match the matrix formula
+        float rows[5][5] = { { 1.3f, 0, 0, 0, 0 },
+                             { 0, -1, 0, 0, 0 },
+                             { 0, 0, 0.7f, 0, 0 },
+                             { 0, 0, 0, 0.5f, 0 },
+                             { -0.15f, 1, 0.2f, 0.1f, 1 } };
+        float * m[5] = { rows[0], rows[1], rows[2], rows[3], rows[4] };
+        const uint32_t byte_of_channel[4] = { 2, 1, 0, 3 };
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                for (uint32_t channel = 0; channel < bpp; channel++) {
+                    uint8_t & v = expected[y * b->stride + x * bpp + byte_of_channel[channel]];
+                    v = uchar_clamp_ff(m[channel][channel] * v + m[4][channel] * 255.0f);
+                }
+            }
+        }
+        REQUIRE(flow_bitmap_bgra_apply_color_matrix(c, b, 0, h, m));
+        REQUIRE(std::vector<uint8_t>(b->pixels, b->pixels + b->stride * h) == expected);
+        flow_bitmap_bgra_destroy(c, b);
+    }
+    flow_bitmap_bgra * b = flow_bitmap_bgra_create(c, 8, 8, true, flow_bgra32);
+    REQUIRE_FALSE(flow_bitmap_bgra_apply_channel_luts(c, b, 4, 5, luts));
+    REQUIRE(flow_context_error_reason(c) == flow_status_Invalid_argument);
+    flow_context_clear_error(c);
+    flow_bitmap_bgra_destroy(c, b);
+    flow_context_destroy(c);
+}
+
 TEST_CASE("Benchmark transpose", "")
 {
     for (int fmt = 4; fmt >= 4; fmt--)
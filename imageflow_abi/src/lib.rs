@@ -761,6 +761,48 @@ pub extern "C" fn imageflow_context_get_output_buffer_by_id(context: *mut Contex
     handle_result!(c, result, false)
 }
 
+///
+/// Lists the pieces of the given output buffer, in order, without coalescing them into one.
+///
+/// Output buffers grow by appending segments rather than reallocating; writing out the list (as with writev)
+/// avoids the copy `imageflow_context_get_output_buffer_by_id` makes when there is more than one.
+///
+/// Fills up to `capacity` entries of `result_buffers` and `result_buffer_lengths`, and sets `result_segment_count`
+/// to the total number of segments. Call with a `capacity` of 0 (and null arrays) to learn how many there are.
+/// Pointers remain valid until the buffer is written to again or coalesced.
+///
+#[no_mangle]
+pub extern "C" fn imageflow_context_get_output_buffer_segments(context: *mut Context,
+                                                               io_id: i32,
+                                                               result_buffers: *mut *const u8,
+                                                               result_buffer_lengths: *mut libc::size_t,
+                                                               capacity: libc::size_t,
+                                                               result_segment_count: *mut libc::size_t)
+                                                               -> bool {
+    let mut c: &mut Context = context_ready!(context);
+    if capacity > 0 && (result_buffers.is_null() || result_buffer_lengths.is_null()) {
+        c.outward_error_mut().try_set_error(nerror!(ErrorKind::NullArgument, "The arguments 'result_buffers' and 'result_buffer_lengths' must not be null when 'capacity' is above zero."));
+        return false;
+    }
+
+    if result_segment_count.is_null() {
+        c.outward_error_mut().try_set_error(nerror!(ErrorKind::NullArgument, "The argument 'result_segment_count' is null."));
+        return false;
+    }
+    let result = catch_unwind(AssertUnwindSafe(|| {
+        let segments = c.get_output_buffer_segments(io_id).map_err(|e| e.at(here!()))?;
+        unsafe {
+            for (ix, segment) in segments.iter().take(capacity).enumerate() {
+                (*result_buffers.offset(ix as isize)) = segment.data;
+                (*result_buffer_lengths.offset(ix as isize)) = segment.length;
+            }
+            (*result_segment_count) = segments.len();
+        }
+        Ok(true)
+    }));
+    handle_result!(c, result, false)
+}
+
 
 
 
@@ -860,6 +902,21 @@ pub fn exercise_json_message() {
 }
 
 
+#[test]
+fn test_output_buffer_segments() {
+    unsafe {
+        let c = imageflow_context_create(IMAGEFLOW_ABI_VER_MAJOR, IMAGEFLOW_ABI_VER_MINOR);
+        assert!(imageflow_context_add_output_buffer(c, 1));
+        let mut count: usize = 99;
+        assert!(imageflow_context_get_output_buffer_segments(c, 1, ptr::null_mut(), ptr::null_mut(), 0, &mut count));
+        assert_eq!(count, 0);
+
+        assert!(!imageflow_context_get_output_buffer_segments(c, 1, ptr::null_mut(), ptr::null_mut(), 1, &mut count));
+        assert!(imageflow_context_has_error(c));
+        imageflow_context_destroy(c);
+    }
+}
+
 #[test]
 fn test_allocate_free() {
     unsafe{
@@ -0,0 +1,92 @@
+//! Splits node work into bands of rows (or columns) and runs them on one thread pool shared by every context in
+//! the process, so concurrent jobs don't each start threads of their own.
+use ::std::panic::{self, AssertUnwindSafe};
+use ::std::sync::{mpsc, Mutex};
+use ::std::sync::atomic::{AtomicUsize, Ordering, ATOMIC_USIZE_INIT};
+use ::threadpool::ThreadPool;
+
+lazy_static! {
+    static ref POOL: Mutex<ThreadPool> = Mutex::new(ThreadPool::new(::num_cpus::get()));
+}
+
+/// Zero until set_max_threads is called
+static MAX_THREADS: AtomicUsize = ATOMIC_USIZE_INIT;
+
+/// Caps how many threads (the caller's included) a single operation is split across; the default is one per cpu.
+/// A host that already runs a job per cpu, such as imageflow_server, passes its share so that banded
+/// operations stay within its admission limits.
+pub fn set_max_threads(threads: usize) {
+    MAX_THREADS.store(threads.max(1), Ordering::SeqCst);
+}
+
+pub fn max_threads() -> usize {
+    match MAX_THREADS.load(Ordering::SeqCst) {
+        0 => ::num_cpus::get(),
+        threads => threads
+    }
+}
+
+/// How many bands `units` of work should be split into; at least one, at most max_threads(), and none smaller than
+/// `min_units_per_band`. Each operation passes the size below which queueing a band, waking a pool thread for it and
+/// joining it costs more than the work itself.
+pub fn band_count(units: u64, min_units_per_band: u64) -> u32 {
+    (units / min_units_per_band.max(1)).max(1).min(max_threads() as u64) as u32
+}
+
+/// The rows [from, to) of band `band` when `rows` are split into `bands` nearly equal bands
+pub fn band_rows(rows: u32, bands: u32, band: u32) -> (u32, u32) {
+    ((rows as u64 * band as u64 / bands as u64) as u32, (rows as u64 * (band as u64 + 1) / bands as u64) as u32)
+}
+
+/// Lets a band closure carry raw pointers, such as a flow_c, a C band job, bitmaps or lookup tables, to the pool.
+/// This is sound only because `run` joins every band before returning, so the pointees outlive the bands, and because
+/// callers give each band its own rows, columns or counters and only read whatever else they share.
+#[derive(Copy, Clone)]
+pub struct Shared<T: Copy>(pub T);
+unsafe impl<T: Copy> Send for Shared<T> {}
+
+/// Runs `run_band` once for each band in 0..bands, and returns true if every band did. The calling thread runs
+/// band 0 and waits for the pool to finish the rest, so whatever the bands point to may live on the caller's stack.
+/// A band that panics counts as failed; a panic in band 0 is resumed once the other bands are done.
+pub fn run<F>(bands: u32, run_band: F) -> bool where F: Fn(u32) -> bool + Send + Copy + 'static {
+    if bands < 2 {
+        return run_band(0);
+    }
+    let (sender, receiver) = mpsc::channel();
+    {
+        let pool = POOL.lock().unwrap();
+        for band in 1..bands {
+            let sender = sender.clone();
+            pool.execute(move || {
+                let _ = sender.send(run_band(band));
+            });
+        }
+    }
+    drop(sender);
+    let first = panic::catch_unwind(AssertUnwindSafe(|| run_band(0)));
+    let mut succeeded = true;
+    for _ in 1..bands {
+        // A band that panicked drops its sender unsent; recv fails once every other band has finished
+        succeeded &= receiver.recv().unwrap_or(false);
+    }
+    match first {
+        Ok(first) => first && succeeded,
+        Err(payload) => panic::resume_unwind(payload)
+    }
+}
+
+#[test]
+fn test_run_bands() {
+    static RAN: AtomicUsize = ATOMIC_USIZE_INIT;
+    assert!(run(7, |band| {
+        RAN.fetch_add(1 << (band * 4), Ordering::SeqCst);
+        true
+    }));
+    assert_eq!(RAN.load(Ordering::SeqCst), 0x1111111);
+    assert!(!run(4, |band| band != 2));
+    assert!(!run(4, |band| if band == 3 { panic!("band 3") } else { true }));
+    assert_eq!(band_rows(10, 3, 0), (0, 3));
+    assert_eq!(band_rows(10, 3, 2), (6, 10));
+    assert_eq!(band_count(10, 100), 1);
+    assert!(band_count(u64::max_value(), 1) as usize <= max_threads());
+}
@@ -39,6 +39,7 @@ pub struct BuildRequest<'a> {
 #[derive(Clone, PartialEq, Debug)]
 pub struct BuildSuccess {
     pub outputs: Vec<BuildOutput>,
+    pub performance: Option<s::JobPerformance>,
 }
 
 #[derive(Debug, PartialEq)]
@@ -102,9 +103,12 @@ impl LibClient {
         for input in task.inputs {
             context.add_input_buffer(input.io_id, input.bytes).map_err(|e| e.at(here!()))?;
         }
+        LibClient::execute_inner(context, task.framewise, task.export_graphs_to)
+    }
 
+    fn execute_inner(context: &mut Context, framewise: s::Framewise, export_graphs_to: Option<std::path::PathBuf>) -> std::result::Result<BuildSuccess, FlowError> {
         // Assume output ids only come from nodes
-        for node in task.framewise.clone_nodes() {
+        for node in framewise.clone_nodes() {
             if let s::Node::Encode { ref io_id, .. } = *node {
                 context.add_output_buffer(*io_id).map_err(|e| e.at(here!()))?;
             }
@@ -116,8 +120,8 @@ impl LibClient {
         }
 
         let send_execute = s::Execute001 {
-            framewise: task.framewise,
-            graph_recording: match task.export_graphs_to {
+            framewise: framewise,
+            graph_recording: match export_graphs_to {
                 Some(_) => Some(s::Build001GraphRecording::debug_defaults()),
                 None => None,
             }
@@ -126,8 +130,8 @@ impl LibClient {
         let payload = context.execute_1(send_execute).map_err(|e| e.at(here!()))?;
 
 
-        let encodes: Vec<s::EncodeResult> = match payload {
-            s::ResponsePayload::JobResult(s::JobResult { encodes }) => encodes,
+        let (encodes, performance) = match payload {
+            s::ResponsePayload::JobResult(s::JobResult { encodes, performance }) => (encodes, performance),
             _ => {
                 unreachable!();
             }
@@ -145,7 +149,7 @@ impl LibClient {
             });
         }
 
-        Ok(BuildSuccess { outputs: outputs })
+        Ok(BuildSuccess { outputs: outputs, performance: performance })
     }
     pub fn build(&mut self, task: BuildRequest) -> std::result::Result<BuildSuccess, BuildFailure> {
         let mut context = Context::create().map_err(|e| e.at(here!()))?;
@@ -163,6 +167,42 @@ impl LibClient {
         context.destroy()?; //Termination errors trump execution errors
         result
     }
+
+    fn build_with_info_inner<'a, F, E>(context: &mut Context, inputs: Vec<BuildInput<'a>>, framewise_generator: F) -> std::result::Result<BuildSuccess, E>
+        where F: FnOnce(s::ImageInfo) -> std::result::Result<s::Framewise, E>,
+              E: From<BuildFailure>
+    {
+        let info_io_id = inputs.first().map(|i| i.io_id).ok_or_else(|| E::from(BuildFailure::from(nerror!(::ErrorKind::InvalidArgument, "build_with_info requires at least one input"))))?;
+        for input in inputs {
+            context.add_input_buffer(input.io_id, input.bytes).map_err(|e| E::from(BuildFailure::from(e.at(here!()))))?;
+        }
+        let info = context.get_image_info(info_io_id).map_err(|e| E::from(BuildFailure::from(e.at(here!()))))?;
+        let framewise = framewise_generator(info)?;
+        LibClient::execute_inner(context, framewise, None).map_err(|e| E::from(BuildFailure::from(e.at(here!()))))
+    }
+
+    /// Builds a job whose steps depend on the first input's ImageInfo, using a single context.
+    /// The codec is selected and the headers parsed once; the decode reuses that decoder instead of starting over,
+    /// which calling get_image_info() and then build() cannot do.
+    /// Errors from the generator are returned as-is; everything else arrives as E::from(BuildFailure).
+    pub fn build_with_info<'a, F, E>(&mut self, inputs: Vec<BuildInput<'a>>, framewise_generator: F) -> std::result::Result<BuildSuccess, E>
+        where F: FnOnce(s::ImageInfo) -> std::result::Result<s::Framewise, E>,
+              E: From<BuildFailure>
+    {
+        let mut context = Context::create().map_err(|e| E::from(BuildFailure::from(e.at(here!()))))?;
+
+        let result = catch_unwind(AssertUnwindSafe(||{
+            LibClient::build_with_info_inner(&mut context, inputs, framewise_generator)
+        }));
+
+        let result = match result{
+            Err(panic) => Err(E::from(BuildFailure::Error{ httpish_code: 500, message: format!("{}", PanicFormatter(&panic))})),
+            Ok(r) => r
+        };
+
+        context.destroy().map_err(|e| E::from(BuildFailure::from(e)))?; //Termination errors trump execution errors
+        result
+    }
 }
 
 
@@ -193,3 +233,26 @@ fn test_stateless() {
     let result = LibClient {}.build(req).unwrap();
     assert!(result.outputs.len() == 1);
 }
+
+#[test]
+fn test_stateless_build_with_info() {
+    let png_bytes = vec![0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A, 0x00, 0x00, 0x00, 0x0D,
+                         0x49, 0x48, 0x44, 0x52, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+                         0x08, 0x06, 0x00, 0x00, 0x00, 0x1F, 0x15, 0xC4, 0x89, 0x00, 0x00, 0x00,
+                         0x0A, 0x49, 0x44, 0x41, 0x54, 0x78, 0x9C, 0x63, 0x00, 0x01, 0x00, 0x00,
+                         0x05, 0x00, 0x01, 0x0D, 0x0A, 0x2D, 0xB4, 0x00, 0x00, 0x00, 0x00, 0x49,
+                         0x45, 0x4E, 0x44, 0xAE, 0x42, 0x60, 0x82];
+    let inputs = || vec![BuildInput { io_id: 0, bytes: &png_bytes }];
+
+    let result = LibClient::new().build_with_info(inputs(), |info| -> std::result::Result<s::Framewise, BuildFailure> {
+        assert_eq!((info.image_width, info.image_height), (1, 1));
+        Ok(Framewise::Steps(vec![s::Node::Decode { io_id: 0, commands: None },
+                                 s::Node::Resample2D { w: info.image_width as u32 * 2, h: info.image_height as u32 * 2, down_filter: None, up_filter: None, hints: None, scaling_colorspace: None },
+                                 s::Node::Encode { io_id: 1, preset: s::EncoderPreset::libpng32() }]))
+    }).unwrap();
+    assert_eq!((result.outputs[0].w, result.outputs[0].h), (Some(2), Some(2)));
+
+    // Generator errors come back unchanged
+    let failure = LibClient::new().build_with_info(inputs(), |_| Err(BuildFailure::Error { httpish_code: 400, message: "no".to_owned() }));
+    assert_eq!(failure.err(), Some(BuildFailure::Error { httpish_code: 400, message: "no".to_owned() }));
+}
@@ -149,14 +149,14 @@ impl Encoder for GifEncoder{
 }
 
 
-fn remove_padding(width: u16, pixels: &[u8], stride: usize) -> Vec<u8>{
-    pixels.chunks(stride).flat_map(|s| s[0..width as usize * 4].iter().map(|v| *v)).collect()
+fn remove_padding(width: u16, bytes_pp: usize, pixels: &[u8], stride: usize) -> Vec<u8>{
+    pixels.chunks(stride).flat_map(|s| s[0..width as usize * bytes_pp].iter().map(|v| *v)).collect()
 }
 /// Creates a frame from pixels in RGBA format.
 ///
 /// *Note: This method is not optimized for speed.*
 pub fn from_bgra_with_stride(width: u16, height: u16, pixels: &mut [u8], stride: usize) -> ::gif::Frame<'static> {
-    let mut without_padding = remove_padding(width, pixels, stride);
+    let mut without_padding = remove_padding(width, 4, pixels, stride);
     for pix in without_padding.chunks_mut(4) {
         let a = pix[0];
         pix[0] = pix[2];
@@ -166,7 +166,7 @@ pub fn from_bgra_with_stride(width: u16, height: u16, pixels: &mut [u8], stride:
 }
 
 pub fn from_bgrx_with_stride(width: u16, height: u16, pixels: &mut [u8], stride: usize) -> ::gif::Frame<'static> {
-    let mut without_padding = remove_padding(width, pixels, stride);
+    let mut without_padding = remove_padding(width, 4, pixels, stride);
 
     for pix in without_padding.chunks_mut(4) {
         let a = pix[0];
@@ -183,7 +183,7 @@ pub fn from_bgrx_with_stride(width: u16, height: u16, pixels: &mut [u8], stride:
 ///
 /// *Note: This method is not optimized for speed.*
 pub fn from_bgr_with_stride(width: u16, height: u16, pixels: &[u8], stride: usize) -> ::gif::Frame<'static> {
-    let mut without_padding = remove_padding(width, pixels, stride);
+    let mut without_padding = remove_padding(width, 3, pixels, stride);
     for pix in without_padding.chunks_mut(3) {
         let a = pix[0];
         pix[0] = pix[2];
@@ -197,6 +197,44 @@ impl Decoder for ClassicDecoder{
     }
 }
 
+/// Decodes the jpeg in `io` a second time, through a temporary decoder with its own downscale hints, then puts the
+/// stream back where it was so the job's own decoder can carry on. The caller owns the returned frame.
+pub fn decode_jpeg_preview(c: &Context, io: &mut IoProxy, hints: &ffi::DecoderDownscaleHints) -> Result<*mut BitmapBgra> {
+    let position = io.position(c).map_err(|e| e.at(here!()))?;
+    if !io.seek(c, 0).map_err(|e| e.at(here!()))? {
+        return Err(cerror!(c, "Failed to seek to the start of the jpeg"));
+    }
+    let mut preview = CodecInstance {
+        codec_id: ffi::CodecType::DecodeJpeg as i64,
+        codec_state: ptr::null_mut(),
+        direction: IoDirection::In,
+        io_id: io.io_id(),
+        io: io.get_io_ptr()
+    };
+    let frame = unsafe {
+        if ffi::flow_codec_initialize(c.flow_c(), &mut preview as *mut CodecInstance) &&
+            ffi::flow_codec_decoder_set_downscale_hints(c.flow_c(), &mut preview as *mut CodecInstance, hints, true) {
+            ffi::flow_codec_execute_read_frame(c.flow_c(), &mut preview as *mut CodecInstance)
+        } else {
+            ptr::null_mut()
+        }
+    };
+    let failure = if frame.is_null() { Some(cerror!(c, "Failed to decode jpeg preview")) } else { None };
+    unsafe {
+        if !preview.codec_state.is_null() {
+            ffi::flow_destroy(c.flow_c(), preview.codec_state, ptr::null(), 0);
+        }
+    }
+    if let Some(e) = failure {
+        return Err(e);
+    }
+    if !io.seek(c, position).map_err(|e| e.at(here!()))? {
+        unsafe { ffi::flow_destroy(c.flow_c(), frame as *const c_void, ptr::null(), 0); }
+        return Err(cerror!(c, "Failed to seek back to {} after decoding jpeg preview", position));
+    }
+    Ok(frame)
+}
+
 struct ClassicEncoder{
     classic: CodecInstance,
     io_id: i32
@@ -299,9 +337,36 @@ impl Encoder for ClassicEncoder{
     }
 }
 
+/// The first output segment is never larger than this; the buffer grows by further segments without copying
+const MAX_FIRST_OUTPUT_SEGMENT: usize = 8 * 1024 * 1024;
+
+/// A conservative guess at the encoded size, used to size the first output buffer segment before encoding.
+/// Guessing low costs another segment or two; guessing high holds memory the encoder never writes to.
+fn estimate_encoded_size(preset: &s::EncoderPreset, frame: &BitmapBgra) -> usize {
+    let pixels = frame.w as usize * frame.h as usize;
+    let body = match *preset {
+        s::EncoderPreset::LibjpegTurbo { quality, .. } => {
+            // Roughly 0.15 bytes per pixel at quality 50, 0.7 at 90, 1 at 100
+            let q = quality.unwrap_or(90).max(0).min(100) as f64 / 100f64;
+            (pixels as f64 * (0.1 + 0.9 * q.powi(4))) as usize
+        },
+        s::EncoderPreset::Libpng { ref depth, .. } => {
+            // Flat artwork compresses to a few percent of its raw size and photos to half or more; start low
+            let bytes_pp = match *depth {
+                Some(s::PngBitDepth::Png24) => 3,
+                _ => 4
+            };
+            pixels * bytes_pp / 8
+        },
+        s::EncoderPreset::Gif => pixels / 4,
+    };
+    (body + 4096).min(MAX_FIRST_OUTPUT_SEGMENT)
+}
+
 impl CodecInstanceContainer{
 
      pub fn write_frame(&mut self, c: &Context, preset: &s::EncoderPreset, frame: &mut BitmapBgra) -> Result<s::EncodeResult>{
+         c.get_proxy_mut(self.io_id)?.reserve_output_buffer(c, estimate_encoded_size(preset, frame)).map_err(|e| e.at(here!()))?;
          // Pick encoder
          if let CodecKind::EncoderPlaceholder = self.codec{
              match *preset {
@@ -23,6 +23,8 @@ pub struct Context {
     pub next_stable_node_id: i32,
     pub next_graph_version: i32,
     pub max_calc_flatten_execute_passes: i32,
+    /// Pixel bytes copied during the current job because two nodes needed to mutate the same frame
+    pub bitmap_bytes_copied: u64,
     pub graph_recording: s::Build001GraphRecording,
     pub codecs: AddRemoveSet<CodecInstanceContainer>,
     pub io_id_list: RefCell<Vec<i32>>
@@ -48,6 +50,7 @@ impl Context {
                 next_graph_version: 0,
                 next_stable_node_id: 0,
                 max_calc_flatten_execute_passes: 40,
+                bitmap_bytes_copied: 0,
                 graph_recording: s::Build001GraphRecording::off(),
                 io_proxies: AddRemoveSet::with_capacity(2),
                 codecs: AddRemoveSet::with_capacity(4),
@@ -158,6 +161,10 @@ impl Context {
         self.get_io(io_id).map_err(|e| e.at(here!()))?.get_output_buffer_bytes(self).map_err(|e| e.at(here!()))
     }
 
+    pub fn get_output_buffer_segments<'b>(&'b self, io_id: i32) -> Result<&'b [::ffi::BufferSegment]> {
+        self.get_io(io_id).map_err(|e| e.at(here!()))?.get_output_buffer_segments(self).map_err(|e| e.at(here!()))
+    }
+
     pub fn add_file(&mut self, io_id: i32, direction: IoDirection, path: &str) -> Result<()> {
         let mode = match direction {
             s::IoDirection::In => ::ffi::IoMode::ReadSeekable,
@@ -243,9 +250,13 @@ impl Context {
 
         ::parsing::IoTranslator{}.add_all( self, parsed.io.clone())?;
 
+        self.bitmap_bytes_copied = 0;
         ::flow::execution_engine::Engine::create(self, & mut g).execute().map_err(|e| e.at(here!())) ?;
 
-        Ok(s::ResponsePayload::BuildResult(s::JobResult { encodes: self.collect_augmented_encode_results( & g, &parsed.io) }))
+        Ok(s::ResponsePayload::BuildResult(s::JobResult {
+            encodes: self.collect_augmented_encode_results( & g, &parsed.io),
+            performance: Some(self.job_performance(&g))
+        }))
     }
     pub fn configure_graph_recording(&mut self, recording: s::Build001GraphRecording) {
         let r = if std::env::var("CI").and_then(|s| Ok(s.to_uppercase())) ==
@@ -263,9 +274,24 @@ impl Context {
             self.configure_graph_recording(r);
         }
 
+        self.bitmap_bytes_copied = 0;
         ::flow::execution_engine::Engine::create(self, &mut g).execute().map_err(|e| e.at(here!()))?;
 
-        Ok(s::ResponsePayload::JobResult(s::JobResult { encodes: Context::collect_encode_results(&g) }))
+        Ok(s::ResponsePayload::JobResult(s::JobResult {
+            encodes: Context::collect_encode_results(&g),
+            performance: Some(self.job_performance(&g))
+        }))
+    }
+
+    pub fn job_performance(&self, g: &Graph) -> s::JobPerformance {
+        s::JobPerformance {
+            bitmap_bytes_copied: self.bitmap_bytes_copied,
+            nodes: g.raw_nodes().iter().map(|n| s::NodePerf {
+                stable_id: n.weight.stable_id,
+                name: n.weight.def.name().to_owned(),
+                wall_microseconds: n.weight.cost.wall_ns as u64 / 1000,
+            }).collect(),
+        }
     }
 
     pub fn collect_encode_results(g: &Graph) -> Vec<s::EncodeResult>{
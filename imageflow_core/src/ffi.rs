@@ -45,7 +45,7 @@ pub struct ImageflowJobIo {
     mode: IoMode,// Call nothing, dereference nothing, if this is 0
     pub read_fn: Option<IoReadFn>,// Optional for write modes
     pub write_fn: Option<IoWriteFn>,// Optional for read modes
-    position_fn: Option<IoPositionFn>, // Optional for sequential modes
+    pub position_fn: Option<IoPositionFn>, // Optional for sequential modes
     pub seek_fn: Option<IoSeekFn>, // Optional for sequential modes
     dispose_fn: Option<DestructorFn>,// Optional
     user_data: *mut c_void,
@@ -54,6 +54,14 @@ pub struct ImageflowJobIo {
     optional_file_length: i64
 }
 
+/// One piece of an output buffer; see `flow_io_get_output_buffer_segments`
+#[repr(C)]
+#[derive(Debug,Copy,Clone)]
+pub struct BufferSegment {
+    pub data: *const u8,
+    pub length: libc::size_t,
+}
+
 #[repr(C)]
 #[derive(Debug,Copy,Clone, PartialEq)]
 pub enum IoMode {
@@ -106,6 +114,25 @@ pub enum Floatspace {
     Linear = 1, // gamma = 2,
 }
 
+/// Stages of a flow_gaussian_blur_job; every band of one stage must finish before the next stage starts
+#[repr(C)]
+#[derive(Copy,Clone, Debug,  PartialEq)]
+pub enum GaussianBlurStage {
+    Rows = 0,
+    Columns = 1,
+    Output = 2,
+}
+
+/// Which block kernel flow_bitmap_bgra_transpose_rows uses; Auto picks the fastest the CPU supports
+#[repr(C)]
+#[derive(Copy,Clone, Debug,  PartialEq)]
+pub enum TransposeKernel {
+    Auto = 0,
+    Scalar = 1,
+    Sse = 2,
+    Avx = 3,
+}
+
 
 
 
@@ -209,17 +236,36 @@ pub struct BitmapBgra {
     pub matte_color: [u8; 4],
 
     pub compositing_mode: BitmapCompositingMode,
+
+    /// If true, `pixels` points into another bitmap's buffer (see `flow_bitmap_bgra_create_view`)
+    pub pixels_borrowed: bool,
 }
 
 
 impl BitmapBgra{
+    /// The last row of a view may end well before `stride`, so the slice stops at the final pixel
     pub unsafe fn pixels_slice_mut(&mut self) -> Option<&mut [u8]>{
         if self.pixels.is_null() {
             None
         }else{
-            Some(::std::slice::from_raw_parts_mut(self.pixels, (self.stride * self.h) as usize))
+            Some(::std::slice::from_raw_parts_mut(self.pixels, self.window_len()))
+        }
+    }
+    /// Bytes from pixel 0,0 through the last pixel of the last row
+    pub fn window_len(&self) -> usize {
+        if self.h == 0 {
+            0
+        } else {
+            self.stride as usize * (self.h as usize - 1) + self.w as usize * self.fmt.bytes()
         }
     }
+    /// True if `other` is a view whose pixels lie within this bitmap's rows
+    pub fn lends_to(&self, other: &BitmapBgra) -> bool {
+        let start = self.pixels as usize;
+        let end = start + self.stride as usize * self.h as usize;
+        let p = other.pixels as usize;
+        other.pixels_borrowed && !self.pixels.is_null() && p >= start && p < end
+    }
     pub fn frame_info(&self) -> ::flow::definitions::FrameInfo {
         ::flow::definitions::FrameInfo {
             w: self.w as i32,
@@ -672,6 +718,13 @@ mod long_term{
                                        format: PixelFormat)
                                        -> *mut BitmapBgra;
 
+        pub fn flow_bitmap_bgra_create_view(c: *mut ImageflowContext,
+                                            source: *mut BitmapBgra,
+                                            x: u32,
+                                            y: u32,
+                                            w: u32,
+                                            h: u32)
+                                            -> *mut BitmapBgra;
 
         pub fn flow_node_execute_scale2d_render1d(c: *mut ImageflowContext,
                                                   input: *mut BitmapBgra,
@@ -772,6 +825,11 @@ mod mid_term {
                                        owner: *const libc::c_void)
                                        -> *mut ImageflowJobIo;
 
+        pub fn flow_io_create_for_mapped_file(context: *mut ImageflowContext,
+                                              filename: *const libc::c_char,
+                                              owner: *const libc::c_void)
+                                              -> *mut ImageflowJobIo;
+
         pub fn flow_io_create_from_memory(context: *mut ImageflowContext,
                                           mode: IoMode,
                                           memory: *const u8,
@@ -793,6 +851,17 @@ mod mid_term {
                                          result_buffer_length: *mut libc::size_t)
                                          -> bool;
 
+        pub fn flow_io_get_output_buffer_segments(context: *mut ImageflowContext,
+                                                  io: *mut ImageflowJobIo,
+                                                  result_segments: *mut *const BufferSegment,
+                                                  result_count: *mut libc::size_t)
+                                                  -> bool;
+
+        pub fn flow_io_output_buffer_reserve(context: *mut ImageflowContext,
+                                             io: *mut ImageflowJobIo,
+                                             byte_count: libc::size_t)
+                                             -> bool;
+
 
 
         pub fn flow_codec_initialize(c: *mut ImageflowContext, instance: *mut CodecInstance) -> bool;
@@ -817,9 +886,21 @@ mod mid_term {
         pub fn detect_content(c: *mut ImageflowContext, input: *mut BitmapBgra, threshold: u32 ) -> Rect;
 
         pub fn flow_bitmap_bgra_populate_histogram(c: *mut ImageflowContext, input: *mut BitmapBgra, histograms: *mut u64, histogram_size_per_channel: u32, histogram_count: u32, pixels_sampled: *mut u64) -> bool;
+        pub fn flow_histogram_job_create(c: *mut ImageflowContext, input: *mut BitmapBgra, histogram_size_per_channel: u32, histogram_count: u32, sample_step: u32, band_count: u32) -> *mut libc::c_void;
+        pub fn flow_histogram_job_band_count(job: *mut libc::c_void) -> u32;
+        pub fn flow_histogram_job_run_band(c: *mut ImageflowContext, job: *mut libc::c_void, band_index: u32) -> bool;
+        pub fn flow_histogram_job_merge(c: *mut ImageflowContext, job: *mut libc::c_void, histograms: *mut u64, pixels_sampled: *mut u64) -> bool;
+        pub fn flow_histogram_sample_step_for_error(w: u32, h: u32, max_error: f64) -> u32;
         pub fn flow_bitmap_bgra_apply_color_matrix(c: *mut ImageflowContext, input: *mut BitmapBgra, row: u32, count: u32, matrix: *const *const f32) -> bool;
+        pub fn flow_bitmap_bgra_apply_channel_luts(c: *mut ImageflowContext, input: *mut BitmapBgra, from_row: u32, row_count: u32, luts: *const u8) -> bool;
 
         pub fn flow_bitmap_bgra_transpose(c: *mut ImageflowContext, input: *mut BitmapBgra, output: *mut BitmapBgra) -> bool;
+        pub fn flow_bitmap_bgra_transpose_rows(c: *mut ImageflowContext, input: *mut BitmapBgra, output: *mut BitmapBgra, from_row: u32, row_count: u32, kernel: TransposeKernel) -> bool;
+
+        pub fn flow_gaussian_blur_job_create(c: *mut ImageflowContext, bitmap: *mut BitmapBgra, sigma: f32, space: Floatspace, band_count: u32) -> *mut libc::c_void;
+        pub fn flow_unsharp_mask_job_create(c: *mut ImageflowContext, bitmap: *mut BitmapBgra, sigma: f32, amount: f32, space: Floatspace, band_count: u32) -> *mut libc::c_void;
+        pub fn flow_gaussian_blur_job_band_count(job: *mut libc::c_void) -> u32;
+        pub fn flow_gaussian_blur_job_run_band(c: *mut ImageflowContext, job: *mut libc::c_void, stage: GaussianBlurStage, band_index: u32) -> bool;
 
 
 }
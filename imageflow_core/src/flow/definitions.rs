@@ -232,20 +232,24 @@ pub trait NodeDef: ::std::fmt::Debug{
         self.as_one_input_one_canvas().is_some() || self.as_one_mutate_bitmap().is_some()
     }
 
+    /// Nodes that write to their input frame get it copy-on-write; the engine runs them after
+    /// their siblings when it can, so the copy is rarely needed.
+    fn mutates_input(&self) -> bool {
+        self.as_one_mutate_bitmap().is_some()
+    }
+
     fn execute(&self, ctx: &mut OpCtxMut, ix: NodeIndex) -> Result<NodeResult>{
         if let Some(n) = self.as_one_input_one_canvas(){
             let input = ctx.bitmap_bgra_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()))?;
-            let canvas = ctx.bitmap_bgra_from(ix, EdgeKind::Canvas).map_err(|e| e.at(here!()))?;
-
-            ctx.consume_parent_result(ix, EdgeKind::Canvas)?;
+            // The canvas is written to, so it must not be (or be seen through) a view another branch still reads
+            let canvas = ctx.bitmap_bgra_for_mutation(ix, EdgeKind::Canvas).map_err(|e| e.at(here!()))?;
 
             n.render(ctx.c, unsafe { &mut *canvas }, unsafe { &mut *input }, &ctx.weight(ix).params).map_err(|e| e.at(here!()).with_ctx_mut(ctx,ix))?;
 
             Ok(NodeResult::Frame(canvas))
 
         } else if let Some(n) = self.as_one_mutate_bitmap(){
-            let input = ctx.bitmap_bgra_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()).with_ctx_mut(ctx,ix))?;
-            ctx.consume_parent_result(ix, EdgeKind::Input)?;
+            let input = ctx.bitmap_bgra_for_mutation(ix, EdgeKind::Input).map_err(|e| e.at(here!()).with_ctx_mut(ctx,ix))?;
 
             n.mutate(ctx.c, unsafe { &mut *input }, &ctx.weight(ix).params).map_err(|e| e.at(here!()))?;
 
@@ -262,6 +266,8 @@ pub trait NodeDef: ::std::fmt::Debug{
 }
 
 
+/// Public face of a mutating node. Expands to the mutating node itself; the input frame is shared
+/// copy-on-write (see `OpCtxMut::bitmap_bgra_for_mutation`), so no defensive clone is inserted.
 #[derive(Debug,Clone)]
 pub struct MutProtect<T> where T: NodeDef + 'static{
     pub node: &'static T,
@@ -293,12 +299,7 @@ impl<T> NodeDefOneInputExpand for MutProtect<T> where T: NodeDef{
         self.fqn
     }
     fn expand(&self, ctx: &mut OpCtxMut, ix: NodeIndex, params: NodeParams, parent: FrameInfo) -> Result<()>{
-        let mut new_nodes = Vec::with_capacity(2);
-        if ctx.has_other_children(ctx.first_parent_input(ix).unwrap(), ix) {
-            new_nodes.push(Node::n(self.node, NodeParams::None));
-        }
-        new_nodes.push(Node::n(&*self.node, ctx.weight(ix).params.clone()));
-        ctx.replace_node(ix, new_nodes);
+        ctx.replace_node(ix, vec![Node::n(&*self.node, params)]);
         Ok(())
     }
 }
@@ -461,7 +462,7 @@ impl From<s::Node> for Node {
     fn from(node: s::Node) -> Node {
         match node {
             s::Node::Crop { .. } => Node::n(&nodes::CROP, NodeParams::Json(node)),
-            //s::Node::CropWhitespace { .. } => Node::n(&nodes::CROP_WHITESPACE, NodeParams::Json(node)),
+            s::Node::CropWhitespace { .. } => Node::n(&nodes::CROP_WHITESPACE, NodeParams::Json(node)),
             s::Node::Decode { .. } => Node::n(&nodes::DECODER, NodeParams::Json(node)),
             s::Node::FlowBitmapBgraPtr { .. } => {
                 Node::n(&nodes::BITMAP_BGRA_POINTER, NodeParams::Json(node))
@@ -499,6 +500,12 @@ impl From<s::Node> for Node {
             s::Node::ColorFilterSrgb { ..} => {
                 Node::n(&nodes::COLOR_FILTER_SRGB, NodeParams::Json(node))
             },
+            s::Node::GaussianBlur { ..} => {
+                Node::n(&nodes::GAUSSIAN_BLUR, NodeParams::Json(node))
+            },
+            s::Node::UnsharpMask { ..} => {
+                Node::n(&nodes::UNSHARP_MASK, NodeParams::Json(node))
+            },
 
         }
     }
@@ -7,6 +7,7 @@ use std::process::Command;
 use ::rustc_serialize::base64::ToBase64;
 use super::visualize::{notify_graph_changed, GraphRecordingUpdate, GraphRecordingInfo};
 use petgraph::EdgeDirection;
+use petgraph::visit::EdgeRef;
 
 pub struct Engine<'a, 'b> where 'a: 'b {
     c: &'a Context,
@@ -249,7 +250,9 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
             ctx.weight_mut(node_id).frame_est = v;
         }
 
-        ctx.weight_mut(node_id).cost.wall_ns += (time::precise_time_ns() - now) as u32;
+        let elapsed = (time::precise_time_ns() - now).min(::std::u32::MAX as u64) as u32;
+        let cost = &mut ctx.weight_mut(node_id).cost;
+        cost.wall_ns = cost.wall_ns.saturating_add(elapsed);
         result
     }
 
@@ -397,6 +400,8 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
         // AND who are not already complete
         loop {
             let mut next = None;
+            // Mutating a frame that siblings still need forces a copy; run everything else first
+            let mut next_needing_copy = None;
             for ix in 0..(self.g.node_count()) {
                 let index = NodeIndex::new(ix);
                 let def = self.g.node_weight(index).unwrap().def;
@@ -411,6 +416,12 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
 
                             let _ = self.estimate_node_recursive(index,100).map_err(|e| e.at(here!()))?;
                         }
+                        if self.mutation_requires_copy(index) {
+                            if next_needing_copy.is_none() {
+                                next_needing_copy = Some((index, def));
+                            }
+                            continue;
+                        }
                         next = Some((index, def));
                         break;
                     }
@@ -419,12 +430,22 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
                     return Err(nerror!(::ErrorKind::MethodNotImplemented, "Nodes must can_execute() or can_expand(). {:?} does neither", def).into());
                 }
             }
-            match next {
+            if next.is_none() && next_needing_copy.is_some() && self.expansion_pending() {
+                // A sibling may turn into a reader once expanded; let the next pass flatten it first
+                return Ok(());
+            }
+            match next.or(next_needing_copy) {
                 None => return Ok(()),
                 Some((next_ix, def)) => {
                     {
                         let mut ctx = self.op_ctx_mut();
+                        let now = time::precise_time_ns();
                         let result = def.execute(&mut ctx, next_ix).map_err(|e| e.with_ctx_mut(&ctx, next_ix).at(here!()))?;
+                        {
+                            let elapsed = (time::precise_time_ns() - now).min(::std::u32::MAX as u64) as u32;
+                            let cost = &mut ctx.weight_mut(next_ix).cost;
+                            cost.wall_ns = cost.wall_ns.saturating_add(elapsed);
+                        }
                         if result == NodeResult::None {
                             return Err(nerror!(::ErrorKind::InvalidOperation, "Node {} execution returned {:?}", def.name(), result).into());
                         }else{
@@ -463,6 +484,7 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
                             }
                         }
                     }
+                    self.release_completed_frames()?;
                 }
             }
 
@@ -476,6 +498,63 @@ impl<'a, 'b> Engine<'a, 'b> where 'a: 'b {
         }
     }
 
+    /// True if the node would mutate an input frame that another child has yet to read
+    fn mutation_requires_copy(&self, ix: NodeIndex) -> bool {
+        if !self.g.node_weight(ix).unwrap().def.mutates_input() {
+            return false;
+        }
+        self.g
+            .graph()
+            .edges_directed(ix, EdgeDirection::Incoming)
+            .filter(|e| e.weight() == &EdgeKind::Input)
+            .any(|e| {
+                self.g
+                    .graph()
+                    .neighbors_directed(e.source(), EdgeDirection::Outgoing)
+                    .any(|sibling| sibling != ix && self.g.node_weight(sibling).unwrap().result == NodeResult::None)
+            })
+    }
+
+    fn expansion_pending(&self) -> bool {
+        (0..self.g.node_count()).map(NodeIndex::new).any(|ix| {
+            self.g.node_weight(ix).unwrap().def.can_expand() && self.parents_complete(ix)
+        })
+    }
+
+    /// Frees frames that every child has finished with, so their pixel buffers go back to the
+    /// context's bitmap pool in time for the nodes that haven't executed yet.
+    fn release_completed_frames(&mut self) -> Result<()> {
+        for ix in 0..self.g.node_count() {
+            let index = NodeIndex::new(ix);
+            let bitmap = match self.g.node_weight(index).unwrap().result {
+                NodeResult::Frame(ptr) if !ptr.is_null() => ptr,
+                _ => continue
+            };
+            // Frames supplied by the caller aren't ours to free
+            if let NodeParams::Json(s::Node::FlowBitmapBgraPtr { .. }) = self.g.node_weight(index).unwrap().params {
+                continue;
+            }
+            let mut children = self.g.graph().neighbors_directed(index, EdgeDirection::Outgoing).peekable();
+            // Frames without children are the job's output
+            if children.peek().is_none() {
+                continue;
+            }
+            let children_done = children.all(|child| self.g.node_weight(child).unwrap().result != NodeResult::None);
+            let shared = self.g.raw_nodes().iter().enumerate()
+                .any(|(other, n)| other != ix && n.weight.result == NodeResult::Frame(bitmap));
+
+            if children_done && !shared && !frame_is_lent(&self.g, bitmap) {
+                unsafe {
+                    if !::ffi::flow_destroy(self.flow_c(), bitmap as *const c_void, ptr::null(), 0) {
+                        return Err(cerror!(self.c, "Failed to release frame"));
+                    }
+                }
+                self.g.node_weight_mut(index).unwrap().result = NodeResult::Consumed;
+            }
+        }
+        Ok(())
+    }
+
     fn graph_fully_executed(&self) -> bool {
         for node in self.g.raw_nodes() {
             if node.weight.result == NodeResult::None {
@@ -508,6 +587,19 @@ pub fn flow_node_has_dimensions(g: &Graph, node_id: NodeIndex) -> bool {
         .unwrap_or(false)
 }
 
+/// True while some other node's frame is a view into `bitmap`'s pixels. Such a frame can be neither freed,
+/// re-windowed, nor written to in place.
+pub fn frame_is_lent(g: &Graph, bitmap: *mut ::ffi::BitmapBgra) -> bool {
+    if bitmap.is_null() {
+        return false;
+    }
+    let lender = unsafe { &*bitmap };
+    g.raw_nodes().iter().any(|n| match n.weight.result {
+        NodeResult::Frame(other) if other != bitmap && !other.is_null() => lender.lends_to(unsafe { &*other }),
+        _ => false
+    })
+}
+
 pub fn inputs_estimated(g: &Graph, node_id: NodeIndex) -> bool {
     inputs_estimates(g, node_id).iter().all(|est| match *est {
         FrameEstimate::Some(_) => true,
@@ -0,0 +1,104 @@
+use super::internal_prelude::*;
+use ::bands;
+
+pub static GAUSSIAN_BLUR: MutProtect<GaussianBlurMutDef> = MutProtect{ node: &GAUSSIAN_BLUR_MUTATE, fqn: "imazen.gaussian_blur"};
+pub static GAUSSIAN_BLUR_MUTATE: GaussianBlurMutDef = GaussianBlurMutDef{};
+pub static UNSHARP_MASK: MutProtect<UnsharpMaskMutDef> = MutProtect{ node: &UNSHARP_MASK_MUTATE, fqn: "imazen.unsharp_mask"};
+pub static UNSHARP_MASK_MUTATE: UnsharpMaskMutDef = UnsharpMaskMutDef{};
+
+/// The smallest band worth a thread (see bands::band_count), in pixels
+const MIN_PIXELS_PER_BAND: u64 = 128 * 1024;
+
+fn band_count_for(bitmap: &BitmapBgra) -> u32 {
+    bands::band_count(bitmap.w as u64 * bitmap.h as u64, MIN_PIXELS_PER_BAND)
+}
+
+/// Bands of one stage touch disjoint rows or columns, and each stage is joined before the next starts
+fn blur_in_bands(c: &Context, job: *mut c_void) -> Result<()> {
+    let bands = unsafe { ::ffi::flow_gaussian_blur_job_band_count(job) };
+    let shared = bands::Shared((c.flow_c(), job));
+    let stages = [::ffi::GaussianBlurStage::Rows, ::ffi::GaussianBlurStage::Columns, ::ffi::GaussianBlurStage::Output];
+    for stage in stages.iter() {
+        let stage = *stage;
+        if !bands::run(bands, move |band| {
+            let (flow_c, job) = shared.0;
+            unsafe { ::ffi::flow_gaussian_blur_job_run_band(flow_c, job, stage, band) }
+        }) {
+            return Err(cerror!(c, "Failed to blur bitmap"));
+        }
+    }
+    Ok(())
+}
+
+fn floatspace_for(blur_colorspace: Option<s::ScalingFloatspace>) -> ::ffi::Floatspace {
+    match blur_colorspace {
+        Some(s::ScalingFloatspace::Srgb) => ::ffi::Floatspace::Srgb,
+        Some(s::ScalingFloatspace::Linear) | None => ::ffi::Floatspace::Linear,
+    }
+}
+
+/// Runs a job from flow_gaussian_blur_job_create or flow_unsharp_mask_job_create to completion, then destroys it
+fn run_job(c: &Context, job: *mut c_void, failure: &str) -> Result<()> {
+    if job.is_null() {
+        return Err(cerror!(c, "{}", failure));
+    }
+    let result = blur_in_bands(c, job);
+    unsafe {
+        ::ffi::flow_destroy(c.flow_c(), job as *const c_void, ptr::null(), 0);
+    }
+    result
+}
+
+#[derive(Debug, Clone)]
+pub struct GaussianBlurMutDef;
+impl NodeDef for GaussianBlurMutDef{
+    fn as_one_mutate_bitmap(&self) -> Option<&NodeDefMutateBitmap>{
+        Some(self)
+    }
+}
+impl NodeDefMutateBitmap for GaussianBlurMutDef{
+    fn fqn(&self) -> &'static str{
+        "imazen.gaussian_blur_mut"
+    }
+    fn mutate(&self, c: &Context, bitmap: &mut BitmapBgra,  p: &NodeParams) -> Result<()> {
+        if let &NodeParams::Json(s::Node::GaussianBlur { sigma, blur_colorspace }) = p {
+            if !(sigma >= 2f32) {
+                return Err(nerror!(::ErrorKind::InvalidNodeParams, "gaussian_blur sigma must be at least 2, got {}", sigma));
+            }
+            let bands = band_count_for(bitmap);
+            // Holds a premultiplied float copy of the frame (16 bytes per pixel) until destroyed
+            let job = unsafe { ::ffi::flow_gaussian_blur_job_create(c.flow_c(), bitmap as *mut BitmapBgra, sigma, floatspace_for(blur_colorspace), bands) };
+            run_job(c, job, "Failed to prepare gaussian blur")
+        } else {
+            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need GaussianBlur, got {:?}", p))
+        }
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct UnsharpMaskMutDef;
+impl NodeDef for UnsharpMaskMutDef{
+    fn as_one_mutate_bitmap(&self) -> Option<&NodeDefMutateBitmap>{
+        Some(self)
+    }
+}
+impl NodeDefMutateBitmap for UnsharpMaskMutDef{
+    fn fqn(&self) -> &'static str{
+        "imazen.unsharp_mask_mut"
+    }
+    fn mutate(&self, c: &Context, bitmap: &mut BitmapBgra,  p: &NodeParams) -> Result<()> {
+        if let &NodeParams::Json(s::Node::UnsharpMask { sigma, amount, blur_colorspace }) = p {
+            if !(sigma >= 2f32) {
+                return Err(nerror!(::ErrorKind::InvalidNodeParams, "unsharp_mask sigma must be at least 2, got {}", sigma));
+            }
+            if !(amount > 0f32) {
+                return Err(nerror!(::ErrorKind::InvalidNodeParams, "unsharp_mask amount must be positive, got {}", amount));
+            }
+            let bands = band_count_for(bitmap);
+            let job = unsafe { ::ffi::flow_unsharp_mask_job_create(c.flow_c(), bitmap as *mut BitmapBgra, sigma, amount, floatspace_for(blur_colorspace), bands) };
+            run_job(c, job, "Failed to prepare unsharp mask")
+        } else {
+            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need UnsharpMask, got {:?}", p))
+        }
+    }
+}
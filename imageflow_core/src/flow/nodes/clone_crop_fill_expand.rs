@@ -7,7 +7,7 @@ pub static CROP: MutProtect<CropMutNodeDef> = MutProtect{node: &CROP_MUTATE, fqn
 pub static CROP_MUTATE: CropMutNodeDef = CropMutNodeDef{};
 pub static CLONE: CloneDef = CloneDef{};
 pub static EXPAND_CANVAS: ExpandCanvasDef = ExpandCanvasDef{};
-//pub static CROP_WHITESPACE: CropWhitespaceDef = CropWhitespaceDef{};
+pub static CROP_WHITESPACE: CropWhitespaceDef = CropWhitespaceDef{};
 
 
 #[derive(Debug, Clone)]
@@ -52,16 +52,16 @@ impl NodeDefOneInputOneCanvas for CopyRectNodeDef{
             }
 
             let bytes_pp = input.fmt.bytes() as u32;
-            if from_x == 0 && x == 0 && width == input.w && width == canvas.w &&
+            if from_x == 0 && x == 0 && height > 0 && width == input.w && width == canvas.w &&
                 input.stride == canvas.stride {
-                //This optimization has the side effect of copying irrelevant data, so we don't want to do it if windowed, only
-                // if padded or permanently cropped.
+                // Copies whatever lies between rows into the canvas padding. The last row stops at the final pixel, since
+                // the input may be a window (or view) whose buffer ends there.
                 unsafe {
                     let from_offset = input.stride * from_y;
                     let from_ptr = input.pixels.offset(from_offset as isize);
                     let to_offset = canvas.stride * y;
                     let to_ptr = canvas.pixels.offset(to_offset as isize);
-                    ptr::copy_nonoverlapping(from_ptr, to_ptr, (input.stride * height) as usize);
+                    ptr::copy_nonoverlapping(from_ptr, to_ptr, (input.stride * (height - 1) + width * bytes_pp) as usize);
                 }
             } else {
                 for row in 0..height {
@@ -225,6 +225,38 @@ impl NodeDefOneInputExpand for ExpandCanvasDef{
 }
 
 
+/// Crops the frame `ix` reads from its input without copying pixels. The frame itself is narrowed if `ix` is its last
+/// reader; otherwise a view of it is returned.
+fn crop_input_frame(ctx: &mut OpCtxMut, ix: NodeIndex, bitmap: *mut BitmapBgra, x1: u32, y1: u32, x2: u32, y2: u32) -> Result<NodeResult> {
+    let input = unsafe { &mut *bitmap };
+    let (w, h) = (input.w, input.h);
+    if x2 <= x1 || y2 <= y1 || x2 > w || y2 > h {
+        return Err(nerror!(::ErrorKind::InvalidNodeParams, "Crop coordinates {},{} {},{} invalid for {}x{} bitmap", x1, y1, x2, y2, w, h));
+    }
+
+    let parent = ctx.first_parent_input(ix).expect(loc!());
+    if ctx.has_other_pending_children(parent, ix) || ctx.frame_is_lent(bitmap) {
+        // Someone else still reads the whole frame; window it through a new header instead
+        let view = unsafe { ::ffi::flow_bitmap_bgra_create_view(ctx.flow_c(), bitmap, x1, y1, x2 - x1, y2 - y1) };
+        if view.is_null() {
+            return Err(cerror!(ctx.c, "Failed to create {}x{} view of {}x{} bitmap", x2 - x1, y2 - y1, w, h));
+        }
+        return Ok(NodeResult::Frame(view));
+    }
+
+    ctx.consume_parent_result(ix, EdgeKind::Input).map_err(|e| e.at(here!()))?;
+    unsafe {
+        let offset = input.stride as isize * y1 as isize +
+            input.fmt.bytes() as isize * x1 as isize;
+        input.pixels = input.pixels.offset(offset);
+    }
+    input.w = x2 - x1;
+    input.h = y2 - y1;
+
+
+    Ok(NodeResult::Frame(input))
+}
+
 #[derive(Debug, Clone)]
 pub struct CropMutNodeDef;
 
@@ -274,85 +306,157 @@ impl NodeDef for CropMutNodeDef{
     fn can_execute(&self) -> bool { true }
 
     fn execute(&self, ctx: &mut OpCtxMut, ix: NodeIndex) -> Result<NodeResult> {
-        let mut input = unsafe {
-            &mut *ctx.bitmap_bgra_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()).with_ctx_mut(ctx, ix))?
-        };
-        ctx.consume_parent_result(ix, EdgeKind::Input)?;
+        let bitmap = ctx.bitmap_bgra_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()).with_ctx_mut(ctx, ix))?;
+        let input = unsafe { &mut *bitmap };
 
         // Validate against actual bitmap
         let _ = self.est_validate(&ctx.weight(ix).params, FrameEstimate::Some(input.frame_info())).map_err(|e| e.at(here!()))?;
 
         if let &NodeParams::Json(s::Node::Crop { x1, x2, y1, y2 }) = &ctx.weight(ix).params {
             // println!("Cropping {}x{} to ({},{}) ({},{})", (*input).w, (*input).h, x1, y1, x2, y2);
+            crop_input_frame(ctx, ix, bitmap, x1, y1, x2, y2)
+        } else {
+            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need Crop, got {:?}", &ctx.weight(ix).params))
+        }
+    }
+}
 
-            let (w, h) = (input.w, input.h);
-            if x2 <= x1 || y2 <= y1 || x2 > w || y2 > h {
-                panic!("Invalid crop bounds {:?} (image {}x{})", ((x1, y1), (x2, y2)), w, h);
-            }
+/// A jpeg is searched for whitespace on an IDCT-downscaled preview once its longer edge reaches twice this
+const WHITESPACE_PREVIEW_MIN_EDGE: i32 = 1024;
 
+/// Finds the content of `bitmap`, maps it onto a `to_w` x `to_h` frame (the same size, unless `bitmap` is a
+/// preview), and pads it by `percent_padding` percent of its average dimension. Returns (x1, y1, x2, y2).
+fn padded_content_bounds(c: &Context, bitmap: *mut BitmapBgra, threshold: u32, percent_padding: f32, to_w: u32, to_h: u32) -> Result<(u32, u32, u32, u32)> {
+    let rect = unsafe { ::ffi::detect_content(c.flow_c(), bitmap, threshold) };
+    if rect == ::ffi::Rect::failure() {
+        return Err(cerror!(c, "Failed to complete whitespace detection"));
+    }
+    if rect.x2 <= rect.x1 || rect.y2 <= rect.y1 {
+        return Err(nerror!(::ErrorKind::InvalidState, "Whitespace detection returned invalid rectangle {:?}", rect));
+    }
+    let (from_w, from_h) = unsafe { ((*bitmap).w, (*bitmap).h) };
+    // Each preview pixel blends its neighbours, so an edge may land one of them further in; widen by one and round outward
+    let widen = if from_w == to_w && from_h == to_h { 0 } else { 1 };
+    let (scale_x, scale_y) = (to_w as f64 / from_w as f64, to_h as f64 / from_h as f64);
+    let x1 = ((rect.x1 - widen).max(0) as f64 * scale_x).floor();
+    let y1 = ((rect.y1 - widen).max(0) as f64 * scale_y).floor();
+    let x2 = ((rect.x2 + widen).min(from_w as i32) as f64 * scale_x).ceil();
+    let y2 = ((rect.y2 + widen).min(from_h as i32) as f64 * scale_y).ceil();
+
+    let padding = (percent_padding as f64 / 100f64 * (x2 - x1 + y2 - y1) / 2f64).ceil();
+    Ok(((x1 - padding).max(0f64) as u32,
+        (y1 - padding).max(0f64) as u32,
+        (x2 + padding).min(to_w as f64) as u32,
+        (y2 + padding).min(to_h as f64) as u32))
+}
 
-            unsafe {
-                let offset = input.stride as isize * y1 as isize +
-                    input.fmt.bytes() as isize * x1 as isize;
-                input.pixels = input.pixels.offset(offset);
-            }
-            input.w = x2 - x1;
-            input.h = y2 - y1;
+/// Turns the CropWhitespace children of a jpeg decoder into plain crops before the frame is decoded, by searching an
+/// IDCT-downscaled preview instead of the full frame. Called from the decoder's expansion, and only while its children
+/// still read the decoded frame as-is. Other formats and smaller images are left for CropWhitespaceDef::execute.
+pub fn crop_whitespace_from_preview(ctx: &mut OpCtxMut, decoder_ix: NodeIndex, io_id: i32) -> Result<()> {
+    let children = ctx.graph
+        .graph()
+        .edges_directed(decoder_ix, EdgeDirection::Outgoing)
+        .filter(|e| e.weight() == &EdgeKind::Input)
+        .filter_map(|e| match ctx.weight(e.target()).params {
+            NodeParams::Json(s::Node::CropWhitespace { threshold, percent_padding }) => Some((e.target(), threshold, percent_padding)),
+            _ => None
+        })
+        .collect::<Vec<_>>();
+    if children.is_empty() {
+        return Ok(());
+    }
+    // Commands on the decoder only reach it once it executes, so get_image_info still reports the size before them
+    // and bounds mapped onto it would not fit the frame actually decoded
+    if let NodeParams::Json(s::Node::Decode { commands: Some(ref commands), .. }) = ctx.weight(decoder_ix).params {
+        if !commands.is_empty() {
+            return Ok(());
+        }
+    }
+    let info = ctx.job.get_image_info(io_id).map_err(|e| e.at(here!()))?;
+    let (w, h) = (info.image_width, info.image_height);
+    if info.preferred_mime_type != "image/jpeg" || cmp::max(w, h) < WHITESPACE_PREVIEW_MIN_EDGE * 2 {
+        return Ok(());
+    }
 
+    // The smallest IDCT scale that keeps the longer edge at WHITESPACE_PREVIEW_MIN_EDGE
+    let long_edge = cmp::max(w, h) as i64;
+    let hints = ::ffi::DecoderDownscaleHints {
+        downscale_if_wider_than: WHITESPACE_PREVIEW_MIN_EDGE as i64,
+        or_if_taller_than: WHITESPACE_PREVIEW_MIN_EDGE as i64,
+        downscaled_min_width: w as i64 * WHITESPACE_PREVIEW_MIN_EDGE as i64 / long_edge,
+        downscaled_min_height: h as i64 * WHITESPACE_PREVIEW_MIN_EDGE as i64 / long_edge,
+        scale_luma_spatially: false,
+        gamma_correct_for_srgb_during_spatial_luma_scaling: false
+    };
+    let preview = {
+        let mut io = ctx.c.get_io(io_id).map_err(|e| e.at(here!()))?;
+        ::codecs::decode_jpeg_preview(ctx.c, &mut *io, &hints).map_err(|e| e.at(here!()))?
+    };
+    let bounds = children.iter()
+        .map(|&(_, threshold, percent_padding)| padded_content_bounds(ctx.c, preview, threshold, percent_padding, w as u32, h as u32))
+        .collect::<Result<Vec<_>>>();
+    unsafe {
+        ::ffi::flow_destroy(ctx.flow_c(), preview as *const c_void, ptr::null(), 0);
+    }
+    for (&(child, _, _), (x1, y1, x2, y2)) in children.iter().zip(bounds.map_err(|e| e.at(here!()))?) {
+        if x2 <= x1 || y2 <= y1 || x2 > w as u32 || y2 > h as u32 {
+            return Err(nerror!(::ErrorKind::InvalidState, "Whitespace bounds {},{} {},{} found on the preview do not fit the {}x{} frame", x1, y1, x2, y2, w, h));
+        }
+        // Mutate instead of replace, so the graph's node indexes stay put
+        let node = ctx.weight_mut(child);
+        node.def = &CROP;
+        node.params = NodeParams::Json(s::Node::Crop { x1: x1, y1: y1, x2: x2, y2: y2 });
+        node.frame_est = FrameEstimate::None;
+    }
+    Ok(())
+}
 
-            Ok(NodeResult::Frame(input))
+#[derive(Debug, Clone)]
+pub struct CropWhitespaceDef;
+
+impl CropWhitespaceDef {
+    fn get(&self, p: &NodeParams) -> Result<(u32, f32)> {
+        if let &NodeParams::Json(s::Node::CropWhitespace { threshold, percent_padding }) = p {
+            if !(percent_padding >= 0f32) {
+                Err(nerror!(::ErrorKind::InvalidNodeParams, "crop_whitespace percent_padding must be zero or more, got {}", percent_padding))
+            } else {
+                Ok((threshold, percent_padding))
+            }
         } else {
-            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need Crop, got {:?}", &ctx.weight(ix).params))
+            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need CropWhitespace, got {:?}", p))
         }
     }
 }
-//
-//#[derive(Debug,Clone)]
-//pub struct CropWhitespaceDef;
-//impl NodeDef for CropWhitespaceDef{
-//    fn as_one_input_expand(&self) -> Option<&NodeDefOneInputExpand>{
-//        Some(self)
-//    }
-//}
-//impl NodeDefOneInputExpand for CropWhitespaceDef {
-//    fn fqn(&self) -> &'static str {
-//        "imazen.crop_whitespace"
-//    }
-//    fn estimate(&self, p: &NodeParams, input: FrameEstimate) -> Result<FrameEstimate> {
-//        Ok((FrameEstimate::Impossible))
-//    }
-////TODO: mark as risky
-//    fn expand(&self, ctx: &mut OpCtxMut, ix: NodeIndex, p: NodeParams, b: FrameInfo) -> Result<()> {
-//        // detect bounds, increase, and replace with crop
-//        if let NodeParams::Json(s::Node::CropWhitespace { threshold, percent_padding }) = p {
-//            // detect bounds, increase, and replace with crop
-//            let (x1, y1, x2, y2) = match ctx.first_parent_input_weight(ix).unwrap().result {
-//                NodeResult::Frame(b) => {
-//                    unsafe {
-//                        let rect = ::ffi::detect_content(ctx.c.flow_c(), b, threshold);
-//                        if rect == ::ffi::Rect::failure(){
-//                            return Err(cerror!(ctx.c, "Failed to complete whitespace detection"));
-//                        }
-//                        if rect.x2 <= rect.x1 || rect.y2 <= rect.y1{
-//                            return Err(nerror!(::ErrorKind::InvalidState, "Whitespace detection returned invalid rectangle"));
-//                        }
-//                        let padding = (percent_padding * (rect.x2 - rect.x1 + rect.y2 - rect.y1) as f32 / 2f32).ceil() as i32;
-//                        Ok((cmp::max(0, rect.x1 - padding) as u32, cmp::max(0, rect.y1 - padding) as u32,
-//                            cmp::min((*b).w as i32, rect.x2 + padding) as u32, cmp::min((*b).h as i32, rect.y2 + padding) as u32))
-//                    }
-//                },
-//                other => { Err(nerror!(::ErrorKind::InvalidOperation, "Cannot CropWhitespace without a parent bitmap; got {:?}", other)) }
-//            }?;
-//            ctx.replace_node(ix, vec![
-//                Node::n(&CROP,
-//                        NodeParams::Json(s::Node::Crop { x1: x1, y1: y1, x2: x2, y2: y2 }))
-//            ]);
-//
-//
-//            Ok(())
-//        } else {
-//            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need CropWhitespace, got {:?}", p))
-//        }
-//    }
-//}
-//
+
+impl NodeDef for CropWhitespaceDef {
+    fn fqn(&self) -> &'static str {
+        "imazen.crop_whitespace"
+    }
+    fn edges_required(&self, p: &NodeParams) -> Result<(EdgesIn, EdgesOut)> {
+        Ok((EdgesIn::OneInput, EdgesOut::Any))
+    }
+
+    fn validate_params(&self, p: &NodeParams) -> Result<()> {
+        self.get(p).map(|_| ()).map_err(|e| e.at(here!()))
+    }
+
+    fn estimate(&self, ctx: &mut OpCtxMut, ix: NodeIndex) -> Result<FrameEstimate> {
+        let input_est = ctx.frame_est_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()))?;
+        // Until the pixels are searched, all we know is that the result won't be larger
+        Ok(match input_est {
+            FrameEstimate::Some(info) | FrameEstimate::UpperBound(info) => FrameEstimate::UpperBound(info),
+            other => other
+        })
+    }
+
+    fn can_execute(&self) -> bool { true }
+
+    fn execute(&self, ctx: &mut OpCtxMut, ix: NodeIndex) -> Result<NodeResult> {
+        let (threshold, percent_padding) = self.get(&ctx.weight(ix).params).map_err(|e| e.at(here!()))?;
+        let bitmap = ctx.bitmap_bgra_from(ix, EdgeKind::Input).map_err(|e| e.at(here!()).with_ctx_mut(ctx, ix))?;
+        let (w, h) = unsafe { ((*bitmap).w, (*bitmap).h) };
+        let (x1, y1, x2, y2) = padded_content_bounds(ctx.c, bitmap, threshold, percent_padding, w, h).map_err(|e| e.at(here!()))?;
+        crop_input_frame(ctx, ix, bitmap, x1, y1, x2, y2)
+    }
+}
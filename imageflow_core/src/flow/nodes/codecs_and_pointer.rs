@@ -127,9 +127,15 @@ impl NodeDef for DecoderDef {
 
     fn expand(&self, ctx: &mut OpCtxMut, ix: NodeIndex) -> Result<()> {
         let io_id = decoder_get_io_id(&ctx.weight(ix).params)?;
+        let exif_flag = ctx.job.get_exif_rotation_flag(io_id).map_err(|e| e.at(here!()))?;
+
+        // Whitespace found on a preview is only valid for children that see the frame unrotated
+        if exif_flag.unwrap_or(0) <= 1 {
+            super::clone_crop_fill_expand::crop_whitespace_from_preview(ctx, ix, io_id).map_err(|e| e.at(here!()))?;
+        }
 
         // Add the neccessary rotation step afterwards
-        if let Some(exif_flag) = ctx.job.get_exif_rotation_flag(io_id).map_err(|e| e.at(here!()))?{
+        if let Some(exif_flag) = exif_flag {
             if exif_flag > 0 {
                 let new_node = ctx.graph
                     .add_node(Node::n(&APPLY_ORIENTATION,
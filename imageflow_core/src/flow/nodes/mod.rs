@@ -14,6 +14,7 @@ mod codecs_and_pointer;
 mod constrain;
 mod white_balance;
 mod color;
+mod blur;
 
 mod internal_prelude {
     pub use ::ffi;
@@ -32,7 +33,7 @@ extern crate imageflow_types as s;
 pub use self::clone_crop_fill_expand::CLONE;
 pub use self::clone_crop_fill_expand::COPY_RECT;
 pub use self::clone_crop_fill_expand::CROP;
-//pub use self::clone_crop_fill_expand::CROP_WHITESPACE;
+pub use self::clone_crop_fill_expand::CROP_WHITESPACE;
 pub use self::clone_crop_fill_expand::CROP_MUTATE;
 pub use self::clone_crop_fill_expand::EXPAND_CANVAS;
 pub use self::clone_crop_fill_expand::FILL_RECT;
@@ -61,6 +62,10 @@ pub use self::white_balance::WHITE_BALANCE_SRGB;
 pub use self::color::COLOR_MATRIX_SRGB_MUTATE;
 pub use self::color::COLOR_MATRIX_SRGB;
 pub use self::color::COLOR_FILTER_SRGB;
+pub use self::blur::GAUSSIAN_BLUR;
+pub use self::blur::GAUSSIAN_BLUR_MUTATE;
+pub use self::blur::UNSHARP_MASK;
+pub use self::blur::UNSHARP_MASK_MUTATE;
 
 #[macro_use]
 use super::definitions::*;
@@ -159,6 +164,17 @@ impl<'c> OpCtxMut<'c> {
             .any(|n| n != except_child)
     }
 
+    /// True if a child other than `except_child` has yet to execute, and may still read `of_node`'s frame
+    pub fn has_other_pending_children(&self,
+                                      of_node: NodeIndex,
+                                      except_child: NodeIndex)
+                                      -> bool {
+        self.graph
+            .graph()
+            .neighbors_directed(of_node, EdgeDirection::Outgoing)
+            .any(|n| n != except_child && self.graph.node_weight(n).unwrap().result == NodeResult::None)
+    }
+
     pub fn weight(&self, ix: NodeIndex) -> &Node {
         self.graph.node_weight(ix).unwrap()
     }
@@ -202,6 +218,42 @@ impl<'c> OpCtxMut<'c> {
             Err(nerror!(::ErrorKind::InvalidOperation, "Parent {:?} node lacks NodeResult::Frame(bitmap). Value is {:?}", filter_by_kind, result).with_ctx_mut(self, ix))
         }
     }
+    pub fn frame_is_lent(&self, bitmap: *mut BitmapBgra) -> bool {
+        ::flow::execution_engine::frame_is_lent(&*self.graph, bitmap)
+    }
+
+    /// Copy-on-write access to a parent's frame. When no other child still needs the frame, it is
+    /// consumed and handed over for in-place mutation. Otherwise a private copy is returned, and its
+    /// size is added to the job's `bitmap_bytes_copied`.
+    pub fn bitmap_bgra_for_mutation(&mut self, ix: NodeIndex, filter_by_kind: EdgeKind) -> Result<*mut BitmapBgra> {
+        let bitmap = self.bitmap_bgra_from(ix, filter_by_kind)?;
+        let parent = self.first_parent_of_kind_required(ix, filter_by_kind)?;
+
+        // Writing through a view would change its lender, and writing to a lender would change its views
+        let borrowed = unsafe { (*bitmap).pixels_borrowed };
+        if !borrowed && !self.has_other_pending_children(parent, ix) && !self.frame_is_lent(bitmap) {
+            self.consume_parent_result(ix, filter_by_kind)?;
+            return Ok(bitmap);
+        }
+        unsafe {
+            let source = &*bitmap;
+            let copy = ::ffi::flow_bitmap_bgra_create(self.flow_c(), source.w as i32, source.h as i32, false, source.fmt);
+            if copy.is_null() {
+                return Err(cerror!(self.c, "Failed to allocate {}x{} copy of shared bitmap", source.w, source.h));
+            }
+            let row_bytes = source.w as usize * source.fmt.bytes();
+            for row in 0..source.h as isize {
+                ::std::ptr::copy_nonoverlapping(source.pixels.offset(row * source.stride as isize),
+                                                (*copy).pixels.offset(row * (*copy).stride as isize),
+                                                row_bytes);
+            }
+            (*copy).matte_color = source.matte_color;
+            (*copy).compositing_mode = source.compositing_mode;
+            self.job.bitmap_bytes_copied += (row_bytes * source.h as usize) as u64;
+            Ok(copy)
+        }
+    }
+
     pub fn consume_parent_result(&mut self, ix: NodeIndex, filter_by_kind: EdgeKind) -> Result<()> {
         let parent = self.first_parent_of_kind_required(ix, filter_by_kind)?;
 
@@ -1,4 +1,5 @@
 use super::internal_prelude::*;
+use ::bands;
 
 pub static FLIP_V_PRIMITIVE: FlipVerticalMutNodeDef = FlipVerticalMutNodeDef{} ;
 pub static FLIP_H_PRIMITIVE: FlipHorizontalMutNodeDef = FlipHorizontalMutNodeDef{};
@@ -122,6 +123,28 @@ impl NodeDefOneInputExpand for NoOpDef {
 }
 
 
+/// The smallest band worth a thread (see bands::band_count), in pixels
+const MIN_PIXELS_PER_TRANSPOSE_BAND: u64 = 512 * 1024;
+/// Band boundaries fall on whole 8x8 tiles, so only the last band copies leftover rows one pixel at a time
+const TRANSPOSE_BAND_ALIGN: u32 = 8;
+
+/// Bands write disjoint columns of the canvas and only read the input
+fn transpose_in_bands(c: &Context, input: *mut BitmapBgra, canvas: *mut BitmapBgra) -> Result<()> {
+    let (w, h) = unsafe { ((*input).w, (*input).h) };
+    let bands = bands::band_count(w as u64 * h as u64, MIN_PIXELS_PER_TRANSPOSE_BAND)
+        .min(h / TRANSPOSE_BAND_ALIGN)
+        .max(1);
+    let shared = bands::Shared((c.flow_c(), input, canvas));
+    let transposed = bands::run(bands, move |band| {
+        let (flow_c, input, canvas) = shared.0;
+        let (from, until) = bands::band_rows(h, bands, band);
+        let from = from / TRANSPOSE_BAND_ALIGN * TRANSPOSE_BAND_ALIGN;
+        let until = if band + 1 == bands { h } else { until / TRANSPOSE_BAND_ALIGN * TRANSPOSE_BAND_ALIGN };
+        unsafe { ::ffi::flow_bitmap_bgra_transpose_rows(flow_c, input, canvas, from, until - from, ::ffi::TransposeKernel::Auto) }
+    });
+    if transposed { Ok(()) } else { Err(cerror!(c, "Failed to transpose bitmap")) }
+}
+
 #[derive(Debug, Clone)]
 pub struct TransposeMutDef;
 
@@ -140,19 +163,13 @@ impl NodeDefOneInputOneCanvas for TransposeMutDef {
     }
 
     fn render(&self, c: &Context, canvas: &mut BitmapBgra, input: &mut BitmapBgra, p: &NodeParams) -> Result<()> {
-        unsafe {
-            if input.fmt != canvas.fmt {
-                panic!("Can't copy between bitmaps with different pixel formats")
-            }
-            if input == canvas {
-                panic!("Canvas and input must be different bitmaps for transpose to work!")
-            }
-
-            if !::ffi::flow_bitmap_bgra_transpose(c.flow_c(), input as *mut BitmapBgra, canvas as *mut BitmapBgra) {
-                panic!("Failed to transpose bitmap")
-            }
+        if input.fmt != canvas.fmt {
+            panic!("Can't copy between bitmaps with different pixel formats")
         }
-        Ok(())
+        if input == canvas {
+            panic!("Canvas and input must be different bitmaps for transpose to work!")
+        }
+        transpose_in_bands(c, input as *mut BitmapBgra, canvas as *mut BitmapBgra)
     }
 }
 
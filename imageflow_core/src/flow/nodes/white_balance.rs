@@ -1,5 +1,6 @@
 #[macro_use]
 use super::internal_prelude::*;
+use ::bands;
 // TODO: someday look into better algorithms - see http://colorconstancy.com/ and http://ipg.fer.hr/ipg/resources/color_constancy
 // http://localhost:39876/ir4/proxy_unsplash/photo-1496264057429-6a331647b69e?a.balancewhite=true&w=800
 // http://localhost:39876/ir4/proxy_unsplash/photo-1496264057429-6a331647b69e?w=800
@@ -10,6 +11,42 @@ use super::internal_prelude::*;
 
 
 
+/// The smallest histogram band worth a thread (see bands::band_count), in samples
+const MIN_SAMPLES_PER_BAND: u64 = 512 * 1024;
+
+/// The smallest mapping band worth a thread, in pixels
+const MIN_PIXELS_PER_MAPPING_BAND: u64 = 1024 * 1024;
+
+/// Red, green and blue histograms of `bitmap`, and the number of pixels sampled. Every pixel is counted unless
+/// `sample_max_error` is given, in which case large frames are sampled on a grid (see flow_histogram_sample_step_for_error).
+fn populate_histograms(c: &Context, bitmap: *mut BitmapBgra, sample_max_error: Option<f32>) -> Result<([u64; 768], u64)> {
+    let (w, h) = unsafe { ((*bitmap).w, (*bitmap).h) };
+    let step = match sample_max_error {
+        Some(max_error) => unsafe { ::ffi::flow_histogram_sample_step_for_error(w, h, max_error as f64) },
+        None => 1
+    };
+    let samples = ((w + step - 1) / step) as u64 * ((h + step - 1) / step) as u64;
+    let bands = bands::band_count(samples, MIN_SAMPLES_PER_BAND);
+
+    let job = unsafe { ::ffi::flow_histogram_job_create(c.flow_c(), bitmap, 256, 3, step, bands) };
+    if job.is_null() {
+        return Err(cerror!(c, "Failed to prepare histogram"));
+    }
+    // Each band counts its own rows into its own counters
+    let shared = bands::Shared((c.flow_c(), job));
+    let mut histograms = [0u64; 768];
+    let mut pixels_sampled = 0u64;
+    let counted = bands::run(unsafe { ::ffi::flow_histogram_job_band_count(job) }, move |band| {
+        let (flow_c, job) = shared.0;
+        unsafe { ::ffi::flow_histogram_job_run_band(flow_c, job, band) }
+    }) && unsafe { ::ffi::flow_histogram_job_merge(c.flow_c(), job, histograms.as_mut_ptr(), &mut pixels_sampled as *mut u64) };
+    let result = if counted { Ok((histograms, pixels_sampled)) } else { Err(cerror!(c, "Failed to populate histogram")) };
+    unsafe {
+        ::ffi::flow_destroy(c.flow_c(), job as *const c_void, ptr::null(), 0);
+    }
+    result
+}
+
 fn area_threshold(histogram: &[u64], total_pixels: u64, low_threshold: f64, high_threshold: f64) -> (usize, usize){
     let mut low = 0;
     let mut high = histogram.len() - 1;
@@ -41,53 +78,36 @@ fn create_byte_mapping(low: usize, high: usize) -> Vec<u8>{
 }
 
 
-fn apply_mappings(bitmap: *mut BitmapBgra, map_red: &[u8], map_green: &[u8], map_blue: &[u8]) -> Result<()>{
-
-    let input: &BitmapBgra = unsafe{ &*bitmap };
-    let bytes: &mut [u8] = unsafe { slice::from_raw_parts_mut::<u8>(input.pixels, (input.stride * input.h) as usize) };
-
+/// Maps each blue, green and red byte through its table, in row bands; alpha is left alone
+fn apply_mappings(c: &Context, bitmap: *mut BitmapBgra, map_red: &[u8], map_green: &[u8], map_blue: &[u8]) -> Result<()>{
     if map_red.len() < 256 || map_green.len() < 256 || map_blue.len() < 256{
         return Err(nerror!(::ErrorKind::InvalidState));
     }
-
-    match input.fmt {
-        PixelFormat::Gray8 =>
-            Err(unimpl!())
-        ,
-        PixelFormat::Bgra32 | PixelFormat::Bgr32=> {
-            for row in bytes.chunks_mut(input.stride as usize){
-                for pixel in row.chunks_mut(4).take(input.w as usize){
-                    //pixel[0] = map_blue[pixel[0]];
-                    //pixel[1] = map_green[pixel[1]];
-                    //pixel[2] = map_red[pixel[2]];
-                    unsafe {
-                        *pixel.get_unchecked_mut(0) = *map_blue.get_unchecked(*pixel.get_unchecked(0) as usize);
-                        *pixel.get_unchecked_mut(1) = *map_green.get_unchecked(*pixel.get_unchecked(1) as usize);
-                        *pixel.get_unchecked_mut(2) = *map_red.get_unchecked(*pixel.get_unchecked(2) as usize);
-                    }
-                }
-            }
-            Ok(())
-        },
-        PixelFormat::Bgr24 => {
-            for row in bytes.chunks_mut(input.stride as usize){
-                for pixel in row.chunks_mut(3).take(input.w as usize){
-                    //pixel[0] = *map_blue[pixel[0]];
-                    //pixel[1] = *map_green[pixel[1]];
-                    //pixel[2] = *map_red[pixel[2]];
-                    unsafe {
-                        *pixel.get_unchecked_mut(0) = *map_blue.get_unchecked(*pixel.get_unchecked(0) as usize);
-                        *pixel.get_unchecked_mut(1) = *map_green.get_unchecked(*pixel.get_unchecked(1) as usize);
-                        *pixel.get_unchecked_mut(2) = *map_red.get_unchecked(*pixel.get_unchecked(2) as usize);
-                    }
-                }
-            }
-            Ok(())
-        },
+    let (w, h, fmt) = unsafe { ((*bitmap).w, (*bitmap).h, (*bitmap).fmt) };
+    if let PixelFormat::Gray8 = fmt {
+        return Err(unimpl!());
+    }
+    // In byte order: blue, green, red, alpha
+    let mut luts = [0u8; 1024];
+    luts[0..256].copy_from_slice(&map_blue[0..256]);
+    luts[256..512].copy_from_slice(&map_green[0..256]);
+    luts[512..768].copy_from_slice(&map_red[0..256]);
+    for (ix, v) in luts[768..1024].iter_mut().enumerate() {
+        *v = ix as u8;
     }
+
+    let bands = bands::band_count(w as u64 * h as u64, MIN_PIXELS_PER_MAPPING_BAND).min(h.max(1));
+    // Each band rewrites only its own rows, and the tables are only read
+    let shared = bands::Shared((c.flow_c(), bitmap, luts.as_ptr()));
+    let mapped = bands::run(bands, move |band| {
+        let (flow_c, bitmap, luts) = shared.0;
+        let (from_row, to_row) = bands::band_rows(h, bands, band);
+        unsafe { ::ffi::flow_bitmap_bgra_apply_channel_luts(flow_c, bitmap, from_row, to_row - from_row, luts) }
+    });
+    if mapped { Ok(()) } else { Err(cerror!(c, "Failed to apply white balance")) }
 }
 
-fn white_balance_srgb_mut(bitmap: *mut BitmapBgra, histograms: &[u64;768], pixels_sampled: u64, low_threshold: Option<f32>, high_threshold: Option<f32>) -> Result<()>{
+fn white_balance_srgb_mut(c: &Context, bitmap: *mut BitmapBgra, histograms: &[u64;768], pixels_sampled: u64, low_threshold: Option<f32>, high_threshold: Option<f32>) -> Result<()>{
     let low_threshold = low_threshold.unwrap_or(0.006) as f64;
     let high_threshold = high_threshold.unwrap_or(0.006) as f64;
 
@@ -99,7 +119,7 @@ fn white_balance_srgb_mut(bitmap: *mut BitmapBgra, histograms: &[u64;768], pixel
     let green_map = create_byte_mapping(green_low, green_high);
     let blue_map = create_byte_mapping(blue_low, blue_high);
 
-    apply_mappings(bitmap, &red_map, &green_map, &blue_map)
+    apply_mappings(c, bitmap, &red_map, &green_map, &blue_map)
 }
 
 #[derive(Debug, Clone)]
@@ -115,18 +135,46 @@ impl NodeDefMutateBitmap for WhiteBalanceSrgbMutDef{
     }
     fn mutate(&self, c: &Context, bitmap: &mut BitmapBgra,  p: &NodeParams) -> Result<()> {
 
-        unsafe {
-            let mut histograms: [u64; 768] = [0; 768];
-            let mut pixels_sampled: u64 = 0;
-            if !::ffi::flow_bitmap_bgra_populate_histogram(c.flow_c(), bitmap as *mut BitmapBgra, histograms.as_mut_ptr(), 256, 3, &mut pixels_sampled as *mut u64) {
-                return Err(cerror!(c, "Failed to populate histogram"))
-            }
-            if let &NodeParams::Json(s::Node::WhiteBalanceHistogramAreaThresholdSrgb { threshold }) = p {
-                white_balance_srgb_mut(bitmap, &histograms, pixels_sampled, threshold, threshold)
-            } else {
-                Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need ColorMatrixSrgb, got {:?}", p))
-            }
+        if let &NodeParams::Json(s::Node::WhiteBalanceHistogramAreaThresholdSrgb { threshold, sample_max_error }) = p {
+            let (histograms, pixels_sampled) = populate_histograms(c, bitmap as *mut BitmapBgra, sample_max_error)?;
+            white_balance_srgb_mut(c, bitmap, &histograms, pixels_sampled, threshold, threshold)
+        } else {
+            Err(nerror!(::ErrorKind::NodeParamsMismatch, "Need ColorMatrixSrgb, got {:?}", p))
         }
 
     }
 }
+
+#[test]
+fn test_subsampled_thresholds_match_full_count() {
+    // 12 megapixels, so every other row and column is sampled
+    let (w, h) = (4000u32, 3000u32);
+    let c = Context::create().unwrap();
+    assert_eq!(unsafe { ::ffi::flow_histogram_sample_step_for_error(w, h, 0.001) }, 2);
+    let bitmap = unsafe { ::ffi::flow_bitmap_bgra_create(c.flow_c(), w as i32, h as i32, false, PixelFormat::Bgra32) };
+    assert!(!bitmap.is_null());
+    unsafe {
+        let b = &mut *bitmap;
+        for y in 0..h {
+            let row = ::std::slice::from_raw_parts_mut(b.pixels.offset(y as isize * b.stride as isize), w as usize * 4);
+            for x in 0..w {
+                // A gradient under noise, offset per channel; blue, green, red, alpha in byte order
+                for ch in 0..3u32 {
+                    let noise = (x.wrapping_mul(2654435761) ^ y.wrapping_mul(40503) ^ ch.wrapping_mul(2246822519)) >> 7;
+                    let v = (x * 160 / w + y * 60 / h + ch * 20) as i32 + (noise % 41) as i32 - 20;
+                    row[(x * 4 + 2 - ch) as usize] = v.max(0).min(255) as u8;
+                }
+                row[(x * 4 + 3) as usize] = 255;
+            }
+        }
+    }
+    let (sampled, samples) = populate_histograms(&c, bitmap, Some(0.001)).unwrap();
+    let mut full = [0u64; 768];
+    let mut pixels = 0u64;
+    assert!(unsafe { ::ffi::flow_bitmap_bgra_populate_histogram(c.flow_c(), bitmap, full.as_mut_ptr(), 256, 3, &mut pixels as *mut u64) });
+    assert_eq!(samples * 4, pixels);
+    for ch in 0..3 {
+        let (from, to) = (ch * 256, (ch + 1) * 256);
+        assert_eq!(area_threshold(&sampled[from..to], samples, 0.006, 0.006), area_threshold(&full[from..to], pixels, 0.006, 0.006));
+    }
+}
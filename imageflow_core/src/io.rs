@@ -144,6 +144,23 @@ impl IoProxy {
         }
     }
 
+    pub fn position(&self, context: &Context) -> Result<i64> {
+        if let Some(classic) = self.classic_io() {
+            if let Some(position_fn) = classic.position_fn {
+                let position = position_fn(context.flow_c(), self.classic);
+                if position < 0 {
+                    Err(cerror!(context, "Failed to get io position"))
+                } else {
+                    Ok(position)
+                }
+            } else {
+                Err(unimpl!())
+            }
+        } else {
+            Err(unimpl!())
+        }
+    }
+
     pub fn seek(&self, context: &Context, position: i64) -> Result<bool> {
         if let Some(classic) = self.classic_io() {
             if let Some(seek_fn) = classic.seek_fn {
@@ -199,6 +216,37 @@ impl IoProxy {
         }
     }
 
+    /// The output buffer as written, in order, without merging it into one allocation.
+    /// Valid until the next write.
+    pub fn get_output_buffer_segments<'b>(&self, c: &'b Context) -> Result<&'b [::ffi::BufferSegment]> {
+        unsafe {
+            let mut segments: *const ::ffi::BufferSegment = ptr::null();
+            let mut count: usize = 0;
+            if !::ffi::flow_io_get_output_buffer_segments(self.c.flow_c(), self.classic, &mut segments, &mut count) {
+                Err(cerror!(self.c))
+            } else if count == 0 {
+                Ok(&[])
+            } else {
+                Ok(std::slice::from_raw_parts(segments, count))
+            }
+        }
+    }
+
+    /// Sizes an output buffer for the expected encoded length up front, so encoding doesn't have to grow it.
+    /// Has no effect on other kinds of io.
+    pub fn reserve_output_buffer(&self, c: &Context, byte_count: usize) -> Result<()> {
+        if self.classic.is_null() {
+            return Ok(());
+        }
+        unsafe {
+            if ::ffi::flow_io_output_buffer_reserve(c.flow_c(), self.classic, byte_count) {
+                Ok(())
+            } else {
+                Err(cerror!(c, "Failed to reserve {} bytes of output buffer", byte_count))
+            }
+        }
+    }
+
     pub fn create_output_buffer(context: &Context, io_id: i32) -> Result<RefMut<IoProxy>> {
         IoProxy::check_io_id(context,io_id)?;
         unsafe {
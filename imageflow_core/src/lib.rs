@@ -44,6 +44,8 @@ extern crate uuid;
 extern crate gif;
 extern crate gif_dispose;
 extern crate smallvec;
+extern crate threadpool;
+extern crate num_cpus;
 extern crate core;
 
 #[macro_use]
@@ -66,6 +68,7 @@ pub use ::flow::definitions::Graph;
 pub use json::JsonResponse;
 pub use json::MethodRouter;
 // use std::ops::DerefMut;
+pub mod bands;
 pub mod clients;
 pub mod ffi;
 pub mod parsing;
@@ -214,7 +214,7 @@ fn test_white_balance_image() {
     let matched = compare(Some(s::IoEnum::Url("https://s3-us-west-2.amazonaws.com/imageflow-resources/test_inputs/red-night.png".to_owned())), 500,
                           "WhiteBalanceNight".to_owned(), POPULATE_CHECKSUMS, DEBUG_GRAPH, vec![
             s::Node::Decode {io_id: 0, commands: None},
-            s::Node::WhiteBalanceHistogramAreaThresholdSrgb { threshold: None}
+            s::Node::WhiteBalanceHistogramAreaThresholdSrgb { threshold: None, sample_max_error: None}
         ]
     );
     assert!(matched);
@@ -432,6 +432,66 @@ fn test_dimensions(){
 
 
 
+/// Runs a canvas feeding two branches, returning the bytes copied and both branch outputs
+fn execute_two_branches(left: s::Node, right: s::Node) -> (u64, (u32, u32), (u32, u32)) {
+    let mut left_bitmap: *mut imageflow_core::ffi::BitmapBgra = std::ptr::null_mut();
+    let mut right_bitmap: *mut imageflow_core::ffi::BitmapBgra = std::ptr::null_mut();
+
+    let mut nodes = std::collections::HashMap::new();
+    nodes.insert("0".to_owned(), s::Node::CreateCanvas { w: 64, h: 64, format: s::PixelFormat::Bgra32, color: s::Color::Black });
+    nodes.insert("1".to_owned(), left);
+    nodes.insert("2".to_owned(), s::Node::FlowBitmapBgraPtr { ptr_to_flow_bitmap_bgra_ptr: &mut left_bitmap as *mut *mut imageflow_core::ffi::BitmapBgra as usize });
+    nodes.insert("3".to_owned(), right);
+    nodes.insert("4".to_owned(), s::Node::FlowBitmapBgraPtr { ptr_to_flow_bitmap_bgra_ptr: &mut right_bitmap as *mut *mut imageflow_core::ffi::BitmapBgra as usize });
+    let edges = vec![
+        s::Edge { from: 0, to: 1, kind: s::EdgeKind::Input },
+        s::Edge { from: 1, to: 2, kind: s::EdgeKind::Input },
+        s::Edge { from: 0, to: 3, kind: s::EdgeKind::Input },
+        s::Edge { from: 3, to: 4, kind: s::EdgeKind::Input },
+    ];
+
+    let mut context = Context::create().unwrap();
+    let result = context.execute_1(s::Execute001 {
+        framewise: s::Framewise::Graph(s::Graph { nodes: nodes, edges: edges }),
+        graph_recording: None
+    }).unwrap();
+    let copied = match result {
+        s::ResponsePayload::JobResult(s::JobResult { performance: Some(p), .. }) => p.bitmap_bytes_copied,
+        other => panic!("Unexpected result {:?}", other)
+    };
+    assert!(!left_bitmap.is_null() && !right_bitmap.is_null());
+    assert!(left_bitmap != right_bitmap);
+    unsafe { (copied, ((*left_bitmap).w, (*left_bitmap).h), ((*right_bitmap).w, (*right_bitmap).h)) }
+}
+
+#[test]
+fn test_mutation_copies_only_when_shared(){
+    let fill = s::Node::FillRect { x1: 0, y1: 0, x2: 8, y2: 8, color: s::Color::Transparent };
+
+    // Reader goes first, so the flip can have the original
+    let (copied, flipped, scaled) = execute_two_branches(s::Node::FlipV,
+        s::Node::Resample2D { w: 32, h: 16, down_filter: None, up_filter: None, hints: None, scaling_colorspace: None });
+    assert_eq!(copied, 0);
+    assert_eq!(flipped, (64, 64));
+    assert_eq!(scaled, (32, 16));
+
+    // Crops of a shared frame are views, so neither copies
+    let (copied, left, right) = execute_two_branches(s::Node::Crop { x1: 0, y1: 0, x2: 10, y2: 20 },
+                                                     s::Node::Crop { x1: 5, y1: 30, x2: 64, y2: 64 });
+    assert_eq!(copied, 0);
+    assert_eq!(left, (10, 20));
+    assert_eq!(right, (59, 34));
+
+    // The flip can't write to pixels the crop's view still reads, so it gets a copy
+    let (copied, cropped, _) = execute_two_branches(s::Node::Crop { x1: 0, y1: 0, x2: 10, y2: 20 }, s::Node::FlipH);
+    assert_eq!(copied, 64 * 64 * 4);
+    assert_eq!(cropped, (10, 20));
+
+    // Two writers can't share
+    let (copied, _, _) = execute_two_branches(s::Node::FlipV, fill);
+    assert_eq!(copied, 64 * 64 * 4);
+}
+
 #[test]
 fn test_decode_png_and_scale_dimensions(){
 
@@ -467,19 +527,55 @@ fn test_get_info_png() {
     let _ = imageflow_core::clients::stateless::LibClient {}.get_image_info(&tinypng).expect("Image response should be valid");
 }
 
-//#[test]
-//fn test_detect_whitespace(){
-//    //let white = s::Color::Srgb(s::ColorSrgb::Hex("FFFFFFFF".to_owned()));
-//    let blue = s::Color::Srgb(s::ColorSrgb::Hex("0000FFFF".to_owned()));
-//    let matched = compare(None, 1,
-//                          "DetectWhitespace".to_owned(), POPULATE_CHECKSUMS, DEBUG_GRAPH, vec![
-//            s::Node::CreateCanvas {w: 400, h: 300, format: s::PixelFormat::Bgra32, color: s::Color::Transparent},
-//            s::Node::FillRect{x1:0, y1:0, x2:50, y2:100, color: blue},
-//            s::Node::CropWhitespace {threshold: 80, percent_padding: 0f32}
-//        ]
-//    );
-//    assert!(matched);
-//}
+#[test]
+fn test_crop_whitespace(){
+    let blue = s::Color::Srgb(s::ColorSrgb::Hex("0000FFFF".to_owned()));
+    let steps = |percent_padding: f32| vec![
+        s::Node::CreateCanvas {w: 400, h: 300, format: s::PixelFormat::Bgra32, color: s::Color::Srgb(s::ColorSrgb::Hex("FFFFFFFF".to_owned()))},
+        s::Node::FillRect{x1: 100, y1: 50, x2: 250, y2: 150, color: blue.clone()},
+        s::Node::CropWhitespace {threshold: 80, percent_padding: percent_padding}
+    ];
+    assert_eq!(get_result_dimensions(steps(0f32), vec![], DEBUG_GRAPH), (150, 100));
+    // 2% of the 125px average dimension rounds up to 3px a side
+    assert_eq!(get_result_dimensions(steps(2f32), vec![], DEBUG_GRAPH), (156, 106));
+}
+
+#[test]
+fn test_crop_whitespace_jpeg_preview(){
+    // Large enough for the whitespace to be found on an IDCT-downscaled preview; the rectangle sits on the 16px chroma grid
+    let blue = s::Color::Srgb(s::ColorSrgb::Hex("0000FFFF".to_owned()));
+    let req = imageflow_core::clients::stateless::BuildRequest {
+        inputs: vec![],
+        framewise: s::Framewise::Steps(vec![
+            s::Node::CreateCanvas {w: 2400, h: 1600, format: s::PixelFormat::Bgra32, color: s::Color::Srgb(s::ColorSrgb::Hex("FFFFFFFF".to_owned()))},
+            s::Node::FillRect{x1: 592, y1: 400, x2: 1808, y2: 1200, color: blue},
+            s::Node::Encode{ io_id: 1, preset: s::EncoderPreset::LibjpegTurbo {quality: Some(90), progressive: None, optimize_huffman_coding: None}}
+        ]),
+        export_graphs_to: None
+    };
+    let jpeg = imageflow_core::clients::stateless::LibClient {}.build(req).unwrap().outputs.remove(0).bytes;
+    let input = || vec![s::IoObject { io_id: 0, direction: s::IoDirection::In, io: s::IoEnum::ByteArray(jpeg.clone()) }];
+
+    let (w, h) = get_result_dimensions(vec![
+        s::Node::Decode {io_id: 0, commands: None},
+        s::Node::CropWhitespace {threshold: 80, percent_padding: 0f32}
+    ], input(), DEBUG_GRAPH);
+    // Bounds found on the preview are widened by a preview pixel and may take in some ringing
+    assert!(w >= 1216 && w <= 1232 && h >= 800 && h <= 816, "got {}x{}", w, h);
+
+    // The decoder's own hints shrink the frame; the crop must be found on that frame instead of the preview
+    let hints = s::JpegIDCTDownscaleHints {
+        width: 1200,
+        height: 800,
+        scale_luma_spatially: Some(false),
+        gamma_correct_for_srgb_during_spatial_luma_scaling: None
+    };
+    let (w, h) = get_result_dimensions(vec![
+        s::Node::Decode {io_id: 0, commands: Some(vec![s::DecoderCommand::JpegDownscaleHints(hints)])},
+        s::Node::CropWhitespace {threshold: 80, percent_padding: 0f32}
+    ], input(), DEBUG_GRAPH);
+    assert!(w >= 608 && w <= 616 && h >= 400 && h <= 408, "got {}x{}", w, h);
+}
 
 
 //#[test]
@@ -534,6 +630,35 @@ fn test_idct_spatial_no_gamma(){
                                      test_idct_no_gamma_callback);
     assert!(matched);
 }
+
+/// Hints for a plain scaled IDCT to num/8, which the decoder deblocks
+fn idct_deblocked_hints(info: &s::ImageInfo, num: i32) -> (Option<s::DecoderCommand>, Vec<s::Node>)
+{
+    let hints = s::JpegIDCTDownscaleHints{
+        gamma_correct_for_srgb_during_spatial_luma_scaling: Some(false),
+        scale_luma_spatially: Some(false),
+        width: ((info.image_width * num + 8 - 1) / 8) as i64,
+        height: ((info.image_height * num + 8 - 1) / 8) as i64
+    };
+    (Some(s::DecoderCommand::JpegDownscaleHints(hints)), vec![s::Node::Decode{io_id:0, commands: None}])
+}
+
+fn test_idct_deblocked_4_callback(info: s::ImageInfo) -> (Option<s::DecoderCommand>, Vec<s::Node>)
+{
+    idct_deblocked_hints(&info, 4)
+}
+
+fn test_idct_deblocked_3_callback(info: s::ImageInfo) -> (Option<s::DecoderCommand>, Vec<s::Node>)
+{
+    idct_deblocked_hints(&info, 3)
+}
+
+#[test]
+fn test_idct_deblocked(){
+    let roof = "https://s3-us-west-2.amazonaws.com/imageflow-resources/test_inputs/roof_test_800x600.jpg";
+    assert!(test_with_callback("ScaleIDCTDeblocked4".to_owned(), s::IoEnum::Url(roof.to_owned()), test_idct_deblocked_4_callback));
+    assert!(test_with_callback("ScaleIDCTDeblocked3".to_owned(), s::IoEnum::Url(roof.to_owned()), test_idct_deblocked_3_callback));
+}
 //
 //#[test]
 //fn test_fail(){
@@ -577,7 +702,8 @@ fn test_with_callback(checksum_name: String, input: s::IoEnum, callback: fn(s::I
 
         context.execute_1(send_execute).unwrap();
 
-        let ctx = checkums_ctx_for(&context);
+        let mut ctx = checkums_ctx_for(&context);
+        ctx.create_if_missing = POPULATE_CHECKSUMS;
         matched = regression_check(&ctx, *ptr_to_ptr, &checksum_name)
 
 
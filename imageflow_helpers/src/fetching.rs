@@ -1,9 +1,12 @@
 use ::preludes::from_std::*;
 use ::std;
+use ::std::sync::{Arc, Mutex};
 use ::reqwest;
 use ::hyper;
 use ::hyper::Client;
+use ::hyper::client::pool::{Pool, Config as PoolConfig};
 use ::hyper::net::HttpsConnector;
+#[cfg(any(target_os = "windows", target_os = "macos"))]
 use ::hyper_native_tls::NativeTlsClient;
 
 #[cfg(not(any(target_os = "windows", target_os = "macos")))]
@@ -25,6 +28,9 @@ pub enum FetchError {
 pub struct FetchedResponse {
     pub bytes: Vec<u8>,
     pub content_type: hyper::header::ContentType,
+    /// Validators for a later conditional request, verbatim
+    pub etag: Option<String>,
+    pub last_modified: Option<String>,
 }
 
 impl fmt::Debug for FetchedResponse {
@@ -66,31 +72,134 @@ impl FetchConfig {
         }
         let ssl = OpensslClient::from(ssl.build());
         let connector = HttpsConnector::new(ssl);
-        Client::with_connector(connector)
+        Client::with_connector(Pool::with_connector(PoolConfig { max_idle: MAX_IDLE_CONNECTIONS_PER_ORIGIN }, connector))
     }
 
     #[cfg(any(target_os = "windows", target_os = "macos"))]
     pub fn create_hyper_client(&self) -> Client{
         let ssl = NativeTlsClient::new().unwrap();
         let connector = HttpsConnector::new(ssl);
-        Client::with_connector(connector)
+        Client::with_connector(Pool::with_connector(PoolConfig { max_idle: MAX_IDLE_CONNECTIONS_PER_ORIGIN }, connector))
+    }
+
+    /// The process-wide client for this trust configuration. Its pool keeps connections alive per (scheme, host, port),
+    /// so repeat fetches from an origin skip the TCP and TLS handshakes.
+    pub fn shared_hyper_client(&self) -> Arc<Client>{
+        let mut clients = SHARED_CLIENTS.lock().unwrap();
+        if let Some(client) = clients.get(&self.custom_ca_trust_file){
+            return client.clone();
+        }
+        let client = Arc::new(self.create_hyper_client());
+        clients.insert(self.custom_ca_trust_file.clone(), client.clone());
+        client
     }
 }
 
+/// Idle keep-alive connections retained for each origin
+pub const MAX_IDLE_CONNECTIONS_PER_ORIGIN: usize = 16;
 
+lazy_static! {
+    static ref SHARED_CLIENTS: Mutex<HashMap<Option<PathBuf>, Arc<Client>>> = Mutex::new(HashMap::new());
+}
 
-pub fn fetch(url: &str, config: Option<FetchConfig>) -> std::result::Result<FetchedResponse, FetchError> {
+/// An upstream response whose body has not been read yet. Reads pull from the socket as data arrives,
+/// so a caller can inspect the first chunk (e.g., image headers) while the rest is in flight.
+/// Reading to the end returns the connection to the pool; dropping it early closes the connection.
+pub struct FetchedStream {
+    pub status: hyper::status::StatusCode,
+    pub content_type: Option<hyper::header::ContentType>,
+    pub content_length: Option<u64>,
+    pub etag: Option<String>,
+    pub last_modified: Option<String>,
+    response: hyper::client::Response,
+}
+
+impl fmt::Debug for FetchedStream {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "FetchedStream {{ status: {:?}, content_type: {:?}, content_length: {:?} }}", self.status, self.content_type, self.content_length)
+    }
+}
+
+impl Read for FetchedStream {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        self.response.read(buf)
+    }
+}
+
+impl FetchedStream {
+    /// Reads the remainder of the body, sizing the buffer from Content-Length when the upstream sent one
+    pub fn read_body(&mut self) -> std::io::Result<Vec<u8>> {
+        // Don't let a hostile Content-Length reserve unbounded memory up front
+        let mut bytes = Vec::with_capacity(self.content_length.unwrap_or(0).min(64 * 1024 * 1024) as usize);
+        self.response.read_to_end(&mut bytes)?;
+        Ok(bytes)
+    }
+}
+
+/// Sends the request and returns once the response headers arrive, without waiting for the body.
+/// Uses the shared pooled client. A request that fails with an IO error is retried once on a fresh connection,
+/// as a pooled connection may have been closed by the origin while idle; this is safe because fetches are GETs.
+pub fn fetch_stream(url: &str, config: Option<FetchConfig>) -> std::result::Result<FetchedStream, FetchError> {
+    fetch_stream_with_headers(url, hyper::header::Headers::new(), config)
+}
+
+fn raw_header(headers: &hyper::header::Headers, name: &str) -> Option<String> {
+    headers.get_raw(name).and_then(|values| values.first()).map(|v| String::from_utf8_lossy(v).into_owned())
+}
+
+fn fetch_stream_with_headers(url: &str, headers: hyper::header::Headers, config: Option<FetchConfig>) -> std::result::Result<FetchedStream, FetchError> {
     let conf = config.unwrap_or_default();
-    let client = conf.create_hyper_client();
+    let client = conf.shared_hyper_client();
 
-    let mut res = client.get(url).send()?;
+    let response = match client.get(url).headers(headers.clone()).send() {
+        Err(hyper::Error::Io(_)) => client.get(url).headers(headers).send()?,
+        other => other?
+    };
+    Ok(FetchedStream {
+        status: response.status,
+        content_type: response.headers.get::<hyper::header::ContentType>().cloned(),
+        content_length: response.headers.get::<hyper::header::ContentLength>().map(|l| l.0),
+        etag: raw_header(&response.headers, "ETag"),
+        last_modified: raw_header(&response.headers, "Last-Modified"),
+        response: response,
+    })
+}
 
-    let response = if res.status == hyper::Ok || conf.read_error_body.unwrap_or(false) {
-        let mut source_bytes = Vec::new();
-        let _ = res.read_to_end(&mut source_bytes)?;
+/// Conditional GET using the validators from an earlier response. Returns None if the origin answered
+/// 304 Not Modified; otherwise behaves like fetch(). With no validators, this is an unconditional fetch.
+pub fn fetch_if_modified(url: &str, etag: Option<&str>, last_modified: Option<&str>, config: Option<FetchConfig>) -> std::result::Result<Option<FetchedResponse>, FetchError> {
+    let mut headers = hyper::header::Headers::new();
+    if let Some(etag) = etag {
+        headers.set_raw("If-None-Match", vec![etag.as_bytes().to_vec()]);
+    }
+    if let Some(last_modified) = last_modified {
+        headers.set_raw("If-Modified-Since", vec![last_modified.as_bytes().to_vec()]);
+    }
+    let read_error_body = config.as_ref().and_then(|c| c.read_error_body).unwrap_or(false);
+    let mut res = fetch_stream_with_headers(url, headers, config)?;
+    if res.status == hyper::status::StatusCode::NotModified {
+        let _ = std::io::copy(&mut res, &mut std::io::sink());
+        return Ok(None);
+    }
+    read_fetched(res, read_error_body).map(Some)
+}
+
+
+
+pub fn fetch(url: &str, config: Option<FetchConfig>) -> std::result::Result<FetchedResponse, FetchError> {
+    let read_error_body = config.as_ref().and_then(|c| c.read_error_body).unwrap_or(false);
+    let res = fetch_stream(url, config)?;
+    read_fetched(res, read_error_body)
+}
+
+fn read_fetched(mut res: FetchedStream, read_error_body: bool) -> std::result::Result<FetchedResponse, FetchError> {
+    let response = if res.status == hyper::Ok || read_error_body {
+        let source_bytes = res.read_body()?;
         Some(FetchedResponse {
             bytes: source_bytes,
-            content_type: res.headers.get::<hyper::header::ContentType>().expect("content type required").clone()
+            content_type: res.content_type.clone().expect("content type required"),
+            etag: res.etag.clone(),
+            last_modified: res.last_modified.clone(),
         })
     } else {
         None
@@ -108,12 +217,9 @@ pub fn fetch(url: &str, config: Option<FetchConfig>) -> std::result::Result<Fetc
 
 
 pub fn get_status_code_for(url: &str) -> std::result::Result<hyper::status::StatusCode, FetchError> {
-    let ssl = NativeTlsClient::new().unwrap();
-    let connector = HttpsConnector::new(ssl);
-    let client = Client::with_connector(connector);
-
-
-    let res = client.get(url).send()?;
+    let mut res = fetch_stream(url, None)?;
+    // Drain the body so the connection can be reused
+    let _ = std::io::copy(&mut res, &mut std::io::sink());
     Ok(res.status)
 
     //Ok(*reqwest::get(url)?.status())
@@ -9,6 +9,94 @@ pub fn read_file_bytes<P: AsRef<Path>>(path: P) -> std::io::Result<Vec<u8>>{
     Ok((data))
 }
 
+/// A whole file, memory-mapped read-only where the platform allows. Pages come from the OS page cache,
+/// so processes working on the same originals share them instead of each holding a copy.
+/// Empty files (which can't be mapped) and other platforms fall back to reading into a `Vec`.
+pub struct MappedFile {
+    data: *mut u8,
+    len: usize,
+    fallback: Vec<u8>,
+}
+
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    #[cfg(unix)]
+    pub fn open<P: AsRef<Path>>(path: P) -> std::io::Result<MappedFile> {
+        use std::os::unix::io::AsRawFd;
+        let f = OpenOptions::new().read(true).create(false).open(path.as_ref())?;
+        let len = f.metadata()?.len() as usize;
+        if len == 0 {
+            return Ok(MappedFile::from_vec(Vec::new()));
+        }
+        let data = unsafe {
+            ::libc::mmap(ptr::null_mut(), len, ::libc::PROT_READ, ::libc::MAP_PRIVATE, f.as_raw_fd(), 0)
+        };
+        if data == ::libc::MAP_FAILED {
+            return read_file_bytes(path).map(MappedFile::from_vec);
+        }
+        // Decoders read front to back; this is only a hint
+        let _ = unsafe { ::libc::madvise(data, len, ::libc::MADV_SEQUENTIAL) };
+        Ok(MappedFile { data: data as *mut u8, len: len, fallback: Vec::new() })
+    }
+
+    #[cfg(not(unix))]
+    pub fn open<P: AsRef<Path>>(path: P) -> std::io::Result<MappedFile> {
+        read_file_bytes(path).map(MappedFile::from_vec)
+    }
+
+    fn from_vec(bytes: Vec<u8>) -> MappedFile {
+        MappedFile { data: ptr::null_mut(), len: 0, fallback: bytes }
+    }
+
+    pub fn is_mapped(&self) -> bool {
+        !self.data.is_null()
+    }
+}
+
+impl std::ops::Deref for MappedFile {
+    type Target = [u8];
+    fn deref(&self) -> &[u8] {
+        if self.data.is_null() {
+            &self.fallback
+        } else {
+            unsafe { slice::from_raw_parts(self.data, self.len) }
+        }
+    }
+}
+
+impl AsRef<[u8]> for MappedFile {
+    fn as_ref(&self) -> &[u8] {
+        &**self
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        {
+            if !self.data.is_null() {
+                let _ = unsafe { ::libc::munmap(self.data as *mut ::libc::c_void, self.len) };
+            }
+        }
+    }
+}
+
+#[test]
+fn test_mapped_file_matches_contents() {
+    let path = std::env::temp_dir().join("imageflow_helpers_mapped_file_test");
+    let bytes: Vec<u8> = (0..70000u32).map(|v| (v % 251) as u8).collect();
+    File::create(&path).unwrap().write_all(&bytes).unwrap();
+    {
+        let mapped = MappedFile::open(&path).unwrap();
+        assert_eq!(&mapped[..], &bytes[..]);
+    }
+    File::create(&path).unwrap();
+    assert_eq!(MappedFile::open(&path).unwrap().len(), 0);
+    std::fs::remove_file(&path).unwrap();
+}
+
 pub fn zip_directory_nonrecursive<P: AsRef<Path>>(dir: P, archive_name: P) -> zip::result::ZipResult<()> {
     let mut zip = zip::ZipWriter::new(File::create(archive_name.as_ref()).unwrap());
 
@@ -294,7 +294,8 @@ impl Ir4Layout{
         // Perform white balance
         if Some(HistogramThresholdAlgorithm::Area) == self.i.a_balance_white{
             b.add( s::Node::WhiteBalanceHistogramAreaThresholdSrgb {
-                threshold: None
+                threshold: None,
+                sample_max_error: None
             });
         }
 
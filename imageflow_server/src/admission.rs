@@ -0,0 +1,176 @@
+/// Admission control for work that competes for a scarce resource: CPU for renders, sockets for upstream fetches,
+/// and memory for decoded frames.
+///
+/// A Gate has a weighted capacity (slots, or bytes). Callers wait for room in a bounded queue; if the queue is full,
+/// or room doesn't appear within `max_wait`, they are turned away immediately so the server can answer 503 instead of
+/// letting latency climb for everyone. Callers block on their own thread while queued, so a gate in front of a
+/// fixed pool of handler threads must queue few enough callers to leave threads for work that needs no gate.
+use ::std::sync::{Mutex, Condvar};
+use ::std::sync::atomic::{AtomicU64, Ordering};
+use ::std::time::{Duration, Instant};
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum Rejection {
+    /// `max_waiting` callers were already queued
+    QueueFull,
+    /// Room did not appear within `max_wait`
+    TimedOut,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct GateLimits {
+    pub capacity: u64,
+    pub max_waiting: usize,
+    pub max_wait: Duration,
+}
+
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct GateStats {
+    pub in_use: u64,
+    pub waiting: u64,
+    pub admitted: u64,
+    pub rejected_queue_full: u64,
+    pub rejected_timed_out: u64,
+}
+
+#[derive(Debug, Default)]
+struct GateState {
+    in_use: u64,
+    waiting: usize,
+}
+
+#[derive(Debug)]
+pub struct Gate {
+    name: &'static str,
+    limits: GateLimits,
+    state: Mutex<GateState>,
+    released: Condvar,
+    admitted: AtomicU64,
+    rejected_queue_full: AtomicU64,
+    rejected_timed_out: AtomicU64,
+}
+
+/// Returns its weight to the gate when dropped
+#[derive(Debug)]
+pub struct Permit<'a> {
+    gate: &'a Gate,
+    weight: u64,
+}
+
+impl<'a> Drop for Permit<'a> {
+    fn drop(&mut self) {
+        let mut state = self.gate.state.lock().unwrap();
+        state.in_use -= self.weight;
+        self.gate.released.notify_all();
+    }
+}
+
+impl Gate {
+    pub fn new(name: &'static str, limits: GateLimits) -> Gate {
+        Gate {
+            name: name,
+            limits: limits,
+            state: Mutex::new(GateState::default()),
+            released: Condvar::new(),
+            admitted: AtomicU64::new(0),
+            rejected_queue_full: AtomicU64::new(0),
+            rejected_timed_out: AtomicU64::new(0),
+        }
+    }
+
+    pub fn name(&self) -> &'static str {
+        self.name
+    }
+
+    pub fn limits(&self) -> &GateLimits {
+        &self.limits
+    }
+
+    /// Weights above capacity are clamped to it; such work waits until the gate is idle, then runs alone.
+    pub fn acquire(&self, weight: u64) -> Result<Permit, Rejection> {
+        let weight = weight.min(self.limits.capacity);
+        let mut state = self.state.lock().unwrap();
+        if state.in_use + weight <= self.limits.capacity && state.waiting == 0 {
+            state.in_use += weight;
+            self.admitted.fetch_add(1, Ordering::Relaxed);
+            return Ok(Permit { gate: self, weight: weight });
+        }
+        if state.waiting >= self.limits.max_waiting {
+            self.rejected_queue_full.fetch_add(1, Ordering::Relaxed);
+            return Err(Rejection::QueueFull);
+        }
+        let deadline = Instant::now() + self.limits.max_wait;
+        state.waiting += 1;
+        loop {
+            if state.in_use + weight <= self.limits.capacity {
+                state.waiting -= 1;
+                state.in_use += weight;
+                self.admitted.fetch_add(1, Ordering::Relaxed);
+                // Others may fit in what's left
+                self.released.notify_all();
+                return Ok(Permit { gate: self, weight: weight });
+            }
+            let now = Instant::now();
+            if now >= deadline {
+                state.waiting -= 1;
+                self.rejected_timed_out.fetch_add(1, Ordering::Relaxed);
+                return Err(Rejection::TimedOut);
+            }
+            state = self.released.wait_timeout(state, deadline - now).unwrap().0;
+        }
+    }
+
+    pub fn stats(&self) -> GateStats {
+        let state = self.state.lock().unwrap();
+        GateStats {
+            in_use: state.in_use,
+            waiting: state.waiting as u64,
+            admitted: self.admitted.load(Ordering::Relaxed),
+            rejected_queue_full: self.rejected_queue_full.load(Ordering::Relaxed),
+            rejected_timed_out: self.rejected_timed_out.load(Ordering::Relaxed),
+        }
+    }
+}
+
+#[test]
+fn test_gate_limits_concurrency_and_rejects() {
+    use ::std::sync::Arc;
+    use ::std::thread;
+    let gate = Arc::new(Gate::new("test", GateLimits { capacity: 2, max_waiting: 1, max_wait: Duration::from_millis(300) }));
+    let a = gate.acquire(1).unwrap();
+    let b = gate.acquire(1).unwrap();
+    assert_eq!(gate.stats().in_use, 2);
+
+    // One waiter is queued until a permit is dropped
+    let waiter_gate = gate.clone();
+    let waiter = thread::spawn(move || {
+        let start = Instant::now();
+        let permit = waiter_gate.acquire(1);
+        (permit.is_ok(), start.elapsed())
+    });
+    thread::sleep(Duration::from_millis(50));
+    // A second waiter doesn't fit in the queue
+    assert_eq!(gate.acquire(1).err(), Some(Rejection::QueueFull));
+    drop(a);
+    let (admitted, waited) = waiter.join().unwrap();
+    assert!(admitted);
+    assert!(waited >= Duration::from_millis(40));
+
+    // Nothing frees up in time
+    let c = gate.acquire(1).unwrap();
+    assert_eq!(gate.acquire(1).err(), Some(Rejection::TimedOut));
+    drop(b);
+    drop(c);
+    let stats = gate.stats();
+    assert_eq!((stats.in_use, stats.waiting, stats.admitted, stats.rejected_queue_full, stats.rejected_timed_out), (0, 0, 4, 1, 1));
+}
+
+#[test]
+fn test_gate_clamps_oversized_weight() {
+    let gate = Gate::new("bytes", GateLimits { capacity: 100, max_waiting: 4, max_wait: Duration::from_millis(50) });
+    let huge = gate.acquire(1000).unwrap();
+    assert_eq!(gate.stats().in_use, 100);
+    assert_eq!(gate.acquire(1).err(), Some(Rejection::TimedOut));
+    drop(huge);
+    assert!(gate.acquire(60).is_ok());
+}
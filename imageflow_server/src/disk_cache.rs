@@ -1,24 +1,25 @@
 /// This is a naive local 'caching' implementation of a key/value blob store
 /// Each pair gets 1 file
 /// Hash collisions are improbable - we use blake2 256, faster than SHA-3. 32-byte hashes
-/// Write only
-/// Append-only log for transitioning to more complex system
 /// Staging folder - files are renamed into final locations
-/// soft and hard count and byte limit - NO DELETION
+/// Append-only write log (meta/write_log_{layout}) - one 40-byte record (hash, size) per completed write
+/// Byte and entry tallies (meta/consumption_summary_{layout}), replaced atomically, and replayed from the log after a crash
+/// Optional byte and count limits, enforced FIFO by a background evictor that walks the write log - never the tree
 use ::std::path::*;
 use ::std::io;
 use ::std;
 use ::std::io::prelude::*;
-use ::std::fs::{create_dir_all, File};
-use std::sync::atomic::{AtomicBool, Ordering};
+use ::std::io::{SeekFrom, BufReader};
+use ::std::fs::{create_dir_all, File, OpenOptions};
+use std::collections::HashSet;
+use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+use std::thread;
 
 // TODO:
 // Cleanup staging folders automatically (failed renames)
-// Implement write-only log
-// Implement transactional filesystem 'counters' to track total count/size
-// Implement write failure when limits are reached
-
-// It *is* possible to implement FIFO cache eviction, but is FIFO worth it? (random sampling of the write log, staging folders to drop handles, etc)
+// Entries written before the write log existed are not tallied, and are never evicted
 
 extern crate rand;
 extern crate imageflow_helpers;
@@ -47,6 +48,53 @@ fn create_dir_all_helpful<P: AsRef<Path>>(path: P) -> io::Result<()> {
 //and use a bitset or something.
 //We can use RwLock on a BitVec or a Vec of AtomicBools (64kb vs 8kb, but maybe we just collapse for storage?)
 
+const LOG_RECORD_BYTES: u64 = 40;
+/// Eviction stops once usage falls to this fraction of the limit, so it runs in batches rather than per write
+const EVICT_TO_PERCENT: u64 = 90;
+/// Rewrite the write log without its evicted prefix once that prefix is both this large and over half the file
+const COMPACT_LOG_AFTER_BYTES: u64 = 64 * 1024 * 1024;
+
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct CacheTally {
+    pub bytes: u64,
+    pub entries: u64,
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct CacheLimits {
+    pub max_bytes: u64,
+    pub max_entries: u64,
+}
+
+impl CacheLimits {
+    fn exceeded_by(&self, tally: &CacheTally) -> bool {
+        tally.bytes > self.max_bytes || tally.entries > self.max_entries
+    }
+    fn satisfied_by(&self, tally: &CacheTally) -> bool {
+        tally.bytes <= self.max_bytes / 100 * EVICT_TO_PERCENT && tally.entries <= self.max_entries / 100 * EVICT_TO_PERCENT
+    }
+}
+
+#[derive(Debug, Copy, Clone, Default, PartialEq, Eq)]
+pub struct EvictionReport {
+    pub entries_evicted: u64,
+    pub bytes_evicted: u64,
+    /// Log records whose file was already gone (overwritten and evicted earlier, or removed by hand)
+    pub records_skipped: u64,
+}
+
+/// Everything the write log and summary describe, guarded by one lock so a record and its tally change together
+#[derive(Debug, Default)]
+struct Accounting {
+    loaded: bool,
+    tally: CacheTally,
+    /// Bytes of whole records in the write log
+    log_length: u64,
+    /// Log offset of the oldest record not yet evicted
+    eviction_cursor: u64,
+    log: Option<File>,
+}
+
 #[derive(Debug)]
 pub struct CacheFolder{
     root: PathBuf,
@@ -60,7 +108,10 @@ pub struct CacheFolder{
     folder_bits: u8,
     folders_from_hash: u32,
     bits_format: &'static str,
-    write_layout: FolderLayout
+    write_layout: FolderLayout,
+    accounting: Mutex<Accounting>,
+    limits: Option<CacheLimits>,
+    evicted_entries: AtomicU64,
 }
 
 #[derive(Debug, Copy, Clone, PartialEq, Eq)]
@@ -73,6 +124,25 @@ pub enum FolderLayout {
     Huge
 }
 
+impl FolderLayout {
+    /// The entry count past which directories get large enough to slow lookups
+    pub fn suggested_max_entries(&self) -> u64 {
+        match *self {
+            FolderLayout::Tiny => 51_000,
+            FolderLayout::Normal => 3_000_000,
+            FolderLayout::Huge => 50_000_000,
+        }
+    }
+
+    pub fn to_id(&self) -> &'static str {
+        match *self {
+            FolderLayout::Tiny => "tiny",
+            FolderLayout::Normal => "normal",
+            FolderLayout::Huge => "huge",
+        }
+    }
+}
+
 impl CacheFolder{
     pub fn new(root: &Path, write_layout: FolderLayout) -> CacheFolder{
         CacheFolder{
@@ -81,9 +151,9 @@ impl CacheFolder{
             root_confirmed: AtomicBool::default(),
             meta_dir: root.join(Path::new("meta")),
             staging_dir: root.join(Path::new("staging")),
-            write_log: root.join(Path::new("meta")).join(Path::new("write_log")),
+            write_log: root.join(Path::new("meta")).join(Path::new(&format!("write_log_{}", write_layout.to_id()))),
             consumption_log: root.join(Path::new("meta")).join(Path::new("consumption_log")),
-            consumption_summary: root.join(Path::new("meta")).join(Path::new("consumption_summary")),
+            consumption_summary: root.join(Path::new("meta")).join(Path::new(&format!("consumption_summary_{}", write_layout.to_id()))),
             folder_bits: match write_layout{
                 FolderLayout::Tiny => 6,
                 FolderLayout::Normal => 12,
@@ -99,10 +169,33 @@ impl CacheFolder{
                 FolderLayout::Normal => 64 * 64 * 2 + 64,
                 FolderLayout::Huge => 64 * 64 * 16 + 64 * 64 + 64,
             },
-            write_layout: write_layout
+            write_layout: write_layout,
+            accounting: Mutex::new(Accounting::default()),
+            limits: None,
+            evicted_entries: AtomicU64::new(0),
         }
     }
 
+    /// Enables eviction; without limits the cache only grows
+    pub fn with_limits(mut self, limits: CacheLimits) -> CacheFolder {
+        self.limits = Some(limits);
+        self
+    }
+
+    pub fn limits(&self) -> Option<CacheLimits> {
+        self.limits
+    }
+
+    pub fn tally(&self) -> io::Result<CacheTally> {
+        let mut accounting = self.accounting.lock().unwrap();
+        self.ensure_accounting_loaded(&mut accounting)?;
+        Ok(accounting.tally)
+    }
+
+    pub fn evicted_entries(&self) -> u64 {
+        self.evicted_entries.load(Ordering::Relaxed)
+    }
+
     pub fn entry(&self, hash: &[u8;32]) -> CacheEntry {
         CacheEntry {
             path: self.root.join(hlp::hashing::normalize_slashes(hlp::hashing::bits_format(hash, self.bits_format))),
@@ -124,11 +217,7 @@ impl CacheFolder{
 
     fn ensure_meta_layout_confirmed(&self) -> io::Result<()>{
         if !self.meta_layout_confirmed.load(Ordering::SeqCst){
-            let path = self.meta_dir.join(Path::new(match self.write_layout{
-                FolderLayout::Huge => "huge",
-                FolderLayout::Tiny => "tiny",
-                FolderLayout::Normal => "normal"
-            }));
+            let path = self.meta_dir.join(Path::new(self.write_layout.to_id()));
             if !self.meta_layout_confirmed.load(Ordering::SeqCst) && !path.exists() {
                 create_dir_all_helpful(&self.meta_dir)?;
                 File::create(path)?;
@@ -166,6 +255,232 @@ impl CacheFolder{
         let staging_path = format!("{:064x}_{:016x}_incoming", hlp::hashing::HexableBytes(hash), rand::thread_rng().next_u64());
         Ok(subdir.join(Path::new(&staging_path)))
     }
+
+    /// Summary layout: bytes, entries, log_length, eviction_cursor; little-endian u64s
+    fn read_summary(&self) -> io::Result<Option<[u64; 4]>> {
+        let mut buffer = Vec::new();
+        match File::open(&self.consumption_summary) {
+            Ok(mut f) => { f.read_to_end(&mut buffer)?; }
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(None),
+            Err(e) => return Err(e)
+        }
+        if buffer.len() != 32 {
+            return Ok(None);
+        }
+        let mut fields = [0u64; 4];
+        for (ix, field) in fields.iter_mut().enumerate() {
+            *field = read_u64_le(&buffer[ix * 8..ix * 8 + 8]);
+        }
+        Ok(Some(fields))
+    }
+
+    fn write_summary(&self, accounting: &Accounting) -> io::Result<()> {
+        let mut buffer = Vec::with_capacity(32);
+        for field in &[accounting.tally.bytes, accounting.tally.entries, accounting.log_length, accounting.eviction_cursor] {
+            write_u64_le(&mut buffer, *field);
+        }
+        // Write then rename, so a crash leaves either the old summary or the new one
+        let temp_path = self.meta_dir.join(Path::new(&format!("consumption_summary_{}_{:016x}_incoming", self.write_layout.to_id(), rand::thread_rng().next_u64())));
+        {
+            let mut f = OpenOptions::new().write(true).create_new(true).open(&temp_path)?;
+            f.write_all(&buffer)?;
+        }
+        std::fs::rename(&temp_path, &self.consumption_summary)
+    }
+
+    /// Loads the last summary, then replays any log records appended after it (found on disk => counted)
+    fn ensure_accounting_loaded(&self, accounting: &mut Accounting) -> io::Result<()> {
+        if accounting.loaded {
+            return Ok(());
+        }
+        self.ensure_root()?;
+        self.ensure_meta_layout_confirmed()?;
+        let log = OpenOptions::new().read(true).append(true).create(true).open(&self.write_log)?;
+        let file_length = log.metadata()?.len();
+        // A crash mid-append can leave a torn record at the end
+        let whole_length = file_length - file_length % LOG_RECORD_BYTES;
+        if whole_length != file_length {
+            log.set_len(whole_length)?;
+        }
+        let (tally, summarized_length, cursor) = match self.read_summary()? {
+            Some(f) if f[2] <= whole_length && f[3] <= f[2] => (CacheTally { bytes: f[0], entries: f[1] }, f[2], f[3]),
+            _ => (CacheTally::default(), 0, 0)
+        };
+        accounting.tally = tally;
+        accounting.log_length = whole_length;
+        accounting.eviction_cursor = cursor;
+
+        if summarized_length < whole_length {
+            let mut reader = BufReader::new(File::open(&self.write_log)?);
+            reader.seek(SeekFrom::Start(summarized_length))?;
+            let mut record = [0u8; 40];
+            // An entry rewritten since the summary is logged once per write, but is on disk only once
+            let mut replayed = HashSet::new();
+            for _ in 0..(whole_length - summarized_length) / LOG_RECORD_BYTES {
+                reader.read_exact(&mut record)?;
+                let hash = log_record_hash(&record);
+                if !replayed.insert(hash) {
+                    continue;
+                }
+                if let Ok(meta) = self.entry(&hash).path.metadata() {
+                    accounting.tally.bytes += meta.len();
+                    accounting.tally.entries += 1;
+                }
+            }
+        }
+        accounting.log = Some(log);
+        accounting.loaded = true;
+        Ok(())
+    }
+
+    /// Called after an entry is renamed into place; `replaced_bytes` is the size of the file it overwrote, if any
+    fn record_write(&self, hash: &[u8; 32], bytes: u64, replaced_bytes: Option<u64>) -> io::Result<()> {
+        let mut record = Vec::with_capacity(LOG_RECORD_BYTES as usize);
+        record.extend_from_slice(hash);
+        write_u64_le(&mut record, bytes);
+
+        let mut accounting = self.accounting.lock().unwrap();
+        self.ensure_accounting_loaded(&mut accounting)?;
+        accounting.log.as_mut().unwrap().write_all(&record)?;
+        accounting.log_length += LOG_RECORD_BYTES;
+        if let Some(replaced) = replaced_bytes {
+            accounting.tally.bytes = accounting.tally.bytes.saturating_sub(replaced);
+            accounting.tally.entries = accounting.tally.entries.saturating_sub(1);
+        }
+        accounting.tally.bytes += bytes;
+        accounting.tally.entries += 1;
+        Ok(())
+    }
+
+    fn record_removal(&self, bytes: u64) -> io::Result<()> {
+        let mut accounting = self.accounting.lock().unwrap();
+        self.ensure_accounting_loaded(&mut accounting)?;
+        accounting.tally.bytes = accounting.tally.bytes.saturating_sub(bytes);
+        accounting.tally.entries = accounting.tally.entries.saturating_sub(1);
+        Ok(())
+    }
+
+    /// Saves the tally, so the next start replays only what was logged since
+    pub fn persist_tally(&self) -> io::Result<()> {
+        let mut accounting = self.accounting.lock().unwrap();
+        self.ensure_accounting_loaded(&mut accounting)?;
+        self.write_summary(&accounting)
+    }
+
+    /// Deletes the oldest entries, in write-log order, until usage is at 90% of the limits.
+    /// Does nothing unless limits are set and exceeded. Safe to call while other threads write.
+    pub fn evict(&self) -> io::Result<EvictionReport> {
+        let mut report = EvictionReport::default();
+        let limits = match self.limits {
+            Some(limits) => limits,
+            None => return Ok(report)
+        };
+        let (mut cursor, log_length) = {
+            let mut accounting = self.accounting.lock().unwrap();
+            self.ensure_accounting_loaded(&mut accounting)?;
+            if !limits.exceeded_by(&accounting.tally) {
+                return Ok(report);
+            }
+            (accounting.eviction_cursor, accounting.log_length)
+        };
+
+        let mut reader = BufReader::with_capacity(1 << 20, File::open(&self.write_log)?);
+        reader.seek(SeekFrom::Start(cursor))?;
+        let mut record = [0u8; 40];
+        while cursor < log_length {
+            reader.read_exact(&mut record)?;
+            cursor += LOG_RECORD_BYTES;
+            let path = self.entry(&log_record_hash(&record)).path;
+            let removed_bytes = match path.metadata() {
+                Ok(meta) => match std::fs::remove_file(&path) {
+                    Ok(()) => Some(meta.len()),
+                    Err(ref e) if e.kind() == io::ErrorKind::NotFound => None,
+                    Err(e) => return Err(e)
+                },
+                Err(_) => None
+            };
+            if removed_bytes.is_some() {
+                // Headers are only written alongside bodies; most entries have none
+                let _ = std::fs::remove_file(sidecar_path(&path));
+            }
+            let mut accounting = self.accounting.lock().unwrap();
+            accounting.eviction_cursor = cursor;
+            if let Some(bytes) = removed_bytes {
+                accounting.tally.bytes = accounting.tally.bytes.saturating_sub(bytes);
+                accounting.tally.entries = accounting.tally.entries.saturating_sub(1);
+                report.entries_evicted += 1;
+                report.bytes_evicted += bytes;
+            } else {
+                report.records_skipped += 1;
+            }
+            if limits.satisfied_by(&accounting.tally) {
+                break;
+            }
+        }
+        self.evicted_entries.fetch_add(report.entries_evicted, Ordering::Relaxed);
+
+        let mut accounting = self.accounting.lock().unwrap();
+        if accounting.eviction_cursor >= COMPACT_LOG_AFTER_BYTES && accounting.eviction_cursor * 2 >= accounting.log_length {
+            self.compact_log(&mut accounting)?;
+        }
+        self.write_summary(&accounting)?;
+        Ok(report)
+    }
+
+    /// Drops the evicted prefix of the write log. Writers wait on the lock while the remainder is copied.
+    fn compact_log(&self, accounting: &mut Accounting) -> io::Result<()> {
+        let temp_path = self.meta_dir.join(Path::new(&format!("write_log_{}_{:016x}_incoming", self.write_layout.to_id(), rand::thread_rng().next_u64())));
+        {
+            let mut source = File::open(&self.write_log)?;
+            source.seek(SeekFrom::Start(accounting.eviction_cursor))?;
+            let mut target = OpenOptions::new().write(true).create_new(true).open(&temp_path)?;
+            io::copy(&mut source.take(accounting.log_length - accounting.eviction_cursor), &mut target)?;
+        }
+        std::fs::rename(&temp_path, &self.write_log)?;
+        accounting.log_length -= accounting.eviction_cursor;
+        accounting.eviction_cursor = 0;
+        accounting.log = Some(OpenOptions::new().append(true).open(&self.write_log)?);
+        Ok(())
+    }
+}
+
+/// Evicts and persists the tally every `interval` until the process exits
+pub fn start_evictor(cache: Arc<CacheFolder>, interval: Duration) -> thread::JoinHandle<()> {
+    thread::spawn(move || {
+        loop {
+            thread::sleep(interval);
+            let start = Instant::now();
+            match cache.evict() {
+                Ok(report) => if report.entries_evicted > 0 {
+                    info!("Evicted {} entries ({} bytes) from {:?} in {:?}", report.entries_evicted, report.bytes_evicted, cache.root, start.elapsed());
+                },
+                Err(e) => warn!("Eviction failed for {:?}: {:?}", cache.root, e)
+            }
+            if let Err(e) = cache.persist_tally() {
+                warn!("Failed to save the cache tally for {:?}: {:?}", cache.root, e);
+            }
+        }
+    })
+}
+
+fn sidecar_path(entry_path: &Path) -> PathBuf {
+    entry_path.with_extension("headers")
+}
+
+fn read_u64_le(bytes: &[u8]) -> u64 {
+    bytes.iter().rev().fold(0u64, |v, b| (v << 8) | (*b as u64))
+}
+
+fn write_u64_le(to: &mut Vec<u8>, v: u64) {
+    for ix in 0..8 {
+        to.push((v >> (ix * 8)) as u8);
+    }
+}
+
+fn log_record_hash(record: &[u8; 40]) -> [u8; 32] {
+    let mut hash = [0u8; 32];
+    hash.copy_from_slice(&record[0..32]);
+    hash
 }
 
 pub struct CacheEntry<'a>{
@@ -191,20 +506,159 @@ impl<'a> CacheEntry<'a>{
     pub fn write(&self, bytes: &[u8]) -> io::Result<()> {
         self.prepare_dir()?;
         let temp_path = self.parent.acquire_staging_location(&self.hash)?;
-        use ::std::fs::OpenOptions;
         {
             let mut f = OpenOptions::new().write(true).create_new(true).open(&temp_path)?;
             f.write_all(bytes)?;
         }
+        let replaced_bytes = self.path.metadata().ok().map(|m| m.len());
         std::fs::rename(&temp_path, &self.path)?;
-        Ok(())
+        self.parent.record_write(&self.hash, bytes.len() as u64, replaced_bytes)
     }
 
     pub fn read(&self) -> io::Result<Vec<u8>>{
         hlp::filesystem::read_file_bytes(&self.path)
     }
 
+    /// Stores the body as-is, with `Name: value` header lines in a small file beside it. The headers land first,
+    /// so a body is never visible without them.
+    pub fn write_with_headers(&self, bytes: &[u8], headers: &[(&str, &str)]) -> io::Result<()> {
+        self.prepare_dir()?;
+        let mut text = String::new();
+        for &(name, value) in headers {
+            text.push_str(name);
+            text.push_str(": ");
+            text.push_str(value);
+            text.push('\n');
+        }
+        let temp_path = self.parent.acquire_staging_location(&self.hash)?;
+        {
+            let mut f = OpenOptions::new().write(true).create_new(true).open(&temp_path)?;
+            f.write_all(text.as_bytes())?;
+        }
+        std::fs::rename(&temp_path, sidecar_path(&self.path))?;
+        self.write(bytes)
+    }
+
+    /// Deletes the body and its headers, if any. Returns false if there was no body.
+    /// The write log keeps its record; eviction skips records whose file is gone.
+    pub fn remove(&self) -> io::Result<bool> {
+        let bytes = match self.path.metadata() {
+            Ok(meta) => meta.len(),
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(false),
+            Err(e) => return Err(e)
+        };
+        match std::fs::remove_file(&self.path) {
+            Ok(()) => {},
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(false),
+            Err(e) => return Err(e)
+        }
+        let _ = std::fs::remove_file(sidecar_path(&self.path));
+        self.parent.record_removal(bytes)?;
+        Ok(true)
+    }
+
+    /// Maps the body rather than reading it, so it can be written to the socket straight from the page cache.
+    /// Returns None if either the body or its headers are missing.
+    pub fn open_with_headers(&self) -> io::Result<Option<(hlp::filesystem::MappedFile, Vec<(String, String)>)>> {
+        let text = match hlp::filesystem::read_file_bytes(sidecar_path(&self.path)) {
+            Ok(bytes) => String::from_utf8_lossy(&bytes).into_owned(),
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(None),
+            Err(e) => return Err(e)
+        };
+        let headers = text.lines().filter_map(|line| {
+            line.find(": ").map(|ix| (line[..ix].to_owned(), line[ix + 2..].to_owned()))
+        }).collect();
+        match hlp::filesystem::MappedFile::open(&self.path) {
+            Ok(body) => Ok(Some((body, headers))),
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => Ok(None),
+            Err(e) => Err(e)
+        }
+    }
+
+
+}
+
+#[cfg(test)]
+fn temp_cache_dir(name: &str) -> PathBuf {
+    ::std::env::temp_dir().join(format!("imageflow_disk_cache_{}_{:016x}", name, rand::thread_rng().next_u64()))
+}
+
+#[test]
+fn test_disk_cache_evicts_oldest_first() {
+    let dir = temp_cache_dir("evict");
+    let limits = CacheLimits { max_bytes: 1000, max_entries: 1000 };
+    let hashes = (0..20u8).map(|i| hlp::hashing::hash_256(&[i])).collect::<Vec<_>>();
+    {
+        let cache = CacheFolder::new(&dir, FolderLayout::Tiny).with_limits(limits);
+        for hash in hashes.iter() {
+            cache.entry(hash).write(&[1u8; 100]).unwrap();
+        }
+        // Overwriting an entry replaces its bytes in the tally
+        cache.entry(&hashes[19]).write(&[2u8; 100]).unwrap();
+        assert_eq!(cache.tally().unwrap(), CacheTally { bytes: 2000, entries: 20 });
+
+        let report = cache.evict().unwrap();
+        assert_eq!(report, EvictionReport { entries_evicted: 11, bytes_evicted: 1100, records_skipped: 0 });
+        assert_eq!(cache.tally().unwrap(), CacheTally { bytes: 900, entries: 9 });
+        assert!(!cache.entry(&hashes[10]).exists());
+        assert!(cache.entry(&hashes[11]).exists());
+        assert_eq!(cache.evict().unwrap(), EvictionReport::default());
+
+        cache.entry(&hashes[0]).write(&[3u8; 50]).unwrap();
+        cache.entry(&hashes[0]).write(&[4u8; 50]).unwrap();
+    }
+    // Without a fresh summary, a new instance replays what was logged after the last one, counting each entry once
+    let cache = CacheFolder::new(&dir, FolderLayout::Tiny).with_limits(limits);
+    assert_eq!(cache.tally().unwrap(), CacheTally { bytes: 950, entries: 10 });
+    ::std::fs::remove_dir_all(&dir).unwrap();
+}
+
+#[test]
+fn test_disk_cache_headers_round_trip() {
+    let dir = temp_cache_dir("headers");
+    let cache = CacheFolder::new(&dir, FolderLayout::Tiny).with_limits(CacheLimits { max_bytes: 100, max_entries: 100 });
+    let entry = cache.entry(&hlp::hashing::hash_256(b"headers"));
+    assert!(entry.open_with_headers().unwrap().is_none());
+    entry.write_with_headers(&[5u8; 80], &[("Content-Type", "image/png")]).unwrap();
+    {
+        let (body, headers) = entry.open_with_headers().unwrap().unwrap();
+        assert_eq!(&body[..], &[5u8; 80][..]);
+        assert_eq!(headers, vec![("Content-Type".to_owned(), "image/png".to_owned())]);
+    }
+    // Eviction removes the headers with the body
+    cache.entry(&hlp::hashing::hash_256(b"other")).write(&[0u8; 80]).unwrap();
+    assert_eq!(cache.evict().unwrap().entries_evicted, 1);
+    assert!(!sidecar_path(&entry.path).exists());
+    ::std::fs::remove_dir_all(&dir).unwrap();
+}
 
+/// Eviction throughput at scale. Slow (it creates every entry first), so it only runs on request:
+/// cargo test --release -p imageflow_server bench_disk_cache_eviction -- --ignored --nocapture
+/// IMAGEFLOW_CACHE_BENCH_ENTRIES overrides the entry count (default 10 million).
+#[test]
+#[ignore]
+fn bench_disk_cache_eviction() {
+    let count = ::std::env::var("IMAGEFLOW_CACHE_BENCH_ENTRIES").ok().and_then(|v| v.parse::<u64>().ok()).unwrap_or(10_000_000);
+    let dir = temp_cache_dir("bench");
+    let cache = CacheFolder::new(&dir, FolderLayout::Huge);
+    let start = Instant::now();
+    for i in 0..count {
+        let mut key = Vec::with_capacity(8);
+        write_u64_le(&mut key, i);
+        cache.entry(&hlp::hashing::hash_256(&key)).write(&[0u8; 16]).unwrap();
+    }
+    let populated = start.elapsed();
+    println!("Wrote {} entries in {:?}", count, populated);
+
+    // Evicts down to 45% of the entries
+    let cache = cache.with_limits(CacheLimits { max_bytes: ::std::u64::MAX, max_entries: count / 2 });
+    let start = Instant::now();
+    let report = cache.evict().unwrap();
+    let elapsed = start.elapsed();
+    let seconds = elapsed.as_secs() as f64 + elapsed.subsec_nanos() as f64 / 1e9;
+    println!("Evicted {} entries in {:?} ({:.0} entries/sec); {:?}", report.entries_evicted, elapsed, report.entries_evicted as f64 / seconds, cache.tally().unwrap());
+    assert_eq!(cache.tally().unwrap().entries, count / 2 / 100 * EVICT_TO_PERCENT);
+    ::std::fs::remove_dir_all(&dir).unwrap();
 }
 
 /// If one migrates from one FolderLayout to another, or is moving off of a old cache directory, then multiple queries make sense
@@ -7,7 +7,6 @@ extern crate persistent;
 extern crate router;
 extern crate logger;
 
-extern crate bincode;
 extern crate mount;
 
 use staticfile::Static;
@@ -20,15 +19,19 @@ extern crate rustc_serialize;
 #[macro_use] extern crate hyper;
 
 extern crate libc;
+extern crate num_cpus;
 extern crate time;
 #[macro_use] extern crate lazy_static;
+#[macro_use] extern crate log;
+extern crate env_logger;
 extern crate regex;
 
 extern crate hyper_native_tls;
 
 use hyper_native_tls::NativeTlsServer;
 
-use std::sync::atomic::{AtomicU64, ATOMIC_U64_INIT};
+use std::sync::{Arc, RwLock};
+use std::time::Duration;
 
 
 extern crate conduit_mime_types as mime_types;
@@ -48,18 +51,28 @@ use imageflow_core::clients::stateless;
 
 use hyper::Url;
 
+pub mod admission;
+pub mod metrics;
 pub mod disk_cache;
+pub mod mem_cache;
+pub mod single_flight;
+pub mod source_metadata;
 pub mod resizer;
 pub mod diagnose;
 
 mod requested_path;
 extern crate url;
 
-use disk_cache::{CacheFolder,  FolderLayout};
+use disk_cache::{CacheFolder, CacheLimits, FolderLayout};
+use mem_cache::{MemCache, CachedBlob};
+use single_flight::SingleFlight;
+use admission::{Gate, GateLimits, Rejection};
+use source_metadata::{MetadataStore, CachedMetadataStore, DiskMetadataStore, RedisMetadataStore, SourceMetadata};
+use metrics::{Counter, Gauge, Histogram, Exposition};
 use logger::Logger;
 
 pub mod preludes {
-    pub use super::{MountedEngine, MountLocation, StartServerConfig, ServerError};
+    pub use super::{MountedEngine, MountLocation, StartServerConfig, AdmissionConfig, ServerError};
     pub use super::disk_cache::FolderLayout;
 }
 
@@ -74,23 +87,238 @@ use router::Router;
 
 use time::precise_time_ns;
 
-#[macro_use] extern crate log;
-extern crate env_logger;
 
 
 #[derive(Debug)]
 struct SharedData {
-    source_cache: CacheFolder,
-    output_cache: CacheFolder,
-    requests_received: AtomicU64,
+    source_cache: Arc<CacheFolder>,
+    output_cache: Arc<CacheFolder>,
+    /// Sits in front of both folders; source and derivative keys are hashed from different inputs, so they can share it
+    memory_cache: MemCache,
+    /// Concurrent misses for the same original share one upstream fetch
+    source_flights: SingleFlight<SharedResult<(Arc<[u8]>, AcquirePerf)>>,
+    /// Concurrent misses for the same derivative share one render
+    render_flights: SingleFlight<SharedResult<(CachedBlob, String)>>,
+    /// How long a request waits on another request's fetch or render before doing the work itself
+    coalescing_timeout: Duration,
+    gates: Gates,
+    /// Validators and versions of upstream originals, and which derivatives were rendered from each version
+    source_metadata: Box<MetadataStore>,
+    /// None serves a cached original forever
+    revalidate_after: Option<Duration>,
+    /// Concurrent requests for a stale original share one conditional GET
+    revalidation_flights: SingleFlight<SharedResult<SourceMetadata>>,
+    metrics: ServerMetrics,
     //detailed_errors: bool
 }
 
 impl iron::typemap::Key for SharedData { type Value = SharedData; }
 
+/// Recorded on the request path without locks; exported with the cache, coalescing and admission stats at /metrics
+#[derive(Debug)]
+struct ServerMetrics {
+    requests: Counter,
+    in_flight: Gauge,
+    upstream_bytes: Counter,
+    response_bytes: Counter,
+    source_disk_hits: Counter,
+    upstream_fetches: Counter,
+    derivative_disk_hits: Counter,
+    renders: Counter,
+    fetch_ns: Histogram,
+    cache_read_ns: Histogram,
+    cache_write_ns: Histogram,
+    getinfo_ns: Histogram,
+    execute_ns: Histogram,
+    /// By node name. Decoding and encoding are nodes, so they appear here.
+    /// The set of names is small and fixed, so the write lock is only taken the first time each is seen.
+    node_ns: RwLock<HashMap<String, Arc<Histogram>>>,
+}
+
+impl ServerMetrics {
+    fn new() -> ServerMetrics {
+        ServerMetrics {
+            requests: Counter::default(),
+            in_flight: Gauge::default(),
+            upstream_bytes: Counter::default(),
+            response_bytes: Counter::default(),
+            source_disk_hits: Counter::default(),
+            upstream_fetches: Counter::default(),
+            derivative_disk_hits: Counter::default(),
+            renders: Counter::default(),
+            fetch_ns: Histogram::new(),
+            cache_read_ns: Histogram::new(),
+            cache_write_ns: Histogram::new(),
+            getinfo_ns: Histogram::new(),
+            execute_ns: Histogram::new(),
+            node_ns: RwLock::new(HashMap::new()),
+        }
+    }
+
+    fn record_acquire(&self, perf: &AcquirePerf) {
+        if perf.fetch_ns > 0 {
+            self.fetch_ns.record(perf.fetch_ns);
+        }
+        if perf.cache_read_ns > 0 {
+            self.cache_read_ns.record(perf.cache_read_ns);
+        }
+        if perf.cache_write_ns > 0 {
+            self.cache_write_ns.record(perf.cache_write_ns);
+        }
+    }
+
+    fn record_render(&self, perf: &RequestPerf) {
+        self.renders.inc();
+        self.record_acquire(&perf.acquire);
+        self.getinfo_ns.record(perf.get_image_info_ns);
+        self.execute_ns.record(perf.execute_ns);
+        for node in perf.nodes.iter() {
+            let existing = self.node_ns.read().unwrap().get(&node.name).cloned();
+            let histogram = match existing {
+                Some(h) => h,
+                None => self.node_ns.write().unwrap().entry(node.name.clone()).or_insert_with(|| Arc::new(Histogram::new())).clone()
+            };
+            histogram.record(node.wall_microseconds * 1000);
+        }
+    }
+}
+
+impl SharedData {
+    fn render_metrics(&self) -> String {
+        let m = &self.metrics;
+        let mut e = Exposition::new();
+        e.describe("imageflow_requests_total", "counter", "Requests received by image mounts");
+        e.sample("imageflow_requests_total", &[], m.requests.get());
+        e.describe("imageflow_requests_in_flight", "gauge", "Requests being handled by image mounts");
+        e.sample("imageflow_requests_in_flight", &[], m.in_flight.get());
+        e.describe("imageflow_upstream_bytes_total", "counter", "Bytes fetched from upstream origins");
+        e.sample("imageflow_upstream_bytes_total", &[], m.upstream_bytes.get());
+        e.describe("imageflow_response_bytes_total", "counter", "Response body bytes sent by image mounts");
+        e.sample("imageflow_response_bytes_total", &[], m.response_bytes.get());
+        e.describe("imageflow_upstream_fetches_total", "counter", "Originals fetched from upstream origins");
+        e.sample("imageflow_upstream_fetches_total", &[], m.upstream_fetches.get());
+        e.describe("imageflow_renders_total", "counter", "Derivatives rendered");
+        e.sample("imageflow_renders_total", &[], m.renders.get());
+
+        e.describe("imageflow_stage_seconds", "summary", "Latency of each stage of a request");
+        for &(stage, h) in &[("fetch", &m.fetch_ns), ("cache_read", &m.cache_read_ns), ("cache_write", &m.cache_write_ns),
+                             ("getinfo", &m.getinfo_ns), ("execute", &m.execute_ns)] {
+            e.summary_seconds("imageflow_stage_seconds", &[("stage", stage)], &h.snapshot());
+        }
+        e.describe("imageflow_node_seconds", "summary", "Time spent estimating and executing each kind of graph node");
+        for (name, h) in m.node_ns.read().unwrap().iter() {
+            e.summary_seconds("imageflow_node_seconds", &[("node", name)], &h.snapshot());
+        }
+
+        let memory = self.memory_cache.stats();
+        e.describe("imageflow_cache_hits_total", "counter", "Cache hits by tier");
+        e.sample("imageflow_cache_hits_total", &[("tier", "memory")], memory.hits);
+        e.sample("imageflow_cache_hits_total", &[("tier", "source_disk")], m.source_disk_hits.get());
+        e.sample("imageflow_cache_hits_total", &[("tier", "output_disk")], m.derivative_disk_hits.get());
+        e.describe("imageflow_cache_misses_total", "counter", "Cache misses by tier; the disk tiers miss when an original is fetched or a derivative rendered");
+        e.sample("imageflow_cache_misses_total", &[("tier", "memory")], memory.misses);
+        e.sample("imageflow_cache_misses_total", &[("tier", "source_disk")], m.upstream_fetches.get());
+        e.sample("imageflow_cache_misses_total", &[("tier", "output_disk")], m.renders.get());
+        e.describe("imageflow_cache_bytes", "gauge", "Bytes held by each cache tier");
+        e.sample("imageflow_cache_bytes", &[("tier", "memory")], memory.bytes);
+        e.describe("imageflow_cache_entries", "gauge", "Entries held by each cache tier");
+        e.sample("imageflow_cache_entries", &[("tier", "memory")], memory.entries);
+        e.describe("imageflow_cache_evictions_total", "counter", "Entries evicted from each cache tier");
+        e.sample("imageflow_cache_evictions_total", &[("tier", "memory")], memory.evictions);
+        for &(tier, folder) in &[("source_disk", &self.source_cache), ("output_disk", &self.output_cache)] {
+            if let Ok(tally) = folder.tally() {
+                e.sample("imageflow_cache_bytes", &[("tier", tier)], tally.bytes);
+                e.sample("imageflow_cache_entries", &[("tier", tier)], tally.entries);
+            }
+            e.sample("imageflow_cache_evictions_total", &[("tier", tier)], folder.evicted_entries());
+        }
+
+        e.describe("imageflow_coalesced_total", "counter", "Requests that shared another request's fetch, render or revalidation");
+        e.sample("imageflow_coalesced_total", &[("work", "fetch")], self.source_flights.stats().shared);
+        e.sample("imageflow_coalesced_total", &[("work", "render")], self.render_flights.stats().shared);
+        e.sample("imageflow_coalesced_total", &[("work", "revalidation")], self.revalidation_flights.stats().shared);
+
+        e.describe("imageflow_gate_in_use", "gauge", "Capacity in use at each admission gate (slots, or bytes for decoded_bytes)");
+        e.describe("imageflow_gate_waiting", "gauge", "Requests queued at each admission gate");
+        e.describe("imageflow_gate_rejected_total", "counter", "Requests turned away by each admission gate");
+        for gate in &[&self.gates.cpu, &self.gates.io, &self.gates.decoded_bytes] {
+            let stats = gate.stats();
+            e.sample("imageflow_gate_in_use", &[("gate", gate.name())], stats.in_use);
+            e.sample("imageflow_gate_waiting", &[("gate", gate.name())], stats.waiting);
+            e.sample("imageflow_gate_rejected_total", &[("gate", gate.name()), ("reason", "queue_full")], stats.rejected_queue_full);
+            e.sample("imageflow_gate_rejected_total", &[("gate", gate.name()), ("reason", "timed_out")], stats.rejected_timed_out);
+        }
+        e.into_string()
+    }
+}
+
+fn metrics_handler(req: &mut Request) -> IronResult<Response> {
+    let shared = req.get::<persistent::Read<SharedData>>().unwrap();
+    Ok(Response::with((Mime::from_str("text/plain; version=0.0.4").unwrap(), status::Ok, shared.render_metrics())))
+}
+
+/// Separate admission for each scarce resource, so a flood of one kind of work can't starve the others
+#[derive(Debug)]
+struct Gates {
+    /// One slot per render
+    cpu: Gate,
+    /// One slot per upstream fetch
+    io: Gate,
+    /// Estimated bytes of decoded frames (width x height x 4) across renders in flight
+    decoded_bytes: Gate,
+}
+
+/// Renders that may queue at the cpu gate, and again at the decoded_bytes gate, per cpu worker
+const RENDERS_QUEUED_PER_CPU_WORKER: usize = 2;
+
+impl Gates {
+    fn new(c: &AdmissionConfig) -> Gates {
+        let limits = |capacity: u64, max_waiting: usize| GateLimits { capacity: capacity, max_waiting: max_waiting, max_wait: c.max_queue_wait };
+        let (cpu_workers, io_workers) = (c.cpu_workers.max(1), c.io_workers.max(1));
+        Gates {
+            cpu: Gate::new("cpu", limits(cpu_workers as u64, cpu_workers * RENDERS_QUEUED_PER_CPU_WORKER)),
+            io: Gate::new("io", limits(io_workers as u64, (io_workers / 2).max(1))),
+            decoded_bytes: Gate::new("decoded_bytes", limits(c.max_decoded_bytes_in_flight.max(1), cpu_workers * RENDERS_QUEUED_PER_CPU_WORKER)),
+        }
+    }
+
+    /// The most Iron handler threads that gated work can hold at once. A render holds its thread from the
+    /// decoded_bytes queue until it has rendered, and a fetch from the io queue until it has fetched; a request
+    /// finishes fetching before it starts rendering.
+    fn max_handler_threads_held(&self) -> usize {
+        let (cpu, io) = (self.cpu.limits(), self.io.limits());
+        self.decoded_bytes.limits().max_waiting + cpu.max_waiting + cpu.capacity as usize + io.max_waiting + io.capacity as usize
+    }
+
+    /// Twice what gated work can hold, so memory cache hits and /metrics always find a free thread
+    fn handler_threads(&self) -> usize {
+        self.max_handler_threads_held() * 2
+    }
+}
+
+fn admit(gate: &Gate, weight: u64) -> std::result::Result<admission::Permit, ServerError> {
+    gate.acquire(weight).map_err(|r| ServerError::Overloaded(gate.name(), r))
+}
+
 
 // Todo: consider lru_cache crate
 
+/// A single failure may be handed to every request that waited on the same fetch or render
+type SharedResult<T> = std::result::Result<T, Arc<ServerError>>;
+
+const DEFAULT_COALESCING_TIMEOUT_SECS: u64 = 30;
+
+const EVICTION_INTERVAL_SECS: u64 = 10;
+
+/// How long source versions are held in memory when originals aren't revalidated
+const DEFAULT_METADATA_TTL_SECS: u64 = 300;
+
+/// Source versions held in memory; each is a few hundred bytes
+const METADATA_MEMORY_ENTRIES: usize = 100_000;
+
+/// How soon an original is checked again after a revalidation that couldn't reach the origin
+const REVALIDATION_RETRY_SECS: u64 = 30;
+
 #[derive(Debug)]
 pub enum ServerError {
     HyperError(hyper::Error),
@@ -103,7 +331,11 @@ pub enum ServerError {
     UpstreamReqwestError(reqwest::Error),
     UpstreamIoError(std::io::Error),
     BuildFailure(stateless::BuildFailure),
-    LayoutSizingError(::imageflow_riapi::sizing::LayoutError)
+    LayoutSizingError(::imageflow_riapi::sizing::LayoutError),
+    /// The failure of a fetch or render this request shared with concurrent requests
+    Coalesced(Arc<ServerError>),
+    /// Turned away by the named admission gate; answered with 503
+    Overloaded(&'static str, Rejection)
 }
 
 impl From<stateless::BuildFailure> for ServerError {
@@ -145,6 +377,8 @@ struct FetchedResponse {
     bytes: Vec<u8>,
     perf: AcquirePerf,
     content_type: hyper::header::ContentType,
+    etag: Option<String>,
+    last_modified: Option<String>,
 }
 
 fn fetch_bytes(url: &str, config: Option<FetchConfig>) -> std::result::Result<FetchedResponse, ServerError> {
@@ -156,6 +390,8 @@ fn fetch_bytes(url: &str, config: Option<FetchConfig>) -> std::result::Result<Fe
         Ok(r) => Ok(FetchedResponse{
             bytes: r.bytes,
             content_type: r.content_type,
+            etag: r.etag,
+            last_modified: r.last_modified,
             perf: AcquirePerf { fetch_ns: downloaded - start, ..Default::default() }
         }),
         Err(e) => Err(error_upstream(e.into()))
@@ -174,83 +410,229 @@ fn error_upstream(from: ServerError) -> ServerError {
 
 
 
-#[derive(Debug, Serialize, Deserialize, PartialEq, Clone)]
-struct CachedResponse {
-    bytes: Vec<u8>,
+/// A response body read from the disk cache, or fresh from upstream on a miss
+struct CachedBody {
+    body: Box<iron::response::WriteBody>,
+    length: u64,
     content_type: String,
 }
 
+/// Writes a mapped cache file to the socket; the pages go from the page cache to the socket in one kernel copy
+struct MappedBody(hlp::filesystem::MappedFile);
+
+impl iron::response::WriteBody for MappedBody {
+    fn write_body(&mut self, res: &mut std::io::Write) -> std::io::Result<()> {
+        res.write_all(&self.0)
+    }
+}
+
+fn header_value<'a>(headers: &'a [(String, String)], name: &str) -> Option<&'a str> {
+    headers.iter().find(|&&(ref n, _)| n.eq_ignore_ascii_case(name)).map(|&(_, ref v)| v.as_str())
+}
+
 // Additional ways this can fail (compared to fetch_bytes)
 // Parent directories are deleted from cache between .exists() and cache writes
 // Permissions issues
-// Cached file is deleted between .exists(0 and .read()
 // Write fails due to out-of-space
 // rename fails (it should overwrite, for eventual consistency, but ... filesystems)
-fn fetch_bytes_using_cache_by_url(cache: &CacheFolder, url: &str) -> std::result::Result<(Vec<u8>, AcquirePerf), ServerError> {
+fn fetch_bytes_using_cache_by_url(shared: &SharedData, url: &str) -> std::result::Result<(Arc<[u8]>, AcquirePerf), ServerError> {
     let hash = hlp::hashing::hash_256(url.as_bytes());
+    let start = precise_time_ns();
+    if let Some(hit) = shared.memory_cache.get(&hash) {
+        let end = precise_time_ns();
+        return Ok((hit.bytes, AcquirePerf { cache_read_ns: end - start, ..Default::default() }));
+    }
+    shared.source_flights.run(&hash, shared.coalescing_timeout, || {
+        fetch_bytes_through_disk_cache(&shared.memory_cache, &shared.source_cache, &*shared.source_metadata, &shared.gates.io, &shared.metrics, &hash, url).map_err(Arc::new)
+    }).map_err(ServerError::Coalesced)
+}
+
+fn fetch_bytes_through_disk_cache(memory: &MemCache, cache: &CacheFolder, metadata: &MetadataStore, io: &Gate, metrics: &ServerMetrics, hash: &[u8; 32], url: &str) -> std::result::Result<(Arc<[u8]>, AcquirePerf), ServerError> {
+    let hash = *hash;
     let entry = cache.entry(&hash);
-    if entry.exists() {
+    let start = precise_time_ns();
+    match entry.read() {
+        Ok(vec) => {
+            metrics.source_disk_hits.inc();
+            let bytes: Arc<[u8]> = Arc::from(vec);
+            memory.insert(hash, CachedBlob::new(bytes.clone(), None));
+            let end = precise_time_ns();
+            return Ok((bytes, AcquirePerf { cache_read_ns: end - start, ..Default::default() }));
+        },
+        // Never cached, or evicted since; either way, a miss
+        Err(ref e) if e.kind() == std::io::ErrorKind::NotFound => {},
+        Err(e) => return Err(ServerError::DiskCacheReadIoError(e))
+    }
+    let result = {
+        let _permit = admit(io, 1)?;
+        fetch_bytes(url, None)
+    };
+    if let Ok(FetchedResponse { bytes, perf, etag, last_modified, .. }) = result {
+        metrics.upstream_fetches.inc();
+        metrics.upstream_bytes.add(bytes.len() as u64);
         let start = precise_time_ns();
-        match entry.read() {
-            Ok(vec) => {
+        match entry.write(&bytes) {
+            Ok(()) => {
+                record_source_version(metadata, &hash, url, &SourceMetadata::new(&bytes, etag, last_modified));
+                let bytes: Arc<[u8]> = Arc::from(bytes);
+                memory.insert(hash, CachedBlob::new(bytes.clone(), None));
                 let end = precise_time_ns();
-                Ok((vec, AcquirePerf { cache_read_ns: end - start, ..Default::default() }))
+                Ok((bytes, AcquirePerf { cache_write_ns: end - start, ..perf }))
             },
-            Err(e) => Err(ServerError::DiskCacheReadIoError(e))
+            Err(e) => Err(ServerError::DiskCacheWriteIoError(e))
         }
     } else {
-        let result = fetch_bytes(url, None);
-        if let Ok(FetchedResponse { bytes, perf, .. }) = result {
-            let start = precise_time_ns();
-            match entry.write(&bytes) {
-                Ok(()) => {
-                    let end = precise_time_ns();
-                    Ok((bytes, AcquirePerf { cache_write_ns: end - start, ..perf }))
-                },
-                Err(e) => Err(ServerError::DiskCacheWriteIoError(e))
+        Err(result.map_err(error_upstream).err().unwrap())
+    }
+}
+
+fn record_source_version(metadata: &MetadataStore, hash: &[u8; 32], url: &str, version: &SourceMetadata) {
+    if let Err(e) = metadata.put(hash, version) {
+        warn!("Failed to record source metadata for {}: {:?}", url, e);
+    }
+}
+
+/// The version of an upstream original that requests should be served from. If it was last checked more than
+/// `revalidate_after` ago, the origin is asked first. Derivative keys include the version, so a changed original
+/// gets fresh derivatives.
+fn current_source_version(shared: &SharedData, url: &str) -> std::result::Result<SourceMetadata, ServerError> {
+    let hash = hlp::hashing::hash_256(url.as_bytes());
+    let known = shared.source_metadata.get(&hash).unwrap_or_else(|e| {
+        warn!("Failed to read source metadata for {}: {:?}", url, e);
+        None
+    });
+    match known {
+        Some(known) => match shared.revalidate_after {
+            Some(after) if known.is_stale(after) => {
+                shared.revalidation_flights.run(&hash, shared.coalescing_timeout, || {
+                    revalidate_source(shared, &hash, url, known.clone(), after).map_err(Arc::new)
+                }).map_err(ServerError::Coalesced)
+            },
+            _ => Ok(known)
+        },
+        None => {
+            // Fetching an original records its version; one cached before versions were tracked is hashed here
+            let (bytes, _) = fetch_bytes_using_cache_by_url(shared, url)?;
+            match shared.source_metadata.get(&hash) {
+                Ok(Some(version)) => Ok(version),
+                _ => {
+                    let version = SourceMetadata::new(&bytes, None, None);
+                    record_source_version(&*shared.source_metadata, &hash, url, &version);
+                    Ok(version)
+                }
             }
-        } else {
-            Err(result.map_err(error_upstream).err().unwrap())
         }
     }
 }
 
-fn fetch_response_using_cache_by_url(cache: &CacheFolder, url: &str) -> std::result::Result<(CachedResponse, AcquirePerf), ServerError> {
-    let hash = hlp::hashing::hash_256(url.as_bytes()); //TODO: version this
+/// Conditional GET using the stored validators (a plain GET if the origin sent none).
+/// If the content changed, the cached original is replaced and derivatives of the old version are deleted.
+/// If the check can't be made (io gate full, origin unreachable or failing), the known version keeps being served
+/// and the check is retried after REVALIDATION_RETRY_SECS.
+fn revalidate_source(shared: &SharedData, hash: &[u8; 32], url: &str, known: SourceMetadata, revalidate_after: Duration) -> std::result::Result<SourceMetadata, ServerError> {
+    let result = match admit(&shared.gates.io, 1) {
+        Ok(_permit) => hlp::fetching::fetch_if_modified(url, known.etag.as_ref().map(|s| s.as_str()), known.last_modified.as_ref().map(|s| s.as_str()), None)
+            .map_err(|e| error_upstream(e.into())),
+        Err(e) => Err(e)
+    };
+    let version = match result {
+        Ok(None) => SourceMetadata { last_revalidation: source_metadata::unix_now(), ..known.clone() },
+        Ok(Some(fetched)) => {
+            shared.metrics.upstream_bytes.add(fetched.bytes.len() as u64);
+            let version = SourceMetadata::new(&fetched.bytes, fetched.etag.clone(), fetched.last_modified.clone());
+            if version.content_hash != known.content_hash {
+                // Replace the original before publishing the new version, so new derivatives never render old bytes
+                shared.source_cache.entry(hash).write(&fetched.bytes).map_err(ServerError::DiskCacheWriteIoError)?;
+                shared.memory_cache.remove(hash);
+                shared.memory_cache.insert(*hash, CachedBlob::new(Arc::from(fetched.bytes), None));
+                record_source_version(&*shared.source_metadata, hash, url, &version);
+                invalidate_derivatives(shared, url, &known.version_hash(url));
+                return Ok(version);
+            }
+            version
+        },
+        Err(ref e) if is_transient_upstream_failure(e) => {
+            warn!("Serving the cached copy of {}; revalidation failed: {:?}", url, e);
+            known.retry_revalidation_in(Duration::from_secs(REVALIDATION_RETRY_SECS), revalidate_after)
+        },
+        Err(e) => return Err(e)
+    };
+    record_source_version(&*shared.source_metadata, hash, url, &version);
+    Ok(version)
+}
+
+/// Failures that say nothing about whether an original changed, so its cached copy can still be served
+fn is_transient_upstream_failure(e: &ServerError) -> bool {
+    match *e {
+        ServerError::UpstreamHyperError(_) |
+        ServerError::UpstreamReqwestError(_) |
+        ServerError::UpstreamIoError(_) |
+        ServerError::Overloaded(..) => true,
+        ServerError::UpstreamResponseError(status) => status.is_server_error(),
+        _ => false
+    }
+}
+
+/// Deletes the derivatives rendered from a superseded version of an original, from memory and disk
+fn invalidate_derivatives(shared: &SharedData, url: &str, version_hash: &[u8; 32]) {
+    match shared.source_metadata.take_dependents(version_hash) {
+        Ok(keys) => {
+            for key in keys {
+                shared.memory_cache.remove(&key);
+                if let Err(e) = shared.output_cache.entry(&key).remove() {
+                    warn!("Failed to delete an outdated derivative of {}: {:?}", url, e);
+                }
+            }
+        },
+        Err(e) => warn!("Failed to look up derivatives of the previous version of {}: {:?}", url, e)
+    }
+}
+
+/// Entries are stored as the raw body plus a sidecar holding the content type, so hits are mapped and never parsed
+fn fetch_response_using_cache_by_url(cache: &CacheFolder, io: &Gate, metrics: &ServerMetrics, url: &str) -> std::result::Result<(CachedBody, AcquirePerf), ServerError> {
+    // Versioned: v1 entries were bincode-serialized and are not readable as raw bodies
+    let hash = hlp::hashing::hash_256(format!("permacache-v2\n{}", url).as_bytes());
     let entry = cache.entry(&hash);
-    if entry.exists() {
+    let start = precise_time_ns();
+    match entry.open_with_headers() {
+        Ok(Some((body, headers))) => {
+            let end = precise_time_ns();
+            metrics.source_disk_hits.inc();
+            let content_type = header_value(&headers, "Content-Type").unwrap_or("application/octet-stream").to_owned();
+            return Ok((CachedBody { length: body.len() as u64, body: Box::new(MappedBody(body)), content_type: content_type },
+                       AcquirePerf { cache_read_ns: end - start, ..Default::default() }));
+        },
+        Ok(None) => {},
+        Err(e) => return Err(ServerError::DiskCacheReadIoError(e))
+    }
+    let result = {
+        let _permit = admit(io, 1)?;
+        fetch_bytes(url, None)
+    };
+    if let Ok(fetched) = result {
+        metrics.upstream_fetches.inc();
+        metrics.upstream_bytes.add(fetched.bytes.len() as u64);
         let start = precise_time_ns();
-        match entry.read() {
-            Ok(vec) => {
+        let content_type = format!("{}", fetched.content_type);
+        match entry.write_with_headers(&fetched.bytes, &[("Content-Type", &content_type)]) {
+            Ok(()) => {
                 let end = precise_time_ns();
-                let cached: CachedResponse =  bincode::deserialize(&vec).unwrap();
-                Ok((cached, AcquirePerf { cache_read_ns: end - start, ..Default::default() }))
+                Ok((CachedBody { length: fetched.bytes.len() as u64, body: Box::new(fetched.bytes), content_type: content_type },
+                    AcquirePerf { cache_write_ns: end - start, ..fetched.perf }))
             },
-            Err(e) => Err(ServerError::DiskCacheReadIoError(e))
+            Err(e) => Err(ServerError::DiskCacheWriteIoError(e))
         }
     } else {
-        let result = fetch_bytes(url, None);
-        if let Ok(fetched) = result {
-            let start = precise_time_ns();
-            let bytes = bincode::serialize(&fetched.bytes, bincode::Infinite).unwrap();
-            match entry.write(&bytes) {
-                Ok(()) => {
-                    let end = precise_time_ns();
-                    Ok((CachedResponse { bytes: fetched.bytes, content_type: format!("{}", fetched.content_type) }, AcquirePerf { cache_write_ns: end - start, ..fetched.perf }))
-                },
-                Err(e) => Err(ServerError::DiskCacheWriteIoError(e))
-            }
-        } else {
-            Err(result.map_err(error_upstream).err().unwrap())
-        }
+        Err(result.map_err(error_upstream).err().unwrap())
     }
 }
 
-fn fetch_bytes_from_disk(url: &Path) -> std::result::Result<(Vec<u8>, AcquirePerf), ServerError> {
+/// Maps the original rather than reading it, so workers share the page cache and the decoder reads it in place
+fn fetch_bytes_from_disk(url: &Path) -> std::result::Result<(hlp::filesystem::MappedFile, AcquirePerf), ServerError> {
     let start = precise_time_ns();
-    let vec = hlp::filesystem::read_file_bytes(url)?;
+    let mapped = hlp::filesystem::MappedFile::open(url)?;
     let end = precise_time_ns();
-    Ok((vec, AcquirePerf { cache_read_ns: end - start, ..Default::default() }))
+    Ok((mapped, AcquirePerf { cache_read_ns: end - start, ..Default::default() }))
 }
 
 #[derive(Default, Copy, Clone, Debug)]
@@ -271,6 +653,7 @@ struct RequestPerf {
     acquire: AcquirePerf,
     get_image_info_ns: u64,
     execute_ns: u64,
+    nodes: Vec<s::NodePerf>,
 }
 
 impl RequestPerf {
@@ -283,59 +666,164 @@ impl RequestPerf {
 }
 
 
-fn execute_using<F, F2>(bytes_provider: F2, framewise_generator: F)
+fn execute_using<F, F2, B>(gates: &Gates, bytes_provider: F2, framewise_generator: F)
                         -> std::result::Result<(stateless::BuildOutput, RequestPerf), ServerError>
     where F: Fn(s::ImageInfo) -> std::result::Result<s::Framewise, ServerError>,
-          F2: Fn() -> std::result::Result<(Vec<u8>, AcquirePerf), ServerError>,
+          F2: Fn() -> std::result::Result<(B, AcquirePerf), ServerError>,
+          B: AsRef<[u8]>
 {
-    let (original_bytes, acquire_perf) = bytes_provider()?;
+    let (original, acquire_perf) = bytes_provider()?;
+    let original_bytes = original.as_ref();
     let mut client = stateless::LibClient {};
     let start_get_info = precise_time_ns();
-    let info = client.get_image_info(&original_bytes)?;
-    let start_execute = precise_time_ns();
-
-    let result: stateless::BuildSuccess = client.build(stateless::BuildRequest {
-        framewise: framewise_generator(info)?,
-        inputs: vec![stateless::BuildInput {
+    let mut start_execute = 0;
+    // Permits are taken once the headers are parsed, which tells us how much memory to reserve, and held until the job ends
+    let mut permits = None;
+    let result: stateless::BuildSuccess = client.build_with_info(vec![stateless::BuildInput {
             io_id: 0,
-            bytes: &original_bytes,
-        }],
-        export_graphs_to: None,
+            bytes: original_bytes,
+        }], |info| {
+        let decoded_bytes = (info.image_width.max(0) as u64) * (info.image_height.max(0) as u64) * 4;
+        permits = Some((admit(&gates.decoded_bytes, decoded_bytes)?, admit(&gates.cpu, 1)?));
+        start_execute = precise_time_ns();
+        framewise_generator(info)
     })?;
+    drop(permits);
     let end_execute = precise_time_ns();
     Ok((result.outputs.into_iter().next().unwrap(),
         RequestPerf {
             acquire: acquire_perf,
             get_image_info_ns: start_execute - start_get_info,
             execute_ns: end_execute - start_execute,
+            nodes: result.performance.map(|p| p.nodes).unwrap_or_default(),
         }))
 }
 header! { (XImageflowPerf, "X-Imageflow-Perf") => [String] }
 
-fn respond_using<F, F2, A>(debug_info: A, bytes_provider: F2, framewise_generator: F)
-                        -> IronResult<Response>
+/// Identifies an encoded derivative by where the original came from and the normalized instructions applied to it.
+/// Querystrings that differ only in key case, key order, or ignored keys share an entry.
+fn derivative_cache_key(source_identity: &str, url: &Url) -> std::result::Result<[u8; 32], ServerError> {
+    let command = ::imageflow_riapi::ir4::Ir4Command::Url(url.as_str().to_owned());
+    let canonical = command.parse().map_err(|e| ServerError::LayoutSizingError(e))?.parsed.to_string();
+    Ok(hlp::hashing::hash_256(format!("ir4-derivative-v2\n{}\n{}", source_identity, canonical).as_bytes()))
+}
+
+/// Writes a cached value to the socket without copying it into a Vec first
+struct SharedBody(Arc<[u8]>);
+
+impl iron::response::WriteBody for SharedBody {
+    fn write_body(&mut self, res: &mut std::io::Write) -> std::io::Result<()> {
+        res.write_all(&self.0)
+    }
+}
+
+fn respond_with_blob(blob: CachedBlob, perf: String) -> Response {
+    let mime = blob.content_type.as_ref()
+        .and_then(|s| s.parse::<Mime>().ok())
+        .unwrap_or(Mime::from_str("application/octet-stream").unwrap());
+    let length = blob.bytes.len() as u64;
+    let body: Box<iron::response::WriteBody> = Box::new(SharedBody(blob.bytes));
+    let mut res = Response::with((mime, status::Ok, body));
+    res.headers.set(hyper::header::ContentLength(length));
+    res.headers.set(XImageflowPerf(perf));
+    res
+}
+
+/// Serves a previously encoded derivative from memory or disk; no LibClient is created and the original is never read.
+/// Misses are executed as before (once, however many requests are waiting on the same key),
+/// and the encoded result is written back to both tiers for next time.
+fn respond_using_output_cache<F, F2, A, B>(shared: &SharedData, cache_key: &[u8; 32], debug_info: A,
+                                         bytes_provider: F2, framewise_generator: F)
+                                         -> IronResult<Response>
     where F: Fn(s::ImageInfo) -> std::result::Result<s::Framewise, ServerError>,
-          F2: Fn() -> std::result::Result<(Vec<u8>, AcquirePerf), ServerError>,
-    A: std::fmt::Debug
+          F2: Fn() -> std::result::Result<(B, AcquirePerf), ServerError>,
+          A: std::fmt::Debug,
+          B: AsRef<[u8]>
 {
-    //TODO: support process=, cache=, etc? pass-through by default?
-    match execute_using(bytes_provider, framewise_generator) {
-        Ok((output, perf)) => {
-            let mime = output.mime_type
-                .parse::<Mime>()
-                .unwrap_or(Mime::from_str("application/octet-stream").unwrap());
-            let mut res = Response::with((mime, status::Ok, output.bytes));
+    let start = precise_time_ns();
+    if let Some(hit) = shared.memory_cache.get(cache_key) {
+        let end = precise_time_ns();
+        return Ok(respond_with_blob(hit, format!("memory cache hit {:.2}ms", (end - start) as f64 / 1000000.0)));
+    }
+    let outcome = shared.render_flights.run(cache_key, shared.coalescing_timeout, || {
+        read_or_render_derivative(&shared.memory_cache, &shared.output_cache, &shared.gates, &shared.metrics, cache_key, &debug_info, bytes_provider, framewise_generator)
+            .map_err(Arc::new)
+    });
+    match outcome {
+        Ok((blob, perf)) => Ok(respond_with_blob(blob, perf)),
+        Err(e) => respond_with_server_error(debug_info, ServerError::Coalesced(e), true)
+    }
+}
 
-            res.headers.set(XImageflowPerf(perf.short()));
-            Ok(res)
+fn read_or_render_derivative<F, F2, A, B>(memory: &MemCache, output_cache: &CacheFolder, gates: &Gates, metrics: &ServerMetrics, cache_key: &[u8; 32], debug_info: &A,
+                                         bytes_provider: F2, framewise_generator: F)
+                                         -> std::result::Result<(CachedBlob, String), ServerError>
+    where F: Fn(s::ImageInfo) -> std::result::Result<s::Framewise, ServerError>,
+          F2: Fn() -> std::result::Result<(B, AcquirePerf), ServerError>,
+          A: std::fmt::Debug,
+          B: AsRef<[u8]>
+{
+    let start = precise_time_ns();
+    let entry = output_cache.entry(cache_key);
+    match entry.open_with_headers() {
+        Ok(Some((body, headers))) => {
+            let content_type = header_value(&headers, "Content-Type").map(|v| Arc::from(v));
+            // Copied once into the memory tier; later hits share that copy
+            let blob = CachedBlob::new(Arc::from(&body[..]), content_type);
+            memory.insert(*cache_key, blob.clone());
+            let end = precise_time_ns();
+            metrics.derivative_disk_hits.inc();
+            metrics.cache_read_ns.record(end - start);
+            return Ok((blob, format!("output cache hit {:.2}ms", (end - start) as f64 / 1000000.0)));
         }
-        Err(e) => respond_with_server_error(debug_info, e, true)
+        Ok(None) => {}
+        Err(e) => warn!("Ignoring unreadable output cache entry for {:?}: {:?}", debug_info, e)
+    }
+
+    let (output, perf) = execute_using(gates, bytes_provider, framewise_generator)?;
+    metrics.record_render(&perf);
+    let start_write = precise_time_ns();
+    // The response is still good if the cache is full or unwritable
+    if let Err(e) = entry.write_with_headers(&output.bytes, &[("Content-Type", &output.mime_type)]) {
+        warn!("Failed to write output cache entry for {:?}: {:?}", debug_info, ServerError::DiskCacheWriteIoError(e));
+    }
+    let end_write = precise_time_ns();
+    metrics.cache_write_ns.record(end_write - start_write);
+    let blob = CachedBlob::new(Arc::from(output.bytes), Some(Arc::from(output.mime_type.as_str())));
+    memory.insert(*cache_key, blob.clone());
+    Ok((blob, format!("{} cache-write: {:.2}ms", perf.short(), (end_write - start_write) as f64 / 1000000.0)))
+}
+
+fn is_upstream_not_found(e: &ServerError) -> bool {
+    match *e {
+        ServerError::UpstreamResponseError(hyper::status::StatusCode::NotFound) => true,
+        ServerError::Coalesced(ref inner) => is_upstream_not_found(inner),
+        _ => false
+    }
+}
+
+fn is_overloaded(e: &ServerError) -> bool {
+    match *e {
+        ServerError::Overloaded(_, _) => true,
+        ServerError::Coalesced(ref inner) => is_overloaded(inner),
+        _ => false
     }
 }
 
 fn respond_with_server_error<A>(debug_info: A, e: ServerError, detailed_errors: bool) -> IronResult<Response> where A: std::fmt::Debug {
     match e {
-        ServerError::UpstreamResponseError(hyper::status::StatusCode::NotFound) => {
+        ref e if is_overloaded(e) => {
+            let bytes = match detailed_errors {
+                true => format!("Service Unavailable (server busy)\nInfo:{:?}\nError:{:?}", debug_info, e).into_bytes(),
+                false => format!("Service Unavailable (server busy)").into_bytes()
+            };
+            let mut res = Response::with((Mime::from_str("text/plain").unwrap(),
+                                          status::ServiceUnavailable,
+                                          bytes));
+            res.headers.set_raw("Retry-After", vec![b"1".to_vec()]);
+            Ok(res)
+        },
+        ref e if is_upstream_not_found(e) => {
             let bytes = match detailed_errors {
                 false => format!("Remote file not found (upstream server responded with 404)").into_bytes(),
                 true => format!("Remote file not found (upstream server responded with 404 to {:?})", debug_info).into_bytes(),
@@ -359,10 +847,16 @@ fn respond_with_server_error<A>(debug_info: A, e: ServerError, detailed_errors:
 }
 
 
-fn ir4_http_respond<F>(shared: &SharedData, url: &str, framewise_generator: F) -> IronResult<Response>
+fn ir4_http_respond<F>(shared: &SharedData, url: &str, version: &SourceMetadata, cache_key: &[u8; 32], framewise_generator: F) -> IronResult<Response>
     where F: Fn(s::ImageInfo) -> std::result::Result<s::Framewise, ServerError>
 {
-    respond_using(url, || fetch_bytes_using_cache_by_url(&shared.source_cache, url).map_err(error_upstream), framewise_generator)
+    respond_using_output_cache(shared, cache_key, url, || {
+        // Only called when rendering, so each derivative is recorded against its source version once
+        if let Err(e) = shared.source_metadata.add_dependent(&version.version_hash(url), cache_key) {
+            warn!("Failed to record a derivative of {}: {:?}", url, e);
+        }
+        fetch_bytes_using_cache_by_url(shared, url).map_err(error_upstream)
+    }, framewise_generator)
 }
 
 
@@ -380,10 +874,17 @@ type EngineHandler<T> = fn(req: &mut Request, engine_data: &T, mount: &MountLoca
 type EngineSetup<T> = fn(mount: &MountLocation) -> Result<(T, EngineHandler<T>), String>;
 
 
-fn ir4_local_respond<F>(_: &SharedData, source: &Path, framewise_generator: F) -> IronResult<Response>
+fn ir4_local_respond<F>(shared: &SharedData, source: &Path, cache_key: &[u8; 32], framewise_generator: F) -> IronResult<Response>
     where F: Fn(s::ImageInfo) -> std::result::Result<s::Framewise, ServerError>
 {
-    respond_using(source, || fetch_bytes_from_disk(source), framewise_generator)
+    respond_using_output_cache(shared, cache_key, source, || fetch_bytes_from_disk(source), framewise_generator)
+}
+
+/// Path, length and modification time, so replacing an original invalidates its derivatives
+fn local_source_identity(source: &Path) -> std::result::Result<String, ServerError> {
+    let meta = std::fs::metadata(source)?;
+    let modified = meta.modified()?.duration_since(std::time::UNIX_EPOCH).unwrap_or_default();
+    Ok(format!("ir4_local {:?} {} {}.{:09}", source, meta.len(), modified.as_secs(), modified.subsec_nanos()))
 }
 
 fn ir4_local_handler(req: &mut Request, local_path: &PathBuf, _: &MountLocation) -> IronResult<Response> {
@@ -393,7 +894,12 @@ fn ir4_local_handler(req: &mut Request, local_path: &PathBuf, _: &MountLocation)
     let shared = req.get::<persistent::Read<SharedData>>().unwrap();
 
     if requested_path.path.exists() {
-        return ir4_local_respond(&shared, requested_path.path.as_path(), move |info: s::ImageInfo| {
+        let source = requested_path.path.as_path();
+        let cache_key = match local_source_identity(source).and_then(|id| derivative_cache_key(&id, &url)) {
+            Ok(key) => key,
+            Err(e) => return respond_with_server_error(source, e, true)
+        };
+        return ir4_local_respond(&shared, source, &cache_key, move |info: s::ImageInfo| {
             ir4_framewise(info, &url)
         });
     }
@@ -449,13 +955,16 @@ fn permacache_proxy_handler(req: &mut Request, base_url: &String, _: &MountLocat
     //TODO: Ensure the combined url is canonical (or, at least, lacks ..)
     let remote_url = format!("{}{}{}", base_url, &url.path()[1..], req.url.query().unwrap_or(""));
 
-    match fetch_response_using_cache_by_url(&shared.source_cache, &remote_url) {
-        Ok((output, _)) => {
+    match fetch_response_using_cache_by_url(&shared.source_cache, &shared.gates.io, &shared.metrics, &remote_url) {
+        Ok((output, perf)) => {
+            shared.metrics.record_acquire(&perf);
             let mime = output.content_type
                 .parse::<Mime>()
                 .unwrap_or(Mime::from_str("application/octet-stream").unwrap());
 
-            Ok(Response::with((mime, status::Ok, output.bytes)))
+            let mut res = Response::with((mime, status::Ok, output.body));
+            res.headers.set(hyper::header::ContentLength(output.length));
+            Ok(res)
         }
         Err(e) => respond_with_server_error(&remote_url, e, true)
     }
@@ -472,7 +981,7 @@ fn permacache_proxy_handler_guess_types(req: &mut Request, base_url: &String, _:
     let shared = req.get::<persistent::Read<SharedData>>().unwrap();
     //TODO: Ensure the combined url is canonical (or, at least, lacks ..)
     let remote_url = format!("{}{}{}", base_url, &url.path()[1..], req.url.query().unwrap_or(""));
-    match fetch_bytes_using_cache_by_url(&shared.source_cache, &remote_url) {
+    match fetch_bytes_using_cache_by_url(&shared, &remote_url) {
         Ok((bytes, _)) => {
 
             let part_path = Path::new(&url.path()[1..]);
@@ -483,7 +992,11 @@ fn permacache_proxy_handler_guess_types(req: &mut Request, base_url: &String, _:
 //                .parse::<Mime>()
 //                .unwrap_or(Mime::from_str("application/octet-stream").unwrap());
 
-            Ok(Response::with((mime, status::Ok, bytes)))
+            let length = bytes.len() as u64;
+            let body: Box<iron::response::WriteBody> = Box::new(SharedBody(bytes));
+            let mut res = Response::with((mime, status::Ok, body));
+            res.headers.set(hyper::header::ContentLength(length));
+            Ok(res)
         }
         Err(e) => respond_with_server_error(&remote_url, e, true)
     }
@@ -495,8 +1008,16 @@ fn ir4_http_handler(req: &mut Request, base_url: &String, _: &MountLocation) ->
     let shared = req.get::<persistent::Read<SharedData>>().unwrap();
     //TODO: Ensure the combined url is canonical (or, at least, lacks ..)
     let remote_url = format!("{}{}", base_url, &url.path()[1..]);
+    let version = match current_source_version(&shared, &remote_url) {
+        Ok(version) => version,
+        Err(e) => return respond_with_server_error(&remote_url, e, true)
+    };
+    let cache_key = match derivative_cache_key(&format!("ir4_http {} {}", remote_url, version.content_hash), &url) {
+        Ok(key) => key,
+        Err(e) => return respond_with_server_error(&remote_url, e, true)
+    };
 
-    ir4_http_respond(&shared, &remote_url, move |info: s::ImageInfo| {
+    ir4_http_respond(&shared, &remote_url, &version, &cache_key, move |info: s::ImageInfo| {
         ir4_framewise(info, &url)
     })
 }
@@ -529,7 +1050,18 @@ fn mount<T>(mount: MountLocation, mou: &mut mount::Mount, setup: EngineSetup<T>)
     let (data, handler) = setup(&mount)?;
 
     let prefix = mount.prefix.clone();
-    mou.mount(&prefix, move |r: &mut Request| { handler(r, &data, &mount) });
+    mou.mount(&prefix, move |r: &mut Request| {
+        let shared = r.get::<persistent::Read<SharedData>>().unwrap();
+        shared.metrics.requests.inc();
+        let _in_flight = shared.metrics.in_flight.track();
+        let response = handler(r, &data, &mount);
+        if let Ok(ref res) = response {
+            if let Some(length) = res.headers.get::<hyper::header::ContentLength>() {
+                shared.metrics.response_bytes.add(length.0);
+            }
+        }
+        response
+    });
     Ok(())
 }
 
@@ -537,13 +1069,47 @@ fn mount<T>(mount: MountLocation, mou: &mut mount::Mount, setup: EngineSetup<T>)
 pub fn serve(c: StartServerConfig) {
     env_logger::init().unwrap();
 
+    let (source_cache, output_cache) = {
+        let layout = c.default_cache_layout.unwrap_or(FolderLayout::Normal);
+        let open_cache = |name: &str| {
+            let folder = CacheFolder::new(c.data_dir.join(Path::new(name)).as_path(), layout);
+            Arc::new(match c.disk_cache_bytes {
+                Some(max_bytes) => folder.with_limits(CacheLimits { max_bytes: max_bytes, max_entries: layout.suggested_max_entries() }),
+                None => folder
+            })
+        };
+        (open_cache("source_cache"), open_cache("output_cache"))
+    };
+    for cache in &[&source_cache, &output_cache] {
+        disk_cache::start_evictor((*cache).clone(), Duration::from_secs(EVICTION_INTERVAL_SECS));
+    }
+    // Each admitted render may split its work across no more than its share of the cores
+    imageflow_core::bands::set_max_threads(num_cpus::get() / c.admission.cpu_workers.max(1));
+
     let shared_data = SharedData {
-        source_cache: CacheFolder::new(c.data_dir.join(Path::new("source_cache")).as_path(), c.default_cache_layout.unwrap_or(FolderLayout::Normal)),
-        output_cache: CacheFolder::new(c.data_dir.join(Path::new("output_cache")).as_path(), c.default_cache_layout.unwrap_or(FolderLayout::Normal)),
-        requests_received: ATOMIC_U64_INIT //NOT YET USED
+        source_cache: source_cache,
+        output_cache: output_cache,
+        memory_cache: MemCache::new(c.memory_cache_bytes),
+        source_flights: SingleFlight::new(),
+        render_flights: SingleFlight::new(),
+        coalescing_timeout: Duration::from_secs(DEFAULT_COALESCING_TIMEOUT_SECS),
+        gates: Gates::new(&c.admission),
+        source_metadata: {
+            let store: Box<MetadataStore> = match c.metadata_redis {
+                Some(ref address) => Box::new(RedisMetadataStore::new(address, "imageflow:")),
+                None => Box::new(DiskMetadataStore::new(&c.data_dir.join("source_metadata")))
+            };
+            // A record held longer than the revalidation interval would hide another server's revalidation
+            let ttl = c.revalidate_sources_after.unwrap_or(Duration::from_secs(DEFAULT_METADATA_TTL_SECS));
+            Box::new(CachedMetadataStore::new(store, ttl, METADATA_MEMORY_ENTRIES))
+        },
+        revalidate_after: c.revalidate_sources_after,
+        revalidation_flights: SingleFlight::new(),
+        metrics: ServerMetrics::new(),
     };
 
     let mut mou = mount::Mount::new();
+    mou.mount("/metrics", metrics_handler);
     let mut router = Router::new();
 
     // Mount prefix (external) (url|relative path)
@@ -581,6 +1147,7 @@ pub fn serve(c: StartServerConfig) {
 
     let mut chain = Chain::new(mou);
 
+    let handler_threads = shared_data.gates.handler_threads();
     chain.link(persistent::Read::<SharedData>::both(shared_data));
 
     let (logger_before, logger_after) = Logger::new(None);
@@ -594,14 +1161,17 @@ pub fn serve(c: StartServerConfig) {
     //let ssl = NativeTlsServer::new("identity.p12", "mypass").unwrap();
 
 
+    let mut iron = Iron::new(chain);
+    iron.threads = handler_threads;
+
     println!("Listening on {}", c.bind_addr.as_str());
     if c.cert.is_some() {
         let pwd = c.cert_pwd.unwrap_or("".into());
         let ssl = NativeTlsServer::new(c.cert.unwrap(), &pwd).unwrap();
 
-        Iron::new(chain).https(c.bind_addr.as_str(), ssl).unwrap();
+        iron.https(c.bind_addr.as_str(), ssl).unwrap();
     }else{
-        Iron::new(chain).http(c.bind_addr.as_str()).unwrap();
+        iron.http(c.bind_addr.as_str()).unwrap();
     }
 }
 
@@ -681,6 +1251,30 @@ impl MountLocation {
 }
 
 
+/// Limits on concurrent work; requests that can't be admitted within `max_queue_wait` get a 503
+#[derive(Debug, Clone, PartialEq)]
+pub struct AdmissionConfig {
+    /// Concurrent renders
+    pub cpu_workers: usize,
+    /// Concurrent upstream fetches
+    pub io_workers: usize,
+    pub max_queue_wait: Duration,
+    /// Estimated decoded frame bytes (width x height x 4) across all renders in flight
+    pub max_decoded_bytes_in_flight: u64,
+}
+
+impl AdmissionConfig {
+    /// One render per core, 64 fetches, 5 seconds of queueing, and 1GiB of decoded frames
+    pub fn for_this_machine() -> AdmissionConfig {
+        AdmissionConfig {
+            cpu_workers: num_cpus::get(),
+            io_workers: 64,
+            max_queue_wait: Duration::from_secs(5),
+            max_decoded_bytes_in_flight: 1024 * 1024 * 1024,
+        }
+    }
+}
+
 #[derive(Debug, Clone, PartialEq)]
 pub struct StartServerConfig {
     pub data_dir: PathBuf,
@@ -688,6 +1282,15 @@ pub struct StartServerConfig {
     pub mounts: Vec<MountLocation>,
     pub default_cache_layout: Option<FolderLayout>,
     pub integration_test: bool,
+    /// Byte budget for originals and derivatives held in memory, across all mounts. 0 disables the tier.
+    pub memory_cache_bytes: usize,
+    /// Byte limit for each disk cache folder (originals, derivatives). None lets them grow without bound.
+    pub disk_cache_bytes: Option<u64>,
+    pub admission: AdmissionConfig,
+    /// How long an upstream original is trusted before a conditional GET checks it. None trusts it forever.
+    pub revalidate_sources_after: Option<Duration>,
+    /// host:port of a redis server to hold source metadata; by default it is kept in data_dir
+    pub metadata_redis: Option<String>,
     pub cert: Option<PathBuf>,
     pub cert_pwd: Option<String>
 }
@@ -697,3 +1300,13 @@ pub struct StartServerConfig {
 fn test_file_macro_for_this_build(){
     assert!(file!().starts_with(env!("CARGO_PKG_NAME")))
 }
+
+#[test]
+fn test_derivative_cache_key_is_canonical(){
+    let key = |source: &str, url: &str| derivative_cache_key(source, &Url::parse(url).unwrap()).unwrap();
+    let a = key("ir4_http http://example.com/a.jpg", "http://localhost/a.jpg?w=100&h=50&format=png");
+    assert_eq!(a, key("ir4_http http://example.com/a.jpg", "http://localhost/a.jpg?format=png&H=50&w=100"));
+    assert_eq!(a, key("ir4_http http://example.com/a.jpg", "http://localhost/a.jpg?w=100&h=50&format=png&unrecognized=1"));
+    assert_ne!(a, key("ir4_http http://example.com/a.jpg", "http://localhost/a.jpg?w=101&h=50&format=png"));
+    assert_ne!(a, key("ir4_http http://example.com/b.jpg", "http://localhost/a.jpg?w=100&h=50&format=png"));
+}
@@ -65,6 +65,29 @@ fn main_with_exit_code() -> i32 {
                 .arg(Arg::with_name("data-dir").long("data-dir").takes_value(true).required_unless("demo")
                     .validator(|f| if Path::new(&f).is_dir() { Ok(()) } else { Err(format!("The specified data-dir {} must be an existing directory. ", f)) })
                 .help("An existing directory for logging and caching"))
+                .arg(Arg::with_name("memory-cache-mb").long("memory-cache-mb").takes_value(true).default_value("256").required(false)
+                    .validator(|f| f.parse::<usize>().map(|_| ()).map_err(|_| format!("--memory-cache-mb must be a whole number of megabytes; received {}", f)))
+                    .help("Megabytes of RAM to use for caching originals and resized images (in front of the disk cache). 0 disables."))
+                .arg(Arg::with_name("disk-cache-mb").long("disk-cache-mb").takes_value(true).required(false)
+                    .validator(|f| f.parse::<u64>().map(|_| ()).map_err(|_| format!("--disk-cache-mb must be a whole number of megabytes; received {}", f)))
+                    .help("Megabytes of disk each cache folder under data-dir may use; the oldest entries are deleted beyond this. Unlimited if omitted."))
+                .arg(Arg::with_name("cpu-workers").long("cpu-workers").takes_value(true).required(false)
+                    .validator(|f| f.parse::<usize>().map(|_| ()).map_err(|_| format!("--cpu-workers must be a whole number; received {}", f)))
+                    .help("How many images to process at once. Defaults to the number of cores."))
+                .arg(Arg::with_name("io-workers").long("io-workers").takes_value(true).required(false)
+                    .validator(|f| f.parse::<usize>().map(|_| ()).map_err(|_| format!("--io-workers must be a whole number; received {}", f)))
+                    .help("How many upstream fetches to run at once. Defaults to 64."))
+                .arg(Arg::with_name("max-queue-wait-ms").long("max-queue-wait-ms").takes_value(true).required(false)
+                    .validator(|f| f.parse::<u64>().map(|_| ()).map_err(|_| format!("--max-queue-wait-ms must be a whole number; received {}", f)))
+                    .help("How long a request may wait for a worker before the server answers 503. Defaults to 5000."))
+                .arg(Arg::with_name("max-decoded-mb-in-flight").long("max-decoded-mb-in-flight").takes_value(true).required(false)
+                    .validator(|f| f.parse::<u64>().map(|_| ()).map_err(|_| format!("--max-decoded-mb-in-flight must be a whole number; received {}", f)))
+                    .help("Caps the estimated memory (width x height x 4) of all images being processed at once. Defaults to 1024."))
+                .arg(Arg::with_name("revalidate-after-secs").long("revalidate-after-secs").takes_value(true).required(false)
+                    .validator(|f| f.parse::<u64>().map(|_| ()).map_err(|_| format!("--revalidate-after-secs must be a whole number; received {}", f)))
+                    .help("Check upstream originals for changes (with a conditional GET) once they are this old. By default they are cached forever."))
+                .arg(Arg::with_name("metadata-redis").long("metadata-redis").takes_value(true).required(false)
+                    .help("host:port of a redis server for sharing source metadata between servers. By default it is stored in the data directory."))
                 .arg(Arg::with_name("integration-test").long("integration-test").hidden(true).help("Never use this outside of an integration test. Exposes an HTTP endpoint to kill the server."))
 
 
@@ -105,6 +128,15 @@ fn main_with_exit_code() -> i32 {
                 std::process::exit(64);
             }
         }
+        let memory_cache_bytes = m.value_of("memory-cache-mb").map(|s| s.parse::<usize>().expect("validator not working - bug in clap?")).unwrap_or(256) * 1024 * 1024;
+        let disk_cache_bytes = m.value_of("disk-cache-mb").map(|s| s.parse::<u64>().expect("validator not working - bug in clap?") * 1024 * 1024);
+        let mut admission = AdmissionConfig::for_this_machine();
+        if let Some(v) = m.value_of("cpu-workers") { admission.cpu_workers = v.parse::<usize>().expect("validator not working - bug in clap?"); }
+        if let Some(v) = m.value_of("io-workers") { admission.io_workers = v.parse::<usize>().expect("validator not working - bug in clap?"); }
+        if let Some(v) = m.value_of("max-queue-wait-ms") { admission.max_queue_wait = std::time::Duration::from_millis(v.parse::<u64>().expect("validator not working - bug in clap?")); }
+        if let Some(v) = m.value_of("max-decoded-mb-in-flight") { admission.max_decoded_bytes_in_flight = v.parse::<u64>().expect("validator not working - bug in clap?") * 1024 * 1024; }
+        let revalidate_sources_after = m.value_of("revalidate-after-secs").map(|v| std::time::Duration::from_secs(v.parse::<u64>().expect("validator not working - bug in clap?")));
+        let metadata_redis = m.value_of("metadata-redis").map(|s| s.to_owned());
         let bind = m.value_of("bind-address").map(|s| s.to_owned()).expect("bind address required");
 
 //        let is_release = option_env!("GIT_OPTIONAL_TAG").is_some() && !option_env!("GIT_OPTIONAL_TAG").unwrap().is_empty();
@@ -174,6 +206,11 @@ fn main_with_exit_code() -> i32 {
                 data_dir: data_dir.unwrap_or_else(|| { if !alt_data_dir.exists() { std::fs::create_dir_all(&alt_data_dir).unwrap(); } alt_data_dir }),
                 default_cache_layout: Some(FolderLayout::Tiny),
                 integration_test: integration_test,
+                memory_cache_bytes: memory_cache_bytes,
+                disk_cache_bytes: disk_cache_bytes,
+                admission: admission.clone(),
+                revalidate_sources_after: revalidate_sources_after,
+                metadata_redis: metadata_redis.clone(),
                 mounts: mounts,
                 cert: cert,
                 cert_pwd: m.value_of("cert-pwd").map(|s| s.into()),
@@ -188,6 +225,11 @@ fn main_with_exit_code() -> i32 {
                 mounts: mounts,
                 default_cache_layout: Some(FolderLayout::Normal),
                 integration_test: integration_test,
+                memory_cache_bytes: memory_cache_bytes,
+                disk_cache_bytes: disk_cache_bytes,
+                admission: admission.clone(),
+                revalidate_sources_after: revalidate_sources_after,
+                metadata_redis: metadata_redis.clone(),
                 cert: cert,
                 cert_pwd: m.value_of("cert-pwd").map(|s| s.into()),
             });
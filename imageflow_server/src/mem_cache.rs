@@ -0,0 +1,306 @@
+/// An in-memory tier in front of CacheFolder, for originals and encoded derivatives that are requested over and over.
+///
+/// Keys are the same 32-byte blake2 hashes used on disk. Values are shared as Arc<[u8]>, so a hit is a refcount bump.
+/// The byte budget is split evenly across lock-striped shards; each shard is an LRU list plus a small frequency sketch.
+/// When a shard is full, a newcomer is only admitted if it has been requested more often than the entry it would
+/// evict (TinyLFU), so a burst of one-off requests cannot flush the hot set.
+use ::std::sync::{Arc, Mutex};
+use ::std::sync::atomic::{AtomicU64, Ordering};
+
+extern crate lru_cache;
+use self::lru_cache::LruCache;
+
+pub const DEFAULT_SHARD_COUNT: usize = 16;
+
+#[derive(Clone, Debug)]
+pub struct CachedBlob {
+    pub bytes: Arc<[u8]>,
+    /// Known for fetched originals and encoded outputs; None when only the bytes were cached
+    pub content_type: Option<Arc<str>>,
+}
+
+impl CachedBlob {
+    pub fn new(bytes: Arc<[u8]>, content_type: Option<Arc<str>>) -> CachedBlob {
+        CachedBlob { bytes: bytes, content_type: content_type }
+    }
+    fn weight(&self) -> usize {
+        self.bytes.len() + self.content_type.as_ref().map(|s| s.len()).unwrap_or(0)
+    }
+}
+
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct MemCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub insertions: u64,
+    pub evictions: u64,
+    /// Inserts turned away by the frequency filter, or because the value exceeds a shard's budget
+    pub rejections: u64,
+    pub entries: u64,
+    pub bytes: u64,
+    pub max_bytes: u64,
+}
+
+/// Four rows of 4-bit counters, packed two per byte. Counters are halved every `sample_size` increments,
+/// so popularity decays and yesterday's hot set does not linger.
+struct FrequencySketch {
+    rows: [Vec<u8>; 4],
+    mask: usize,
+    additions: usize,
+    sample_size: usize,
+}
+
+impl FrequencySketch {
+    fn new(expected_entries: usize) -> FrequencySketch {
+        let counters = expected_entries.max(64).next_power_of_two();
+        FrequencySketch {
+            rows: [vec![0u8; counters / 2], vec![0u8; counters / 2], vec![0u8; counters / 2], vec![0u8; counters / 2]],
+            mask: counters - 1,
+            additions: 0,
+            sample_size: counters * 10,
+        }
+    }
+
+    fn index(&self, key: &[u8; 32], row: usize) -> usize {
+        // The key is already a uniform hash; each row reads a different 8 bytes of it
+        let mut v = 0u64;
+        for b in &key[row * 8..row * 8 + 8] {
+            v = (v << 8) | (*b as u64);
+        }
+        (v as usize) & self.mask
+    }
+
+    fn get(row: &[u8], ix: usize) -> u8 {
+        (row[ix / 2] >> ((ix % 2) * 4)) & 0x0f
+    }
+
+    fn frequency(&self, key: &[u8; 32]) -> u8 {
+        (0..4).map(|r| FrequencySketch::get(&self.rows[r], self.index(key, r))).min().unwrap_or(0)
+    }
+
+    fn increment(&mut self, key: &[u8; 32]) {
+        let mut added = false;
+        for r in 0..4 {
+            let ix = self.index(key, r);
+            let shift = (ix % 2) * 4;
+            let byte = &mut self.rows[r][ix / 2];
+            if (*byte >> shift) & 0x0f < 15 {
+                *byte += 1 << shift;
+                added = true;
+            }
+        }
+        if added {
+            self.additions += 1;
+            if self.additions >= self.sample_size {
+                self.reset();
+            }
+        }
+    }
+
+    fn reset(&mut self) {
+        for row in self.rows.iter_mut() {
+            for byte in row.iter_mut() {
+                *byte = (*byte >> 1) & 0x77;
+            }
+        }
+        self.additions /= 2;
+    }
+}
+
+struct Shard {
+    entries: LruCache<[u8; 32], CachedBlob>,
+    sketch: FrequencySketch,
+    bytes: usize,
+    max_bytes: usize,
+}
+
+pub struct MemCache {
+    shards: Vec<Mutex<Shard>>,
+    max_bytes: usize,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    insertions: AtomicU64,
+    evictions: AtomicU64,
+    rejections: AtomicU64,
+}
+
+impl ::std::fmt::Debug for MemCache {
+    fn fmt(&self, f: &mut ::std::fmt::Formatter) -> ::std::fmt::Result {
+        write!(f, "MemCache {:?}", self.stats())
+    }
+}
+
+impl MemCache {
+    pub fn new(max_bytes: usize) -> MemCache {
+        MemCache::with_shards(max_bytes, DEFAULT_SHARD_COUNT)
+    }
+
+    pub fn with_shards(max_bytes: usize, shard_count: usize) -> MemCache {
+        let shard_count = shard_count.max(1);
+        let shard_bytes = max_bytes / shard_count;
+        // Size each sketch for a shard full of ~32KiB values
+        let expected_entries = shard_bytes / 32768;
+        MemCache {
+            shards: (0..shard_count).map(|_| Mutex::new(Shard {
+                entries: LruCache::new(::std::usize::MAX),
+                sketch: FrequencySketch::new(expected_entries),
+                bytes: 0,
+                max_bytes: shard_bytes,
+            })).collect(),
+            max_bytes: max_bytes,
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            insertions: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+            rejections: AtomicU64::new(0),
+        }
+    }
+
+    fn shard_for(&self, key: &[u8; 32]) -> &Mutex<Shard> {
+        // Use bytes the sketch rows don't, so shard choice and counter placement are independent
+        &self.shards[(key[31] as usize) % self.shards.len()]
+    }
+
+    pub fn get(&self, key: &[u8; 32]) -> Option<CachedBlob> {
+        let mut shard = self.shard_for(key).lock().unwrap();
+        shard.sketch.increment(key);
+        let found = shard.entries.get_mut(key).map(|v| v.clone());
+        if found.is_some() {
+            self.hits.fetch_add(1, Ordering::Relaxed);
+        } else {
+            self.misses.fetch_add(1, Ordering::Relaxed);
+        }
+        found
+    }
+
+    /// Returns false if the value was not admitted. Replacing an existing entry is always allowed.
+    pub fn insert(&self, key: [u8; 32], value: CachedBlob) -> bool {
+        let weight = value.weight();
+        let mut shard = self.shard_for(&key).lock().unwrap();
+        if weight > shard.max_bytes {
+            self.rejections.fetch_add(1, Ordering::Relaxed);
+            return false;
+        }
+        if let Some(previous) = shard.entries.remove(&key) {
+            shard.bytes -= previous.weight();
+        } else if shard.bytes + weight > shard.max_bytes {
+            // Only make room if the newcomer is more popular than everything it would displace
+            let candidate = shard.sketch.frequency(&key);
+            let mut needed = shard.bytes + weight - shard.max_bytes;
+            for (victim_key, victim) in shard.entries.iter() {
+                if needed == 0 {
+                    break;
+                }
+                if shard.sketch.frequency(victim_key) >= candidate {
+                    self.rejections.fetch_add(1, Ordering::Relaxed);
+                    return false;
+                }
+                needed = needed.saturating_sub(victim.weight());
+            }
+        }
+        while shard.bytes + weight > shard.max_bytes {
+            match shard.entries.remove_lru() {
+                Some((_, evicted)) => {
+                    shard.bytes -= evicted.weight();
+                    self.evictions.fetch_add(1, Ordering::Relaxed);
+                }
+                None => break,
+            }
+        }
+        shard.bytes += weight;
+        shard.entries.insert(key, value);
+        self.insertions.fetch_add(1, Ordering::Relaxed);
+        true
+    }
+
+    pub fn remove(&self, key: &[u8; 32]) -> Option<CachedBlob> {
+        let mut shard = self.shard_for(key).lock().unwrap();
+        let removed = shard.entries.remove(key);
+        if let Some(ref v) = removed {
+            shard.bytes -= v.weight();
+        }
+        removed
+    }
+
+    pub fn stats(&self) -> MemCacheStats {
+        let mut stats = MemCacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            insertions: self.insertions.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+            rejections: self.rejections.load(Ordering::Relaxed),
+            max_bytes: self.max_bytes as u64,
+            ..Default::default()
+        };
+        for shard in self.shards.iter() {
+            let shard = shard.lock().unwrap();
+            stats.entries += shard.entries.len() as u64;
+            stats.bytes += shard.bytes as u64;
+        }
+        stats
+    }
+}
+
+#[cfg(test)]
+fn key(i: u8) -> [u8; 32] {
+    let mut k = [0u8; 32];
+    for (ix, b) in k.iter_mut().enumerate() {
+        *b = i.wrapping_mul(31).wrapping_add(ix as u8).wrapping_mul(i | 1);
+    }
+    k[31] = 0; // same shard
+    k
+}
+
+#[cfg(test)]
+fn blob(len: usize) -> CachedBlob {
+    CachedBlob::new(Arc::from(vec![7u8; len]), None)
+}
+
+#[test]
+fn test_mem_cache_shares_values() {
+    let cache = MemCache::with_shards(1000, 1);
+    let value = blob(100);
+    assert!(cache.insert(key(1), value.clone()));
+    let hit = cache.get(&key(1)).unwrap();
+    assert_eq!(hit.bytes.as_ptr(), value.bytes.as_ptr());
+    assert!(cache.get(&key(2)).is_none());
+    let stats = cache.stats();
+    assert_eq!((stats.hits, stats.misses, stats.entries, stats.bytes), (1, 1, 1, 100));
+}
+
+#[test]
+fn test_mem_cache_stays_within_budget() {
+    let cache = MemCache::with_shards(1000, 1);
+    for i in 0..10 {
+        // Make each newcomer more popular than the residents, so it is admitted
+        for _ in 0..i + 2 {
+            cache.get(&key(i));
+        }
+        assert!(cache.insert(key(i), blob(300)));
+        assert!(cache.stats().bytes <= 1000);
+    }
+    let stats = cache.stats();
+    assert_eq!(stats.entries, 3);
+    assert_eq!(stats.evictions, 7);
+    assert!(!cache.insert(key(100), blob(1001)));
+}
+
+#[test]
+fn test_mem_cache_protects_popular_entries() {
+    let cache = MemCache::with_shards(1000, 1);
+    for i in 0..3 {
+        for _ in 0..5 {
+            cache.get(&key(i));
+        }
+        assert!(cache.insert(key(i), blob(300)));
+    }
+    // A scan of one-off keys is turned away rather than flushing the hot set
+    for i in 10..40 {
+        cache.get(&key(i));
+        assert!(!cache.insert(key(i), blob(300)));
+    }
+    for i in 0..3 {
+        assert!(cache.get(&key(i)).is_some());
+    }
+    assert_eq!(cache.stats().rejections, 30);
+}
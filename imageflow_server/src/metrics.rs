@@ -0,0 +1,226 @@
+/// Counters, gauges and latency histograms, rendered in the Prometheus text format.
+///
+/// Recording never takes a lock. Histograms keep HDR-style log-linear buckets (8 per power of two, so any
+/// reported value is within 12.5% of the truth) in atomic counters. Each thread records into one of a few
+/// stripes, so threads rarely share a cache line; stripes are only merged when scraped.
+use ::std::fmt::Write;
+use ::std::sync::atomic::{AtomicU64, AtomicUsize, Ordering, ATOMIC_USIZE_INIT};
+
+const SUB_BUCKETS: u64 = 8;
+const SUB_BUCKET_BITS: u32 = 3;
+/// Enough for any u64
+const BUCKET_COUNT: usize = ((64 - SUB_BUCKET_BITS + 1) as usize) * (SUB_BUCKETS as usize);
+const STRIPES: usize = 4;
+
+static NEXT_STRIPE: AtomicUsize = ATOMIC_USIZE_INIT;
+thread_local!(static STRIPE: usize = NEXT_STRIPE.fetch_add(1, Ordering::Relaxed) % STRIPES);
+
+#[derive(Debug, Default)]
+pub struct Counter(AtomicU64);
+
+impl Counter {
+    pub fn inc(&self) {
+        self.add(1);
+    }
+    pub fn add(&self, v: u64) {
+        self.0.fetch_add(v, Ordering::Relaxed);
+    }
+    pub fn get(&self) -> u64 {
+        self.0.load(Ordering::Relaxed)
+    }
+}
+
+#[derive(Debug, Default)]
+pub struct Gauge(AtomicUsize);
+
+/// Decrements its gauge when dropped
+pub struct GaugeGuard<'a>(&'a Gauge);
+
+impl<'a> Drop for GaugeGuard<'a> {
+    fn drop(&mut self) {
+        (self.0).0.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+impl Gauge {
+    pub fn track(&self) -> GaugeGuard {
+        self.0.fetch_add(1, Ordering::Relaxed);
+        GaugeGuard(self)
+    }
+    pub fn get(&self) -> u64 {
+        self.0.load(Ordering::Relaxed) as u64
+    }
+}
+
+fn bucket_of(v: u64) -> usize {
+    if v < SUB_BUCKETS * 2 {
+        return v as usize;
+    }
+    let msb = 63 - v.leading_zeros();
+    let sub = (v >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    ((msb - SUB_BUCKET_BITS + 1) as u64 * SUB_BUCKETS + sub) as usize
+}
+
+/// The largest value that lands in bucket `ix`
+fn bucket_max(ix: usize) -> u64 {
+    let ix = ix as u64;
+    if ix < SUB_BUCKETS * 2 {
+        return ix;
+    }
+    let shift = (ix / SUB_BUCKETS - 1) as u32;
+    let low = (SUB_BUCKETS + ix % SUB_BUCKETS) << shift;
+    low + ((1u64 << shift) - 1)
+}
+
+struct Stripe {
+    counts: Vec<AtomicU64>,
+    sum: AtomicU64,
+}
+
+pub struct Histogram {
+    stripes: Vec<Stripe>,
+}
+
+impl ::std::fmt::Debug for Histogram {
+    fn fmt(&self, f: &mut ::std::fmt::Formatter) -> ::std::fmt::Result {
+        let s = self.snapshot();
+        write!(f, "Histogram {{ count: {}, p50: {}, p99: {} }}", s.count, s.quantile(0.5), s.quantile(0.99))
+    }
+}
+
+#[derive(Clone, Debug)]
+pub struct HistogramSnapshot {
+    counts: Vec<u64>,
+    pub count: u64,
+    pub sum: u64,
+}
+
+impl HistogramSnapshot {
+    /// Highest value equivalent to the q-th quantile; 0 if nothing was recorded
+    pub fn quantile(&self, q: f64) -> u64 {
+        if self.count == 0 {
+            return 0;
+        }
+        let rank = ((q * self.count as f64).ceil() as u64).max(1).min(self.count);
+        let mut seen = 0;
+        for (ix, c) in self.counts.iter().enumerate() {
+            seen += *c;
+            if seen >= rank {
+                return bucket_max(ix);
+            }
+        }
+        bucket_max(self.counts.len() - 1)
+    }
+}
+
+impl Histogram {
+    pub fn new() -> Histogram {
+        Histogram {
+            stripes: (0..STRIPES).map(|_| Stripe {
+                counts: (0..BUCKET_COUNT).map(|_| AtomicU64::new(0)).collect(),
+                sum: AtomicU64::new(0),
+            }).collect()
+        }
+    }
+
+    pub fn record(&self, v: u64) {
+        let stripe = &self.stripes[STRIPE.with(|s| *s)];
+        stripe.counts[bucket_of(v)].fetch_add(1, Ordering::Relaxed);
+        stripe.sum.fetch_add(v, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> HistogramSnapshot {
+        let mut counts = vec![0u64; BUCKET_COUNT];
+        let mut sum = 0;
+        for stripe in self.stripes.iter() {
+            for (total, c) in counts.iter_mut().zip(stripe.counts.iter()) {
+                *total += c.load(Ordering::Relaxed);
+            }
+            sum += stripe.sum.load(Ordering::Relaxed);
+        }
+        HistogramSnapshot { count: counts.iter().sum(), counts: counts, sum: sum }
+    }
+}
+
+/// Accumulates a Prometheus text exposition. Label values are escaped; names are trusted.
+#[derive(Default)]
+pub struct Exposition {
+    text: String,
+}
+
+fn escape_label(value: &str) -> String {
+    value.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n")
+}
+
+fn format_labels(labels: &[(&str, &str)]) -> String {
+    if labels.is_empty() {
+        return String::new();
+    }
+    let pairs = labels.iter().map(|&(k, v)| format!("{}=\"{}\"", k, escape_label(v))).collect::<Vec<_>>();
+    format!("{{{}}}", pairs.join(","))
+}
+
+impl Exposition {
+    pub fn new() -> Exposition {
+        Exposition::default()
+    }
+
+    /// Call once per metric name, before its samples
+    pub fn describe(&mut self, name: &str, kind: &str, help: &str) {
+        let _ = write!(self.text, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, kind);
+    }
+
+    pub fn sample(&mut self, name: &str, labels: &[(&str, &str)], value: u64) {
+        let _ = write!(self.text, "{}{} {}\n", name, format_labels(labels), value);
+    }
+
+    /// A summary in seconds, from a histogram recorded in nanoseconds
+    pub fn summary_seconds(&mut self, name: &str, labels: &[(&str, &str)], h: &HistogramSnapshot) {
+        for &(q, q_text) in &[(0.5, "0.5"), (0.9, "0.9"), (0.99, "0.99"), (0.999, "0.999")] {
+            let mut with_q = labels.to_vec();
+            with_q.push(("quantile", q_text));
+            let _ = write!(self.text, "{}{} {:.9}\n", name, format_labels(&with_q), h.quantile(q) as f64 / 1e9);
+        }
+        let _ = write!(self.text, "{}_sum{} {:.9}\n", name, format_labels(labels), h.sum as f64 / 1e9);
+        let _ = write!(self.text, "{}_count{} {}\n", name, format_labels(labels), h.count);
+    }
+
+    pub fn into_string(self) -> String {
+        self.text
+    }
+}
+
+#[test]
+fn test_histogram_buckets_round_trip() {
+    let mut previous_max = None;
+    for ix in 0..BUCKET_COUNT {
+        let max = bucket_max(ix);
+        assert_eq!(bucket_of(max), ix);
+        if let Some(p) = previous_max {
+            assert_eq!(bucket_of(p + 1), ix);
+        }
+        previous_max = Some(max);
+    }
+    assert_eq!(bucket_max(BUCKET_COUNT - 1), ::std::u64::MAX);
+}
+
+#[test]
+fn test_histogram_quantiles() {
+    let h = Histogram::new();
+    for v in 1..1001u64 {
+        h.record(v * 1000);
+    }
+    let s = h.snapshot();
+    assert_eq!((s.count, s.sum), (1000, 500500 * 1000));
+    for &(q, exact) in &[(0.5, 500000f64), (0.99, 990000f64), (1.0, 1000000f64)] {
+        let reported = s.quantile(q) as f64;
+        assert!(reported >= exact && reported <= exact * 1.125, "q{} reported {} for {}", q, reported, exact);
+    }
+
+    let mut e = Exposition::new();
+    e.describe("latency_seconds", "summary", "Test");
+    e.summary_seconds("latency_seconds", &[("stage", "a\"b")], &s);
+    let text = e.into_string();
+    assert!(text.contains("latency_seconds{stage=\"a\\\"b\",quantile=\"0.5\"} 0.000"));
+    assert!(text.contains("latency_seconds_count{stage=\"a\\\"b\"} 1000\n"));
+}
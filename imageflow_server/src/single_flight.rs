@@ -0,0 +1,194 @@
+/// Collapses concurrent identical work (an upstream fetch, a render) into one execution whose result every waiter shares.
+///
+/// The first caller for a key becomes the leader and runs the work; callers arriving while it runs wait for its result.
+/// A follower gives up after its timeout, or if the leader panics, and then runs the work itself, so a stuck leader
+/// slows its followers down but never blocks them for good. Results are cloned to each follower, so T should be cheap
+/// to clone (Arc-backed).
+use ::std::collections::HashMap;
+use ::std::sync::{Arc, Mutex, Condvar};
+use ::std::sync::atomic::{AtomicU64, Ordering};
+use ::std::time::{Duration, Instant};
+
+enum FlightState<T> {
+    Running,
+    Done(T),
+    Abandoned,
+}
+
+struct Flight<T> {
+    state: Mutex<FlightState<T>>,
+    finished: Condvar,
+}
+
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub struct SingleFlightStats {
+    /// Executions of the work closure by a leader
+    pub led: u64,
+    /// Callers that received a leader's result instead of doing the work
+    pub shared: u64,
+    /// Followers that stopped waiting and did the work themselves
+    pub timed_out: u64,
+}
+
+pub struct SingleFlight<T> {
+    flights: Mutex<HashMap<[u8; 32], Arc<Flight<T>>>>,
+    led: AtomicU64,
+    shared: AtomicU64,
+    timed_out: AtomicU64,
+}
+
+impl<T: Clone> ::std::fmt::Debug for SingleFlight<T> {
+    fn fmt(&self, f: &mut ::std::fmt::Formatter) -> ::std::fmt::Result {
+        write!(f, "SingleFlight {:?}", self.stats())
+    }
+}
+
+/// Publishes the outcome and retires the flight, even if the work panics
+struct Leader<'a, T: 'a> {
+    owner: &'a SingleFlight<T>,
+    key: [u8; 32],
+    flight: Arc<Flight<T>>,
+    outcome: Option<T>,
+}
+
+impl<'a, T> Drop for Leader<'a, T> {
+    fn drop(&mut self) {
+        {
+            let mut flights = self.owner.flights.lock().unwrap();
+            if flights.get(&self.key).map(|f| Arc::ptr_eq(f, &self.flight)).unwrap_or(false) {
+                flights.remove(&self.key);
+            }
+        }
+        let mut state = self.flight.state.lock().unwrap();
+        *state = match self.outcome.take() {
+            Some(v) => FlightState::Done(v),
+            None => FlightState::Abandoned,
+        };
+        self.flight.finished.notify_all();
+    }
+}
+
+impl<T: Clone> SingleFlight<T> {
+    pub fn new() -> SingleFlight<T> {
+        SingleFlight {
+            flights: Mutex::new(HashMap::new()),
+            led: AtomicU64::new(0),
+            shared: AtomicU64::new(0),
+            timed_out: AtomicU64::new(0),
+        }
+    }
+
+    pub fn run<F>(&self, key: &[u8; 32], timeout: Duration, work: F) -> T
+        where F: FnOnce() -> T
+    {
+        let (flight, is_leader) = {
+            let mut flights = self.flights.lock().unwrap();
+            if let Some(existing) = flights.get(key) {
+                (existing.clone(), false)
+            } else {
+                let flight = Arc::new(Flight { state: Mutex::new(FlightState::Running), finished: Condvar::new() });
+                flights.insert(*key, flight.clone());
+                (flight, true)
+            }
+        };
+
+        if is_leader {
+            self.led.fetch_add(1, Ordering::Relaxed);
+            let mut leader = Leader { owner: self, key: *key, flight: flight, outcome: None };
+            let result = work();
+            leader.outcome = Some(result.clone());
+            return result;
+        }
+
+        let deadline = Instant::now() + timeout;
+        {
+            let mut state = flight.state.lock().unwrap();
+            loop {
+                match *state {
+                    FlightState::Done(ref v) => {
+                        self.shared.fetch_add(1, Ordering::Relaxed);
+                        return v.clone();
+                    }
+                    FlightState::Abandoned => break,
+                    FlightState::Running => {}
+                }
+                let now = Instant::now();
+                if now >= deadline {
+                    self.timed_out.fetch_add(1, Ordering::Relaxed);
+                    break;
+                }
+                state = flight.finished.wait_timeout(state, deadline - now).unwrap().0;
+            }
+        }
+        work()
+    }
+
+    pub fn stats(&self) -> SingleFlightStats {
+        SingleFlightStats {
+            led: self.led.load(Ordering::Relaxed),
+            shared: self.shared.load(Ordering::Relaxed),
+            timed_out: self.timed_out.load(Ordering::Relaxed),
+        }
+    }
+}
+
+#[test]
+fn test_single_flight_shares_one_execution() {
+    use ::std::thread;
+    let flights = Arc::new(SingleFlight::<Arc<Vec<u8>>>::new());
+    let executions = Arc::new(AtomicU64::new(0));
+    let threads = (0..16).map(|_| {
+        let flights = flights.clone();
+        let executions = executions.clone();
+        thread::spawn(move || {
+            flights.run(&[1u8; 32], Duration::from_secs(30), || {
+                executions.fetch_add(1, Ordering::SeqCst);
+                thread::sleep(Duration::from_millis(200));
+                Arc::new(vec![1, 2, 3])
+            })
+        })
+    }).collect::<Vec<_>>();
+    for t in threads {
+        assert_eq!(*t.join().unwrap(), vec![1, 2, 3]);
+    }
+    assert_eq!(executions.load(Ordering::SeqCst), 1);
+    assert_eq!(flights.stats(), SingleFlightStats { led: 1, shared: 15, timed_out: 0 });
+    // The flight is retired once it lands
+    assert_eq!(flights.run(&[1u8; 32], Duration::from_secs(1), || Arc::new(vec![4])), Arc::new(vec![4]));
+}
+
+#[test]
+fn test_single_flight_followers_time_out() {
+    use ::std::thread;
+    let flights = Arc::new(SingleFlight::<u32>::new());
+    let leader_flights = flights.clone();
+    let leader = thread::spawn(move || {
+        leader_flights.run(&[2u8; 32], Duration::from_secs(30), || {
+            thread::sleep(Duration::from_millis(1500));
+            1
+        })
+    });
+    thread::sleep(Duration::from_millis(200));
+    let start = Instant::now();
+    assert_eq!(flights.run(&[2u8; 32], Duration::from_millis(100), || 2), 2);
+    assert!(start.elapsed() < Duration::from_millis(1000));
+    assert_eq!(leader.join().unwrap(), 1);
+    assert_eq!(flights.stats().timed_out, 1);
+}
+
+#[test]
+fn test_single_flight_survives_leader_panic() {
+    use ::std::thread;
+    let flights = Arc::new(SingleFlight::<u32>::new());
+    let leader_flights = flights.clone();
+    let leader = thread::spawn(move || {
+        leader_flights.run(&[3u8; 32], Duration::from_secs(30), || {
+            thread::sleep(Duration::from_millis(300));
+            panic!("leader failed");
+        })
+    });
+    thread::sleep(Duration::from_millis(100));
+    assert_eq!(flights.run(&[3u8; 32], Duration::from_secs(30), || 3), 3);
+    assert!(leader.join().is_err());
+    assert_eq!(flights.stats().timed_out, 0);
+}
@@ -0,0 +1,479 @@
+/// Metadata about mutable upstream sources, so they can be revalidated with conditional GETs and so derivatives of
+/// a superseded version can be found and deleted. Follows the schema sketched in docs/redis.md.
+///
+/// Records are keyed by uri_hash (the same hash the source cache uses). A version of a source is identified by
+/// (uri, content_hash); derivatives record themselves as dependents of that version when rendered.
+///
+/// Two backends: DiskMetadataStore, an embedded store in the data directory (the default), and RedisMetadataStore,
+/// a minimal RESP client for sharing metadata across servers. The server wraps either in CachedMetadataStore.
+use ::std;
+use ::std::collections::HashMap;
+use ::std::fmt;
+use ::std::fs::{File, OpenOptions};
+use ::std::io::{self, Read, Write, BufRead, BufReader};
+use ::std::net::TcpStream;
+use ::std::path::{Path, PathBuf};
+use ::std::sync::Mutex;
+use ::std::time::{Duration, Instant};
+use ::imageflow_helpers as hlp;
+
+extern crate rand;
+extern crate serde_json;
+use self::rand::Rng;
+
+#[derive(Serialize, Deserialize, Clone, Debug, PartialEq, Eq)]
+pub struct SourceMetadata {
+    pub etag: Option<String>,
+    pub last_modified: Option<String>,
+    /// Hex blake2 hash of the body; distinguishes versions even when the origin sends no validators
+    pub content_hash: String,
+    /// Unix seconds; when the origin last confirmed (or supplied) this version
+    pub last_revalidation: u64,
+}
+
+impl SourceMetadata {
+    pub fn new(bytes: &[u8], etag: Option<String>, last_modified: Option<String>) -> SourceMetadata {
+        SourceMetadata {
+            etag: etag,
+            last_modified: last_modified,
+            content_hash: hlp::hashing::bytes_to_hex(&hlp::hashing::hash_256(bytes)),
+            last_revalidation: unix_now(),
+        }
+    }
+
+    pub fn is_stale(&self, revalidate_after: Duration) -> bool {
+        unix_now().saturating_sub(self.last_revalidation) >= revalidate_after.as_secs()
+    }
+
+    /// The same version, due for revalidation `retry_in` from now (or `revalidate_after`, if sooner)
+    pub fn retry_revalidation_in(&self, retry_in: Duration, revalidate_after: Duration) -> SourceMetadata {
+        let wait = std::cmp::min(retry_in, revalidate_after).as_secs();
+        SourceMetadata { last_revalidation: unix_now().saturating_sub(revalidate_after.as_secs()).saturating_add(wait), ..self.clone() }
+    }
+
+    /// docs/redis.md calls this the "immutable hash"; dependents are recorded against it
+    pub fn version_hash(&self, uri: &str) -> [u8; 32] {
+        hlp::hashing::hash_256(format!("{}\n{}", uri, self.content_hash).as_bytes())
+    }
+}
+
+pub fn unix_now() -> u64 {
+    std::time::SystemTime::now().duration_since(std::time::UNIX_EPOCH).map(|d| d.as_secs()).unwrap_or(0)
+}
+
+pub trait MetadataStore: Send + Sync + fmt::Debug {
+    fn get(&self, uri_hash: &[u8; 32]) -> io::Result<Option<SourceMetadata>>;
+    fn put(&self, uri_hash: &[u8; 32], meta: &SourceMetadata) -> io::Result<()>;
+    /// Records that `dependent` (e.g., a derivative cache key) was produced from version `version_hash`.
+    /// Recording the same pair twice is harmless.
+    fn add_dependent(&self, version_hash: &[u8; 32], dependent: &[u8; 32]) -> io::Result<()>;
+    /// Removes and returns everything recorded against `version_hash`, without duplicates
+    fn take_dependents(&self, version_hash: &[u8; 32]) -> io::Result<Vec<[u8; 32]>>;
+}
+
+fn hex(hash: &[u8; 32]) -> String {
+    hlp::hashing::bytes_to_hex(hash)
+}
+
+fn parse_hex_hash(text: &str) -> Option<[u8; 32]> {
+    if text.len() != 64 {
+        return None;
+    }
+    let mut hash = [0u8; 32];
+    for (ix, b) in hash.iter_mut().enumerate() {
+        match u8::from_str_radix(&text[ix * 2..ix * 2 + 2], 16) {
+            Ok(v) => *b = v,
+            Err(_) => return None
+        }
+    }
+    Some(hash)
+}
+
+fn dedup(mut hashes: Vec<[u8; 32]>) -> Vec<[u8; 32]> {
+    hashes.sort();
+    hashes.dedup();
+    hashes
+}
+
+fn invalid_data(message: String) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message)
+}
+
+/// One small JSON file per source under `meta/`, and an append-only file of 32-byte records per version
+/// under `dependents/`. Both are fanned out by the first hex byte of the key.
+#[derive(Debug)]
+pub struct DiskMetadataStore {
+    root: PathBuf,
+}
+
+impl DiskMetadataStore {
+    pub fn new(root: &Path) -> DiskMetadataStore {
+        DiskMetadataStore { root: root.to_owned() }
+    }
+
+    fn path_for(&self, kind: &str, hash: &[u8; 32]) -> PathBuf {
+        let name = hex(hash);
+        self.root.join(kind).join(&name[0..2]).join(name)
+    }
+
+    fn prepare_parent(path: &Path) -> io::Result<()> {
+        let dir = path.parent().expect("metadata paths always have a parent");
+        if !dir.is_dir() {
+            std::fs::create_dir_all(dir)?;
+        }
+        Ok(())
+    }
+}
+
+impl MetadataStore for DiskMetadataStore {
+    fn get(&self, uri_hash: &[u8; 32]) -> io::Result<Option<SourceMetadata>> {
+        let bytes = match hlp::filesystem::read_file_bytes(self.path_for("meta", uri_hash)) {
+            Ok(bytes) => bytes,
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(None),
+            Err(e) => return Err(e)
+        };
+        serde_json::from_slice(&bytes).map(Some).map_err(|e| invalid_data(format!("{}", e)))
+    }
+
+    fn put(&self, uri_hash: &[u8; 32], meta: &SourceMetadata) -> io::Result<()> {
+        let path = self.path_for("meta", uri_hash);
+        DiskMetadataStore::prepare_parent(&path)?;
+        // Write beside the target, then rename over it, so readers never see a partial record
+        let temp_path = path.with_extension(format!("{:016x}_incoming", rand::thread_rng().next_u64()));
+        {
+            let mut f = OpenOptions::new().write(true).create_new(true).open(&temp_path)?;
+            f.write_all(&serde_json::to_vec(meta).map_err(|e| invalid_data(format!("{}", e)))?)?;
+        }
+        std::fs::rename(&temp_path, &path)
+    }
+
+    fn add_dependent(&self, version_hash: &[u8; 32], dependent: &[u8; 32]) -> io::Result<()> {
+        let path = self.path_for("dependents", version_hash);
+        DiskMetadataStore::prepare_parent(&path)?;
+        // A single 32-byte append is not interleaved with other appends
+        OpenOptions::new().append(true).create(true).open(&path)?.write_all(dependent)
+    }
+
+    fn take_dependents(&self, version_hash: &[u8; 32]) -> io::Result<Vec<[u8; 32]>> {
+        let path = self.path_for("dependents", version_hash);
+        // Move the file aside first, so appends racing with us start a new list instead of being lost
+        let taken = path.with_extension(format!("{:016x}_taken", rand::thread_rng().next_u64()));
+        match std::fs::rename(&path, &taken) {
+            Ok(()) => {},
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(Vec::new()),
+            Err(e) => return Err(e)
+        }
+        let mut bytes = Vec::new();
+        File::open(&taken)?.read_to_end(&mut bytes)?;
+        std::fs::remove_file(&taken)?;
+        Ok(dedup(bytes.chunks(32).filter(|c| c.len() == 32).map(|c| {
+            let mut hash = [0u8; 32];
+            hash.copy_from_slice(c);
+            hash
+        }).collect()))
+    }
+}
+
+/// Speaks just enough RESP for GET, SET, SADD, SMEMBERS and SREM. Keys are `{prefix}meta:{uri_hash}` (a JSON string)
+/// and `{prefix}dependents:{version_hash}` (a set of hex hashes). One connection, reopened after any error.
+pub struct RedisMetadataStore {
+    address: String,
+    prefix: String,
+    connection: Mutex<Option<BufReader<TcpStream>>>,
+}
+
+impl fmt::Debug for RedisMetadataStore {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "RedisMetadataStore {{ address: {:?}, prefix: {:?} }}", self.address, self.prefix)
+    }
+}
+
+#[derive(Debug, PartialEq)]
+enum Reply {
+    Status(String),
+    Integer(i64),
+    Bulk(Option<Vec<u8>>),
+    Array(Vec<Reply>),
+}
+
+impl RedisMetadataStore {
+    /// `address` is host:port. Nothing connects until the first command.
+    pub fn new(address: &str, prefix: &str) -> RedisMetadataStore {
+        RedisMetadataStore { address: address.to_owned(), prefix: prefix.to_owned(), connection: Mutex::new(None) }
+    }
+
+    fn command(&self, args: &[&[u8]]) -> io::Result<Reply> {
+        let mut connection = self.connection.lock().unwrap();
+        if connection.is_none() {
+            let stream = TcpStream::connect(&self.address[..])?;
+            stream.set_read_timeout(Some(Duration::from_secs(5)))?;
+            stream.set_write_timeout(Some(Duration::from_secs(5)))?;
+            *connection = Some(BufReader::new(stream));
+        }
+        let result = match RedisMetadataStore::send(connection.as_mut().unwrap().get_mut(), args) {
+            Ok(()) => RedisMetadataStore::read_reply(connection.as_mut().unwrap()),
+            Err(e) => Err(e)
+        };
+        if result.is_err() {
+            // The stream may hold half a reply; start over next time
+            *connection = None;
+        }
+        result
+    }
+
+    fn send(stream: &mut TcpStream, args: &[&[u8]]) -> io::Result<()> {
+        let mut buffer = format!("*{}\r\n", args.len()).into_bytes();
+        for arg in args {
+            buffer.extend_from_slice(format!("${}\r\n", arg.len()).as_bytes());
+            buffer.extend_from_slice(arg);
+            buffer.extend_from_slice(b"\r\n");
+        }
+        stream.write_all(&buffer)
+    }
+
+    fn read_reply<R: BufRead>(reader: &mut R) -> io::Result<Reply> {
+        let mut line = String::new();
+        if reader.read_line(&mut line)? == 0 {
+            return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "redis closed the connection"));
+        }
+        let line = line.trim_right_matches("\r\n");
+        if line.is_empty() {
+            return Err(invalid_data("empty redis reply".to_owned()));
+        }
+        let (kind, rest) = line.split_at(1);
+        let number = || rest.parse::<i64>().map_err(|_| invalid_data(format!("bad redis reply {:?}", line)));
+        match kind {
+            "+" => Ok(Reply::Status(rest.to_owned())),
+            "-" => Err(io::Error::new(io::ErrorKind::Other, format!("redis error: {}", rest))),
+            ":" => Ok(Reply::Integer(number()?)),
+            "$" => {
+                let length = number()?;
+                if length < 0 {
+                    return Ok(Reply::Bulk(None));
+                }
+                let mut bytes = vec![0u8; length as usize + 2];
+                reader.read_exact(&mut bytes)?;
+                bytes.truncate(length as usize);
+                Ok(Reply::Bulk(Some(bytes)))
+            },
+            "*" => {
+                let count = number()?;
+                let mut items = Vec::with_capacity(count.max(0) as usize);
+                for _ in 0..count {
+                    items.push(RedisMetadataStore::read_reply(reader)?);
+                }
+                Ok(Reply::Array(items))
+            },
+            _ => Err(invalid_data(format!("unknown redis reply {:?}", line)))
+        }
+    }
+
+    fn key(&self, kind: &str, hash: &[u8; 32]) -> String {
+        format!("{}{}:{}", self.prefix, kind, hex(hash))
+    }
+}
+
+impl MetadataStore for RedisMetadataStore {
+    fn get(&self, uri_hash: &[u8; 32]) -> io::Result<Option<SourceMetadata>> {
+        match self.command(&[b"GET", self.key("meta", uri_hash).as_bytes()])? {
+            Reply::Bulk(None) => Ok(None),
+            Reply::Bulk(Some(bytes)) => serde_json::from_slice(&bytes).map(Some).map_err(|e| invalid_data(format!("{}", e))),
+            other => Err(invalid_data(format!("unexpected reply to GET: {:?}", other)))
+        }
+    }
+
+    fn put(&self, uri_hash: &[u8; 32], meta: &SourceMetadata) -> io::Result<()> {
+        let json = serde_json::to_vec(meta).map_err(|e| invalid_data(format!("{}", e)))?;
+        self.command(&[b"SET", self.key("meta", uri_hash).as_bytes(), &json]).map(|_| ())
+    }
+
+    fn add_dependent(&self, version_hash: &[u8; 32], dependent: &[u8; 32]) -> io::Result<()> {
+        self.command(&[b"SADD", self.key("dependents", version_hash).as_bytes(), hex(dependent).as_bytes()]).map(|_| ())
+    }
+
+    fn take_dependents(&self, version_hash: &[u8; 32]) -> io::Result<Vec<[u8; 32]>> {
+        let key = self.key("dependents", version_hash);
+        let members = match self.command(&[b"SMEMBERS", key.as_bytes()])? {
+            Reply::Array(items) => items.into_iter().filter_map(|item| match item {
+                Reply::Bulk(Some(bytes)) => String::from_utf8(bytes).ok(),
+                _ => None
+            }).collect::<Vec<String>>(),
+            other => return Err(invalid_data(format!("unexpected reply to SMEMBERS: {:?}", other)))
+        };
+        if !members.is_empty() {
+            // Remove only what we read, so members added since are kept for the next caller
+            let mut args: Vec<&[u8]> = vec![b"SREM", key.as_bytes()];
+            args.extend(members.iter().map(|m| m.as_bytes()));
+            self.command(&args)?;
+        }
+        Ok(dedup(members.iter().filter_map(|m| parse_hex_hash(m)).collect()))
+    }
+}
+
+/// Keeps records read from or written to another store in memory for `ttl`, so looking up the version of an original
+/// doesn't wait on the backing store (and, for RedisMetadataStore, its single connection) on every request.
+/// Dependents pass straight through. Records written by other servers are seen once the local copy expires.
+pub struct CachedMetadataStore {
+    inner: Box<MetadataStore>,
+    ttl: Duration,
+    max_entries: usize,
+    records: Mutex<HashMap<[u8; 32], (SourceMetadata, Instant)>>,
+}
+
+impl fmt::Debug for CachedMetadataStore {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "CachedMetadataStore {{ inner: {:?}, ttl: {:?}, max_entries: {} }}", self.inner, self.ttl, self.max_entries)
+    }
+}
+
+impl CachedMetadataStore {
+    pub fn new(inner: Box<MetadataStore>, ttl: Duration, max_entries: usize) -> CachedMetadataStore {
+        CachedMetadataStore { inner: inner, ttl: ttl, max_entries: max_entries, records: Mutex::new(HashMap::new()) }
+    }
+
+    fn remember(&self, uri_hash: &[u8; 32], meta: &SourceMetadata) {
+        let mut records = self.records.lock().unwrap();
+        if records.len() >= self.max_entries && !records.contains_key(uri_hash) {
+            let ttl = self.ttl;
+            records.retain(|_, &mut (_, stored)| stored.elapsed() < ttl);
+            if records.len() >= self.max_entries {
+                records.clear();
+            }
+        }
+        records.insert(*uri_hash, (meta.clone(), Instant::now()));
+    }
+}
+
+impl MetadataStore for CachedMetadataStore {
+    fn get(&self, uri_hash: &[u8; 32]) -> io::Result<Option<SourceMetadata>> {
+        if let Some(&(ref meta, stored)) = self.records.lock().unwrap().get(uri_hash) {
+            if stored.elapsed() < self.ttl {
+                return Ok(Some(meta.clone()));
+            }
+        }
+        let found = self.inner.get(uri_hash)?;
+        if let Some(ref meta) = found {
+            self.remember(uri_hash, meta);
+        }
+        Ok(found)
+    }
+
+    fn put(&self, uri_hash: &[u8; 32], meta: &SourceMetadata) -> io::Result<()> {
+        self.inner.put(uri_hash, meta)?;
+        self.remember(uri_hash, meta);
+        Ok(())
+    }
+
+    fn add_dependent(&self, version_hash: &[u8; 32], dependent: &[u8; 32]) -> io::Result<()> {
+        self.inner.add_dependent(version_hash, dependent)
+    }
+
+    fn take_dependents(&self, version_hash: &[u8; 32]) -> io::Result<Vec<[u8; 32]>> {
+        self.inner.take_dependents(version_hash)
+    }
+}
+
+#[cfg(test)]
+fn exercise_store(store: &MetadataStore) {
+    let uri_hash = hlp::hashing::hash_256(b"http://example.com/a.jpg");
+    assert_eq!(store.get(&uri_hash).unwrap(), None);
+    let meta = SourceMetadata::new(b"version one", Some("\"v1\"".to_owned()), None);
+    store.put(&uri_hash, &meta).unwrap();
+    assert_eq!(store.get(&uri_hash).unwrap(), Some(meta.clone()));
+
+    let version = meta.version_hash("http://example.com/a.jpg");
+    assert_ne!(version, SourceMetadata::new(b"version two", None, None).version_hash("http://example.com/a.jpg"));
+    let (a, b) = (hlp::hashing::hash_256(b"a"), hlp::hashing::hash_256(b"b"));
+    store.add_dependent(&version, &a).unwrap();
+    store.add_dependent(&version, &b).unwrap();
+    store.add_dependent(&version, &a).unwrap();
+    assert_eq!(store.take_dependents(&version).unwrap(), dedup(vec![a, b]));
+    assert_eq!(store.take_dependents(&version).unwrap(), Vec::<[u8; 32]>::new());
+}
+
+#[test]
+fn test_disk_metadata_store() {
+    let dir = std::env::temp_dir().join(format!("imageflow_source_metadata_{:016x}", rand::thread_rng().next_u64()));
+    exercise_store(&DiskMetadataStore::new(&dir));
+    let _ = std::fs::remove_dir_all(&dir);
+}
+
+/// A stand-in for redis that handles the five commands the store uses
+#[cfg(test)]
+fn start_redis_stand_in() -> String {
+    use ::std::collections::{HashMap, HashSet};
+    use ::std::net::TcpListener;
+    let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+    let address = format!("{}", listener.local_addr().unwrap());
+    std::thread::spawn(move || {
+        let mut strings: HashMap<Vec<u8>, Vec<u8>> = HashMap::new();
+        let mut sets: HashMap<Vec<u8>, HashSet<Vec<u8>>> = HashMap::new();
+        for stream in listener.incoming() {
+            let mut writer = stream.unwrap();
+            let mut reader = BufReader::new(writer.try_clone().unwrap());
+            while let Ok(Reply::Array(args)) = RedisMetadataStore::read_reply(&mut reader) {
+                let args = args.into_iter().map(|a| match a { Reply::Bulk(Some(b)) => b, _ => Vec::new() }).collect::<Vec<_>>();
+                let bulk = |b: &[u8]| [format!("${}\r\n", b.len()).into_bytes(), b.to_vec(), b"\r\n".to_vec()].concat();
+                let reply = match &args[0][..] {
+                    b"GET" => strings.get(&args[1]).map(|v| bulk(v)).unwrap_or(b"$-1\r\n".to_vec()),
+                    b"SET" => { strings.insert(args[1].clone(), args[2].clone()); b"+OK\r\n".to_vec() },
+                    b"SADD" => {
+                        let added = args[2..].iter().filter(|m| sets.entry(args[1].clone()).or_insert_with(HashSet::new).insert(m.to_vec())).count();
+                        format!(":{}\r\n", added).into_bytes()
+                    },
+                    b"SMEMBERS" => {
+                        let members = sets.get(&args[1]).map(|s| s.iter().cloned().collect::<Vec<_>>()).unwrap_or(Vec::new());
+                        let mut reply = format!("*{}\r\n", members.len()).into_bytes();
+                        for m in members {
+                            reply.extend(bulk(&m));
+                        }
+                        reply
+                    },
+                    b"SREM" => {
+                        let set = sets.entry(args[1].clone()).or_insert_with(HashSet::new);
+                        format!(":{}\r\n", args[2..].iter().filter(|m| set.remove(&m[..])).count()).into_bytes()
+                    },
+                    _ => b"-ERR unknown command\r\n".to_vec()
+                };
+                writer.write_all(&reply).unwrap();
+            }
+        }
+    });
+    address
+}
+
+#[test]
+fn test_redis_metadata_store() {
+    let address = start_redis_stand_in();
+    exercise_store(&RedisMetadataStore::new(&address, "imageflow:"));
+}
+
+#[test]
+fn test_cached_metadata_store() {
+    let address = start_redis_stand_in();
+    exercise_store(&CachedMetadataStore::new(Box::new(RedisMetadataStore::new(&address, "imageflow:")), Duration::from_secs(60), 2));
+
+    // Reads are answered from memory until the ttl passes
+    let dir = std::env::temp_dir().join(format!("imageflow_source_metadata_{:016x}", rand::thread_rng().next_u64()));
+    let uri_hash = hlp::hashing::hash_256(b"http://example.com/b.jpg");
+    let (one, two) = (SourceMetadata::new(b"one", None, None), SourceMetadata::new(b"two", None, None));
+    let cached = CachedMetadataStore::new(Box::new(DiskMetadataStore::new(&dir)), Duration::from_secs(60), 2);
+    cached.put(&uri_hash, &one).unwrap();
+    DiskMetadataStore::new(&dir).put(&uri_hash, &two).unwrap();
+    assert_eq!(cached.get(&uri_hash).unwrap(), Some(one));
+    let expiring = CachedMetadataStore::new(Box::new(DiskMetadataStore::new(&dir)), Duration::from_secs(0), 2);
+    assert_eq!(expiring.get(&uri_hash).unwrap(), Some(two));
+    let _ = std::fs::remove_dir_all(&dir);
+}
+
+#[test]
+fn test_retry_revalidation_in() {
+    let after = Duration::from_secs(3600);
+    let meta = SourceMetadata { last_revalidation: 0, ..SourceMetadata::new(b"bytes", None, None) };
+    let retry = meta.retry_revalidation_in(Duration::from_secs(30), after);
+    assert!(!retry.is_stale(after));
+    assert!(retry.last_revalidation + after.as_secs() <= unix_now() + 30);
+    assert_eq!(retry.content_hash, meta.content_hash);
+    // Never later than a regular revalidation
+    assert!(meta.retry_revalidation_in(Duration::from_secs(30), Duration::from_secs(10)).last_revalidation <= unix_now());
+}
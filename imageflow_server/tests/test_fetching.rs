@@ -0,0 +1,98 @@
+extern crate imageflow_helpers;
+
+use ::imageflow_helpers::fetching::{fetch, fetch_stream};
+use std::io::{Read, Write, BufRead, BufReader};
+use std::net::{TcpListener, TcpStream};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::{channel, Receiver};
+use std::sync::Mutex;
+use std::thread;
+use std::time::{Duration, Instant};
+
+/// A minimal keep-alive HTTP/1.1 origin. Every request gets `body` as image/png.
+/// If `hold` is set, only the first `split` bytes are sent until a message arrives on it.
+struct StubOrigin {
+    port: u16,
+    connections: Arc<AtomicUsize>,
+}
+
+impl StubOrigin {
+    fn start(body: Vec<u8>, split: usize, hold: Option<Receiver<()>>) -> StubOrigin {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let port = listener.local_addr().unwrap().port();
+        let connections = Arc::new(AtomicUsize::new(0));
+        let counter = connections.clone();
+        let body = Arc::new(body);
+        let hold = Arc::new(Mutex::new(hold));
+        thread::spawn(move || {
+            for stream in listener.incoming() {
+                let stream = stream.unwrap();
+                counter.fetch_add(1, Ordering::SeqCst);
+                let body = body.clone();
+                let hold = hold.clone();
+                thread::spawn(move || StubOrigin::serve(stream, &body, split, &hold));
+            }
+        });
+        StubOrigin { port: port, connections: connections }
+    }
+
+    fn serve(stream: TcpStream, body: &[u8], split: usize, hold: &Mutex<Option<Receiver<()>>>) {
+        let mut reader = BufReader::new(stream.try_clone().unwrap());
+        let mut writer = stream;
+        loop {
+            // Read one request head; EOF means the client closed the connection
+            let mut line = String::new();
+            loop {
+                line.clear();
+                if reader.read_line(&mut line).unwrap_or(0) == 0 {
+                    return;
+                }
+                if line == "\r\n" {
+                    break;
+                }
+            }
+            write!(writer, "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: {}\r\n\r\n", body.len()).unwrap();
+            writer.write_all(&body[..split]).unwrap();
+            writer.flush().unwrap();
+            if let Some(ref rx) = *hold.lock().unwrap() {
+                let _ = rx.recv_timeout(Duration::from_secs(5));
+            }
+            writer.write_all(&body[split..]).unwrap();
+            writer.flush().unwrap();
+        }
+    }
+
+    fn url(&self) -> String {
+        format!("http://127.0.0.1:{}/image.png", self.port)
+    }
+}
+
+#[test]
+fn test_fetch_reuses_connections() {
+    let origin = StubOrigin::start(vec![7u8; 5000], 0, None);
+    for _ in 0..5 {
+        let response = fetch(&origin.url(), None).unwrap();
+        assert_eq!(response.bytes, vec![7u8; 5000]);
+    }
+    assert_eq!(origin.connections.load(Ordering::SeqCst), 1);
+}
+
+#[test]
+fn test_fetch_stream_yields_first_chunk_early() {
+    let (release, hold) = channel();
+    let body = (0..100u8).collect::<Vec<u8>>();
+    let origin = StubOrigin::start(body.clone(), 16, Some(hold));
+
+    let start = Instant::now();
+    let mut stream = fetch_stream(&origin.url(), None).unwrap();
+    assert_eq!(stream.content_length, Some(100));
+    let mut head = [0u8; 16];
+    stream.read_exact(&mut head).unwrap();
+    // The origin is still holding back the rest of the body
+    assert!(start.elapsed() < Duration::from_secs(4));
+    assert_eq!(&head[..], &body[..16]);
+
+    release.send(()).unwrap();
+    assert_eq!(stream.read_body().unwrap(), &body[16..]);
+}
@@ -330,8 +330,8 @@ pub enum Node {
     FlipH,
     #[serde(rename="crop")]
     Crop { x1: u32, y1: u32, x2: u32, y2: u32 },
-    // #[serde(rename="crop_whitespace")]
-    // CropWhitespace { threshold: u32, percent_padding: f32 },
+    #[serde(rename="crop_whitespace")]
+    CropWhitespace { threshold: u32, percent_padding: f32 },
     #[serde(rename="create_canvas")]
     CreateCanvas {
         format: PixelFormat,
@@ -412,7 +412,11 @@ pub enum Node {
 //    },
     #[serde(rename="white_balance_histogram_area_threshold_srgb")]
     WhiteBalanceHistogramAreaThresholdSrgb{
-        threshold: Option<f32>
+        threshold: Option<f32>,
+        /// When set, large frames are histogrammed on a grid of every nth row and column, spaced so that each
+        /// channel's share of the frame stays within this (0.001 is a sixth of the default threshold). Detail
+        /// repeating at the grid's period skews it. Every pixel is counted when unset.
+        sample_max_error: Option<f32>
     },
     #[serde(rename="color_matrix_srgb")]
     ColorMatrixSrgb{
@@ -420,6 +424,19 @@ pub enum Node {
     },
     #[serde(rename="color_matrix_srgb")]
     ColorFilterSrgb (ColorFilterSrgb),
+    /// Blurs in place; sigma is in pixels and must be at least 2. Blurs in linear light unless told otherwise.
+    #[serde(rename="gaussian_blur")]
+    GaussianBlur {
+        sigma: f32,
+        blur_colorspace: Option<ScalingFloatspace>,
+    },
+    /// Sharpens in place by `amount` times each pixel's difference from a gaussian blur (sigma at least 2) of it.
+    #[serde(rename="unsharp_mask")]
+    UnsharpMask {
+        sigma: f32,
+        amount: f32,
+        blur_colorspace: Option<ScalingFloatspace>,
+    },
     // TODO: Block use except from FFI/unit test use
     #[serde(rename="flow_bitmap_bgra_ptr")]
     FlowBitmapBgraPtr {
@@ -937,7 +954,7 @@ pub struct BuildResult {
 }
 impl BuildResult {
     pub fn into_job_result(self) -> JobResult {
-        JobResult { encodes: self.encodes }
+        JobResult { encodes: self.encodes, performance: None }
     }
 }
 
@@ -947,9 +964,27 @@ impl BuildResult {
 //
 //}
 
+#[derive(Serialize, Deserialize, Clone, PartialEq, Debug)]
+pub struct NodePerf {
+    pub stable_id: i32,
+    pub name: String,
+    /// Time spent estimating and executing the node
+    pub wall_microseconds: u64,
+}
+
+#[derive(Serialize, Deserialize, Clone, PartialEq, Debug)]
+pub struct JobPerformance {
+    /// Pixel bytes copied because two nodes needed to mutate the same frame
+    pub bitmap_bytes_copied: u64,
+    /// Nodes of the final graph, in graph order
+    #[serde(default)]
+    pub nodes: Vec<NodePerf>,
+}
+
 #[derive(Serialize, Deserialize, Clone, PartialEq, Debug)]
 pub struct JobResult {
     pub encodes: Vec<EncodeResult>,
+    pub performance: Option<JobPerformance>,
 }
 #[derive(Serialize, Deserialize, Clone, PartialEq, Debug)]
 pub enum ResponsePayload {
@@ -1007,6 +1042,7 @@ impl Response001 {
                                   preferred_extension: ext.to_owned(),
                                   bytes: ResultBytes::Elsewhere,
                               }],
+                performance: Some(JobPerformance { bitmap_bytes_copied: 0, nodes: Vec::new() }),
             }),
         }
     }